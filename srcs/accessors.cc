@@ -3,13 +3,20 @@
 #include "efcodec.h"
 #include "macros.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace {
 
+MemMapPolicy default_mem_map_policy;
+
 void CheckFileSize(const char *filename, size_t size) {
   if (!std::filesystem::exists(filename)) {
     std::cerr << "File " << filename << " does not exist.\n";
@@ -88,9 +95,52 @@ void MemUnmapWindows(void *data, size_t length) {
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
-void *MemMapLinux(const char *filename, size_t length, bool writable) {
+size_t PageSize() {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+void Advise(const char *filename, void *data, size_t length, int advice, const char *name) {
+  if (length > 0 && madvise(data, length, advice) != 0) {
+    std::cerr << "WARNING: madvise(" << name << ") failed on " << filename << std::endl;
+    // Don't exit. This is only an optimization.
+  }
+}
+
+void ApplyMemMapPolicy(const char *filename, void *data, size_t length, const MemMapPolicy &policy) {
+  switch (policy.advice) {
+    case MemMapPolicy::Advice::NORMAL:
+      break;
+    case MemMapPolicy::Advice::RANDOM:
+      Advise(filename, data, length, MADV_RANDOM, "MADV_RANDOM");
+      break;
+    case MemMapPolicy::Advice::SEQUENTIAL:
+      Advise(filename, data, length, MADV_SEQUENTIAL, "MADV_SEQUENTIAL");
+      break;
+  }
+#ifdef MADV_HUGEPAGE
+  if (policy.huge_pages) {
+    Advise(filename, data, length, MADV_HUGEPAGE, "MADV_HUGEPAGE");
+  }
+#endif
+  if (policy.willneed_bytes > 0) {
+    Advise(filename, data, std::min(length, policy.willneed_bytes), MADV_WILLNEED, "MADV_WILLNEED");
+  }
+  size_t lock_begin = std::min(policy.lock_begin, length) / PageSize() * PageSize();
+  size_t lock_end = std::min(policy.lock_end, length);
+  if (lock_begin < lock_end) {
+    std::cerr << "Locking " << (lock_end - lock_begin) / 1e9 << " GB of " << filename << " in memory..." << std::endl;
+    if (mlock(static_cast<char*>(data) + lock_begin, lock_end - lock_begin) != 0) {
+      std::cerr << "WARNING: mlock() failed on " << filename << " (check RLIMIT_MEMLOCK)" << std::endl;
+      // Don't exit. This is only an optimization.
+    }
+  }
+}
+
+void *MemMapLinux(const char *filename, size_t length, bool writable, const MemMapPolicy &policy) {
   int mode = writable ? O_RDWR : O_RDONLY;
   int fd = open(filename, mode);
   if (fd == -1) {
@@ -100,12 +150,17 @@ void *MemMapLinux(const char *filename, size_t length, bool writable) {
   // Apparently MAP_SHARED works on Windows Subsystem for Linux
   // while MAP_PRIVATE does not?
   int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
-  void *data = mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (policy.populate) flags |= MAP_POPULATE;
+#endif
+  void *data = mmap(nullptr, length, prot, flags, fd, 0);
   close(fd);
   if (data == MAP_FAILED) {
     std::cerr << "Failed to mmap() " << filename << std::endl;
     exit(1);
   }
+  ApplyMemMapPolicy(filename, data, length, policy);
   return data;
 }
 
@@ -121,12 +176,17 @@ void MemUnmapLinux(void *data, size_t length) {
 }  // namespace
 
 void *MemMap(const char *filename, size_t length, bool writable) {
+  return MemMap(filename, length, writable, GetMemMapPolicy());
+}
+
+void *MemMap(const char *filename, size_t length, bool writable, const MemMapPolicy &policy) {
   CheckFileSize(filename, length);
 
 #if _WIN32
+  (void) policy;  // unused
   return MemMapWindows(filename, length, writable);
 #else
-  return MemMapLinux(filename, length, writable);
+  return MemMapLinux(filename, length, writable, policy);
 #endif
 }
 
@@ -138,6 +198,111 @@ void MemUnmap(void *data, size_t length) {
 #endif
 }
 
+void MemWillNeed(const void *data, size_t length) {
+#if _WIN32
+  (void) data;  // unused
+  (void) length;  // unused
+#else
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data) / PageSize() * PageSize();
+  uintptr_t end = reinterpret_cast<uintptr_t>(data) + length;
+  if (begin < end) {
+    // Errors are ignored, since this is only an optimization.
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+  }
+#endif
+}
+
+bool ParseByteSize(const std::string &s, size_t *size) {
+  if (s.empty() || !isdigit(s[0])) return false;
+  char *end = nullptr;
+  errno = 0;
+  unsigned long long value = strtoull(s.c_str(), &end, 10);
+  if (errno == ERANGE) return false;
+  int shift = 0;
+  switch (*end) {
+    case '\0': break;
+    case 'K': shift = 10; ++end; break;
+    case 'M': shift = 20; ++end; break;
+    case 'G': shift = 30; ++end; break;
+    case 'T': shift = 40; ++end; break;
+    default: return false;
+  }
+  if (*end != '\0' || value > (std::numeric_limits<size_t>::max() >> shift)) return false;
+  *size = size_t{value} << shift;
+  return true;
+}
+
+bool ParseMemMapPolicy(const std::string &s, MemMapPolicy *policy) {
+  MemMapPolicy result;
+  std::istringstream iss(s);
+  std::string option;
+  while (std::getline(iss, option, ',')) {
+    std::string key = option, value;
+    if (size_t i = option.find('='); i != std::string::npos) {
+      key = option.substr(0, i);
+      value = option.substr(i + 1);
+    }
+    if (key == "normal" && value.empty()) {
+      result.advice = MemMapPolicy::Advice::NORMAL;
+    } else if (key == "random" && value.empty()) {
+      result.advice = MemMapPolicy::Advice::RANDOM;
+    } else if (key == "sequential" && value.empty()) {
+      result.advice = MemMapPolicy::Advice::SEQUENTIAL;
+    } else if (key == "populate" && value.empty()) {
+      result.populate = true;
+    } else if (key == "hugepages" && value.empty()) {
+      result.huge_pages = true;
+    } else if (key == "willneed" && ParseByteSize(value, &result.willneed_bytes)) {
+      // Parsed successfully.
+    } else if (key == "lock" && value == "all") {
+      result.lock_begin = 0;
+      result.lock_end = std::numeric_limits<size_t>::max();
+    } else if (size_t i = value.find('-');
+        key == "lock" && i != std::string::npos &&
+        ParseByteSize(value.substr(0, i), &result.lock_begin) &&
+        ParseByteSize(value.substr(i + 1), &result.lock_end) &&
+        result.lock_begin <= result.lock_end) {
+      // Parsed successfully.
+    } else {
+      std::cerr << "Invalid memory map option: " << option << std::endl;
+      return false;
+    }
+  }
+  *policy = result;
+  return true;
+}
+
+const MemMapPolicy &GetMemMapPolicy() {
+  return default_mem_map_policy;
+}
+
+void SetMemMapPolicy(const MemMapPolicy &policy) {
+  default_mem_map_policy = policy;
+}
+
+bool InitMemMapPolicyFromFlag(const std::string &flag_value) {
+  if (flag_value.empty()) return true;
+  MemMapPolicy policy;
+  if (!ParseMemMapPolicy(flag_value, &policy)) return false;
+  SetMemMapPolicy(policy);
+  std::atexit(ReportPageFaults);
+  return true;
+}
+
+void ReportPageFaults() {
+#if _WIN32
+  std::cerr << "Page fault counts are not supported on Windows." << std::endl;
+#else
+  struct rusage usage = {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    std::cerr << "getrusage() failed" << std::endl;
+    return;
+  }
+  std::cerr << "Page faults: " << usage.ru_minflt << " minor, "
+      << usage.ru_majflt << " major." << std::endl;
+#endif
+}
+
 ChunkedR0Accessor::ChunkedR0Accessor() {
   maps.reserve(num_chunks);
   REP(chunk, num_chunks) {
@@ -152,6 +317,52 @@ ChunkedR1Accessor::ChunkedR1Accessor() {
   }
 }
 
+namespace {
+
+template<class T>
+void CheckShardedRnFileSize(const char *manifest_filename, const T &map) {
+  if (map.size() != total_perms / 5) {
+    std::cerr << "Unexpected size of sharded phase file " << manifest_filename << ": "
+        << map.size() << " bytes." << std::endl;
+    exit(1);
+  }
+}
+
+}  // namespace
+
+ShardedRnAccessor::ShardedRnAccessor(const char *manifest_filename) : map(manifest_filename) {
+  CheckShardedRnFileSize(manifest_filename, map);
+}
+
+ShardedMutableRnAccessor::ShardedMutableRnAccessor(const char *manifest_filename) : map(manifest_filename) {
+  CheckShardedRnFileSize(manifest_filename, map);
+}
+
+ConcurrentMutableRnAccessor::ConcurrentMutableRnAccessor(const char *filename) {
+  if (IsShardManifest(filename)) {
+    sharded.emplace(filename);
+    CheckShardedRnFileSize(filename, *sharded);
+  } else {
+    map.emplace(filename);
+  }
+}
+
+AnyRnAccessor::AnyRnAccessor(const char *filename) {
+  if (IsShardManifest(filename)) {
+    sharded.emplace(filename);
+    return;
+  }
+  // A file in the 2-bit format is larger than one in the ternary format, so
+  // anything shorter than that is treated as ternary (and CheckFileSize()
+  // will complain if it's too short for that, too).
+  if (std::filesystem::exists(filename) &&
+      std::filesystem::file_size(filename) >= TwoBitRnAccessor::num_words * sizeof(uint64_t)) {
+    two_bit.emplace(filename);
+  } else {
+    ternary.emplace(filename);
+  }
+}
+
 const char *CheckLossPropagationOutputFile(const char *filename, bool writable) {
   auto expected_size = loss_propagation_filesize;
   if (std::filesystem::exists(filename)) {
@@ -182,27 +393,30 @@ const char *CheckLossPropagationOutputFile(const char *filename, bool writable)
   return filename;
 }
 
-EFAccessor::EFAccessor(const char *filename) : data_(filename) {
-  const uint8_t *start = data_.data();
-  size_t size = data_.size();
-  byte_span_t bytes = byte_span_t(start, size);
+namespace {
+
+EFIndex OpenEFIndex(const char *filename, const DynMappedFile<uint8_t> &data, bool save_index) {
+  if (std::optional<EFIndex> index = EFIndex::Load(filename)) return std::move(*index);
   std::cerr << "Indexing EF-encoded file " << filename << "..." << std::endl;
-  while (!bytes.empty()) {
-    size_t offset = bytes.data() - start;
-    auto res = DecodeEF(&bytes);
-    if (!res) {
-      std::cerr << "Failed to decode part " << part_byte_offsets.size() << " of " << filename << "!" << std::endl;
-      exit(1);
-    }
-    part_byte_offsets.push_back(offset);
+  std::optional<EFIndex> index = EFIndex::Build(byte_span_t(data.data(), data.size()));
+  if (!index) {
+    std::cerr << "Failed to decode " << filename << "!" << std::endl;
+    exit(1);
   }
-  part_byte_offsets.push_back(size);
+  // Failure to save the index is not fatal; it will be rebuilt next time.
+  if (save_index) index->Save(filename);
+  return std::move(*index);
 }
 
-std::vector<int64_t> EFAccessor::GetPart(size_t i) {
-  assert(i + 1 < part_byte_offsets.size());
-  size_t begin = part_byte_offsets[i];
-  size_t end = part_byte_offsets[i + 1];
+}  // namespace
+
+EFAccessor::EFAccessor(const char *filename, bool save_index)
+  : data_(filename), index(OpenEFIndex(filename, data_, save_index)) {}
+
+std::vector<int64_t> EFAccessor::GetPart(size_t i) const {
+  assert(i < index.PartCount());
+  size_t begin = index.PartBegin(i);
+  size_t end = index.PartEnd(i);
   assert(begin <= end);
   byte_span_t bytes = byte_span_t(data_.data() + begin, end - begin);
   auto res = DecodeEF(&bytes);
@@ -210,3 +424,93 @@ std::vector<int64_t> EFAccessor::GetPart(size_t i) {
   assert(bytes.empty());
   return std::move(*res);
 }
+
+ConcurrentMutableRnAccessor::UpdateStats
+ConcurrentMutableRnAccessor::ApplySortedUpdates(
+    const int64_t *indices, size_t count, Outcome o) {
+  assert(std::is_sorted(indices, indices + count));
+  UpdateStats stats;
+  size_t i = 0;
+  while (i < count) {
+    // Find all indices that refer to the same byte.
+    const size_t byte_index = indices[i] / 5;
+    size_t j = i + 1;
+    while (j < count && indices[j] / 5 == byte_index) ++j;
+
+    std::atomic_ref<uint32_t> word(Word(byte_index));
+    const int shift = Shift(byte_index);
+    uint32_t old_word = word.load(std::memory_order_relaxed);
+    UpdateStats byte_stats;
+    for (;;) {
+      byte_stats = UpdateStats();
+      uint8_t byte = old_word >> shift;
+      for (size_t k = i; k < j; ++k) {
+        Outcome old_outcome = static_cast<Outcome>(DecodeTernary(byte, indices[k]));
+        if (old_outcome == o) {
+          ++byte_stats.unchanged;
+        } else if (old_outcome != TIE) {
+          if (byte_stats.conflicts++ == 0) byte_stats.first_conflict = indices[k];
+        } else {
+          byte = EncodeTernary(byte, indices[k], o);
+          ++byte_stats.changed;
+        }
+      }
+      // Stop at the first conflict, without modifying this byte.
+      if (byte_stats.conflicts > 0) break;
+      uint32_t new_word = (old_word & ~(uint32_t{0xff} << shift)) | (uint32_t{byte} << shift);
+      if (new_word == old_word ||
+          word.compare_exchange_weak(old_word, new_word, std::memory_order_relaxed)) {
+        break;
+      }
+      // Another thread modified the word in the meantime. Try again with
+      // the updated value of old_word.
+    }
+    if (byte_stats.conflicts > 0) {
+      stats.conflicts = byte_stats.conflicts;
+      stats.first_conflict = byte_stats.first_conflict;
+      break;
+    }
+    stats.Merge(byte_stats);
+    i = j;
+  }
+  return stats;
+}
+
+ConcurrentMutableRnAccessor::UpdateStats
+ConcurrentMutableRnAccessor::ApplySortedUpdates(
+    const std::vector<int64_t> &indices, Outcome o, int num_threads) {
+  constexpr size_t block_size = 1 << 16;
+  const size_t num_blocks = (indices.size() + block_size - 1) / block_size;
+  if (num_threads > num_blocks) num_threads = num_blocks;
+  if (num_threads <= 1) {
+    // Single-threaded computation.
+    return ApplySortedUpdates(indices.data(), indices.size(), o);
+  }
+
+  // Multi-threaded computation. Blocks may start or end in the middle of a
+  // byte, but that's fine since updates are atomic. Blocks are claimed in
+  // order, and no more blocks are claimed after a conflict, so all blocks
+  // before the first conflict are still completed.
+  std::atomic<size_t> next_block = 0;
+  std::atomic<bool> conflict = false;
+  std::vector<UpdateStats> thread_stats(num_threads);
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  REP(t, num_threads) {
+    threads.emplace_back([&, t]() {
+      for (size_t block; !conflict && (block = next_block++) < num_blocks; ) {
+        size_t start = block * block_size;
+        size_t count = std::min(block_size, indices.size() - start);
+        UpdateStats block_stats = ApplySortedUpdates(indices.data() + start, count, o);
+        if (block_stats.conflicts > 0) conflict = true;
+        thread_stats[t].Merge(block_stats);
+      }
+    });
+  }
+  UpdateStats stats;
+  REP(t, num_threads) {
+    threads[t].join();
+    stats.Merge(thread_stats[t]);
+  }
+  return stats;
+}
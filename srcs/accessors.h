@@ -1,26 +1,107 @@
 #ifndef ACCESSORS_H_INCLUDED
 #define ACCESSORS_H_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>
 #include <functional>
+#include <iostream>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <sstream>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "chunks.h"
+#include "ef-index.h"
+#include "shards.h"
 #include "ternary.h"
+#include "two-bit.h"
 
 static_assert(sizeof(size_t) >= 8, "Need a 64-bit OS to map large files");
 
+// Policy that controls how MemMap() maps files into memory.
+//
+// Different tools access the large data files in different ways: the solvers
+// probe them randomly, while tools like minify-merged scan them sequentially.
+// The defaults leave everything up to the kernel.
+//
+// These settings are only supported on Linux; they're ignored on Windows.
+struct MemMapPolicy {
+  enum class Advice : char { NORMAL, RANDOM, SEQUENTIAL };
+
+  // Access pattern passed to madvise() (MADV_RANDOM or MADV_SEQUENTIAL).
+  Advice advice = Advice::NORMAL;
+
+  // Prefault the entire mapping with MAP_POPULATE.
+  bool populate = false;
+
+  // Request transparent huge pages with MADV_HUGEPAGE.
+  bool huge_pages = false;
+
+  // Number of bytes at the start of the mapping to prefetch with MADV_WILLNEED.
+  size_t willneed_bytes = 0;
+
+  // Byte range of the mapping to lock in memory with mlock(). The range is
+  // clipped to the size of the mapping. lock_end == 0 disables locking.
+  size_t lock_begin = 0;
+  size_t lock_end = 0;
+};
+
+// Parses a policy from a comma-separated list of options:
+//
+//   normal, random, sequential   access pattern advice
+//   populate                     prefault the whole mapping
+//   hugepages                    request transparent huge pages
+//   willneed=<size>              prefetch the first <size> bytes
+//   lock=<begin>-<end>           lock bytes between <begin> and <end> (begin <= end)
+//   lock=all                     lock the whole mapping
+//
+// Sizes may have a K, M, G or T suffix (powers of 1024). For example:
+// "random,hugepages,lock=0-4G". Returns false if the string is invalid.
+bool ParseMemMapPolicy(const std::string &s, MemMapPolicy *policy);
+
+// Parses a size in bytes, with an optional K, M, G or T suffix (powers of
+// 1024), e.g. "64M". Returns false if the string is invalid, or if the size
+// does not fit in a size_t.
+bool ParseByteSize(const std::string &s, size_t *size);
+
+// Returns the policy used by MemMap() when no policy is passed explicitly.
+// It applies to all mappings of the process, including writable ones (e.g.
+// output files and the input file that input-generation.cc fills in place).
+const MemMapPolicy &GetMemMapPolicy();
+
+// Changes the default policy used by MemMap().
+void SetMemMapPolicy(const MemMapPolicy &policy);
+
+// Convenience method for tools that accept a --mmap flag: parses the policy,
+// makes it the default, and arranges for page fault counts to be reported
+// when the process exits. Does nothing if `flag_value` is empty.
+//
+// Returns false (after printing an error message) if the flag is invalid.
+bool InitMemMapPolicyFromFlag(const std::string &flag_value);
+
+// Prints the number of minor and major page faults incurred by the process
+// so far to stderr.
+void ReportPageFaults();
+
 void *MemMap(const char *filename, size_t length, bool writable);
 
+void *MemMap(const char *filename, size_t length, bool writable, const MemMapPolicy &policy);
+
 void MemUnmap(void *data, size_t length);
 
+// Asks the kernel to start reading the pages in the given range in the
+// background (i.e., MADV_WILLNEED). `data` does not need to be page-aligned.
+void MemWillNeed(const void *data, size_t length);
+
 template<class T, size_t size>
 class MappedFile {
 public:
@@ -80,6 +161,78 @@ protected:
   std::unique_ptr<T, std::function<void(T*)>> data_;
 };
 
+template<class T>
+class MutableDynMappedFile : public DynMappedFile<T> {
+public:
+  explicit MutableDynMappedFile(const char *filename) : DynMappedFile<T>(filename, true) {}
+
+  T* data() { return DynMappedFile<T>::data_.get(); }
+  T& operator[](size_t i) { return data()[i]; }
+
+  const T* data() const { return DynMappedFile<T>::data_.get(); }
+  const T& operator[](size_t i) const { return data()[i]; }
+};
+
+// Like DynMappedFile, but for a file that is split into shards (see
+// shards.h). Each shard is mapped separately, so lookups need an extra
+// division to find the shard, which is cheap compared to the memory access.
+//
+// If `writable` is true, values can be modified through the non-const
+// operator[].
+template<class T, bool writable = false>
+class ShardedMappedFile {
+public:
+  // Exits if the manifest is invalid, or any shard is missing or has the
+  // wrong size.
+  explicit ShardedMappedFile(const char *manifest_filename) {
+    ShardManifest manifest;
+    if (!ReadShardManifest(manifest_filename, &manifest)) exit(1);
+    if (manifest.size % sizeof(T) != 0) {
+      std::cerr << "Size of sharded file " << manifest_filename << " is not a multiple of "
+          << sizeof(T) << " bytes!" << std::endl;
+      exit(1);
+    }
+    static_assert(shard_alignment % sizeof(T) == 0);
+    size_ = manifest.size / sizeof(T);
+    shard_length = manifest.shard_size / sizeof(T);
+    for (size_t k = 0; k < manifest.paths.size(); ++k) {
+      const char *path = manifest.paths[k].c_str();
+      if (!std::filesystem::is_regular_file(path) ||
+          int64_t(std::filesystem::file_size(path)) != manifest.ShardEnd(k) - manifest.ShardBegin(k)) {
+        std::cerr << "Shard " << path << " is missing or has the wrong size!" << std::endl;
+        exit(1);
+      }
+      shards.emplace_back(path);
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  const T& operator[](size_t i) const { return shards[i / shard_length][i % shard_length]; }
+
+  T& operator[](size_t i) requires writable { return shards[i / shard_length][i % shard_length]; }
+
+  // Copies `count` values starting at index `begin` to `dest`, which may span
+  // multiple shards.
+  void Copy(size_t begin, size_t count, T *dest) const {
+    while (count > 0) {
+      const size_t offset = begin % shard_length;
+      const size_t n = std::min(count, shard_length - offset);
+      std::copy_n(shards[begin / shard_length].data() + offset, n, dest);
+      begin += n;
+      dest += n;
+      count -= n;
+    }
+  }
+
+private:
+  using Shard = std::conditional_t<writable, MutableDynMappedFile<T>, DynMappedFile<T>>;
+
+  size_t size_ = 0;
+  size_t shard_length = 0;  // number of values per shard
+  std::vector<Shard> shards;
+};
+
 // Accessor for binary data. Note that file size is in bytes, so the number of
 // bits is filesize * 8.
 template<size_t filesize>
@@ -133,6 +286,82 @@ private:
   std::vector<MappedFile<uint8_t, chunk_size/8>> maps;
 };
 
+// Batch lookup methods shared by the Outcome accessors below.
+//
+// These look up the values at the given indices, while issuing software
+// prefetches `prefetch_distance` lookups ahead, so that the cache (and TLB)
+// misses of consecutive lookups overlap, instead of stalling on each one.
+//
+// Indices can be given in any order, but when the order of lookups doesn't
+// matter, sorting them first improves locality of reference.
+//
+// Derived must define `Outcome operator[](size_t i) const` and
+// `void Prefetch(size_t i) const`.
+template<class Derived>
+class BatchLookups {
+public:
+  static constexpr size_t prefetch_distance = 16;
+
+  // Looks up the values at `count` indices, and writes them to `outcomes`.
+  void GetBatch(const int64_t *indices, Outcome *outcomes, size_t count) const {
+    PrefetchFirst(indices, count);
+    for (size_t i = 0; i < count; ++i) {
+      if (i + prefetch_distance < count) self().Prefetch(indices[i + prefetch_distance]);
+      outcomes[i] = self()[indices[i]];
+    }
+  }
+
+  // Returns whether any of the values at the given indices is equal to `o`.
+  // Stops at the first match.
+  bool AnyOf(const int64_t *indices, size_t count, Outcome o) const {
+    PrefetchFirst(indices, count);
+    for (size_t i = 0; i < count; ++i) {
+      if (i + prefetch_distance < count) self().Prefetch(indices[i + prefetch_distance]);
+      if (self()[indices[i]] == o) return true;
+    }
+    return false;
+  }
+
+  // Returns whether all of the values at the given indices are equal to `o`.
+  // Stops at the first mismatch. If `mismatch` is not null, the first
+  // mismatched value is written to *mismatch.
+  bool AllOf(const int64_t *indices, size_t count, Outcome o, Outcome *mismatch = nullptr) const {
+    PrefetchFirst(indices, count);
+    for (size_t i = 0; i < count; ++i) {
+      if (i + prefetch_distance < count) self().Prefetch(indices[i + prefetch_distance]);
+      if (Outcome p = self()[indices[i]]; p != o) {
+        if (mismatch) *mismatch = p;
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  const Derived &self() const { return static_cast<const Derived&>(*this); }
+
+  void PrefetchFirst(const int64_t *indices, size_t count) const {
+    for (size_t i = 0; i < count && i < prefetch_distance; ++i) self().Prefetch(indices[i]);
+  }
+};
+
+// Decodes `count` ternary values starting from index `start` of `bytes` into
+// `outcomes`. Whole bytes are decoded with a single table lookup.
+inline void DecodeTernaryRange(const uint8_t *bytes, size_t start, size_t count, Outcome *outcomes) {
+  while (count > 0 && start % 5 != 0) {
+    *outcomes++ = static_cast<Outcome>(DecodeTernary(bytes[start / 5], start));
+    ++start, --count;
+  }
+  for (const uint8_t *p = bytes + start / 5; count >= 5; count -= 5, start += 5, ++p) {
+    const std::array<uint8_t, 5> &digits = ternary_decode_table[*p];
+    for (int j = 0; j < 5; ++j) *outcomes++ = static_cast<Outcome>(digits[j]);
+  }
+  while (count-- > 0) {
+    *outcomes++ = static_cast<Outcome>(DecodeTernary(bytes[start / 5], start));
+    ++start;
+  }
+}
+
 // Accessor for result data of phase 1 (written by solve-r1) merged into a
 // single file.
 //
@@ -140,7 +369,7 @@ private:
 // 2 for WIN). The results are encoded in ternary with 5 values per byte (or
 // 1.6 bits per value).
 template<size_t filesize>
-class RnAccessorBase {
+class RnAccessorBase : public BatchLookups<RnAccessorBase<filesize>> {
 public:
   explicit RnAccessorBase(const char *filename) : map(filename) {}
 
@@ -148,6 +377,16 @@ public:
     return static_cast<Outcome>(DecodeTernary(map[i / 5], i));
   }
 
+  // Hints the CPU to start loading the byte that contains value i.
+  void Prefetch(size_t i) const {
+    __builtin_prefetch(&map[i / 5]);
+  }
+
+  // Decodes `count` values starting from index `start` into `outcomes`.
+  void Decode(size_t start, size_t count, Outcome *outcomes) const {
+    DecodeTernaryRange(map.data(), start, count, outcomes);
+  }
+
 private:
   MappedFile<uint8_t, filesize> map;
 
@@ -165,6 +404,130 @@ public:
   explicit RnChunkAccessor(const char *filename) : RnAccessorBase(filename) {}
 };
 
+// Like RnAccessor, but for a file that is split into shards (see shards.h).
+class ShardedRnAccessor : public BatchLookups<ShardedRnAccessor> {
+public:
+  explicit ShardedRnAccessor(const char *manifest_filename);
+
+  Outcome operator[](size_t i) const {
+    return static_cast<Outcome>(DecodeTernary(map[i / 5], i));
+  }
+
+  void Prefetch(size_t i) const {
+    __builtin_prefetch(&map[i / 5]);
+  }
+
+  // Decodes `count` values starting from index `start` into `outcomes`.
+  void Decode(size_t start, size_t count, Outcome *outcomes) const {
+    for (size_t i = 0; i < count; ++i) outcomes[i] = (*this)[start + i];
+  }
+
+private:
+  ShardedMappedFile<uint8_t> map;
+
+  // Allow access to the mapped file to enable checksum verification.
+  friend class ChunkVerifier;
+};
+
+// Accessor for result data of phase N stored in the 2-bit format (see
+// two-bit.h), with 32 values per 64-bit word. `size` is the number of values;
+// the last word is padded with TIE values.
+//
+// This takes 25% more space than the ternary format used by RnAccessorBase,
+// but lookups don't require division by 5, and values can be tested 64 at a
+// time with word operations.
+template<size_t size>
+class TwoBitRnAccessorBase : public BatchLookups<TwoBitRnAccessorBase<size>> {
+public:
+  static constexpr size_t num_words = TwoBitWordCount(size);
+
+  explicit TwoBitRnAccessorBase(const char *filename) : map(filename) {}
+
+  Outcome operator[](size_t i) const {
+    return static_cast<Outcome>(DecodeTwoBit(map[i / 32], i));
+  }
+
+  // Hints the CPU to start loading the word that contains value i.
+  void Prefetch(size_t i) const {
+    __builtin_prefetch(&map[i / 32]);
+  }
+
+  // Returns a 64-bit mask with bit j set if and only if the value at index
+  // (start + j) is equal to `o`. Bits for indices past the end are 0.
+  uint64_t Match64(size_t start, Outcome o) const {
+    size_t word = start / 32;
+    unsigned shift = start % 32;
+    uint64_t mask = Match32(word, o) | uint64_t{Match32(word + 1, o)} << 32;
+    if (shift > 0) mask = (mask >> shift) | uint64_t{Match32(word + 2, o)} << (64 - shift);
+    if (start + 64 > size) mask &= start >= size ? 0 : (uint64_t{1} << (size - start)) - 1;
+    return mask;
+  }
+
+  // Decodes `count` values starting from index `start` into `outcomes`.
+  void Decode(size_t start, size_t count, Outcome *outcomes) const {
+    assert(start + count <= size);
+    while (count > 0 && start % 32 != 0) {
+      *outcomes++ = (*this)[start++];
+      --count;
+    }
+    for (const uint64_t *word = &map[start / 32]; count >= 32; count -= 32, ++word) {
+      uint64_t w = *word;
+      for (int j = 0; j < 32; ++j, w >>= 2) *outcomes++ = static_cast<Outcome>(w & 3);
+      start += 32;
+    }
+    while (count-- > 0) *outcomes++ = (*this)[start++];
+  }
+
+private:
+  uint32_t Match32(size_t word, Outcome o) const {
+    return word < num_words ? TwoBitMatchMask(map[word], o) : 0;
+  }
+
+  MappedFile<uint64_t, num_words> map;
+};
+
+class TwoBitRnAccessor : public TwoBitRnAccessorBase<total_perms> {
+public:
+  explicit TwoBitRnAccessor(const char *filename) : TwoBitRnAccessorBase(filename) {}
+};
+
+// Accessor for result data of phase N that is stored either in the ternary
+// format (RnAccessor), in the 2-bit format (TwoBitRnAccessor), or in the
+// ternary format split into shards (ShardedRnAccessor). Sharded files are
+// detected by their manifest; the other formats by the file size.
+//
+// Lookups dispatch on the format with a branch, which is cheap compared to
+// the memory access itself, since it's perfectly predictable.
+class AnyRnAccessor : public BatchLookups<AnyRnAccessor> {
+public:
+  explicit AnyRnAccessor(const char *filename);
+
+  Outcome operator[](size_t i) const {
+    return two_bit ? (*two_bit)[i] : ternary ? (*ternary)[i] : (*sharded)[i];
+  }
+
+  void Prefetch(size_t i) const {
+    if (two_bit) two_bit->Prefetch(i); else if (ternary) ternary->Prefetch(i); else sharded->Prefetch(i);
+  }
+
+  // Decodes `count` values starting from index `start` into `outcomes`.
+  void Decode(size_t start, size_t count, Outcome *outcomes) const {
+    if (two_bit) two_bit->Decode(start, count, outcomes);
+    else if (ternary) ternary->Decode(start, count, outcomes);
+    else sharded->Decode(start, count, outcomes);
+  }
+
+  // Exactly one of these returns a non-null pointer.
+  const RnAccessor *Ternary() const { return ternary ? &*ternary : nullptr; }
+  const TwoBitRnAccessor *TwoBit() const { return two_bit ? &*two_bit : nullptr; }
+  const ShardedRnAccessor *Sharded() const { return sharded ? &*sharded : nullptr; }
+
+private:
+  std::optional<RnAccessor> ternary;
+  std::optional<TwoBitRnAccessor> two_bit;
+  std::optional<ShardedRnAccessor> sharded;
+};
+
 
 template<class A, class T>
 class AccessorReference {
@@ -212,6 +575,35 @@ private:
   MutableMappedFile<uint8_t, total_perms/5> map;
 };
 
+// Like MutableRnAccessor, but for a file that is split into shards (see
+// shards.h), e.g. one created with `shard-file create`.
+class ShardedMutableRnAccessor {
+public:
+  using Reference = AccessorReference<ShardedMutableRnAccessor, Outcome>;
+
+  explicit ShardedMutableRnAccessor(const char *manifest_filename);
+
+  Outcome get(size_t i) const {
+    return static_cast<Outcome>(DecodeTernary(map[i / 5], i));
+  }
+
+  void set(size_t i, Outcome o) {
+    uint8_t &byte = map[i / 5];
+    byte = EncodeTernary(byte, i, static_cast<int>(o));
+  }
+
+  Outcome operator[](size_t i) const {
+    return get(i);
+  }
+
+  Reference operator[](size_t i) {
+    return Reference(this, i);
+  }
+
+private:
+  ShardedMappedFile<uint8_t, true> map;
+};
+
 // Accessor wrapper that wraps get() and set() calls with a mutex guard.
 template<class T, class A>
 class ThreadSafeAccessor {
@@ -245,6 +637,123 @@ private:
 
 using ThreadSafeMutableRnAccessor = ThreadSafeAccessor<Outcome, MutableRnAccessor>;
 
+// Mutable accessor for ternary data that can be updated concurrently from
+// multiple threads without a mutex.
+//
+// Since each byte packs five values, changing a value is a read-modify-write
+// of the byte. This class performs that update with a compare-and-swap loop on
+// the aligned 32-bit word that contains the byte, so concurrent updates to
+// different values in the same byte (or word) are never lost. This is only
+// safe if all concurrent writers use this class.
+//
+// The file may also be split into shards (see shards.h), in which case
+// `filename` is the manifest. Shard boundaries are aligned, so a word never
+// spans two shards.
+class ConcurrentMutableRnAccessor {
+public:
+  using Reference = AccessorReference<ConcurrentMutableRnAccessor, Outcome>;
+
+  // Statistics returned by ApplySortedUpdates().
+  struct UpdateStats {
+    // Number of values that were changed from TIE to the new outcome.
+    int64_t changed = 0;
+
+    // Number of values that already had the new outcome.
+    int64_t unchanged = 0;
+
+    // Number of values found with an outcome other than TIE and the new
+    // outcome. Since updating stops at a conflict, this is not necessarily
+    // the total number of conflicts in the batch.
+    int64_t conflicts = 0;
+
+    // Smallest index that caused a conflict, or -1 if there were none.
+    int64_t first_conflict = -1;
+
+    void Merge(const UpdateStats &s) {
+      changed += s.changed;
+      unchanged += s.unchanged;
+      conflicts += s.conflicts;
+      if (s.first_conflict >= 0 && (first_conflict < 0 || s.first_conflict < first_conflict)) {
+        first_conflict = s.first_conflict;
+      }
+    }
+  };
+
+  explicit ConcurrentMutableRnAccessor(const char *filename);
+
+  Outcome get(size_t i) const {
+    return static_cast<Outcome>(DecodeTernary(LoadByte(i / 5), i));
+  }
+
+  void set(size_t i, Outcome o) {
+    std::atomic_ref<uint32_t> word(Word(i / 5));
+    const int shift = Shift(i / 5);
+    uint32_t old_word = word.load(std::memory_order_relaxed);
+    uint32_t new_word;
+    do {
+      uint8_t byte = EncodeTernary(old_word >> shift, i, static_cast<int>(o));
+      new_word = (old_word & ~(uint32_t{0xff} << shift)) | (uint32_t{byte} << shift);
+    } while (new_word != old_word &&
+        !word.compare_exchange_weak(old_word, new_word, std::memory_order_relaxed));
+  }
+
+  Outcome operator[](size_t i) const {
+    return get(i);
+  }
+
+  Reference operator[](size_t i) {
+    return Reference(this, i);
+  }
+
+  // Changes the values at the given indices from TIE to `o`.
+  //
+  // Indices must be given in nondecreasing order (duplicates are allowed).
+  // Indices that share a byte are updated together with a single
+  // compare-and-swap. Values that are already equal to `o` are skipped.
+  //
+  // A value that is neither TIE nor `o` is a conflict. Updating stops at the
+  // first conflict: the byte that contains it is left unchanged, but updates
+  // to earlier bytes have been applied, so the batch is not all-or-nothing
+  // (like the element-wise loops this replaces). Callers treat a conflict as
+  // a fatal error.
+  UpdateStats ApplySortedUpdates(const int64_t *indices, size_t count, Outcome o);
+
+  // Same as above, but splits the indices into blocks that are processed by
+  // `num_threads` threads concurrently. 0 threads disables multithreading.
+  // After a conflict, no new blocks are started, but blocks that other
+  // threads are already working on are finished, so some updates after the
+  // first conflict may have been applied as well.
+  UpdateStats ApplySortedUpdates(const std::vector<int64_t> &indices, Outcome o, int num_threads);
+
+private:
+  static constexpr size_t filesize = total_perms/5;
+
+  static_assert(filesize % sizeof(uint32_t) == 0);
+  static_assert(std::endian::native == std::endian::little);
+
+  uint32_t &Word(size_t byte_index) const {
+    static_assert(alignof(uint32_t) == sizeof(uint32_t));
+    static_assert(shard_alignment % sizeof(uint32_t) == 0);
+    // Mappings are page-aligned, so the rounded-down offset is aligned too.
+    const size_t offset = byte_index & ~size_t{3};
+    const uint8_t *p = sharded ? &(*sharded)[offset] : map->data() + offset;
+    return *reinterpret_cast<uint32_t*>(const_cast<uint8_t*>(p));
+  }
+
+  static int Shift(size_t byte_index) {
+    return (byte_index & 3) * 8;
+  }
+
+  uint8_t LoadByte(size_t byte_index) const {
+    std::atomic_ref<uint32_t> word(Word(byte_index));
+    return word.load(std::memory_order_relaxed) >> Shift(byte_index);
+  }
+
+  // Exactly one of these is set.
+  std::optional<MutableMappedFile<uint8_t, filesize>> map;
+  std::optional<ShardedMappedFile<uint8_t, true>> sharded;
+};
+
 // Accessor for result data of phase 1 (written by solve-r1) as separate
 // chunk files.
 //
@@ -258,15 +767,7 @@ public:
   Outcome operator[](size_t i) const {
     size_t chunk = i / chunk_size;
     size_t index = i % chunk_size;
-    uint8_t byte = maps[chunk][index / 5];
-    switch (index % 5) {
-    case 0: return static_cast<Outcome>(byte % 3);
-    case 1: return static_cast<Outcome>(byte / 3 % 3);
-    case 2: return static_cast<Outcome>(byte / (3 * 3) % 3);
-    case 3: return static_cast<Outcome>(byte / (3 * 3 * 3) % 3);
-    case 4: return static_cast<Outcome>(byte / (3 * 3 * 3 * 3) % 3);
-    default: abort();  // unreachable
-    }
+    return static_cast<Outcome>(DecodeTernary(maps[chunk][index / 5], index));
   }
 
 private:
@@ -371,22 +872,33 @@ public:
 // Accessor for files that contain Elias-Fano-encoded lists of integers
 // (see efcodec.h).
 //
-// Each file can consist of multiple parts. The constructor scans the whole
-// file and indexes the byte offset of each part. Individual parts can then
-// be extracted with GetPart().
+// Each file can consist of multiple parts. The constructor indexes the byte
+// offset of each part, and samples elements for random access (see
+// ef-index.h). If an up-to-date index was saved next to the file, it is loaded
+// instead; otherwise the whole file is scanned, and the index is saved if
+// `save_index` is true.
+//
+// Individual parts can be decoded with GetPart(), or accessed without
+// decoding them with Part().
 class EFAccessor {
 public:
-  explicit EFAccessor(const char *filename);
+  explicit EFAccessor(const char *filename, bool save_index = false);
 
-  std::vector<int64_t> GetPart(size_t i);
+  std::vector<int64_t> GetPart(size_t i) const;
+
+  // Returns a random-access reader for the i-th part. The reader is valid as
+  // long as this accessor exists.
+  EFListReader Part(size_t i) const {
+    return index.Part(byte_span_t(data_.data(), data_.size()), i);
+  }
 
-  size_t PartCount() {
-    return part_byte_offsets.size() - 1;
+  size_t PartCount() const {
+    return index.PartCount();
   }
 
 private:
   DynMappedFile<uint8_t> data_;
-  std::vector<size_t> part_byte_offsets;
+  EFIndex index;
 };
 
 #endif  // ndef ACCESSORS_H_INCLUDED
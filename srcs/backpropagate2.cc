@@ -8,7 +8,8 @@
 // predecessors of a position is similar to the number of successors.
 //
 // The downside is that this approach doesn't allow generating output in chunks,
-// because predecessors may appear anywhere in the output.
+// because predecessors may appear anywhere in the output. To bound the memory
+// used to collect them, use --spill-dir (see bucket-spill.h).
 //
 // This implementation uses two preceding files r(N-2).bin and r(N-1).bin to
 // calculate newly losing positions.
@@ -16,6 +17,7 @@
 #include "auto-solver.h"
 #include "accessors.h"
 #include "board.h"
+#include "bucket-spill.h"
 #include "bytes.h"
 #include "chunks.h"
 #include "dedupe.h"
@@ -26,7 +28,9 @@
 #include "parse-int.h"
 #include "perms.h"
 #include "search.h"
+#include "thread-pool.h"
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <filesystem>
@@ -45,10 +49,21 @@ const char *solver_id = "backpropagate2-v0.1.3";
 // Number of threads to use for calculations. 0 to disable multithreading.
 int num_threads = std::thread::hardware_concurrency();
 
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
 std::optional<RnAccessor> rn2_acc;  // r(N-2).bin
 std::optional<RnAccessor> rn1_acc;  // r(N-1).bin
 int initialized_phase = -1;
 
+// Directory for spilling wins to disk (selected with --spill-dir), or empty to
+// collect them in memory.
+std::string spill_dir;
+
+// Number of wins buffered per thread before spilling (derived from
+// --spill-buffer).
+size_t spill_buffer_size = 0;
+
 const std::string PhaseInputFilename(int phase) {
   std::ostringstream oss;
   oss << "input/r" << phase << ".bin";
@@ -85,7 +100,9 @@ struct ChunkStats {
   }
 };
 
-void ProcessPerm(int64_t perm_index, const Perm &perm, ChunkStats *stats, std::vector<int64_t> *wins) {
+// Calls add_win(pred_index) for each predecessor of a new loss that is TIE.
+template<class AddWin>
+void ProcessPerm(int64_t perm_index, const Perm &perm, ChunkStats *stats, const AddWin &add_win) {
   {
     // Process new losses only.
     Outcome o1 = (*rn1_acc)[perm_index];
@@ -95,12 +112,12 @@ void ProcessPerm(int64_t perm_index, const Perm &perm, ChunkStats *stats, std::v
     assert(o2 == TIE);
   }
   ++stats->losses_found;
-  GeneratePredecessors(perm, [stats, wins](const Perm &pred){
+  GeneratePredecessors(perm, [stats, &add_win](const Perm &pred){
     ++stats->total_predecessors;
     int64_t pred_index = IndexOf(pred);
     Outcome o = (*rn1_acc)[pred_index];
     if (o == TIE) {
-      wins->push_back(pred_index);
+      add_win(pred_index);
       ++stats->wins_written;
     } else {
       assert(o == WIN);
@@ -108,47 +125,38 @@ void ProcessPerm(int64_t perm_index, const Perm &perm, ChunkStats *stats, std::v
   });
 }
 
-void ComputeChunkThread(int chunk, std::atomic<int> *next_part, std::vector<int64_t> *wins, ChunkStats *stats) {
+// Processes one part of the chunk. Calls add_win(index) for each win found.
+template<class AddWin>
+void ProcessPart(int chunk, int part, ChunkStats *stats, const AddWin &add_win) {
   const int64_t start_index = int64_t{chunk} * int64_t{chunk_size};
-  for (;;) {
-    const int part = (*next_part)++;
-    if (part + 1 >= num_threads) PrintChunkUpdate(chunk, part + 1 - num_threads);
-    if (part >= num_parts) break;  // note: will actually exceed num_parts!
-    int part_start = part * part_size;
-    int64_t perm_index = start_index + part_start;
-    Perm perm = PermAtIndex(perm_index);
-    REP(i, part_size) {
-      ProcessPerm(perm_index, perm, stats, wins);
-      std::next_permutation(perm.begin(), perm.end());
-      ++perm_index;
-    }
+  int part_start = part * part_size;
+  int64_t perm_index = start_index + part_start;
+  Perm perm = PermAtIndex(perm_index);
+  REP(i, part_size) {
+    ProcessPerm(perm_index, perm, stats, add_win);
+    std::next_permutation(perm.begin(), perm.end());
+    ++perm_index;
   }
-  SortAndDedupe(*wins);
 }
 
-ChunkStats ProcessChunk(int chunk, std::vector<int64_t> &wins) {
-  std::atomic<int> next_part = 0;
-  ChunkStats stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeChunkThread(chunk, &next_part, &wins, &stats);
-  } else {
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    std::vector<std::vector<int64_t>> thread_wins(num_threads);
-    std::vector<ChunkStats> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(ComputeChunkThread, chunk, &next_part, &thread_wins[i], &thread_stats[i]);
-    }
-    REP(i, num_threads) {
-      threads[i].join();
-      wins.insert(wins.end(), thread_wins[i].begin(), thread_wins[i].end());
-    }
-    assert(next_part == num_parts + num_threads);
-    for (const ChunkStats &s : thread_stats) stats.Merge(s);
-  }
+// Appends the wins to `result` as an EF-coded list, and stores their number
+// in `win_count`.
+ChunkStats ProcessChunk(int chunk, bytes_t &result, int64_t *win_count) {
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  IndexCollector collector(pool_ptr, spill_dir, chunk_size, num_chunks, spill_buffer_size);
+  PerWorker<ChunkStats> thread_stats(pool_ptr);
+  std::atomic<int> parts_done = 0;
+  ParallelFor(pool_ptr, num_parts, num_threads, [&](size_t part) {
+    ChunkStats *stats = &thread_stats.Local();
+    collector.WithLocal([&](const auto &add_win) {
+      ProcessPart(chunk, part, stats, add_win);
+    });
+    PrintChunkUpdate(chunk, ++parts_done);
+  });
   ClearChunkUpdate();
+  ChunkStats stats;
+  thread_stats.ForEach([&stats](const ChunkStats &s) { stats.Merge(s); });
+  if (!collector.Encode(result, EFVersion::V1, win_count)) exit(1);
   return stats;
 }
 
@@ -157,17 +165,16 @@ bytes_t ComputeChunk(int phase, int chunk) {
 
   auto start_time = std::chrono::system_clock::now();
 
-  std::vector<int64_t> wins;
-  ChunkStats stats = ProcessChunk(chunk, wins);
-  SortAndDedupe(wins);
-  bytes_t encoded_wins = EncodeEF(wins);
+  bytes_t encoded_wins;
+  int64_t win_count = 0;
+  ChunkStats stats = ProcessChunk(chunk, encoded_wins, &win_count);
 
   std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start_time;
   double elapsed_minutes = elapsed_seconds.count() / 60;
   std::cerr << "Chunk stats: "
     << stats.losses_found << " losses found. "
     << stats.wins_written << " wins written. "
-    << wins.size() << " new wins.\n";
+    << win_count << " new wins.\n";
 
   if (stats.losses_found > 0) {
     std::cerr << "Average number of predecessors: " << stats.total_predecessors / stats.losses_found << ".\n";
@@ -199,6 +206,10 @@ void PrintUsage() {
     << "For automatic chunk assignment (requires network access):\n\n"
     << "  backpropagate2 --phase=N --user=<user-id> --machine=<machine-id>\n"
     << "      [--host=styx.verver.ch] [--port=7429]\n"
+    << "\nOptional flags:\n\n"
+    << "  --mmap=<policy>  memory map options for all mapped files (inputs and outputs), e.g. random,hugepages\n"
+    << "  --spill-dir=<dir>  spill wins to temporary files in this directory\n"
+    << "  --spill-buffer=<size>  total memory for buffering spilled wins (default: 4G)\n"
     << std::endl;
 }
 
@@ -212,6 +223,9 @@ int main(int argc, char *argv[]) {
   std::string arg_port = "7429";
   std::string arg_user;
   std::string arg_machine;
+  std::string arg_mmap;
+  std::string arg_spill_dir;
+  std::string arg_spill_buffer = "4G";
   std::map<std::string, Flag> flags = {
     {"phase", Flag::required(arg_phase)},
 
@@ -224,6 +238,18 @@ int main(int argc, char *argv[]) {
     {"port", Flag::optional(arg_port)},
     {"user", Flag::optional(arg_user)},
     {"machine", Flag::optional(arg_machine)},
+
+    // Memory map policy for all mapped files, read-only or writable (see
+    // ParseMemMapPolicy() in accessors.h)
+    {"mmap", Flag::optional(arg_mmap)},
+
+    // Directory for temporary files (see bucket-spill.h). If set, wins are
+    // spilled to disk instead of collected in memory.
+    {"spill-dir", Flag::optional(arg_spill_dir)},
+
+    // Total memory for buffering wins before they are spilled, divided among
+    // the threads
+    {"spill-buffer", Flag::optional(arg_spill_buffer)},
   };
 
   if (argc == 1) {
@@ -243,6 +269,26 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (!InitMemMapPolicyFromFlag(arg_mmap)) {
+    return 1;
+  }
+
+  if (!arg_spill_dir.empty() && !std::filesystem::is_directory(arg_spill_dir)) {
+    std::cout << "Spill directory " << arg_spill_dir << " does not exist!\n";
+    return 1;
+  }
+  spill_dir = arg_spill_dir;
+  size_t spill_buffer_bytes = 0;
+  const size_t spill_buffers = std::max(num_threads, 1);
+  if (!ParseByteSize(arg_spill_buffer, &spill_buffer_bytes) ||
+      spill_buffer_bytes < spill_buffers * sizeof(int64_t)) {
+    std::cout << "Invalid value for --spill-buffer: " << arg_spill_buffer << "\n";
+    return 1;
+  }
+  spill_buffer_size = spill_buffer_bytes / spill_buffers / sizeof(int64_t);
+
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
   bool want_manual = !arg_start.empty() || !arg_end.empty();
   bool want_automatic = !arg_user.empty() || !arg_machine.empty();
 
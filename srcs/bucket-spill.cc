@@ -0,0 +1,218 @@
+#include "bucket-spill.h"
+
+#include <unistd.h>
+
+#include <cassert>
+#include <filesystem>
+#include <iostream>
+#include <utility>
+
+#include "bytes.h"
+#include "byte_span.h"
+#include "dedupe.h"
+#include "efcodec.h"
+#include "macros.h"
+
+namespace {
+
+// Distinguishes the spill files of different BucketSpill instances in the
+// same process.
+std::atomic<int> next_spill_id = 0;
+
+}  // namespace
+
+BucketSpill::BucketSpill(const std::string &dir, int64_t bucket_size, int num_buckets)
+    : dir(dir), bucket_size(bucket_size), num_buckets(num_buckets), id(next_spill_id++),
+      bucket_segments(num_buckets) {
+  assert(bucket_size > 0);
+  assert(num_buckets > 0);
+}
+
+BucketSpill::~BucketSpill() {
+  readers.clear();
+  for (const std::string &filename : filenames) {
+    std::error_code error;
+    std::filesystem::remove(filename, error);
+  }
+}
+
+int BucketSpill::AddFile(std::string *filename) {
+  std::lock_guard<std::mutex> lock(mutex);
+  const int file = filenames.size();
+  *filename = (std::filesystem::path(dir) /
+      ("spill-" + std::to_string(getpid()) + "-" +
+       std::to_string(id) + "-" +
+       std::to_string(file) + ".bin")).string();
+  filenames.push_back(*filename);
+  return file;
+}
+
+void BucketSpill::AddRun(
+    int file, const std::vector<std::pair<int, Segment>> &segments, uint64_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &[bucket, segment] : segments) {
+      assert(segment.file == file);
+      bucket_segments[bucket].push_back(segment);
+    }
+  }
+  ++run_count;
+  spilled_bytes += size;
+}
+
+std::ifstream &BucketSpill::Reader(int file, const std::string &filename) const {
+  if (readers.size() <= static_cast<size_t>(file)) readers.resize(file + 1);
+  std::unique_ptr<std::ifstream> &reader = readers[file];
+  if (!reader) reader = std::make_unique<std::ifstream>(filename, std::ifstream::binary);
+  return *reader;
+}
+
+bool BucketSpill::ReadBucket(int bucket, std::vector<int64_t> &output) const {
+  return ForEachInBucket(bucket, [&output](int64_t index) { output.push_back(index); });
+}
+
+bool BucketSpill::ForEachInBucket(
+    int bucket, const std::function<void(int64_t)> &callback) const {
+  assert(bucket >= 0 && bucket < num_buckets);
+  std::vector<Segment> segments;
+  std::vector<std::string> files;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    segments = bucket_segments[bucket];
+    files = filenames;
+  }
+
+  // The encoded lists are small compared to the decoded bucket, so it's fine
+  // to read them all into memory before merging.
+  std::vector<bytes_t> encoded(segments.size());
+  {
+    std::lock_guard<std::mutex> lock(read_mutex);
+    for (size_t i = 0; i < segments.size(); ++i) {
+      const Segment &segment = segments[i];
+      const std::string &filename = files[segment.file];
+      std::ifstream &ifs = Reader(segment.file, filename);
+      encoded[i].resize(segment.size);
+      ifs.clear();
+      if (!ifs.seekg(segment.offset) ||
+          !ifs.read(reinterpret_cast<char*>(encoded[i].data()), segment.size)) {
+        std::cerr << "Failed to read " << segment.size << " bytes at offset " << segment.offset
+            << " from spill file " << filename << std::endl;
+        return false;
+      }
+    }
+  }
+  std::vector<byte_span_t> spans(encoded.begin(), encoded.end());
+  std::vector<EFIterator> lists;
+  lists.reserve(spans.size());
+  for (byte_span_t &span : spans) lists.emplace_back(&span);
+
+  EFMerger merger(std::move(lists));
+  for (int64_t last = -1; !merger.AtEnd(); merger.Advance()) {
+    const int64_t value = merger.Value();
+    if (value != last) callback(value);
+    last = value;
+  }
+  if (merger.Failed()) {
+    std::cerr << "Failed to decode spilled list of bucket " << bucket << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool BucketSpill::EncodeAll(bytes_t &result, EFVersion version, int64_t *count) const {
+  int64_t n = 0;
+  int64_t max_value = 0;
+  REP(bucket, num_buckets) {
+    if (!ForEachInBucket(bucket, [&n, &max_value](int64_t index) {
+          ++n;
+          max_value = index;
+        })) {
+      return false;
+    }
+  }
+  EFEncoder encoder(result, n, max_value, -1, version);
+  REP(bucket, num_buckets) {
+    if (!ForEachInBucket(bucket, [&encoder](int64_t index) { encoder.Add(index); })) {
+      return false;
+    }
+  }
+  encoder.Finish();
+  *count = n;
+  return true;
+}
+
+BucketSpill::Writer::Writer(BucketSpill *spill, size_t buffer_size)
+    : spill(spill), buffer_size(buffer_size) {
+  assert(buffer_size > 0);
+  buffer.reserve(buffer_size);
+}
+
+BucketSpill::Writer::~Writer() {
+  Flush();
+}
+
+void BucketSpill::Writer::Flush() {
+  if (buffer.empty()) return;
+  if (file < 0) {
+    file = spill->AddFile(&filename);
+    ofs.open(filename, std::ofstream::binary);
+    if (!ofs) {
+      std::cerr << "Failed to open spill file: " << filename << std::endl;
+      exit(1);
+    }
+  }
+
+  SortAndDedupe(buffer);
+  bytes_t run;
+  std::vector<std::pair<int, Segment>> segments;
+  std::vector<int64_t> part;
+  for (auto begin = buffer.begin(); begin != buffer.end(); ) {
+    const int bucket = spill->BucketOf(*begin);
+    assert(bucket >= 0 && bucket < spill->NumBuckets());
+    auto end = begin;
+    while (end != buffer.end() && spill->BucketOf(*end) == bucket) ++end;
+    part.assign(begin, end);
+    const size_t start = run.size();
+    EncodeEF(part, run, -1, EFVersion::V2);
+    segments.push_back({bucket, Segment{file, file_size + start, run.size() - start}});
+    begin = end;
+  }
+  buffer.clear();
+
+  if (!ofs.write(reinterpret_cast<const char*>(run.data()), run.size()) || !ofs.flush()) {
+    std::cerr << "Failed to write " << run.size() << " bytes to spill file: " << filename << std::endl;
+    exit(1);
+  }
+  file_size += run.size();
+  spill->AddRun(file, segments, run.size());
+}
+
+IndexCollector::IndexCollector(
+    ThreadPool *pool, const std::string &spill_dir, int64_t bucket_size, int num_buckets,
+    size_t buffer_size)
+    : pool(pool), buffer_size(buffer_size), vectors(pool), writers(pool) {
+  if (!spill_dir.empty()) spill.emplace(spill_dir, bucket_size, num_buckets);
+}
+
+bool IndexCollector::Encode(bytes_t &result, EFVersion version, int64_t *count) {
+  if (!spill) {
+    std::vector<int64_t> indices;
+    MergeAndDedupe(vectors, pool, indices);
+    EncodeEF(indices, result, -1, version);
+    *count = indices.size();
+    return true;
+  }
+  {
+    // Destroying the writers flushes their buffers. Each flush sorts and
+    // encodes a full buffer, so they are done in parallel.
+    TaskGroup group(pool);
+    writers.ForEach([&group](std::optional<BucketSpill::Writer> &writer) {
+      group.Run([&writer]() { writer.reset(); });
+    });
+  }
+  // The indices are encoded one bucket at a time, so they are never all
+  // decoded in memory at once.
+  std::cerr << "Merging " << spill->RunCount() << " spilled runs ("
+      << spill->SpilledBytes() / 1e6 << " MB)..." << std::endl;
+  return spill->EncodeAll(result, version, count);
+}
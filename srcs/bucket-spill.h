@@ -0,0 +1,195 @@
+#ifndef BUCKET_SPILL_H_INCLUDED
+#define BUCKET_SPILL_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bytes.h"
+#include "efcodec.h"
+#include "thread-pool.h"
+
+// External-memory collection of a large set of permutation indices, such as
+// the predecessors generated by backpropagate2 and solve3.
+//
+// Collecting all indices in RAM and deduplicating them at the end needs memory
+// proportional to the number of indices generated, including duplicates.
+// Instead, each thread adds indices through a Writer with a fixed-size buffer.
+// When the buffer is full, it is sorted, deduplicated, and split by bucket
+// (a range of `bucket_size` consecutive indices, normally a chunk), and each
+// bucket's part is appended to the writer's spill file as an EF-coded list.
+// This is called a run. At the end, the runs of each bucket are merged.
+//
+// Since buckets cover consecutive ranges, reading buckets 0, 1, 2, etc. in
+// order yields all indices in sorted order. EncodeAll() uses this to produce
+// a single EF-coded list of all indices, one bucket at a time, without ever
+// decoding them into memory. Memory use is then bounded by the writer buffers
+// plus the encoded runs of one bucket and the encoded output.
+//
+// Spill files are created in `dir`, which must exist, and are removed when the
+// BucketSpill is destroyed.
+class BucketSpill {
+public:
+  class Writer;
+
+  BucketSpill(const std::string &dir, int64_t bucket_size, int num_buckets);
+  ~BucketSpill();
+
+  BucketSpill(const BucketSpill&) = delete;
+  BucketSpill &operator=(const BucketSpill&) = delete;
+
+  int NumBuckets() const { return num_buckets; }
+
+  // Returns the bucket that contains the given index.
+  int BucketOf(int64_t index) const { return index / bucket_size; }
+
+  // Total number of runs written by all writers so far.
+  int64_t RunCount() const { return run_count; }
+
+  // Total number of bytes written to spill files so far.
+  int64_t SpilledBytes() const { return spilled_bytes; }
+
+  // Appends the distinct indices of the given bucket to `output` in sorted
+  // order. All writers must have been flushed. Returns false if a spill file
+  // could not be read or decoded.
+  bool ReadBucket(int bucket, std::vector<int64_t> &output) const;
+
+  // Calls callback(index) for the distinct indices of the given bucket in
+  // sorted order. All writers must have been flushed. Returns false if a spill
+  // file could not be read or decoded.
+  bool ForEachInBucket(int bucket, const std::function<void(int64_t)> &callback) const;
+
+  // Appends all distinct indices to `result` as a single EF-coded list, like
+  // EncodeEF(), and stores their number in `count`. The spill files are read
+  // twice: once to determine the header, and once to encode the list. All
+  // writers must have been flushed. Returns false if a spill file could not be
+  // read or decoded.
+  bool EncodeAll(bytes_t &result, EFVersion version, int64_t *count) const;
+
+private:
+  // Location of a bucket's list within a spill file.
+  struct Segment {
+    int file;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Registers a new spill file and returns its number.
+  int AddFile(std::string *filename);
+
+  // Records the segments of a run that was written to spill file `file`.
+  void AddRun(int file, const std::vector<std::pair<int, Segment>> &segments, uint64_t size);
+
+  // Returns the stream used to read spill file `file`, opening it on first
+  // use. Must be called with read_mutex held.
+  std::ifstream &Reader(int file, const std::string &filename) const;
+
+  const std::string dir;
+  const int64_t bucket_size;
+  const int num_buckets;
+  const int id;
+
+  mutable std::mutex mutex;
+  std::vector<std::string> filenames;  // protected by mutex
+  std::vector<std::vector<Segment>> bucket_segments;  // protected by mutex
+
+  // Each spill file is opened for reading once, since a merge reads many
+  // small segments from every file.
+  mutable std::mutex read_mutex;
+  mutable std::vector<std::unique_ptr<std::ifstream>> readers;  // protected by read_mutex
+
+  std::atomic<int64_t> run_count = 0;
+  std::atomic<int64_t> spilled_bytes = 0;
+};
+
+// Buffers indices for a single thread. Writers are not thread-safe, but
+// different writers for the same BucketSpill can be used concurrently.
+//
+// Exits the process if the spill file cannot be written, like WriteToFile().
+class BucketSpill::Writer {
+public:
+  // `buffer_size` is the number of indices that are buffered before a run is
+  // written. It determines the memory use (8 bytes per index) and the number
+  // of runs that ReadBucket() needs to merge.
+  Writer(BucketSpill *spill, size_t buffer_size);
+
+  // Flushes the remaining indices.
+  ~Writer();
+
+  Writer(const Writer&) = delete;
+  Writer &operator=(const Writer&) = delete;
+
+  void Add(int64_t index) {
+    buffer.push_back(index);
+    if (buffer.size() == buffer_size) Flush();
+  }
+
+  // Writes the buffered indices as a run (if there are any).
+  void Flush();
+
+private:
+  BucketSpill *const spill;
+  const size_t buffer_size;
+  std::vector<int64_t> buffer;
+  int file = -1;  // opened on the first flush
+  std::string filename;
+  std::ofstream ofs;
+  uint64_t file_size = 0;
+};
+
+// Collects the distinct indices generated by the threads of a ParallelFor()
+// or ParallelForRange() on `pool`. If `spill_dir` is empty, each thread adds
+// them to its own vector, and the vectors are merged at the end. Otherwise,
+// each thread adds them to its own BucketSpill::Writer.
+//
+// Usage:
+//
+//   IndexCollector collector(pool, spill_dir, bucket_size, num_buckets, buffer_size);
+//   ParallelFor(pool, n, max_threads, [&](size_t i) {
+//     collector.WithLocal([&](const auto &add) { add(f(i)); });
+//   });
+//   collector.Encode(result, EFVersion::V1, &count);
+class IndexCollector {
+public:
+  // `buffer_size` is passed to the spill writers, and is unused if
+  // `spill_dir` is empty.
+  IndexCollector(
+      ThreadPool *pool, const std::string &spill_dir, int64_t bucket_size, int num_buckets,
+      size_t buffer_size);
+
+  // Calls func(add) where add(index) adds an index on behalf of the calling
+  // thread.
+  template<class Func>
+  void WithLocal(const Func &func) {
+    if (spill) {
+      std::optional<BucketSpill::Writer> &writer = writers.Local();
+      if (!writer) writer.emplace(&*spill, buffer_size);
+      func([&writer](int64_t index) { writer->Add(index); });
+    } else {
+      std::vector<int64_t> *v = &vectors.Local();
+      func([v](int64_t index) { v->push_back(index); });
+    }
+  }
+
+  // Appends all distinct indices to `result` as a single EF-coded list, and
+  // stores their number in `count`. Must be called once, after all threads
+  // have finished adding indices. Returns false if spilled indices could not
+  // be read back.
+  bool Encode(bytes_t &result, EFVersion version, int64_t *count);
+
+private:
+  ThreadPool *const pool;
+  const size_t buffer_size;
+  std::optional<BucketSpill> spill;
+  PerWorker<std::vector<int64_t>> vectors;
+  PerWorker<std::optional<BucketSpill::Writer>> writers;
+};
+
+#endif  // ndef BUCKET_SPILL_H_INCLUDED
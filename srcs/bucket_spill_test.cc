@@ -0,0 +1,164 @@
+#include "bucket-spill.h"
+#include "bytes.h"
+#include "dedupe.h"
+#include "efcodec.h"
+#include "macros.h"
+#include "random.h"
+#include "thread-pool.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+void TestBucketSpill() {
+  const std::filesystem::path tmp = std::filesystem::temp_directory_path() /
+      ("bucket_spill_test." + std::to_string(getpid()));
+  std::filesystem::create_directories(tmp);
+
+  const int64_t bucket_size = 1000;
+  const int num_buckets = 50;
+  const int num_writers = 4;
+  for (size_t buffer_size : {1, 7, 100, 100000}) {
+    // Each writer adds random indices with many duplicates, concentrated in a
+    // few buckets, so some buckets stay empty.
+    std::vector<std::vector<int64_t>> added(num_writers);
+    for (auto &v : added) {
+      REP(i, 5000) {
+        const int bucket = RandInt(0, 9) * 5;
+        v.push_back(bucket * bucket_size + RandInt(0, 99) * RandInt(0, 9));
+      }
+    }
+    std::vector<int64_t> expected;
+    for (const auto &v : added) expected.insert(expected.end(), v.begin(), v.end());
+    SortAndDedupe(expected);
+
+    BucketSpill spill(tmp, bucket_size, num_buckets);
+    {
+      std::vector<std::thread> threads;
+      REP(i, num_writers) {
+        threads.emplace_back([&spill, &added, buffer_size, i]() {
+          BucketSpill::Writer writer(&spill, buffer_size);
+          for (int64_t index : added[i]) writer.Add(index);
+        });
+      }
+      for (auto &thread : threads) thread.join();
+    }
+    assert(spill.RunCount() > 0);
+    assert(spill.SpilledBytes() > 0);
+    if (buffer_size >= 5000) assert(spill.RunCount() == num_writers);
+
+    std::vector<int64_t> output;
+    REP(bucket, num_buckets) {
+      const size_t old_size = output.size();
+      assert(spill.ReadBucket(bucket, output));
+      for (size_t i = old_size; i < output.size(); ++i) {
+        assert(spill.BucketOf(output[i]) == bucket);
+      }
+    }
+    assert(output == expected);
+
+    // EncodeAll() produces the same list as encoding the merged buckets.
+    bytes_t encoded = {42};
+    int64_t count = -1;
+    assert(spill.EncodeAll(encoded, EFVersion::V1, &count));
+    assert(count == static_cast<int64_t>(expected.size()));
+    assert(encoded[0] == 42);
+    assert(bytes_t(encoded.begin() + 1, encoded.end()) == EncodeEF(expected));
+
+    // Buckets can be read more than once.
+    std::vector<int64_t> first;
+    assert(spill.ReadBucket(0, first));
+    assert(std::equal(first.begin(), first.end(), expected.begin()));
+
+    // Runs written after a bucket was read are seen by later reads, although
+    // the spill files are kept open.
+    {
+      BucketSpill::Writer writer(&spill, buffer_size);
+      writer.Add(bucket_size - 1);
+    }
+    std::vector<int64_t> extended;
+    assert(spill.ReadBucket(0, extended));
+    assert(extended.back() == bucket_size - 1);
+  }
+
+  // Spill files are removed when the spill is destroyed.
+  assert(std::filesystem::is_empty(tmp));
+
+  // A spill without writers has no runs and empty buckets.
+  {
+    BucketSpill spill(tmp, bucket_size, num_buckets);
+    std::vector<int64_t> output;
+    REP(bucket, num_buckets) assert(spill.ReadBucket(bucket, output));
+    assert(output.empty());
+    assert(spill.RunCount() == 0);
+    bytes_t encoded;
+    int64_t count = -1;
+    assert(spill.EncodeAll(encoded, EFVersion::V2, &count));
+    assert(count == 0);
+    assert(encoded == EncodeEF(std::vector<int64_t>(), -1, EFVersion::V2));
+  }
+
+  std::filesystem::remove_all(tmp);
+}
+
+// Both modes of IndexCollector produce the same list, with and without a
+// thread pool.
+void TestIndexCollector() {
+  const std::filesystem::path tmp = std::filesystem::temp_directory_path() /
+      ("bucket_spill_test." + std::to_string(getpid()));
+  std::filesystem::create_directories(tmp);
+
+  const int64_t bucket_size = 1000;
+  const int num_buckets = 20;
+  std::vector<int64_t> input;
+  REP(i, 20000) input.push_back(RandInt(0, bucket_size * num_buckets - 1) / 7 * 7);
+  std::vector<int64_t> expected = input;
+  SortAndDedupe(expected);
+  const bytes_t expected_bytes = EncodeEF(expected);
+
+  ThreadPool pool(3);
+  for (ThreadPool *pool_ptr : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    for (const std::string &spill_dir : {std::string(), tmp.string()}) {
+      IndexCollector collector(pool_ptr, spill_dir, bucket_size, num_buckets, 500);
+      ParallelForRange(pool_ptr, input.size(), 4, 100, [&](size_t begin, size_t end) {
+        collector.WithLocal([&](const auto &add) {
+          for (size_t i = begin; i < end; ++i) add(input[i]);
+        });
+      });
+      bytes_t encoded;
+      int64_t count = -1;
+      assert(collector.Encode(encoded, EFVersion::V1, &count));
+      assert(count == static_cast<int64_t>(expected.size()));
+      assert(encoded == expected_bytes);
+    }
+  }
+
+  std::filesystem::remove_all(tmp);
+}
+
+}  // namespace
+
+int main() {
+  TestBucketSpill();
+  TestIndexCollector();
+}
@@ -0,0 +1,180 @@
+// Tool to build a hot tier file (see hot-tier.h) for the standalone server.
+//
+// Usage:
+//
+//   build-hot-tier [--plies=K] [--max-entries=N] <minimized.bin> <output.hot> <input>...
+//
+// Each input is a text file with one position per line. A line may be a
+// server URL or request line (the position is taken from after "perms/"), or
+// otherwise its last whitespace-separated field is parsed with ParsePerm().
+// This means the access log written by pushfight-standalone-server with
+// --access-log can be used directly, as well as a plain list of positions,
+// e.g. the openings of interest. Lines that cannot be parsed are skipped.
+//
+// Note that results/minimized-samples.txt lists bare minimized indices, which
+// ParsePerm() interprets as permutation indices, so prefix them with a '+'
+// first (e.g. cut -f3 results/minimized-samples.txt | sed 's/^/+/').
+//
+// A lookup of a position reads the values of its successors, and a detailed
+// lookup also reads the values of the successors of those. So for each input
+// position, the positions reachable within 1 to K plies (default: 1; use 2 for
+// detailed lookups) are added to the hot tier, weighted by how often the input
+// position occurs. If there are more than N such positions, only the N with
+// the highest weight are kept.
+//
+// The values are read from <minimized.bin>, which can be in any format
+// supported by MinimizedAccessor.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "board.h"
+#include "flags.h"
+#include "hot-tier.h"
+#include "minimized-accessor.h"
+#include "parse-int.h"
+#include "parse-perm.h"
+#include "perms.h"
+#include "search.h"
+
+namespace {
+
+void PrintUsage() {
+  std::cerr <<
+      "Usage: build-hot-tier [--plies=K] [--max-entries=N] <minimized.bin> <output.hot> <input>...\n";
+}
+
+// Extracts the position string from a line of an input file. Returns an
+// empty string if there is none.
+std::string ExtractPosition(const std::string &line) {
+  static const std::string perms_prefix = "perms/";
+  if (size_t i = line.find(perms_prefix); i != std::string::npos) {
+    i += perms_prefix.size();
+    size_t j = line.find_first_of("?#/ \t\r\"", i);
+    return line.substr(i, j == std::string::npos ? std::string::npos : j - i);
+  }
+  std::istringstream iss(line);
+  std::string field, last;
+  while (iss >> field) last = std::move(field);
+  return last;
+}
+
+// Reads all positions from the input file, and adds them to `counts`.
+// Returns false if the file could not be read.
+bool ReadPositions(const char *filename, std::map<Perm, int64_t> &counts, int64_t *skipped) {
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::string s = ExtractPosition(line);
+    if (s.empty()) continue;
+    std::optional<Perm> perm = ParsePerm(s);
+    if (!perm) {
+      ++*skipped;
+      continue;
+    }
+    PermType type = ValidatePerm(*perm);
+    if (type == PermType::STARTED || (type == PermType::IN_PROGRESS && IsReachable(*perm))) {
+      ++counts[*perm];
+    } else {
+      ++*skipped;
+    }
+  }
+  return true;
+}
+
+// Adds `weight` to the minimized indices of all positions reachable from
+// `start` in 1 to `plies` plies. Each position is counted at most once per
+// start position.
+void AddSuccessors(const Perm &start, int plies, int64_t weight,
+    std::unordered_map<int64_t, int64_t> &weights) {
+  std::unordered_set<int64_t> seen;
+  std::vector<Perm> frontier = {start};
+  for (int ply = 1; ply <= plies && !frontier.empty(); ++ply) {
+    std::vector<Perm> next;
+    for (const Perm &perm : frontier) {
+      for (const auto &[moves, state] : GenerateAllSuccessors(perm)) {
+        if (state.outcome != TIE) continue;
+        int64_t min_index = MinIndexOf(state.perm);
+        if (!seen.insert(min_index).second) continue;
+        weights[min_index] += weight;
+        if (ply < plies) next.push_back(state.perm);
+      }
+    }
+    frontier = std::move(next);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string arg_plies = "1";
+  std::string arg_max_entries = "10000000";
+  std::map<std::string, Flag> flags = {
+    // Number of plies to expand from each input position.
+    {"plies", Flag::optional(arg_plies)},
+    // Maximum number of entries in the hot tier (each takes 9 bytes).
+    {"max-entries", Flag::optional(arg_max_entries)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc < 4) {
+    PrintUsage();
+    return 1;
+  }
+  const int plies = ParseInt(arg_plies.c_str());
+  if (plies < 1) {
+    std::cerr << "Invalid number of plies: " << arg_plies << std::endl;
+    return 1;
+  }
+  const int64_t max_entries = ParseInt64(arg_max_entries.c_str());
+  if (max_entries < 0) {
+    std::cerr << "Invalid maximum number of entries: " << arg_max_entries << std::endl;
+    return 1;
+  }
+  const char *minimized_filename = argv[1];
+  const char *output_filename = argv[2];
+
+  std::map<Perm, int64_t> counts;
+  int64_t skipped = 0;
+  for (int i = 3; i < argc; ++i) {
+    if (!ReadPositions(argv[i], counts, &skipped)) return 1;
+  }
+  std::cerr << "Read " << counts.size() << " distinct positions";
+  if (skipped > 0) std::cerr << " (skipped " << skipped << " invalid lines)";
+  std::cerr << "." << std::endl;
+
+  std::unordered_map<int64_t, int64_t> weights;
+  for (const auto &[perm, count] : counts) AddSuccessors(perm, plies, count, weights);
+
+  // Keep the entries with the highest weights (breaking ties by index, so the
+  // result is deterministic).
+  std::vector<std::pair<int64_t, int64_t>> entries;  // (-weight, min_index)
+  entries.reserve(weights.size());
+  for (const auto &[min_index, weight] : weights) entries.push_back({-weight, min_index});
+  if (entries.size() > static_cast<size_t>(max_entries)) {
+    std::nth_element(entries.begin(), entries.begin() + max_entries, entries.end());
+    entries.resize(max_entries);
+  }
+  std::vector<int64_t> offsets;
+  offsets.reserve(entries.size());
+  for (const auto &entry : entries) offsets.push_back(entry.second);
+  std::sort(offsets.begin(), offsets.end());
+
+  std::cerr << "Reading " << offsets.size() << " values from " << minimized_filename << "..." << std::endl;
+  MinimizedAccessor acc(minimized_filename);
+  std::vector<uint8_t> values = acc.ReadBytes(offsets);
+
+  if (!HotTier::Write(output_filename, offsets, values, min_index_size)) return 1;
+  std::cerr << "Wrote " << offsets.size() << " entries to " << output_filename << "." << std::endl;
+}
@@ -1,22 +1,79 @@
 #include "codec.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
 #include "board.h"
 #include "macros.h"
+#include "ternary.h"
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little);
+
+// Multiplying a little-endian word containing 5 ternary digits d[0..4] (one
+// per byte) by this constant yields d[0] + d[1]*3 + d[2]*9 + d[3]*27 + d[4]*81
+// in byte 4 of the product. Since every partial sum in bytes 0 through 4 is at
+// most 2*(1 + 3 + 9 + 27 + 81) = 242, no carries propagate between bytes, so
+// the result is exact.
+constexpr uint64_t encode_multiplier =
+    uint64_t{81} | (uint64_t{27} << 8) | (uint64_t{9} << 16) | (uint64_t{3} << 24) | (uint64_t{1} << 32);
+
+constexpr uint64_t low_five_bytes = (uint64_t{1} << 40) - 1;
+
+uint8_t EncodeFive(uint64_t word) {
+  return ((word & low_five_bytes) * encode_multiplier) >> 32;
+}
+
+// decode_words[byte] contains the 5 decoded ternary digits of byte in the low
+// 5 bytes (least significant digit first), so that a single 8-byte store
+// writes 5 Outcome values at once.
+const std::array<uint64_t, 256> decode_words = []() {
+  std::array<uint64_t, 256> words = {};
+  REP(byte, 256) REP(i, 5) words[byte] |= uint64_t{ternary_decode_table[byte][i]} << (8 * i);
+  return words;
+}();
+
+// count_words[byte] contains the number of ties, losses and wins encoded in
+// byte, in 21-bit fields at bit offsets 0, 21 and 42 respectively. Invalid
+// bytes (243 and up) count as nothing, which CountOutcomes() uses to detect
+// them.
+constexpr int count_bits = 21;
+constexpr uint64_t count_mask = (uint64_t{1} << count_bits) - 1;
+
+// Maximum number of bytes that can be accumulated before one of the 21-bit
+// fields could overflow.
+constexpr size_t count_flush_interval = count_mask / 5;
+
+const std::array<uint64_t, 256> count_words = []() {
+  std::array<uint64_t, 256> words = {};
+  for (int byte = 0; byte < 243; ++byte) {
+    REP(i, 5) words[byte] += uint64_t{1} << (count_bits * ternary_decode_table[byte][i]);
+  }
+  return words;
+}();
+
+}  // namespace
 
 void EncodeOutcomes(const Outcome *outcomes, uint8_t *bytes, size_t bytes_size) {
-  while (bytes_size-- > 0) {
-    *bytes++ =
-        outcomes[0] +
-        outcomes[1]*3 +
-        outcomes[2]*3*3 +
-        outcomes[3]*3*3*3 +
-        outcomes[4]*3*3*3*3;
+  static_assert(sizeof(Outcome) == 1);
+  if (bytes_size == 0) return;
+  // Load 8 values at a time, of which only the first 5 are used. The last
+  // group is loaded separately, to avoid reading past the end of the input.
+  uint64_t word;
+  for (size_t n = bytes_size - 1; n > 0; --n) {
+    memcpy(&word, outcomes, 8);
+    *bytes++ = EncodeFive(word);
     outcomes += 5;
   }
+  word = 0;
+  memcpy(&word, outcomes, 5);
+  *bytes = EncodeFive(word);
 }
 
 void EncodeOutcomes(const std::vector<Outcome> &outcomes, std::vector<uint8_t> &bytes) {
@@ -34,13 +91,15 @@ std::vector<uint8_t> EncodeOutcomes(const std::vector<Outcome> &outcomes) {
 }
 
 void DecodeOutcomes(const uint8_t *bytes, size_t bytes_size, Outcome *outcomes) {
-  while (bytes_size-- > 0) {
-    uint8_t byte = *bytes++;
-    REP(_, 5) {
-      *outcomes++ = static_cast<Outcome>(byte % 3);
-      byte /= 3;
-    }
+  if (bytes_size == 0) return;
+  // Store 8 values at a time, of which the last 3 are overwritten by the next
+  // iteration. The last group is stored separately, to avoid writing past the
+  // end of the output.
+  for (size_t n = bytes_size - 1; n > 0; --n) {
+    memcpy(outcomes, &decode_words[*bytes++], 8);
+    outcomes += 5;
   }
+  memcpy(outcomes, &decode_words[*bytes], 5);
 }
 
 void DecodeOutcomes(const std::vector<uint8_t> &bytes, std::vector<Outcome> &outcomes) {
@@ -54,3 +113,108 @@ std::vector<Outcome> DecodeOutcomes(const std::vector<uint8_t> &bytes) {
   DecodeOutcomes(bytes, outcomes);
   return outcomes;
 }
+
+bool CountOutcomes(const uint8_t *bytes, size_t bytes_size, int64_t counts[3]) {
+  const int64_t expected_total = 5 * static_cast<int64_t>(bytes_size);
+  int64_t total = 0;
+  while (bytes_size > 0) {
+    size_t n = std::min(bytes_size, count_flush_interval);
+    uint64_t acc = 0;
+    REP(i, n) acc += count_words[bytes[i]];
+    int64_t ties   = acc & count_mask;
+    int64_t losses = (acc >> count_bits) & count_mask;
+    int64_t wins   = (acc >> (2 * count_bits)) & count_mask;
+    counts[TIE]  += ties;
+    counts[LOSS] += losses;
+    counts[WIN]  += wins;
+    total += ties + losses + wins;
+    bytes += n;
+    bytes_size -= n;
+  }
+  return total == expected_total;
+}
+
+void EncodeOutcomesTwoBit(const Outcome *outcomes, size_t count, uint64_t *words) {
+  for (; count >= 32; count -= 32) {
+    uint64_t word = 0;
+    REP(i, 32) word |= uint64_t(outcomes[i]) << (2 * i);
+    *words++ = word;
+    outcomes += 32;
+  }
+  if (count > 0) {
+    uint64_t word = 0;
+    REP(i, count) word |= uint64_t(outcomes[i]) << (2 * i);
+    *words = word;
+  }
+}
+
+void DecodeOutcomesTwoBit(const uint64_t *words, size_t count, Outcome *outcomes) {
+  for (; count >= 32; count -= 32) {
+    uint64_t word = *words++;
+    REP(i, 32) outcomes[i] = static_cast<Outcome>((word >> (2 * i)) & 3);
+    outcomes += 32;
+  }
+  if (count > 0) {
+    uint64_t word = *words;
+    REP(i, count) outcomes[i] = static_cast<Outcome>((word >> (2 * i)) & 3);
+  }
+}
+
+namespace {
+
+// Number of bytes of ternary data converted at once. This must be a multiple
+// of 32, so that each block of outcomes fills a whole number of 64-bit words.
+constexpr size_t conversion_block_bytes = 1 << 20;
+constexpr size_t conversion_block_values = 5 * conversion_block_bytes;
+constexpr size_t conversion_block_words = conversion_block_values / 32;
+static_assert(conversion_block_values % 32 == 0);
+
+bool ReadExactly(std::istream &is, void *data, size_t size) {
+  if (!is.read(reinterpret_cast<char*>(data), size)) {
+    std::cerr << "Conversion failed: input is too short!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool WriteExactly(std::ostream &os, const void *data, size_t size) {
+  if (!os.write(reinterpret_cast<const char*>(data), size)) {
+    std::cerr << "Conversion failed: write failed!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool ConvertTernaryToTwoBit(std::istream &is, std::ostream &os, int64_t count) {
+  assert(count % 5 == 0);
+  std::vector<uint8_t> bytes(conversion_block_bytes);
+  std::vector<Outcome> outcomes(conversion_block_values);
+  std::vector<uint64_t> words(conversion_block_words);
+  while (count > 0) {
+    size_t n = std::min<int64_t>(count, conversion_block_values);
+    if (!ReadExactly(is, bytes.data(), n / 5)) return false;
+    DecodeOutcomes(bytes.data(), n / 5, outcomes.data());
+    EncodeOutcomesTwoBit(outcomes.data(), n, words.data());
+    if (!WriteExactly(os, words.data(), TwoBitWordCount(n) * sizeof(uint64_t))) return false;
+    count -= n;
+  }
+  return true;
+}
+
+bool ConvertTwoBitToTernary(std::istream &is, std::ostream &os, int64_t count) {
+  assert(count % 5 == 0);
+  std::vector<uint64_t> words(conversion_block_words);
+  std::vector<Outcome> outcomes(conversion_block_values);
+  std::vector<uint8_t> bytes(conversion_block_bytes);
+  while (count > 0) {
+    size_t n = std::min<int64_t>(count, conversion_block_values);
+    if (!ReadExactly(is, words.data(), TwoBitWordCount(n) * sizeof(uint64_t))) return false;
+    DecodeOutcomesTwoBit(words.data(), n, outcomes.data());
+    EncodeOutcomes(outcomes.data(), bytes.data(), n / 5);
+    if (!WriteExactly(os, bytes.data(), n / 5)) return false;
+    count -= n;
+  }
+  return true;
+}
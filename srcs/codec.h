@@ -8,6 +8,7 @@
 #include <iostream>
 
 #include "board.h"
+#include "two-bit.h"
 
 // Encodes `outcomes` into `bytes`.
 //
@@ -42,6 +43,30 @@ void DecodeOutcomes(const std::vector<uint8_t> &bytes, std::vector<Outcome> &out
 // Version of the above that returns outcomes in a new given vector.
 std::vector<Outcome> DecodeOutcomes(const std::vector<uint8_t> &bytes);
 
+// Encodes `count` outcomes into TwoBitWordCount(count) words, using the 2-bit
+// encoding described in two-bit.h. The last word is padded with TIE values.
+void EncodeOutcomesTwoBit(const Outcome *outcomes, size_t count, uint64_t *words);
+
+// Decodes the first `count` outcomes stored in `words` (in the 2-bit encoding)
+// into `outcomes`.
+void DecodeOutcomesTwoBit(const uint64_t *words, size_t count, Outcome *outcomes);
+
+// Converts a stream of `count` outcomes from the ternary encoding to the 2-bit
+// encoding, or vice versa. Count must be a multiple of 5.
+//
+// These read exactly as many bytes as needed, and return false (after printing
+// an error message) if the input is too short or the output can't be written.
+bool ConvertTernaryToTwoBit(std::istream &is, std::ostream &os, int64_t count);
+bool ConvertTwoBitToTernary(std::istream &is, std::ostream &os, int64_t count);
+
+// Adds the number of TIE, LOSS and WIN values encoded in `bytes` to
+// counts[TIE], counts[LOSS] and counts[WIN], respectively.
+//
+// This is much faster than decoding the bytes and counting the outcomes.
+// Returns false if any of the bytes is not a valid encoding (i.e., 243 or
+// greater), in which case the counts are incomplete.
+bool CountOutcomes(const uint8_t *bytes, size_t bytes_size, int64_t counts[3]);
+
 class TernaryReader {
 public:
   // Note this is the buffer size in bytes. The number of outcomes will be five
@@ -0,0 +1,145 @@
+// Tool to convert minimized.bin into one of the formats that support faster
+// random access than the XZ compressed format (see "Compressed file formats"
+// in NOTES.txt):
+//
+//   --format=huff: Huffman-coded blocks, described in huffman-accessor.h.
+//   --format=w1: bitmap of WinIn(1) values plus the remaining values,
+//       described in w1-bitmap-accessor.h.
+//
+// Usage:
+//
+//   compress-minimized [--block-size=65536] [--threads=N] minimized.bin minimized.bin.huff
+//
+//   compress-minimized --format=w1 [--threads=N] minimized.bin minimized.bin.w1
+//
+// After the output is written, it is decompressed again and compared with
+// the input, so a successful exit means the output file is valid.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "accessors.h"
+#include "flags.h"
+#include "huffman-accessor.h"
+#include "parse-int.h"
+#include "position-value.h"
+#include "thread-pool.h"
+#include "w1-bitmap-accessor.h"
+
+namespace {
+
+const std::string default_format = "huff";
+const std::string default_block_size = "65536";
+const std::string default_threads = std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+
+// Decompresses the entire file and compares it with the original data, in
+// blocks of the given size. Returns the number of blocks that differ.
+template<class Accessor>
+int64_t CompareWithInput(
+    const Accessor &acc, const uint8_t *data, size_t size,
+    int64_t block_size, ThreadPool *pool, int max_threads) {
+  const int64_t num_blocks = (size + block_size - 1) / block_size;
+  std::atomic<int64_t> mismatches = 0;
+  ParallelFor(pool, num_blocks, max_threads, [&](size_t block) {
+    const int64_t begin = block * block_size;
+    const int64_t end = std::min<int64_t>(begin + block_size, size);
+    std::vector<int64_t> offsets(end - begin);
+    std::iota(offsets.begin(), offsets.end(), begin);
+    std::vector<uint8_t> bytes = acc.ReadBytes(offsets);
+    if (!std::equal(bytes.begin(), bytes.end(), data + begin)) {
+      std::cerr << "Block " << block << " differs from the input!" << std::endl;
+      ++mismatches;
+    }
+  });
+  return mismatches;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string arg_format = default_format;
+  std::string arg_block_size = default_block_size;
+  std::string arg_threads = default_threads;
+  std::map<std::string, Flag> flags = {
+    // Output format: "huff" or "w1" (see above).
+    {"format", Flag::optional(arg_format)},
+    // Uncompressed size of blocks (at most 2^20) for the "huff" format.
+    // Smaller blocks make random access faster, at the cost of a larger index.
+    {"block-size", Flag::optional(arg_block_size)},
+    // Number of threads used to compress and verify blocks.
+    {"threads", Flag::optional(arg_threads)},
+  };
+
+  if (!ParseFlags(argc, argv, flags) || argc != 3) {
+    std::cerr << "Usage: compress-minimized [--format=huff|w1] [--block-size=" << default_block_size << "] "
+        "[--threads=" << default_threads << "] <minimized.bin> <output>" << std::endl;
+    return 1;
+  }
+
+  if (arg_format != "huff" && arg_format != "w1") {
+    std::cerr << "Invalid --format: " << arg_format << std::endl;
+    return 1;
+  }
+  const int block_size = ParseInt(arg_block_size.c_str());
+  if (block_size <= 0 || uint32_t(block_size) > HuffmanAccessor::max_block_size) {
+    std::cerr << "Invalid --block-size: " << arg_block_size << std::endl;
+    return 1;
+  }
+  const int threads = ParseInt(arg_threads.c_str());
+  if (threads < 1) {
+    std::cerr << "Invalid --threads: " << arg_threads << std::endl;
+    return 1;
+  }
+
+  const char *input_filename = argv[1];
+  const char *output_filename = argv[2];
+  if (!std::filesystem::is_regular_file(input_filename)) {
+    std::cerr << "Input file " << input_filename << " does not exist." << std::endl;
+    return 1;
+  }
+  if (std::filesystem::exists(output_filename)) {
+    std::cerr << "Output file " << output_filename << " already exists." << std::endl;
+    return 1;
+  }
+
+  std::optional<ThreadPool> pool;
+  if (threads > 1) pool.emplace(threads - 1);
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+
+  DynMappedFile<uint8_t> input(input_filename);
+  std::cerr << "Converting " << input.size() << " bytes..." << std::endl;
+  const bool success = arg_format == "huff" ?
+      WriteHuffmanFile(input.data(), input.size(), block_size, output_filename, pool_ptr) :
+      WriteW1BitmapFile(input.data(), input.size(), Value::WinIn(1).byte, output_filename, pool_ptr);
+  if (!success) return 1;
+  const uintmax_t output_size = std::filesystem::file_size(output_filename);
+  std::cerr << "Wrote " << output_size << " bytes ("
+      << 100.0 * output_size / std::max<size_t>(input.size(), 1) << "% of input)." << std::endl;
+
+  std::cerr << "Verifying..." << std::endl;
+  bool verified = false;
+  if (arg_format == "huff") {
+    HuffmanAccessor acc(output_filename);
+    verified = acc.GetUncompressedFileSize() == int64_t(input.size()) &&
+        acc.VerifyAllBlocks() == 0 &&
+        CompareWithInput(acc, input.data(), input.size(), block_size, pool_ptr, threads) == 0;
+  } else {
+    W1BitmapAccessor acc(output_filename);
+    verified = acc.GetUncompressedFileSize() == int64_t(input.size()) &&
+        CompareWithInput(acc, input.data(), input.size(), block_size, pool_ptr, threads) == 0;
+  }
+  if (!verified) {
+    std::cerr << "Verification failed!" << std::endl;
+    return 1;
+  }
+  std::cerr << "Verification succeeded." << std::endl;
+}
@@ -0,0 +1,90 @@
+// Tool to convert phase output files (rN.bin) between the ternary format
+// (5 values per byte, 80 GB) and the 2-bit format (32 values per 64-bit word,
+// 100 GB). See RnAccessor and TwoBitRnAccessor in accessors.h.
+//
+// Usage:
+//
+//   convert-two-bit to-2bit r4.bin r4.2bit
+//   convert-two-bit to-ternary r4.2bit r4.bin
+//
+// Both the full phase files and single chunk files are supported; the number
+// of values is determined from the size of the input file. Conversion is
+// streaming, so it requires very little memory.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "chunks.h"
+#include "codec.h"
+#include "perms.h"
+#include "two-bit.h"
+
+namespace {
+
+void PrintUsage() {
+  std::cout << "Usage:\n\n"
+    << "  convert-two-bit to-2bit <input.bin> <output.2bit>\n"
+    << "  convert-two-bit to-ternary <input.2bit> <output.bin>\n"
+    << std::endl;
+}
+
+// Returns the number of values stored in a 2-bit file of the given size, or
+// -1 if the size doesn't correspond to a full phase file or a chunk file.
+int64_t TwoBitValueCount(uintmax_t filesize) {
+  for (int64_t count : {int64_t{total_perms}, int64_t{chunk_size}}) {
+    if (filesize == TwoBitWordCount(count) * sizeof(uint64_t)) return count;
+  }
+  return -1;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 4) {
+    PrintUsage();
+    return 1;
+  }
+  const std::string mode = argv[1];
+  const char *input_filename = argv[2];
+  const char *output_filename = argv[3];
+
+  if (mode != "to-2bit" && mode != "to-ternary") {
+    std::cerr << "Invalid mode: " << mode << "\n\n";
+    PrintUsage();
+    return 1;
+  }
+
+  if (!std::filesystem::exists(input_filename)) {
+    std::cerr << "Input file " << input_filename << " does not exist." << std::endl;
+    return 1;
+  }
+  if (std::filesystem::exists(output_filename)) {
+    std::cerr << "Output file " << output_filename << " already exists." << std::endl;
+    return 1;
+  }
+
+  const uintmax_t input_size = std::filesystem::file_size(input_filename);
+  const int64_t count = mode == "to-2bit" ? input_size * 5 : TwoBitValueCount(input_size);
+  if (count < 0) {
+    std::cerr << "Unexpected size of 2-bit input file: " << input_size << " bytes." << std::endl;
+    return 1;
+  }
+
+  std::ifstream ifs(input_filename, std::ifstream::binary);
+  std::ofstream ofs(output_filename, std::ofstream::binary);
+  if (!ifs || !ofs) {
+    std::cerr << "Could not open files." << std::endl;
+    return 1;
+  }
+  bool success = mode == "to-2bit" ?
+      ConvertTernaryToTwoBit(ifs, ofs, count) :
+      ConvertTwoBitToTernary(ifs, ofs, count);
+  if (!success || !ofs.flush()) {
+    std::cerr << "Conversion failed!" << std::endl;
+    return 1;
+  }
+  std::cerr << "Converted " << count << " values." << std::endl;
+}
@@ -2,7 +2,9 @@
 
 #include "board.h"
 #include "chunks.h"
+#include "codec.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <iostream>
@@ -31,25 +33,25 @@ int main(int argc, char* argv[]) {
   PrintHeader();
   int64_t counts[3] = {0, 0, 0};
   int64_t chunk_counts[3] = {0, 0, 0};
-  int chunk_pos = 0;
+  size_t chunk_pos = 0;
   int chunk_index = 0;
   for (int i = 1; i < argc; ++i) {
     std::ifstream ifs(argv[i], std::ifstream::binary);
     while (ifs) {
       uint8_t buffer[409600];
       ifs.read(reinterpret_cast<char*>(&buffer), sizeof(buffer));
-      for (int n = ifs.gcount(), j = 0; j < n; ++j) {
-        uint8_t byte = buffer[j];
-        REP(_, 5) {
-          int i = byte % 3;
-          byte /= 3;
-          ++counts[i];
-          ++chunk_counts[i];
-        }
-        assert(byte == 0);
-        if (++chunk_pos == chunk_size / 5) {
+      for (size_t n = ifs.gcount(), j = 0; j < n; ) {
+        // Count bytes up to the end of the buffer or the end of the chunk,
+        // whichever comes first.
+        size_t m = std::min(n - j, chunk_size / 5 - chunk_pos);
+        bool valid = CountOutcomes(buffer + j, m, chunk_counts);
+        assert(valid);
+        j += m;
+        chunk_pos += m;
+        if (chunk_pos == chunk_size / 5) {
           // Print chunk summary, and reset counts.
           PrintRow(chunk_index, chunk_counts);
+          REP(k, 3) counts[k] += chunk_counts[k];
           chunk_counts[0] = chunk_counts[1] = chunk_counts[2] = 0;
           chunk_pos = 0;
           ++chunk_index;
@@ -58,5 +60,6 @@ int main(int argc, char* argv[]) {
     }
     assert(ifs.eof() && !ifs.bad());
   }
+  REP(k, 3) counts[k] += chunk_counts[k];
   PrintRow(-1, counts);
 }
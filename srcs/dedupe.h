@@ -4,10 +4,31 @@
 #include <algorithm>
 #include <vector>
 
+#include "thread-pool.h"
+
 template<class T>
 void SortAndDedupe(std::vector<T> &v) {
   std::sort(v.begin(), v.end());
   v.erase(std::unique(v.begin(), v.end()), v.end());
 }
 
+// Appends the values collected by all threads to `output`, which is sorted and
+// deduplicated afterwards. Each thread's values are deduplicated in parallel
+// first, so that less data is left for the final merge. The per-thread
+// vectors are emptied.
+template<class T>
+void MergeAndDedupe(PerWorker<std::vector<T>> &per_worker, ThreadPool *pool, std::vector<T> &output) {
+  {
+    TaskGroup group(pool);
+    per_worker.ForEach([&group](std::vector<T> &v) {
+      group.Run([&v]() { SortAndDedupe(v); });
+    });
+  }
+  per_worker.ForEach([&output](std::vector<T> &v) {
+    output.insert(output.end(), v.begin(), v.end());
+    std::vector<T>().swap(v);
+  });
+  SortAndDedupe(output);
+}
+
 #endif  // ndef DEDUPE_H_INCLUDED
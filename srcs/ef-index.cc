@@ -0,0 +1,367 @@
+#include "ef-index.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "efcodec.h"
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little);
+
+constexpr char magic[8] = {'P', 'F', 'E', 'F', 'I', 'X', '1', '\n'};
+
+struct Header {
+  char magic[8];
+  uint64_t data_size;
+  int64_t data_mtime;
+  uint64_t num_parts;
+  uint64_t num_samples;
+  uint32_t sample_interval;
+  uint8_t reserved[20];
+};
+static_assert(sizeof(Header) == 64);
+
+static_assert(sizeof(EFSample) == 16);
+
+// Number of bits returned by BitCursor::Peek() that are guaranteed to be valid.
+constexpr int peek_bits = 57;
+
+uint32_t ReverseBits32(uint32_t x) {
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+  return __builtin_bswap32(x);
+}
+
+// Reads the bit stream written by BitEncoder in efcodec.cc, which stores bits
+// starting from the least significant bit of each byte. Unlike BitDecoder, it
+// can start reading at an arbitrary bit offset.
+class BitCursor {
+public:
+  BitCursor(const uint8_t *begin, const uint8_t *end, uint64_t pos)
+    : begin(begin), bit_size((end - begin) * uint64_t{8}), pos(pos) {}
+
+  uint64_t Position() const { return pos; }
+
+  // Returns whether the cursor has moved past the end of the stream.
+  bool Overrun() const { return pos > bit_size; }
+
+  // Reads `num_bits` bits (between 0 and 63) as a number, with the least
+  // significant bit first (version 2 streams).
+  uint64_t ReadBits(int num_bits) {
+    if (num_bits > 56) {
+      const uint64_t lo = ReadBits(32);
+      return lo | (ReadBits(num_bits - 32) << 32);
+    }
+    const uint64_t value = Peek() & ((uint64_t{1} << num_bits) - 1);
+    pos += num_bits;
+    return value;
+  }
+
+  // Reads `num_bits` bits (between 0 and 63) as a number, with the most
+  // significant bit first (version 1 streams).
+  uint64_t ReadReversedBits(int num_bits) {
+    uint64_t value = 0;
+    while (num_bits > 0) {
+      const int n = std::min(num_bits, 32);
+      const uint32_t bits = Peek() & ((uint64_t{1} << n) - 1);
+      value = (value << n) | (ReverseBits32(bits) >> (32 - n));
+      pos += n;
+      num_bits -= n;
+    }
+    return value;
+  }
+
+  // Reads a number in unary: zero bits terminated by a one bit.
+  uint64_t ReadUnaryNumber() {
+    uint64_t value = 0;
+    for (;;) {
+      if (pos >= bit_size) {
+        pos = bit_size + 1;  // mark as overrun
+        return value;
+      }
+      const uint64_t word = Peek() & ((uint64_t{1} << peek_bits) - 1);
+      if (word != 0) {
+        const int zeros = std::countr_zero(word);
+        pos += zeros + 1;
+        return value + zeros;
+      }
+      pos += peek_bits;
+      value += peek_bits;
+    }
+  }
+
+private:
+  // Returns the next bits in stream order (bit i of the result is the i-th
+  // next bit). At least `peek_bits` bits are valid; bits past the end of the
+  // stream are zero.
+  uint64_t Peek() const {
+    const uint64_t byte_pos = pos / 8;
+    const uint64_t byte_size = bit_size / 8;
+    uint64_t word = 0;
+    if (byte_pos + 8 <= byte_size) {
+      memcpy(&word, begin + byte_pos, 8);
+    } else if (byte_pos < byte_size) {
+      memcpy(&word, begin + byte_pos, byte_size - byte_pos);
+    }
+    return word >> (pos % 8);
+  }
+
+  const uint8_t *begin;
+  uint64_t bit_size;
+  uint64_t pos;
+};
+
+// Parses a variable-length integer as written by AppendVarInt() in
+// efcodec.cc. Returns false if the input is truncated or invalid.
+bool ParseVarInt(const uint8_t *&p, const uint8_t *end, int64_t *result) {
+  int64_t value = 0;
+  for (int shift = 0; shift <= 56 && p < end; shift += 7) {
+    const uint8_t byte = *p++;
+    value |= int64_t{byte & 0x7f} << shift;
+    if ((byte & 0x80) == 0) {
+      *result = value;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Parsed header of an encoded list.
+struct ListHeader {
+  int64_t count = 0;
+  int64_t first = 0;
+  int k = 0;
+  bool v2 = false;  // see EFVersion
+  const uint8_t *stream = nullptr;  // start of the bit stream
+};
+
+bool ParseListHeader(const uint8_t *p, const uint8_t *end, ListHeader *header) {
+  if (!ParseVarInt(p, end, &header->count)) return false;
+  if (header->count > 0 && !ParseVarInt(p, end, &header->first)) return false;
+  if (header->count > 1) {
+    if (p == end) return false;
+    header->v2 = *p & ef_v2_flag;
+    header->k = *p++ & ~ef_v2_flag;
+    if (header->k > 63) return false;
+  }
+  header->stream = p;
+  return true;
+}
+
+uint64_t ReadLowerBits(BitCursor &cursor, int k, bool v2) {
+  return v2 ? cursor.ReadBits(k) : cursor.ReadReversedBits(k);
+}
+
+int64_t ReadDelta(BitCursor &cursor, int k, bool v2) {
+  const uint64_t lower = ReadLowerBits(cursor, k, v2);
+  const uint64_t upper = cursor.ReadUnaryNumber();
+  return lower | (upper << k);
+}
+
+// Indexes the list that starts at data[*pos], and advances *pos past it.
+bool IndexPart(
+    const uint8_t *data, size_t size, size_t *pos, int sample_interval,
+    std::vector<EFSample> *samples) {
+  const uint8_t *end = data + size;
+  ListHeader header;
+  if (!ParseListHeader(data + *pos, end, &header)) return false;
+  if (header.count == 0) {
+    *pos = header.stream - data;
+    return true;
+  }
+  samples->push_back(EFSample{0, header.first});
+  BitCursor cursor(header.stream, end, 0);
+  int64_t value = header.first;
+  for (int64_t i = 1; i < header.count; ++i) {
+    const uint64_t lower = ReadLowerBits(cursor, header.k, header.v2);
+    const uint64_t upper = cursor.ReadUnaryNumber();
+    if (cursor.Overrun()) return false;
+    if (upper > (uint64_t(std::numeric_limits<int64_t>::max()) >> header.k)) return false;
+    const int64_t delta = lower | (upper << header.k);
+    if (value > std::numeric_limits<int64_t>::max() - delta) return false;
+    value += delta;
+    if (i % sample_interval == 0) samples->push_back(EFSample{cursor.Position(), value});
+  }
+  *pos = (header.stream - data) + (cursor.Position() + 7) / 8;
+  return true;
+}
+
+int64_t FileModificationTime(const char *filename) {
+  return std::filesystem::last_write_time(filename).time_since_epoch().count();
+}
+
+}  // namespace
+
+EFListReader::EFListReader(byte_span_t bytes, const EFSample *samples, int sample_interval)
+  : samples(samples), sample_interval(sample_interval) {
+  ListHeader header;
+  [[maybe_unused]] bool success = ParseListHeader(bytes.data(), bytes.data() + bytes.size(), &header);
+  assert(success);
+  count = header.count;
+  k = header.k;
+  v2 = header.v2;
+  stream_begin = header.stream;
+  stream_end = bytes.data() + bytes.size();
+  assert(count == 0 || samples[0].value == header.first);
+}
+
+int64_t EFListReader::Get(size_t i) const {
+  assert(i < count);
+  const EFSample &sample = samples[i / sample_interval];
+  int64_t value = sample.value;
+  if (size_t n = i % sample_interval; n > 0) {
+    BitCursor cursor(stream_begin, stream_end, sample.bit_offset);
+    while (n-- > 0) value += ReadDelta(cursor, k, v2);
+  }
+  return value;
+}
+
+void EFListReader::Decode(size_t begin, size_t end, int64_t *output) const {
+  assert(begin <= end && end <= count);
+  if (begin == end) return;
+  const EFSample &sample = samples[begin / sample_interval];
+  int64_t value = sample.value;
+  BitCursor cursor(stream_begin, stream_end, sample.bit_offset);
+  for (size_t n = begin % sample_interval; n > 0; --n) value += ReadDelta(cursor, k, v2);
+  *output++ = value;
+  for (size_t i = begin + 1; i < end; ++i) {
+    value += ReadDelta(cursor, k, v2);
+    *output++ = value;
+  }
+}
+
+std::pair<size_t, int64_t> EFListReader::Find(int64_t x) const {
+  if (count == 0) return {0, 0};
+  const size_t num_samples = (count - 1) / sample_interval + 1;
+  // Find the last sample less than x, and search forward from there.
+  const size_t j = std::partition_point(samples, samples + num_samples,
+      [x](const EFSample &s) { return s.value < x; }) - samples;
+  if (j == 0) return {0, samples[0].value};
+  size_t i = (j - 1) * sample_interval;
+  int64_t value = samples[j - 1].value;
+  BitCursor cursor(stream_begin, stream_end, samples[j - 1].bit_offset);
+  while (++i < count) {
+    value += ReadDelta(cursor, k, v2);
+    if (value >= x) return {i, value};
+  }
+  return {count, 0};
+}
+
+size_t EFListReader::LowerBound(int64_t x) const {
+  return Find(x).first;
+}
+
+std::optional<int64_t> EFListReader::NextGEQ(int64_t x) const {
+  auto [i, value] = Find(x);
+  if (i == count) return {};
+  return value;
+}
+
+std::vector<int64_t> EFListReader::DecodeAll() const {
+  std::vector<int64_t> result(count);
+  if (count == 0) return result;
+  result[0] = samples[0].value;
+  BitCursor cursor(stream_begin, stream_end, 0);
+  for (size_t i = 1; i < count; ++i) result[i] = result[i - 1] + ReadDelta(cursor, k, v2);
+  return result;
+}
+
+std::optional<EFIndex> EFIndex::Build(byte_span_t data, int sample_interval) {
+  assert(sample_interval > 0);
+  EFIndex index;
+  index.sample_interval = sample_interval;
+  index.data_size = data.size();
+  size_t pos = 0;
+  while (pos < data.size()) {
+    index.part_offsets.push_back(pos);
+    index.part_first_sample.push_back(index.samples.size());
+    if (!IndexPart(data.data(), data.size(), &pos, sample_interval, &index.samples)) {
+      std::cerr << "Failed to decode part " << index.part_offsets.size() - 1
+          << " at byte offset " << index.part_offsets.back() << "!" << std::endl;
+      return {};
+    }
+  }
+  index.part_offsets.push_back(pos);
+  index.part_first_sample.push_back(index.samples.size());
+  return index;
+}
+
+std::optional<EFIndex> EFIndex::Load(const char *data_filename) {
+  const std::string filename = EFIndexFilename(data_filename);
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs) return {};
+  Header header;
+  if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.sample_interval == 0 ||
+      header.sample_interval > uint32_t(std::numeric_limits<int>::max()) ||
+      header.data_size != std::filesystem::file_size(data_filename) ||
+      header.data_mtime != FileModificationTime(data_filename) ||
+      std::filesystem::file_size(filename) != sizeof(header) +
+          (header.num_parts + 1) * 2 * sizeof(uint64_t) + header.num_samples * sizeof(EFSample)) {
+    return {};
+  }
+  EFIndex index;
+  index.sample_interval = header.sample_interval;
+  index.data_size = header.data_size;
+  index.part_offsets.resize(header.num_parts + 1);
+  index.part_first_sample.resize(header.num_parts + 1);
+  index.samples.resize(header.num_samples);
+  ifs.read(reinterpret_cast<char*>(index.part_offsets.data()), index.part_offsets.size() * sizeof(uint64_t));
+  ifs.read(reinterpret_cast<char*>(index.part_first_sample.data()), index.part_first_sample.size() * sizeof(uint64_t));
+  ifs.read(reinterpret_cast<char*>(index.samples.data()), index.samples.size() * sizeof(EFSample));
+  if (!ifs ||
+      index.part_offsets.back() != index.data_size ||
+      index.part_first_sample.back() != index.samples.size()) {
+    return {};
+  }
+  return index;
+}
+
+bool EFIndex::Save(const char *data_filename) const {
+  Header header = {};
+  memcpy(header.magic, magic, sizeof(magic));
+  header.data_size = data_size;
+  header.data_mtime = FileModificationTime(data_filename);
+  header.num_parts = PartCount();
+  header.num_samples = samples.size();
+  header.sample_interval = sample_interval;
+
+  // Write to a temporary file first, so that concurrent readers never see a
+  // partially written index.
+  const std::string filename = EFIndexFilename(data_filename);
+  const std::string temp_filename = filename + ".tmp";
+  std::ofstream ofs(temp_filename, std::ofstream::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(part_offsets.data()), part_offsets.size() * sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char*>(part_first_sample.data()), part_first_sample.size() * sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(EFSample));
+  ofs.close();
+  std::error_code error;
+  if (!ofs || (std::filesystem::rename(temp_filename, filename, error), error)) {
+    std::cerr << "Failed to write " << filename << "!" << std::endl;
+    std::filesystem::remove(temp_filename, error);
+    return false;
+  }
+  return true;
+}
+
+EFListReader EFIndex::Part(byte_span_t data, size_t i) const {
+  assert(data.size() == data_size);
+  assert(i < PartCount());
+  return EFListReader(
+      byte_span_t(data.data() + part_offsets[i], data.data() + part_offsets[i + 1]),
+      samples.data() + part_first_sample[i], sample_interval);
+}
+
+std::string EFIndexFilename(const char *data_filename) {
+  return std::string(data_filename) + ".efidx";
+}
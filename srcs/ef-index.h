@@ -0,0 +1,131 @@
+// Random access to Elias-Fano-encoded lists (see efcodec.h) without decoding
+// them into memory.
+//
+// The encoding produced by EncodeEF() stores the differences between
+// consecutive elements, with the lower k bits of each difference followed by
+// the upper bits in unary, so the only way to find the i-th element is to
+// decode all elements before it. EFIndex speeds this up by sampling every
+// `sample_interval`-th element: for each sample, it stores the element's
+// value and the bit offset of the next element. A lookup then starts at the
+// nearest sample, and decodes at most sample_interval - 1 differences.
+//
+// With the default interval of 256, the index takes about 0.5 bits per
+// element, compared to 2 + k bits per element for the list itself.
+//
+// An EFIndex covers a file consisting of multiple concatenated lists (parts),
+// like the files written by the solvers, and can be saved next to the data
+// file (as "<filename>.efidx"), so that opening the file doesn't require
+// scanning it.
+
+#ifndef EF_INDEX_H_INCLUDED
+#define EF_INDEX_H_INCLUDED
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "byte_span.h"
+
+constexpr int default_ef_sample_interval = 256;
+
+struct EFSample {
+  // Bit offset (relative to the start of the bit stream of the list) of the
+  // element after the sampled element.
+  uint64_t bit_offset;
+
+  // Value of the sampled element.
+  int64_t value;
+};
+
+// Read-only view of a single encoded list with random access. The encoded
+// bytes and the samples must outlive the reader.
+class EFListReader {
+public:
+  // `bytes` must contain exactly one encoded list, and `samples` must be the
+  // samples of that list computed by EFIndex.
+  EFListReader(byte_span_t bytes, const EFSample *samples, int sample_interval);
+
+  // Number of elements in the list.
+  size_t size() const { return count; }
+
+  bool empty() const { return count == 0; }
+
+  // Returns the i-th element (0-based). i must be less than size().
+  int64_t Get(size_t i) const;
+
+  // Writes the elements with indices from `begin` to `end` (exclusive) to
+  // `output`. Unlike calling Get() for each index, this starts decoding at the
+  // nearest sample only once, so the cost is one difference per element.
+  void Decode(size_t begin, size_t end, int64_t *output) const;
+
+  // Returns the index of the first element that is greater than or equal to
+  // x, or size() if there is no such element.
+  size_t LowerBound(int64_t x) const;
+
+  // Returns the first element that is greater than or equal to x, if any.
+  std::optional<int64_t> NextGEQ(int64_t x) const;
+
+  // Returns whether x occurs in the list.
+  bool Contains(int64_t x) const {
+    auto y = NextGEQ(x);
+    return y && *y == x;
+  }
+
+  // Decodes the entire list (equivalent to DecodeEF()).
+  std::vector<int64_t> DecodeAll() const;
+
+private:
+  // Finds the first element >= x; returns its index and value.
+  std::pair<size_t, int64_t> Find(int64_t x) const;
+
+  const uint8_t *stream_begin = nullptr;
+  const uint8_t *stream_end = nullptr;
+  size_t count = 0;
+  int k = 0;
+  bool v2 = false;
+  const EFSample *samples = nullptr;
+  int sample_interval = default_ef_sample_interval;
+};
+
+// Index over a byte array that consists of one or more encoded lists.
+class EFIndex {
+public:
+  // Scans `data` and computes the index. Returns nothing (after printing an
+  // error message) if `data` is not a sequence of valid encoded lists.
+  static std::optional<EFIndex> Build(
+      byte_span_t data, int sample_interval = default_ef_sample_interval);
+
+  // Loads the index saved next to `data_filename`. Returns nothing if the
+  // index does not exist, or is out of date (i.e., the data file has changed
+  // size or modification time since the index was saved).
+  static std::optional<EFIndex> Load(const char *data_filename);
+
+  // Saves the index next to `data_filename`. Returns false on failure.
+  bool Save(const char *data_filename) const;
+
+  size_t PartCount() const { return part_offsets.size() - 1; }
+
+  // Byte range of the i-th part in the data.
+  size_t PartBegin(size_t i) const { return part_offsets[i]; }
+  size_t PartEnd(size_t i) const { return part_offsets[i + 1]; }
+
+  // Returns a reader for the i-th part. `data` must be the same data that
+  // was indexed.
+  EFListReader Part(byte_span_t data, size_t i) const;
+
+private:
+  EFIndex() {}
+
+  int sample_interval = default_ef_sample_interval;
+  uint64_t data_size = 0;
+  std::vector<uint64_t> part_offsets;        // size: PartCount() + 1
+  std::vector<uint64_t> part_first_sample;   // size: PartCount() + 1
+  std::vector<EFSample> samples;
+};
+
+// Returns the filename of the index that belongs to the given data file.
+std::string EFIndexFilename(const char *data_filename);
+
+#endif  // ndef EF_INDEX_H_INCLUDED
@@ -0,0 +1,128 @@
+#include "ef-index.h"
+#include "efcodec.h"
+#include "macros.h"
+#include "random.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+std::vector<int64_t> RandomList(size_t size, int64_t max_value) {
+  std::vector<int64_t> list(size);
+  for (int64_t &x : list) x = RandInt(0, max_value);
+  std::sort(list.begin(), list.end());
+  return list;
+}
+
+// Checks all methods of the reader against a plain vector.
+void CheckReader(const EFListReader &reader, const std::vector<int64_t> &list) {
+  assert(reader.size() == list.size());
+  assert(reader.DecodeAll() == list);
+  REP(i, list.size()) assert(reader.Get(i) == list[i]);
+  for (int j = 0; j < 100; ++j) {
+    const size_t begin = RandInt(0, list.size());
+    const size_t end = RandInt(begin, list.size());
+    std::vector<int64_t> range(end - begin);
+    reader.Decode(begin, end, range.data());
+    assert(std::equal(range.begin(), range.end(), list.begin() + begin));
+  }
+  const int64_t max_value = list.empty() ? 10 : list.back() + 10;
+  for (int j = 0; j < 1000; ++j) {
+    const int64_t x = j < 10 ? max_value - j : RandInt(0, max_value);
+    auto it = std::lower_bound(list.begin(), list.end(), x);
+    assert(reader.LowerBound(x) == size_t(it - list.begin()));
+    assert(reader.NextGEQ(x) == (it == list.end() ? std::optional<int64_t>() : *it));
+    assert(reader.Contains(x) == std::binary_search(list.begin(), list.end(), x));
+  }
+  for (int64_t x : list) assert(reader.Contains(x));
+}
+
+void TestSingleLists() {
+  for (int sample_interval : {1, 3, 256}) {
+    for (size_t size : {0, 1, 2, 255, 256, 257, 10000}) {
+      // Dense and sparse lists, with and without duplicates.
+      for (int64_t max_value : {int64_t{10}, int64_t{1000000}, int64_t{1} << 50}) {
+        const std::vector<int64_t> list = RandomList(size, max_value);
+        for (EFVersion version : {EFVersion::V1, EFVersion::V2}) {
+          const bytes_t bytes = EncodeEF(list, -1, version);
+          std::optional<EFIndex> index = EFIndex::Build(bytes, sample_interval);
+          assert(index);
+          assert(index->PartCount() == 1);
+          CheckReader(index->Part(bytes, 0), list);
+        }
+      }
+    }
+  }
+}
+
+void TestMultiplePartsAndSaving() {
+  std::vector<std::vector<int64_t>> parts;
+  bytes_t bytes;
+  for (int i = 0; i < 20; ++i) {
+    parts.push_back(RandomList(RandInt(0, 2000), RandInt(1, 1000000)));
+    // Mix both versions of the encoding.
+    EncodeEF(parts.back(), bytes, -1, i % 2 ? EFVersion::V1 : EFVersion::V2);
+  }
+
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("ef_index_test." + std::to_string(getpid()) + ".bin");
+  {
+    std::ofstream ofs(filename, std::ofstream::binary);
+    ofs.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    assert(ofs);
+  }
+  assert(!EFIndex::Load(filename.c_str()));
+
+  std::optional<EFIndex> index = EFIndex::Build(bytes);
+  assert(index);
+  assert(index->PartCount() == parts.size());
+  assert(index->Save(filename.c_str()));
+
+  std::optional<EFIndex> loaded = EFIndex::Load(filename.c_str());
+  assert(loaded);
+  assert(loaded->PartCount() == parts.size());
+  REP(i, parts.size()) CheckReader(loaded->Part(bytes, i), parts[i]);
+
+  // The index is ignored after the data file changes.
+  {
+    const bytes_t extra = EncodeEF(std::vector<int64_t>{1, 2, 3});
+    bytes.insert(bytes.end(), extra.begin(), extra.end());
+    std::ofstream ofs(filename, std::ofstream::binary | std::ofstream::app);
+    ofs.write(reinterpret_cast<const char*>(extra.data()), extra.size());
+  }
+  assert(!EFIndex::Load(filename.c_str()));
+
+  // Invalid data is rejected.
+  bytes.back() = 0x80;
+  assert(!EFIndex::Build(bytes));
+
+  std::filesystem::remove(filename);
+  std::filesystem::remove(EFIndexFilename(filename.c_str()));
+}
+
+}  // namespace
+
+int main() {
+  TestSingleLists();
+  TestMultiplePartsAndSaving();
+}
@@ -1,8 +1,28 @@
 #include "efcodec.h"
 
-#include <iostream>
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cstring>
+#include <functional>
+#include <iostream>
 #include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+class EFIterator::Impl {
+public:
+  virtual ~Impl() {}
+
+  // Reads the list header and stores the number of elements in *count.
+  // Returns false if the header is invalid.
+  virtual bool ReadHeader(int64_t *count) = 0;
+
+  // Decodes up to `max_count` elements. Returns the number of elements
+  // decoded (0 at the end of the list) or nothing if the input is invalid.
+  virtual std::optional<size_t> Decode(int64_t *output, size_t max_count) = 0;
+};
 
 namespace {
 
@@ -16,49 +36,70 @@ void AppendVarInt(bytes_t &output, int64_t value) {
   } while (value > 0);
 }
 
+// Returns the lowest `num_bits` bits of `value` in reverse order.
+// num_bits must be between 1 and 64.
+uint64_t ReverseLowerBits(uint64_t value, int num_bits) {
+  value = ((value >> 1) & 0x5555555555555555) | ((value & 0x5555555555555555) << 1);
+  value = ((value >> 2) & 0x3333333333333333) | ((value & 0x3333333333333333) << 2);
+  value = ((value >> 4) & 0x0F0F0F0F0F0F0F0F) | ((value & 0x0F0F0F0F0F0F0F0F) << 4);
+  return __builtin_bswap64(value) >> (64 - num_bits);
+}
+
+uint64_t LowerBitsMask(int num_bits) {
+  return num_bits < 64 ? (uint64_t{1} << num_bits) - 1 : ~uint64_t{0};
+}
+
+// Packs bits into a 64-bit accumulator, starting from the least significant
+// bit, and appends it to the output 8 bytes at a time.
 struct BitEncoder {
   BitEncoder(bytes_t &output) : output(output) {}
 
   ~BitEncoder() {
-    if (pos != 0) output.push_back(byte);
-  }
-
-  void WriteBit(bool bit) {
-    byte |= bit << pos++;
-    if (pos == 8) {
-      output.push_back(byte);
-      byte = 0;
-      pos = 0;
+    for (; pos > 0; pos -= std::min(pos, 8)) {
+      output.push_back(word);
+      word >>= 8;
     }
   }
 
-  // Writes the lowest num_bits (most-significant bit first).
-  void WriteLowerBits(uint64_t value, int num_bits) {
-    // TODO: this could be optimized a bit, by writing multiple bits at once
-    // if there is space in the byte.
-    //
-    // NOTE: this effectly reverses the order of bits. It would have been better
-    // to encode numbers in little-endian order:
-    //
-    //  REP(i, num_bits) WriteBit((value >> i) & 1);
-    //
-    // which allows reading/writing multiple bits from a byte without having
-    // to reverse the bits. Unfortunately, I don't think I should change the
-    // file format at this point.
-    while (num_bits-- > 0) WriteBit((value >> num_bits) & 1);
+  // Writes the lowest num_bits (between 0 and 63) of value, least-significant
+  // bit first. Higher bits of value must be zero.
+  void WriteBits(uint64_t value, int num_bits) {
+    assert(num_bits < 64 && (value >> num_bits) == 0);
+    word |= value << pos;
+    pos += num_bits;
+    if (pos >= 64) {
+      AppendWord();
+      pos -= 64;
+      // If pos is now 0, all bits of value have been written.
+      word = pos > 0 ? value >> (num_bits - pos) : 0;
+    }
   }
 
+  // Writes `value` zero bits followed by a one bit.
   void WriteUnaryNumber(uint64_t value) {
-    // TODO: this could be optimized a bit, by writing multiple bits at once
-    // if there is space in the byte.
-    while (value-- > 0) WriteBit(0);
-    WriteBit(1);
+    if (value >= uint64_t(64 - pos)) {
+      value -= 64 - pos;
+      AppendWord();
+      word = 0;
+      pos = 0;
+      for (; value >= 64; value -= 64) AppendWord();
+    }
+    pos += value;
+    WriteBits(1, 1);
   }
 
 private:
+  void AppendWord() {
+    uint64_t le = word;
+    if constexpr (std::endian::native == std::endian::big) le = __builtin_bswap64(le);
+    const size_t size = output.size();
+    output.resize(size + 8);
+    memcpy(output.data() + size, &le, 8);
+  }
+
   bytes_t &output;
-  uint8_t byte = 0;
-  int pos = 0;
+  uint64_t word = 0;
+  int pos = 0;  // number of bits in word (between 0 and 63)
 };
 
 template<class ByteSource>
@@ -87,6 +128,26 @@ struct InMemoryByteSource {
     return *data++;
   }
 
+  // Reads up to 7 bytes at once into the bits of `word` starting at `pos`.
+  // Returns the number of bits added, or 0 if fewer than 8 bytes remain.
+  int NextBytes(uint64_t &word, int pos) {
+    if (size < 8) return 0;
+    uint64_t le;
+    memcpy(&le, data, 8);
+    if constexpr (std::endian::native == std::endian::big) le = __builtin_bswap64(le);
+    const int num_bytes = (63 - pos) / 8;
+    word |= (le & LowerBitsMask(8 * num_bytes)) << pos;
+    data += num_bytes;
+    size -= num_bytes;
+    return 8 * num_bytes;
+  }
+
+  // Returns the last `num_bytes` bytes read to the input.
+  void Unread(int num_bytes) {
+    data -= num_bytes;
+    size += num_bytes;
+  }
+
   const uint8_t *data;
   size_t size;
 };
@@ -106,95 +167,211 @@ struct IStreamByteSource {
   std::istream *is;
 };
 
+// Reads bits in the order they are written by BitEncoder, keeping up to 63
+// bits buffered in a 64-bit word. Bits are consumed from the least
+// significant end of the buffer, so unary numbers can be decoded by counting
+// trailing zeros.
+//
+// Input is only read from the byte source when the buffered bits are
+// exhausted, so that a stream byte source is never read past the end of the
+// list. Byte sources that support it (see InMemoryByteSource) are read 7
+// bytes at a time, and the unused whole bytes are returned by Finish().
 template<class ByteSource>
 struct BitDecoder {
   BitDecoder(ByteSource &byte_source) : byte_source(&byte_source) {}
 
-  std::optional<bool> ReadBit() {
-    if (bits == 0) {
-      auto res = byte_source->NextByte();
-      if (!res) return {};   // end of input
-      byte = *res;
-      bits = 8;
+  // Returns unused buffered bytes to the byte source, if supported. Bits left
+  // in a partially consumed byte are padding, and are discarded.
+  void Finish() {
+    if constexpr (requires { byte_source->Unread(0); }) {
+      byte_source->Unread(bits / 8);
     }
-    bool result = byte & 1;
-    byte >>= 1;
-    --bits;
-    return {result};
+    word = 0;
+    bits = 0;
   }
 
-  std::optional<uint64_t> ReadLowerBits(int num_bits) {
-    uint64_t value = 0;
-    // TODO: this could be optimized a bit, by reading multiple bits at once
-    // if there is space in the byte.
-    while (num_bits-- > 0) {
-      auto bit = ReadBit();
-      if (!bit) return {};  // end of input
-      value = (value << 1) | *bit;
+  // Reads num_bits (between 0 and 63), least-significant bit first.
+  std::optional<uint64_t> ReadBits(int num_bits) {
+    if (num_bits > 56) {
+      auto lo = ReadBits(32);
+      if (!lo) return {};
+      auto hi = ReadBits(num_bits - 32);
+      if (!hi) return {};
+      return *lo | (*hi << 32);
     }
+    if (!Fill(num_bits)) return {};  // end of input
+    const uint64_t value = word & LowerBitsMask(num_bits);
+    word >>= num_bits;
+    bits -= num_bits;
     return value;
   }
 
+  // Reads num_bits (between 0 and 63), most-significant bit first.
+  std::optional<uint64_t> ReadReversedBits(int num_bits) {
+    auto value = ReadBits(num_bits);
+    if (!value || num_bits == 0) return value;
+    return ReverseLowerBits(*value, num_bits);
+  }
+
   std::optional<uint64_t> ReadUnaryNumber() {
-    // TODO: this could be optimized a bit, by reading multiple bits at once
-    // if there is space in the byte.
     uint64_t value = 0;
     for (;;) {
-      auto bit = ReadBit();
-      if (!bit) return {};  // end of input
-      if (*bit) return value;
-      ++value;
+      if (word != 0) {
+        const int zeros = std::countr_zero(word);
+        // zeros < bits <= 63, so the shift is well defined.
+        word >>= zeros + 1;
+        bits -= zeros + 1;
+        return value + zeros;
+      }
+      value += bits;
+      bits = 0;
+      if (!Fill(1)) return {};  // end of input
     }
   }
 
 private:
-  uint8_t byte = 0;
+  // Ensures at least num_bits (at most 56) bits are buffered.
+  bool Fill(int num_bits) {
+    if (bits >= num_bits) return true;
+    if constexpr (requires { byte_source->NextBytes(word, bits); }) {
+      bits += byte_source->NextBytes(word, bits);
+    }
+    while (bits < num_bits) {
+      auto byte = byte_source->NextByte();
+      if (!byte) return false;
+      word |= uint64_t{*byte} << bits;
+      bits += 8;
+    }
+    return true;
+  }
+
+  uint64_t word = 0;  // buffered bits; bits above `bits` are zero
   int bits = 0;
   ByteSource *byte_source;
 };
 
+// Decodes a single list, a block of elements at a time.
 template<class ByteSource>
-std::optional<std::vector<int64_t>> DecodeEFImpl(ByteSource &byte_source) {
-  int64_t element_count;
-  if (auto res = ReadVarInt(byte_source); !res) {
-    return {};
-  } else {
-    element_count = *res;
+class ListDecoder {
+public:
+  explicit ListDecoder(ByteSource &byte_source)
+    : byte_source(&byte_source), bit_decoder(byte_source) {}
+
+  // Reads the header of the list. Must be called once, before Decode().
+  // Returns false if the header is invalid.
+  bool ReadHeader() {
+    if (auto res = ReadVarInt(*byte_source); !res) {
+      return false;
+    } else {
+      count = *res;
+    }
+    if (count > 0) {
+      if (auto res = ReadVarInt(*byte_source); !res) {
+        return false;
+      } else {
+        last = *res;
+      }
+    }
+    if (count > 1) {
+      if (auto res = byte_source->NextByte(); !res) {
+        return false;
+      } else {
+        k = *res & ~ef_v2_flag;
+        v2 = *res & ef_v2_flag;
+      }
+      if (k > 63) return false;
+    }
+    return true;
   }
-  std::vector<int64_t> result;
-  if (element_count > 0) {
-    result.resize(element_count);
-    auto min_value = ReadVarInt(byte_source);
-    if (!min_value) return {};
-    result[0] = *min_value;
-    if (element_count > 1) {
-      int k;
-      if (auto res = byte_source.NextByte(); !res) {
-        return {};
+
+  // Total number of elements in the list.
+  int64_t size() const { return count; }
+
+  // Number of elements that have not been decoded yet.
+  int64_t remaining() const { return count - decoded; }
+
+  // Decodes the next n elements into `output`. n must not exceed
+  // remaining(). Returns false if the input is invalid.
+  bool Decode(int64_t *output, size_t n) {
+    assert(int64_t(n) <= remaining());
+    if (n == 0) return true;
+    size_t i = 0;
+    if (decoded == 0) {
+      output[i++] = last;
+    }
+    for (; i < n; ++i) {
+      uint64_t delta;
+      if (auto lower = v2 ? bit_decoder.ReadBits(k) : bit_decoder.ReadReversedBits(k); !lower) {
+        return false;
       } else {
-        k = *res;
+        delta = *lower;
       }
-      if (k > 63) return {};
-      BitDecoder<ByteSource> decoder(byte_source);
-      for (size_t i = 1; i < element_count; ++i) {
-        uint64_t delta;
-        if (auto lower = decoder.ReadLowerBits(k); !lower) {
-          return {};
-        } else {
-          delta = *lower;
-        }
-        if (auto upper = decoder.ReadUnaryNumber(); !upper) {
-          return {};
-        } else {
-          delta |= *upper << k;  // possible overflow here
-        }
-        result[i] = result[i - 1] + delta;  // possible overflow here
+      if (auto upper = bit_decoder.ReadUnaryNumber(); !upper) {
+        return false;
+      } else {
+        delta |= *upper << k;  // possible overflow here
       }
+      last += delta;  // possible overflow here
+      output[i] = last;
     }
+    decoded += n;
+    if (decoded == count) bit_decoder.Finish();
+    return true;
   }
+
+private:
+  ByteSource *byte_source;
+  BitDecoder<ByteSource> bit_decoder;
+  int64_t count = 0;
+  int64_t decoded = 0;
+  int64_t last = 0;  // last decoded element (or the first, before decoding)
+  int k = 0;
+  bool v2 = false;
+};
+
+template<class ByteSource>
+std::optional<std::vector<int64_t>> DecodeEFImpl(ByteSource &byte_source) {
+  ListDecoder<ByteSource> decoder(byte_source);
+  if (!decoder.ReadHeader()) return {};
+  std::vector<int64_t> result(decoder.size());
+  if (!decoder.Decode(result.data(), result.size())) return {};
   return result;
 }
 
+// Implementation of EFIterator::Impl for a specific byte source.
+template<class ByteSource>
+class EFIteratorImpl : public EFIterator::Impl {
+public:
+  template<class... Args>
+  explicit EFIteratorImpl(byte_span_t *bytes, Args&&... args)
+    : bytes(bytes), byte_source(std::forward<Args>(args)...), decoder(byte_source) {}
+
+  bool ReadHeader(int64_t *count) override {
+    if (!decoder.ReadHeader()) return false;
+    *count = decoder.size();
+    UpdateBytes();
+    return true;
+  }
+
+  std::optional<size_t> Decode(int64_t *output, size_t max_count) override {
+    const size_t n = std::min<int64_t>(max_count, decoder.remaining());
+    if (!decoder.Decode(output, n)) return {};
+    UpdateBytes();
+    return n;
+  }
+
+private:
+  void UpdateBytes() {
+    if constexpr (std::is_same_v<ByteSource, InMemoryByteSource>) {
+      if (decoder.remaining() == 0) *bytes = byte_span_t(byte_source.data, byte_source.size);
+    }
+  }
+
+  byte_span_t *bytes;
+  ByteSource byte_source;
+  ListDecoder<ByteSource> decoder;
+};
+
 }  // namespace
 
 std::optional<std::vector<int64_t>> DecodeEF(byte_span_t *bytes) {
@@ -209,7 +386,92 @@ std::optional<std::vector<int64_t>> DecodeEF(std::istream &is) {
   return DecodeEFImpl<IStreamByteSource>(byte_source);
 }
 
-void EncodeEF(const std::vector<int64_t> &sorted_ints, bytes_t &result, int k) {
+EFIterator::EFIterator(byte_span_t *bytes)
+  : EFIterator(std::make_unique<EFIteratorImpl<InMemoryByteSource>>(bytes, *bytes)) {}
+
+EFIterator::EFIterator(std::istream &is)
+  : EFIterator(std::make_unique<EFIteratorImpl<IStreamByteSource>>(nullptr, is)) {}
+
+EFIterator::EFIterator(std::unique_ptr<Impl> impl_arg) : impl(std::move(impl_arg)) {
+  if (!impl->ReadHeader(&count)) {
+    failed = true;
+    count = 0;
+    return;
+  }
+  buffer.resize(std::min<int64_t>(count, block_size));
+  Refill();
+}
+
+EFIterator::EFIterator(EFIterator&&) = default;
+EFIterator &EFIterator::operator=(EFIterator&&) = default;
+EFIterator::~EFIterator() = default;
+
+void EFIterator::Refill() {
+  buffer_pos = 0;
+  buffer_size = 0;
+  if (failed) return;
+  if (auto n = impl->Decode(buffer.data(), buffer.size()); !n) {
+    failed = true;
+  } else {
+    buffer_size = *n;
+  }
+}
+
+size_t EFIterator::Read(int64_t *output, size_t max_count) {
+  // Return buffered elements first.
+  size_t n = std::min(max_count, buffer_size - buffer_pos);
+  std::copy(buffer.begin() + buffer_pos, buffer.begin() + buffer_pos + n, output);
+  buffer_pos += n;
+  if (buffer_pos < buffer_size) return n;
+  if (n < max_count && !failed) {
+    // Decode the rest directly into the output.
+    if (auto m = impl->Decode(output + n, max_count - n); !m) {
+      failed = true;
+    } else {
+      n += *m;
+    }
+  }
+  Refill();
+  return n;
+}
+
+bool EFIterator::SkipToEnd() {
+  while (!AtEnd()) Refill();
+  return !failed;
+}
+
+EFMerger::EFMerger(std::vector<EFIterator> lists_arg) : lists(std::move(lists_arg)) {
+  heap.reserve(lists.size());
+  for (size_t i = 0; i < lists.size(); ++i) Push(i);
+}
+
+bool EFMerger::Failed() const {
+  for (const EFIterator &list : lists) if (list.Failed()) return true;
+  return false;
+}
+
+void EFMerger::Push(size_t i) {
+  if (lists[i].Failed()) {
+    // Stop early, rather than returning a sequence with elements missing.
+    heap.clear();
+  } else if (!lists[i].AtEnd()) {
+    heap.emplace_back(lists[i].Value(), i);
+    std::push_heap(heap.begin(), heap.end(), std::greater<>());
+  }
+}
+
+void EFMerger::Advance() {
+  assert(!AtEnd());
+  std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+  const size_t i = heap.back().second;
+  heap.pop_back();
+  lists[i].Advance();
+  Push(i);
+}
+
+void EncodeEF(
+    const std::vector<int64_t> &sorted_ints, bytes_t &result, int k,
+    EFVersion version) {
   const size_t element_count = sorted_ints.size();
   AppendVarInt(result, element_count);
   if (element_count > 0) {
@@ -220,18 +482,80 @@ void EncodeEF(const std::vector<int64_t> &sorted_ints, bytes_t &result, int k) {
       const int64_t max_value = sorted_ints.back();
       if (k < 0) k = EFTailBits(element_count, max_value);
       assert(k >= 0 && k <= 63);
-      result.push_back(k);
+      const bool v2 = version == EFVersion::V2;
+      result.push_back(v2 ? k | ef_v2_flag : k);
       BitEncoder encoder(result);
+      const uint64_t mask = LowerBitsMask(k);
       for (size_t i = 1; i < element_count; ++i) {
         assert(sorted_ints[i - 1] <= sorted_ints[i]);  // input must be sorted
         uint64_t delta = sorted_ints[i] - sorted_ints[i - 1];
-        encoder.WriteLowerBits(delta, k);
+        if (k > 0) {
+          encoder.WriteBits(v2 ? delta & mask : ReverseLowerBits(delta, k), k);
+        }
         encoder.WriteUnaryNumber(delta >> k);
       }
     }
   }
 }
 
+class EFEncoder::Impl {
+public:
+  Impl(bytes_t &result, int64_t count, int64_t max_value, int k, EFVersion version)
+    : result(result), count(count), max_value(max_value), k(k), v2(version == EFVersion::V2) {
+    assert(count >= 0);
+    AppendVarInt(result, count);
+  }
+
+  void Add(int64_t value) {
+    assert(added < count);
+    assert(value >= 0 && value <= max_value);
+    if (added++ == 0) {
+      AppendVarInt(result, value);
+      if (count > 1) {
+        if (k < 0) k = EFTailBits(count, max_value);
+        assert(k >= 0 && k <= 63);
+        result.push_back(v2 ? k | ef_v2_flag : k);
+        mask = LowerBitsMask(k);
+        encoder.emplace(result);
+      }
+    } else {
+      assert(last_value <= value);  // input must be sorted
+      uint64_t delta = value - last_value;
+      if (k > 0) {
+        encoder->WriteBits(v2 ? delta & mask : ReverseLowerBits(delta, k), k);
+      }
+      encoder->WriteUnaryNumber(delta >> k);
+    }
+    last_value = value;
+  }
+
+  void Finish() {
+    assert(added == count);
+    encoder.reset();
+  }
+
+private:
+  bytes_t &result;
+  const int64_t count;
+  const int64_t max_value;
+  int k;
+  const bool v2;
+  uint64_t mask = 0;
+  int64_t added = 0;
+  int64_t last_value = 0;
+  std::optional<BitEncoder> encoder;
+};
+
+EFEncoder::EFEncoder(
+    bytes_t &result, int64_t count, int64_t max_value, int k, EFVersion version)
+  : impl(std::make_unique<Impl>(result, count, max_value, k, version)) {}
+
+EFEncoder::~EFEncoder() {}
+
+void EFEncoder::Add(int64_t value) { impl->Add(value); }
+
+void EFEncoder::Finish() { impl->Finish(); }
+
 int EFTailBits(int64_t n, int64_t m) {
   static_assert(sizeof(int64_t) == sizeof(long long));
   if (n >= m) return 0;
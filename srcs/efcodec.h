@@ -11,12 +11,36 @@
 #include <cassert>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <utility>
 #include <vector>
 
 #include "bytes.h"
 #include "byte_span.h"
 
+// Version of the encoded bit stream.
+//
+// Both versions start with the element count and the minimum value as
+// variable-length integers, followed by a byte containing the number of tail
+// bits k (only if there are at least 2 elements), followed by the differences
+// between consecutive elements, each encoded as k tail bits followed by the
+// remaining upper bits in unary (zeros terminated by a one). Bits are packed
+// starting from the least significant bit of each byte.
+//
+// In version 1, the tail bits are written most-significant bit first, which
+// means they must be reversed when reading. Version 2 writes them
+// least-significant bit first, so they can be extracted from a 64-bit word
+// with a shift and a mask. Version 2 is marked by setting bit 6 (0x40) of the
+// byte that contains k, which version 1 decoders reject. Lists with fewer
+// than 2 elements are encoded identically in both versions.
+//
+// DecodeEF() accepts both versions.
+enum class EFVersion { V1, V2 };
+
+// Flag set in the tail bits byte of version 2 streams.
+constexpr uint8_t ef_v2_flag = 0x40;
+
 // Encode a sorted list of nonnegative integers (deplicates are allowed) into
 // a compact byte array using Elias-Fano encoding.
 //
@@ -26,16 +50,59 @@
 // k specifies the number of tail bits to use. Normally it should be left at -1
 // which means it will be determined automatically by calling EFTailBits().
 //
+// The version defaults to V1, so that files written by existing tools (e.g.
+// potential-new-losses, backpropagate2 and combine-two) keep their format and
+// hashes. Formats that are read back only by this code base may pass V2.
+//
 // Encodeded bytes are appended to `result`.
-void EncodeEF(const std::vector<int64_t> &sorted_ints, bytes_t &result, int k = -1);
+void EncodeEF(
+    const std::vector<int64_t> &sorted_ints, bytes_t &result, int k = -1,
+    EFVersion version = EFVersion::V1);
 
 // Convience method that encodes the result into a new byte array.
-inline bytes_t EncodeEF(const std::vector<int64_t> &sorted_ints, int k = -1) {
+inline bytes_t EncodeEF(
+    const std::vector<int64_t> &sorted_ints, int k = -1,
+    EFVersion version = EFVersion::V1) {
   bytes_t result;
-  EncodeEF(sorted_ints, result, k);
+  EncodeEF(sorted_ints, result, k, version);
   return result;
 }
 
+// Encodes a list one element at a time, so that the list doesn't have to be
+// kept in memory. The result is identical to that of EncodeEF() with the same
+// k and version, but since the header depends on them, the number of elements
+// and the largest element must be known in advance.
+//
+// Usage:
+//
+//   EFEncoder encoder(result, count, max_value);
+//   for (int64_t value : sorted_values) encoder.Add(value);
+//   encoder.Finish();
+class EFEncoder {
+public:
+  EFEncoder(
+      bytes_t &result, int64_t count, int64_t max_value, int k = -1,
+      EFVersion version = EFVersion::V1);
+  ~EFEncoder();
+
+  EFEncoder(const EFEncoder&) = delete;
+  EFEncoder &operator=(const EFEncoder&) = delete;
+
+  // Adds the next element, which must not be less than the previous one, nor
+  // greater than `max_value`.
+  void Add(int64_t value);
+
+  // Writes the remaining bits to `result`. Must be called exactly once, after
+  // `count` elements have been added.
+  void Finish();
+
+  // Implementation detail (defined in efcodec.cc).
+  class Impl;
+
+private:
+  std::unique_ptr<Impl> impl;
+};
+
 // Decodes a byte array produced by EncodeEF() above. The result is an optional
 // containing a vector of nondecreasing nonnegative integers, or an empty
 // optional if the input byte array was not encoded correctly.
@@ -57,6 +124,146 @@ inline std::optional<std::vector<int64_t>> DecodeEF(byte_span_t bytes) {
 // unspecified.
 std::optional<std::vector<int64_t>> DecodeEF(std::istream &is);
 
+// Decodes a single list produced by EncodeEF() incrementally, a block of
+// elements at a time, so that memory use does not depend on the length of the
+// list. Accepts the same inputs as DecodeEF().
+//
+// Usage:
+//
+//   EFIterator it(is);
+//   for (; !it.AtEnd(); it.Advance()) Process(it.Value());
+//   if (it.Failed()) ...
+//
+// or equivalently `for (int64_t value : it) Process(value);`.
+//
+// If the input is invalid, the iterator stops at the first element that
+// cannot be decoded, and Failed() returns true. The elements before it are
+// returned as normal.
+class EFIterator {
+public:
+  // Maximum number of elements decoded at a time.
+  static constexpr size_t block_size = 4096;
+
+  // Reads a list from memory. When the end of the list is reached, `bytes` is
+  // updated to reflect the undecoded portion of the input, like
+  // DecodeEF(byte_span_t*). `bytes` and the data must outlive the iterator.
+  explicit EFIterator(byte_span_t *bytes);
+
+  // Reads a list from a stream. Like DecodeEF(std::istream&), this does not
+  // read more bytes than strictly necessary, so after reaching the end of the
+  // list, the stream is positioned at the start of the next list.
+  explicit EFIterator(std::istream &is);
+
+  EFIterator(EFIterator&&);
+  EFIterator &operator=(EFIterator&&);
+  ~EFIterator();
+
+  // Number of elements in the list, according to its header.
+  int64_t size() const { return count; }
+
+  // Returns whether all elements have been read, or decoding failed.
+  bool AtEnd() const { return buffer_pos == buffer_size; }
+
+  // Returns whether the input was invalid.
+  bool Failed() const { return failed; }
+
+  // Returns the current element. Must not be called at the end.
+  int64_t Value() const {
+    assert(!AtEnd());
+    return buffer[buffer_pos];
+  }
+
+  // Moves to the next element. Must not be called at the end.
+  void Advance() {
+    assert(!AtEnd());
+    if (++buffer_pos == buffer_size) Refill();
+  }
+
+  // Reads up to `max_count` elements into `output`, and returns the number of
+  // elements read, which is less than `max_count` only at the end of the list.
+  // This is faster than calling Value() and Advance() for each element.
+  size_t Read(int64_t *output, size_t max_count);
+
+  // Skips the remaining elements. Returns false if decoding failed.
+  bool SkipToEnd();
+
+  // Support for range-based for loops.
+  struct Sentinel {};
+
+  class Iterator {
+  public:
+    explicit Iterator(EFIterator *it) : it(it) {}
+    int64_t operator*() const { return it->Value(); }
+    Iterator &operator++() { it->Advance(); return *this; }
+    bool operator==(Sentinel) const { return it->AtEnd(); }
+
+  private:
+    EFIterator *it;
+  };
+
+  Iterator begin() { return Iterator(this); }
+  Sentinel end() { return Sentinel{}; }
+
+  // Implementation detail (defined in efcodec.cc).
+  class Impl;
+
+private:
+  explicit EFIterator(std::unique_ptr<Impl> impl);
+
+  void Refill();
+
+  std::unique_ptr<Impl> impl;
+  int64_t count = 0;
+  bool failed = false;
+  std::vector<int64_t> buffer;
+  size_t buffer_pos = 0;
+  size_t buffer_size = 0;
+};
+
+// Merges several lists into a single nondecreasing sequence, using a binary
+// heap. Like EFIterator, the memory use is independent of the length of the
+// lists. Equal elements are returned in the order of the lists that contain
+// them.
+class EFMerger {
+public:
+  explicit EFMerger(std::vector<EFIterator> lists);
+
+  // Returns whether all elements of all lists have been read (or decoding of
+  // any list failed).
+  bool AtEnd() const { return heap.empty(); }
+
+  // Returns whether any of the lists was invalid.
+  bool Failed() const;
+
+  // Returns the current element. Must not be called at the end.
+  int64_t Value() const {
+    assert(!AtEnd());
+    return heap.front().first;
+  }
+
+  // Returns the index of the list that the current element came from. Must
+  // not be called at the end.
+  size_t Source() const {
+    assert(!AtEnd());
+    return heap.front().second;
+  }
+
+  // Moves to the next element. Must not be called at the end.
+  void Advance();
+
+  // Gives access to the underlying lists, e.g. to check which one failed.
+  const EFIterator &List(size_t i) const { return lists[i]; }
+
+private:
+  void Push(size_t i);
+
+  std::vector<EFIterator> lists;
+
+  // Min-heap of (value, list index) pairs, with one entry for each list that
+  // has not been fully read.
+  std::vector<std::pair<int64_t, size_t>> heap;
+};
+
 // Returns the number of bits that are encoded literally in the Elias-Fano
 // encoding of `n` integers between 0 and `m` (inclusive!)
 //
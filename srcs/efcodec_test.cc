@@ -6,6 +6,7 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <iostream>
@@ -29,8 +30,17 @@ int64_t RandInt(int64_t min, int64_t max) {
   return dist(rng);
 }
 
-void Test(const std::vector<int64_t> &input) {
-  std::vector<uint8_t> bytes = EncodeEF(input);
+std::vector<int64_t> RandomList(size_t n, int64_t m) {
+  std::vector<int64_t> v(n);
+  for (size_t i = 0; i < n; ++i) {
+    v[i] = RandInt(0, m - 1);
+  }
+  std::sort(v.begin(), v.end());
+  return v;
+}
+
+void Test(const std::vector<int64_t> &input, EFVersion version) {
+  std::vector<uint8_t> bytes = EncodeEF(input, -1, version);
   std::vector<int64_t> output;
   if (auto res = DecodeEF(bytes); !res) {
     std::cerr << "DecodeEF() failed!\n";
@@ -62,6 +72,177 @@ void Test(const std::vector<int64_t> &input) {
     // Allow 20 extra bytes for VarInt encoding of size, tail bits, and min_value:
     assert(bytes.size() <= size_in_bits / 8 + 20);
   }
+
+  // Decoding from a stream gives the same result, and doesn't read past the
+  // end of the list.
+  std::istringstream iss(std::string(bytes.begin(), bytes.end()) + "x");
+  assert(DecodeEF(iss).value() == input);
+  assert(iss.get() == 'x');
+
+  // Encoding one element at a time gives the same bytes, also when appending.
+  bytes_t streamed = {42};
+  {
+    EFEncoder encoder(streamed, input.size(), input.empty() ? 0 : input.back(), -1, version);
+    for (int64_t value : input) encoder.Add(value);
+    encoder.Finish();
+  }
+  assert(streamed[0] == 42);
+  assert(bytes_t(streamed.begin() + 1, streamed.end()) == bytes);
+}
+
+void Test(const std::vector<int64_t> &input) {
+  Test(input, EFVersion::V1);
+  Test(input, EFVersion::V2);
+}
+
+void TestVersions() {
+  // Version 1 writes the tail bits in reverse order; version 2 doesn't.
+  const bytes_t v1 = {0x02, 0x00, 0x03, 0x0b};
+  const bytes_t v2 = {0x02, 0x00, 0x43, 0x0e};
+  assert(EncodeEF({0, 6}, 3, EFVersion::V1) == v1);
+  assert(EncodeEF({0, 6}, 3, EFVersion::V2) == v2);
+  // Existing output files must keep their format, so V1 is the default.
+  assert(EncodeEF({0, 6}, 3) == v1);
+  assert(DecodeEF(v1).value() == std::vector<int64_t>({0, 6}));
+  assert(DecodeEF(v2).value() == std::vector<int64_t>({0, 6}));
+
+  // Lists with fewer than 2 elements are encoded the same in both versions.
+  assert(EncodeEF({}, -1, EFVersion::V1) == EncodeEF({}, -1, EFVersion::V2));
+  assert(EncodeEF({42}, -1, EFVersion::V1) == EncodeEF({42}, -1, EFVersion::V2));
+
+  // Invalid tail bits byte.
+  assert(!DecodeEF(bytes_t{0x02, 0x00, 0x80, 0x0e}));
+
+  // Both versions can be mixed in a single stream.
+  const std::vector<int64_t> ints1 = RandomList(1000, 1000000);
+  const std::vector<int64_t> ints2 = RandomList(1001, 50000);
+  bytes_t combined;
+  EncodeEF(ints1, combined, -1, EFVersion::V1);
+  EncodeEF(ints2, combined, -1, EFVersion::V2);
+  EncodeEF(ints1, combined, -1, EFVersion::V2);
+  EncodeEF(ints2, combined, -1, EFVersion::V1);
+  byte_span_t bytes(combined.data(), combined.size());
+  assert(DecodeEF(&bytes).value() == ints1);
+  assert(DecodeEF(&bytes).value() == ints2);
+  assert(DecodeEF(&bytes).value() == ints1);
+  assert(DecodeEF(&bytes).value() == ints2);
+  assert(bytes.empty());
+}
+
+// Tests EFIterator on lists of different sizes, reading from memory and from a
+// stream, and mixing single-element and bulk reads.
+void TestIterator() {
+  std::vector<std::vector<int64_t>> lists;
+  for (size_t size : {size_t{0}, size_t{1}, size_t{2}, EFIterator::block_size - 1,
+      EFIterator::block_size, EFIterator::block_size + 1, size_t{100000}}) {
+    lists.push_back(RandomList(size, 1000000));
+  }
+  bytes_t combined;
+  for (const auto &list : lists) EncodeEF(list, combined);
+  std::string s(reinterpret_cast<const char*>(combined.data()), combined.size());
+
+  byte_span_t bytes(combined.data(), combined.size());
+  std::istringstream iss(s);
+  for (const auto &list : lists) {
+    EFIterator it1(&bytes);
+    assert(it1.size() == list.size());
+    std::vector<int64_t> output;
+    for (int64_t x : it1) output.push_back(x);
+    assert(!it1.Failed());
+    assert(output == list);
+
+    EFIterator it2(iss);
+    assert(it2.size() == list.size());
+    output.clear();
+    // Alternate between Value()/Advance() and Read() with various counts.
+    for (size_t n = 1; !it2.AtEnd(); n = n * 3 % 10007) {
+      output.push_back(it2.Value());
+      it2.Advance();
+      size_t pos = output.size();
+      output.resize(pos + n);
+      output.resize(pos + it2.Read(output.data() + pos, n));
+    }
+    assert(!it2.Failed());
+    assert(output == list);
+  }
+  assert(bytes.empty());
+  assert(iss.get() == EOF);
+
+  // Skipping lists.
+  bytes = byte_span_t(combined.data(), combined.size());
+  for (const auto &list : lists) {
+    EFIterator it(&bytes);
+    if (!list.empty()) assert(it.Value() == list[0]);
+    assert(it.SkipToEnd());
+    assert(it.AtEnd());
+  }
+  assert(bytes.empty());
+
+  // Truncated input: the elements before the error are returned.
+  const std::vector<int64_t> &list = lists.back();
+  bytes_t truncated = EncodeEF(list);
+  truncated.resize(truncated.size() / 2);
+  byte_span_t truncated_bytes(truncated.data(), truncated.size());
+  EFIterator it3(&truncated_bytes);
+  size_t count = 0;
+  for (int64_t x : it3) assert(x == list[count++]);
+  assert(it3.Failed());
+  assert(count > 0 && count < list.size());
+  assert(!EFIterator(iss).SkipToEnd());
+}
+
+void TestMerger() {
+  std::vector<std::vector<int64_t>> lists;
+  for (int i = 0; i < 5; ++i) lists.push_back(RandomList(RandInt(0, 10000), 10000));
+  lists.push_back({});
+  bytes_t combined;
+  for (const auto &list : lists) EncodeEF(list, combined);
+  byte_span_t bytes(combined.data(), combined.size());
+
+  std::vector<std::pair<int64_t, size_t>> expected;
+  for (size_t i = 0; i < lists.size(); ++i) {
+    for (int64_t x : lists[i]) expected.emplace_back(x, i);
+  }
+  std::sort(expected.begin(), expected.end());
+
+  // Parse all lists from the same byte span, which requires finishing each
+  // list before the next one can be started. Here we just decode each list
+  // twice: once to find the start of the next list, and once for merging.
+  std::vector<byte_span_t> list_bytes(lists.size());
+  std::vector<EFIterator> iterators;
+  for (size_t i = 0; i < lists.size(); ++i) {
+    list_bytes[i] = bytes;
+    iterators.emplace_back(&list_bytes[i]);
+    assert(EFIterator(&bytes).SkipToEnd());
+  }
+  EFMerger merger(std::move(iterators));
+  std::vector<std::pair<int64_t, size_t>> output;
+  for (; !merger.AtEnd(); merger.Advance()) output.emplace_back(merger.Value(), merger.Source());
+  assert(!merger.Failed());
+  assert(output == expected);
+}
+
+// Reports encoding and decoding throughput for a large list, in millions of
+// integers per second and megabytes (of encoded data) per second.
+void Benchmark(EFVersion version) {
+  const int64_t n = 10000000;
+  const std::vector<int64_t> input = RandomList(n, n * 100);
+
+  auto start_time = std::chrono::steady_clock::now();
+  const bytes_t bytes = EncodeEF(input, -1, version);
+  auto mid_time = std::chrono::steady_clock::now();
+  const std::vector<int64_t> output = DecodeEF(bytes).value();
+  auto end_time = std::chrono::steady_clock::now();
+  assert(output == input);
+
+  const std::chrono::duration<double> encode_seconds = mid_time - start_time;
+  const std::chrono::duration<double> decode_seconds = end_time - mid_time;
+  std::cout << "Version " << (version == EFVersion::V1 ? 1 : 2) << ": "
+      << n << " integers, " << bytes.size() << " bytes. "
+      << "Encode: " << n / encode_seconds.count() / 1e6 << " M ints/s, "
+      << bytes.size() / encode_seconds.count() / 1e6 << " MB/s. "
+      << "Decode: " << n / decode_seconds.count() / 1e6 << " M ints/s, "
+      << bytes.size() / decode_seconds.count() / 1e6 << " MB/s." << std::endl;
 }
 
 }  // namespace
@@ -88,14 +269,22 @@ int main() {
   for (int test = 2; test < 60; ++test) {
     int n = RandInt(1, 10000);
     int64_t m = RandInt(1, int64_t{1} << test);
-    std::vector<int64_t> v(n);
-    for (size_t i = 0; i < n; ++i) {
-      v[i] = RandInt(0, m - 1);
-    }
+    Test(RandomList(n, m));
+  }
+
+  // Explicit tail bits, including values that exceed the 56 bits that the
+  // decoder buffers at a time.
+  for (int k : {0, 1, 7, 8, 31, 56, 57, 62, 63}) {
+    std::vector<int64_t> v = {0, 1, 5, 1000, 1001, int64_t{1} << std::min(k + 6, 62)};
+    if (k == 63) v.push_back(max_int64);
     std::sort(v.begin(), v.end());
-    Test(v);
+    for (EFVersion version : {EFVersion::V1, EFVersion::V2}) {
+      assert(DecodeEF(EncodeEF(v, k, version)).value() == v);
+    }
   }
 
+  TestVersions();
+
   {
     // Create a test stream with three parts.
     std::vector<int64_t> ints1 = {1, 2, 3};
@@ -127,4 +316,10 @@ int main() {
     assert(iss.get() == EOF);
     assert(iss.eof());
   }
+
+  TestIterator();
+  TestMerger();
+
+  Benchmark(EFVersion::V1);
+  Benchmark(EFVersion::V2);
 }
@@ -0,0 +1,206 @@
+// Tool to convert minimized.bin to the compact "elided" format, where values
+// of positions that are provably won-in-1 are omitted (see elided-accessor.h),
+// and to benchmark lookups in the result.
+//
+// Usage:
+//
+//   elide-minimized convert minimized.bin minimized.bin.elided
+//       [--level=exact] [--group-size=64] [--threads=N] [--limit=<number of indices>]
+//
+//   elide-minimized benchmark minimized.bin.elided
+//       [--lookups=100000] [--reference=minimized.bin]
+//
+// Conversion is slow, since every position must be checked: with the exact
+// level it takes on the order of a CPU-day for the full file. The --limit
+// option converts only a prefix of the file, which is useful to evaluate the
+// space/time trade-off of different options quickly.
+//
+// The benchmark reports the space used per index and the average lookup time
+// of elided and stored values separately. If a reference file is given, the
+// looked-up values are compared against it.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "accessors.h"
+#include "elided-accessor.h"
+#include "flags.h"
+#include "parse-int.h"
+#include "position-value.h"
+#include "random.h"
+#include "thread-pool.h"
+
+namespace {
+
+const std::string default_level = "exact";
+const std::string default_group_size = "64";
+const std::string default_threads = std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+const std::string default_lookups = "100000";
+
+// Number of random indices compared with the input after conversion.
+constexpr int verify_samples = 100000;
+
+void PrintUsage() {
+  std::cerr << "Usage:\n\n"
+    << "  elide-minimized convert [--level=partial|exact] [--group-size=" << default_group_size << "] "
+        "[--threads=" << default_threads << "] [--limit=<indices>] <minimized.bin> <output.elided>\n"
+    << "  elide-minimized benchmark [--lookups=" << default_lookups << "] "
+        "[--reference=<minimized.bin>] <input.elided>\n"
+    << std::endl;
+}
+
+int Convert(int argc, char *argv[]) {
+  std::string arg_level = default_level;
+  std::string arg_group_size = default_group_size;
+  std::string arg_threads = default_threads;
+  std::string arg_limit;
+  std::map<std::string, Flag> flags = {
+    // Which positions to elide: "partial" or "exact" (see elided-accessor.h).
+    {"level", Flag::optional(arg_level)},
+    // Number of indices per rank directory entry (a power of 2, at most 65536).
+    {"group-size", Flag::optional(arg_group_size)},
+    // Number of threads used to check positions.
+    {"threads", Flag::optional(arg_threads)},
+    // If given, only the first `limit` indices are converted.
+    {"limit", Flag::optional(arg_limit)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc != 3) {
+    PrintUsage();
+    return 1;
+  }
+
+  ElisionLevel level;
+  if (!ParseElisionLevel(arg_level, &level)) {
+    std::cerr << "Invalid --level: " << arg_level << std::endl;
+    return 1;
+  }
+  const int group_size = ParseInt(arg_group_size.c_str());
+  const int threads = ParseInt(arg_threads.c_str());
+  if (threads < 1) {
+    std::cerr << "Invalid --threads: " << arg_threads << std::endl;
+    return 1;
+  }
+
+  const char *input_filename = argv[1];
+  const char *output_filename = argv[2];
+  if (!std::filesystem::is_regular_file(input_filename)) {
+    std::cerr << "Input file " << input_filename << " does not exist." << std::endl;
+    return 1;
+  }
+  if (std::filesystem::exists(output_filename)) {
+    std::cerr << "Output file " << output_filename << " already exists." << std::endl;
+    return 1;
+  }
+
+  DynMappedFile<uint8_t> input(input_filename);
+  int64_t size = input.size();
+  if (!arg_limit.empty()) size = std::min(size, ParseInt64(arg_limit.c_str()));
+
+  std::optional<ThreadPool> pool;
+  if (threads > 1) pool.emplace(threads - 1);
+
+  std::cerr << "Converting " << size << " indices..." << std::endl;
+  if (!WriteElidedFile(input.data(), size, level, group_size, Value::WinIn(1).byte,
+          output_filename, pool ? &*pool : nullptr)) {
+    return 1;
+  }
+  const uintmax_t output_size = std::filesystem::file_size(output_filename);
+  std::cerr << "Wrote " << output_size << " bytes ("
+      << 8.0 * output_size / std::max<int64_t>(size, 1) << " bits per index)." << std::endl;
+
+  std::cerr << "Verifying " << verify_samples << " random indices..." << std::endl;
+  ElidedAccessor acc(output_filename);
+  std::mt19937 rng = InitializeRng();
+  std::uniform_int_distribution<int64_t> dist(0, size - 1);
+  for (int i = 0; size > 0 && i < verify_samples; ++i) {
+    int64_t index = dist(rng);
+    if (acc.ReadByte(index) != input[index]) {
+      std::cerr << "Verification failed at index " << index << "!" << std::endl;
+      return 1;
+    }
+  }
+  std::cerr << "Verification succeeded." << std::endl;
+  return 0;
+}
+
+int Benchmark(int argc, char *argv[]) {
+  std::string arg_lookups = default_lookups;
+  std::string arg_reference;
+  std::map<std::string, Flag> flags = {
+    // Number of random lookups to time.
+    {"lookups", Flag::optional(arg_lookups)},
+    // Uncompressed minimized.bin to compare the looked-up values against.
+    {"reference", Flag::optional(arg_reference)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc != 2) {
+    PrintUsage();
+    return 1;
+  }
+  const int lookups = ParseInt(arg_lookups.c_str());
+  const char *filename = argv[1];
+
+  ElidedAccessor acc(filename);
+  std::optional<DynMappedFile<uint8_t>> reference;
+  if (!arg_reference.empty()) reference.emplace(arg_reference.c_str());
+
+  const int64_t size = acc.GetUncompressedFileSize();
+  const uintmax_t file_size = std::filesystem::file_size(filename);
+  std::cout << "Indices:           " << size << '\n'
+      << "Elision level:     " << (acc.GetElisionLevel() == ElisionLevel::EXACT ? "exact" : "partial") << '\n'
+      << "Group size:        " << acc.GetGroupSize() << '\n'
+      << "Stored values:     " << acc.GetStoredValueCount() << " ("
+          << 100.0 * acc.GetStoredValueCount() / std::max<int64_t>(size, 1) << "%)\n"
+      << "File size:         " << file_size << " bytes ("
+          << 8.0 * file_size / std::max<int64_t>(size, 1) << " bits per index)\n";
+  if (size == 0) return 0;
+
+  std::mt19937 rng = InitializeRng();
+  std::uniform_int_distribution<int64_t> dist(0, size - 1);
+  const uint8_t w1_byte = Value::WinIn(1).byte;
+  int64_t count[2] = {0, 0};        // W1, other
+  double seconds[2] = {0.0, 0.0};  // W1, other
+  int64_t mismatches = 0;
+  for (int i = 0; i < lookups; ++i) {
+    const int64_t index = dist(rng);
+    auto start = std::chrono::steady_clock::now();
+    const uint8_t byte = acc.ReadByte(index);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const int kind = byte == w1_byte ? 0 : 1;
+    ++count[kind];
+    seconds[kind] += elapsed.count();
+    if (reference && (*reference)[index] != byte) ++mismatches;
+  }
+  std::cout << "W1 lookups:        " << count[0] << ", average "
+          << 1e6 * seconds[0] / std::max<int64_t>(count[0], 1) << " us\n"
+      << "Other lookups:     " << count[1] << ", average "
+          << 1e6 * seconds[1] / std::max<int64_t>(count[1], 1) << " us\n"
+      << "Overall:           " << 1e6 * (seconds[0] + seconds[1]) / lookups << " us per lookup\n";
+  if (reference) std::cout << "Mismatches:        " << mismatches << '\n';
+  std::cout << std::flush;
+  return mismatches == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    PrintUsage();
+    return 1;
+  }
+  const std::string mode = argv[1];
+  // Skip the mode argument, so that argv[0] is the mode and flags follow.
+  if (mode == "convert") return Convert(argc - 1, argv + 1);
+  if (mode == "benchmark") return Benchmark(argc - 1, argv + 1);
+  std::cerr << "Invalid mode: " << mode << "\n\n";
+  PrintUsage();
+  return 1;
+}
@@ -0,0 +1,201 @@
+#include "elided-accessor.h"
+
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "bytes.h"
+#include "search.h"
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little);
+
+struct Header {
+  char magic[8];
+  uint64_t size;
+  uint64_t num_values;
+  uint32_t group_size;
+  uint8_t level;
+  uint8_t w1_byte;
+  uint8_t reserved[34];
+};
+static_assert(sizeof(Header) == 64);
+
+constexpr int64_t superblock_size = ElidedAccessor::superblock_size;
+
+bool IsValidGroupSize(int64_t group_size) {
+  return group_size > 0 && group_size <= superblock_size && std::has_single_bit(uint64_t(group_size));
+}
+
+// File offsets of the sections of the file.
+struct Layout {
+  explicit Layout(size_t size, size_t group_size, size_t num_values) :
+      num_superblocks((size + superblock_size - 1) / superblock_size),
+      num_groups((size + group_size - 1) / group_size),
+      superblock_ranks(sizeof(Header)),
+      group_ranks(superblock_ranks + num_superblocks * sizeof(uint64_t)),
+      values(group_ranks + num_groups * sizeof(uint16_t)),
+      file_size(values + num_values) {}
+
+  size_t num_superblocks;
+  size_t num_groups;
+  size_t superblock_ranks;
+  size_t group_ranks;
+  size_t values;
+  size_t file_size;
+};
+
+}  // namespace
+
+bool ParseElisionLevel(const std::string &s, ElisionLevel *level) {
+  if (s == "partial") {
+    *level = ElisionLevel::PARTIAL;
+    return true;
+  }
+  if (s == "exact") {
+    *level = ElisionLevel::EXACT;
+    return true;
+  }
+  return false;
+}
+
+bool IsElided(const Perm &perm, ElisionLevel level) {
+  if (PartialHasWinningMove(perm)) return true;
+  if (level == ElisionLevel::PARTIAL) return false;
+  Perm copy = perm;
+  return HasWinningMove(copy);
+}
+
+bool ElidedAccessor::IsElidedFile(const char *filepath) {
+  std::ifstream ifs(filepath, std::ifstream::binary);
+  if (!ifs) return false;
+
+  char buffer[sizeof(magic)] = {};
+  if (!ifs.read(buffer, sizeof(buffer))) return false;
+  return memcmp(buffer, magic, sizeof(magic)) == 0;
+}
+
+ElidedAccessor::ElidedAccessor(const char *filepath) : mapped_file(filepath) {
+  Header header;
+  if (mapped_file.size() < sizeof(header)) {
+    std::cerr << "Elided file too short!" << std::endl;
+    exit(1);
+  }
+  memcpy(&header, mapped_file.data(), sizeof(header));
+  if (memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.size > min_index_size ||
+      header.num_values > header.size ||
+      !IsValidGroupSize(header.group_size) ||
+      (header.level != uint8_t(ElisionLevel::PARTIAL) && header.level != uint8_t(ElisionLevel::EXACT)) ||
+      Layout(header.size, header.group_size, header.num_values).file_size != mapped_file.size()) {
+    std::cerr << "Invalid elided file header!" << std::endl;
+    exit(1);
+  }
+  const Layout layout(header.size, header.group_size, header.num_values);
+  size = header.size;
+  num_values = header.num_values;
+  group_size = header.group_size;
+  level = ElisionLevel(header.level);
+  w1_byte = header.w1_byte;
+  const uint8_t *data = mapped_file.data();
+  superblock_ranks = reinterpret_cast<const uint64_t*>(data + layout.superblock_ranks);
+  group_ranks = reinterpret_cast<const uint16_t*>(data + layout.group_ranks);
+  values = data + layout.values;
+}
+
+uint8_t ElidedAccessor::ReadByte(int64_t offset) const {
+  assert(offset >= 0 && offset < size);
+  if (IsElided(PermAtMinIndex(offset), level)) return w1_byte;
+
+  // Count the stored values before `offset` in the same group.
+  int64_t rank = superblock_ranks[offset / superblock_size] + group_ranks[offset / group_size];
+  for (int64_t i = offset / group_size * group_size; i < offset; ++i) {
+    if (!IsElided(PermAtMinIndex(i), level)) ++rank;
+  }
+  assert(rank < num_values);
+  return values[rank];
+}
+
+bool WriteElidedFile(
+    const uint8_t *data, size_t size, ElisionLevel level, int group_size,
+    uint8_t w1_byte, const char *filename, ThreadPool *pool) {
+  if (size > min_index_size) {
+    std::cerr << "Input too large: " << size << " bytes." << std::endl;
+    return false;
+  }
+  if (!IsValidGroupSize(group_size)) {
+    std::cerr << "Invalid group size: " << group_size << std::endl;
+    return false;
+  }
+  const int max_threads = pool == nullptr ? 1 : pool->NumThreads() + 1;
+
+  // The size of the directory does not depend on the number of values, so
+  // the values can be written while the directory is kept in memory.
+  const Layout layout(size, group_size, 0);
+  std::vector<uint64_t> superblock_ranks(layout.num_superblocks);
+  std::vector<uint16_t> group_ranks(layout.num_groups);
+
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs) {
+    std::cerr << "Could not open " << filename << " for writing!" << std::endl;
+    return false;
+  }
+  ofs.seekp(layout.values);
+
+  // Process superblocks in batches, so that we don't need to keep all stored
+  // values in memory.
+  constexpr size_t batch_size = 256;
+  std::vector<bytes_t> stored(batch_size);
+  std::atomic<bool> mismatch = false;
+  uint64_t num_values = 0;
+  for (size_t batch_start = 0; batch_start < layout.num_superblocks; batch_start += batch_size) {
+    const size_t batch_end = std::min(batch_start + batch_size, layout.num_superblocks);
+    ParallelFor(pool, batch_end - batch_start, max_threads, [&](size_t k) {
+      const size_t superblock = batch_start + k;
+      const int64_t begin = superblock * superblock_size;
+      const int64_t end = std::min<int64_t>(begin + superblock_size, size);
+      bytes_t &output = stored[k];
+      output.clear();
+      for (int64_t i = begin; i < end; ++i) {
+        if (i % group_size == 0) group_ranks[i / group_size] = output.size();
+        if (!IsElided(PermAtMinIndex(i), level)) {
+          output.push_back(data[i]);
+        } else if (data[i] != w1_byte) {
+          std::cerr << "Elided position at index " << i << " has unexpected value "
+              << int{data[i]} << "!" << std::endl;
+          mismatch = true;
+        }
+      }
+    });
+    if (mismatch) return false;
+    for (size_t superblock = batch_start; superblock < batch_end; ++superblock) {
+      const bytes_t &output = stored[superblock - batch_start];
+      superblock_ranks[superblock] = num_values;
+      ofs.write(reinterpret_cast<const char*>(output.data()), output.size());
+      num_values += output.size();
+    }
+  }
+
+  Header header = {};
+  memcpy(header.magic, ElidedAccessor::magic, sizeof(header.magic));
+  header.size = size;
+  header.num_values = num_values;
+  header.group_size = group_size;
+  header.level = uint8_t(level);
+  header.w1_byte = w1_byte;
+  ofs.seekp(0);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(superblock_ranks.data()), superblock_ranks.size() * sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char*>(group_ranks.data()), group_ranks.size() * sizeof(uint16_t));
+  if (!ofs.flush()) {
+    std::cerr << "Failed to write " << filename << "!" << std::endl;
+    return false;
+  }
+  return true;
+}
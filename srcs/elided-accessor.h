@@ -0,0 +1,117 @@
+#ifndef ELIDED_ACCESSOR_H_INCLUDED
+#define ELIDED_ACCESSOR_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "accessors.h"
+#include "perms.h"
+#include "thread-pool.h"
+
+// Compact format for minimized.bin (conventionally named
+// "minimized.bin.elided") intended for machines with little memory.
+//
+// Most positions are won-in-1, and many of those can be identified quickly by
+// examining the position itself (see PartialHasWinningMove() and
+// HasWinningMove() in search.h). This format omits the values of those
+// positions altogether; the accessor recomputes the check when a value is
+// requested, trading CPU time for space. The elision level determines which
+// check is used:
+//
+//   PARTIAL: elide positions where PartialHasWinningMove() returns true
+//      (about 82% of positions). Checking a position takes well under a
+//      microsecond, but the remaining won-in-1 positions must be stored.
+//
+//   EXACT: elide all won-in-1 positions, i.e. those where
+//      PartialHasWinningMove() or HasWinningMove() returns true (about 85% of
+//      positions). Positions that are not elided need the slower
+//      HasWinningMove() check.
+//
+// The stored values are addressed by a rank directory, which counts the
+// stored values before each group of `group_size` indices. To find the
+// offset of a stored value, the accessor rechecks the preceding indices in
+// the same group, so the group size is a second CPU/space trade-off: the
+// directory costs 16 / group_size bits per index, while a lookup of a stored
+// value checks group_size / 2 other positions on average. Lookups of elided
+// positions only check the position itself.
+//
+// File layout (all integers little-endian):
+//
+//   header (64 bytes):
+//     char[8]  magic "PFELID1\n"
+//     uint64   number of indices (N)
+//     uint64   number of stored values (M)
+//     uint32   group size (a power of 2 between 1 and 2^16)
+//     uint8    elision level (1 = PARTIAL, 2 = EXACT)
+//     uint8    the W1 byte (returned for elided positions)
+//     padding
+//   uint64[ceil(N / 2^16)]         number of stored values before each superblock of 2^16 indices
+//   uint16[ceil(N / group size)]   number of stored values before each group,
+//                                  relative to the start of its superblock
+//   uint8[M]                       stored values, in order of index
+//
+// Indices are minimized indices (see MinIndexOf() in perms.h). N may be less
+// than min_index_size, in which case the file covers a prefix of the index
+// space (this is mainly useful for testing).
+enum class ElisionLevel : uint8_t { PARTIAL = 1, EXACT = 2 };
+
+// Parses "partial" or "exact". Returns false if the string is invalid.
+bool ParseElisionLevel(const std::string &s, ElisionLevel *level);
+
+// Returns whether the value of the position is elided at the given level.
+// If this returns true, the position is won-in-1.
+bool IsElided(const Perm &perm, ElisionLevel level);
+
+class ElidedAccessor {
+public:
+  static constexpr char magic[8] = {'P', 'F', 'E', 'L', 'I', 'D', '1', '\n'};
+
+  static constexpr int superblock_size = 1 << 16;
+
+  // Returns whether the file starts with the magic bytes of this format.
+  static bool IsElidedFile(const char *filepath);
+
+  explicit ElidedAccessor(const char *filepath);
+
+  int64_t GetUncompressedFileSize() const { return size; }
+
+  ElisionLevel GetElisionLevel() const { return level; }
+  int GetGroupSize() const { return group_size; }
+  int64_t GetStoredValueCount() const { return num_values; }
+
+  uint8_t ReadByte(int64_t offset) const;
+
+  // Reads the bytes at the given offsets, in any order.
+  void ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const {
+    for (size_t i = 0; i < count; ++i) bytes[i] = ReadByte(offsets[i]);
+  }
+
+  std::vector<uint8_t> ReadBytes(const std::vector<int64_t> &offsets) const {
+    std::vector<uint8_t> bytes(offsets.size());
+    ReadBytes(offsets.data(), bytes.data(), offsets.size());
+    return bytes;
+  }
+
+private:
+  DynMappedFile<uint8_t> mapped_file;
+  int64_t size = 0;
+  int64_t num_values = 0;
+  int group_size = 0;
+  ElisionLevel level = ElisionLevel::EXACT;
+  uint8_t w1_byte = 0;
+  const uint64_t *superblock_ranks = nullptr;
+  const uint16_t *group_ranks = nullptr;
+  const uint8_t *values = nullptr;
+};
+
+// Converts the first `size` bytes of minimized.bin (given as `data`) to a new
+// file in the format described above, using `pool` (if not null) to check
+// positions in parallel. Returns false (after printing an error message) if an
+// error occurs, including when an elided position doesn't have value `w1_byte`
+// in the input.
+bool WriteElidedFile(
+    const uint8_t *data, size_t size, ElisionLevel level, int group_size,
+    uint8_t w1_byte, const char *filename, ThreadPool *pool);
+
+#endif  // ndef ELIDED_ACCESSOR_H_INCLUDED
@@ -0,0 +1,92 @@
+#include "elided-accessor.h"
+#include "macros.h"
+#include "perms.h"
+#include "random.h"
+#include "search.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+constexpr uint8_t w1_byte = 2;
+
+// Generates data for the first `size` minimized indices that is consistent
+// with the elision checks: won-in-1 positions get w1_byte, and other positions
+// get a random other value.
+std::vector<uint8_t> GenerateTestData(size_t size) {
+  std::vector<uint8_t> data(size);
+  REP(i, size) {
+    Perm perm = PermAtMinIndex(i);
+    if (HasWinningMove(perm)) {
+      data[i] = w1_byte;
+    } else {
+      do data[i] = RandInt(0, 99); while (data[i] == w1_byte);
+    }
+  }
+  return data;
+}
+
+void TestRoundTrip() {
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("elided_test." + std::to_string(getpid()) + ".elided");
+  ThreadPool pool(2);
+  // Crosses a superblock boundary.
+  const std::vector<uint8_t> data = GenerateTestData(ElidedAccessor::superblock_size + 1000);
+  for (size_t size : {size_t{0}, size_t{1}, size_t{1000}, data.size()}) {
+    for (ElisionLevel level : {ElisionLevel::PARTIAL, ElisionLevel::EXACT}) {
+      for (int group_size : {1, 64, 65536}) {
+        std::filesystem::remove(filename);
+        assert(WriteElidedFile(data.data(), size, level, group_size, w1_byte, filename.c_str(), &pool));
+        assert(ElidedAccessor::IsElidedFile(filename.c_str()));
+
+        ElidedAccessor acc(filename.c_str());
+        assert(acc.GetUncompressedFileSize() == int64_t(size));
+        assert(acc.GetElisionLevel() == level);
+        assert(acc.GetGroupSize() == group_size);
+
+        int64_t expected_values = 0;
+        REP(i, size) expected_values += !IsElided(PermAtMinIndex(i), level);
+        assert(acc.GetStoredValueCount() == expected_values);
+
+        // Check a sample of indices, since lookups can be slow.
+        for (size_t i = 0; i < size; i += RandInt(1, 100)) {
+          assert(acc.ReadByte(i) == data[i]);
+        }
+        if (size > 0) assert(acc.ReadByte(size - 1) == data[size - 1]);
+      }
+    }
+  }
+
+  // Conversion fails if an elided position has a value other than W1.
+  std::vector<uint8_t> bad_data = data;
+  int64_t index = 0;
+  while (!PartialHasWinningMove(PermAtMinIndex(index))) ++index;
+  bad_data[index] = 0;
+  std::filesystem::remove(filename);
+  assert(!WriteElidedFile(bad_data.data(), bad_data.size(), ElisionLevel::PARTIAL, 64, w1_byte, filename.c_str(), nullptr));
+  std::filesystem::remove(filename);
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+}
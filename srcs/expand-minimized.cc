@@ -20,6 +20,7 @@
 #include "perms.h"
 #include "position-value.h"
 #include "search.h"
+#include "thread-pool.h"
 
 #include <iostream>
 #include <optional>
@@ -30,6 +31,9 @@ namespace {
 // By default, use 1.5 times the number of cores.
 const int thread_count = (std::thread::hardware_concurrency() * 3 + 1) / 2;
 
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
 std::optional<MinimizedAccessor> acc;
 
 Value LookupValue(const Perm &perm) {
@@ -38,37 +42,23 @@ Value LookupValue(const Perm &perm) {
       RecalculateValue(*acc, perm);
 }
 
-void ExpandThread(int chunk, std::atomic<int> *next_part, uint8_t bytes[]) {
+void ExpandPart(int chunk, int part, uint8_t bytes[]) {
   const int64_t start_index = int64_t{chunk} * int64_t{chunk_size};
-  for (;;) {
-    const int part = (*next_part)++;
-    if (part + 1 >= thread_count) PrintChunkUpdate(chunk, part + 1 - thread_count);
-    if (part >= num_parts) break;  // note: will actually exceed num_parts!
-    int part_start = part * part_size;
-    Perm perm = PermAtIndex(start_index + part_start);
-    REP(i, part_size) {
-      bytes[part_start + i] = LookupValue(perm).byte;
-      std::next_permutation(perm.begin(), perm.end());
-    }
+  int part_start = part * part_size;
+  Perm perm = PermAtIndex(start_index + part_start);
+  REP(i, part_size) {
+    bytes[part_start + i] = LookupValue(perm).byte;
+    std::next_permutation(perm.begin(), perm.end());
   }
 }
 
 std::vector<uint8_t> Expand(int chunk) {
   std::vector<uint8_t> bytes(chunk_size);
-  std::atomic<int> next_part = 0;
-  if (thread_count == 0) {
-    // Single-threaded computation.
-    ExpandThread(chunk, &next_part, bytes.data());
-  } else {
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    threads.reserve(thread_count);
-    REP(i, thread_count) {
-      threads.emplace_back(ExpandThread, chunk, &next_part, bytes.data());
-    }
-    REP(i, thread_count) threads[i].join();
-    assert(next_part == num_parts + thread_count);
-  }
+  std::atomic<int> parts_done = 0;
+  ParallelFor(pool ? &*pool : nullptr, num_parts, thread_count, [&](size_t part) {
+    ExpandPart(chunk, part, bytes.data());
+    PrintChunkUpdate(chunk, ++parts_done);
+  });
   ClearChunkUpdate();
   return bytes;
 }
@@ -88,6 +78,7 @@ int main(int argc, char *argv[]) {
   int end_chunk = std::min(ParseInt(argv[3]), num_chunks);
 
   acc.emplace(argv[1]);
+  if (thread_count > 1) pool.emplace(thread_count - 1);
 
   FOR(chunk, start_chunk, end_chunk) {
     std::vector<uint8_t> bytes = Expand(chunk);
@@ -0,0 +1,468 @@
+#include "file-reader.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "accessors.h"
+#include "perms.h"
+#include "two-bit.h"
+
+#if _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// Maximum number of blocks combined into a single read.
+constexpr size_t max_blocks_per_read = 64;
+
+// A single read of `length` bytes at file offset `offset`, into `buffer`.
+struct ReadRequest {
+  int64_t offset;
+  size_t length;
+  uint8_t *buffer;
+};
+
+#if _WIN32
+
+using file_t = HANDLE;
+
+file_t OpenFile(const char *filename) {
+  HANDLE h = CreateFile(
+      filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_READONLY | FILE_FLAG_RANDOM_ACCESS, NULL);
+  if (h == INVALID_HANDLE_VALUE) {
+    std::cerr << "CreateFile() failed on file " << filename
+        << " error code " << GetLastError() << std::endl;
+    exit(1);
+  }
+  return h;
+}
+
+void CloseFile(file_t file) {
+  CloseHandle(file);
+}
+
+// Reads exactly `length` bytes. Returns false on error or end of file.
+bool ReadFully(file_t file, const ReadRequest &request) {
+  size_t done = 0;
+  while (done < request.length) {
+    const int64_t offset = request.offset + done;
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD bytes_read = 0;
+    if (!ReadFile(file, request.buffer + done, request.length - done, &bytes_read, &overlapped) ||
+        bytes_read == 0) {
+      return false;
+    }
+    done += bytes_read;
+  }
+  return true;
+}
+
+#else  // POSIX
+
+using file_t = int;
+
+file_t OpenFile(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    std::cerr << "Failed to open() " << filename << std::endl;
+    exit(1);
+  }
+#ifdef POSIX_FADV_RANDOM
+  // We choose the read size ourselves, so disable kernel readahead.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+  return fd;
+}
+
+void CloseFile(file_t file) {
+  close(file);
+}
+
+// Reads exactly `length` bytes. Returns false on error or end of file.
+bool ReadFully(file_t file, const ReadRequest &request) {
+  size_t done = 0;
+  while (done < request.length) {
+    ssize_t n = pread(file, request.buffer + done, request.length - done, request.offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+#endif  // POSIX
+
+#if HAVE_IO_URING
+
+// Minimal io_uring wrapper using the raw system calls, so we don't depend on
+// liburing. A ring must only be used by one thread at a time.
+class IoUring {
+public:
+  // Returns null if io_uring is not supported by the kernel (or blocked).
+  static std::unique_ptr<IoUring> Create(unsigned entries) {
+    std::unique_ptr<IoUring> ring(new IoUring());
+    return ring->Init(entries) ? std::move(ring) : nullptr;
+  }
+
+  ~IoUring() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+    if (ring_fd >= 0) close(ring_fd);
+  }
+
+  // Executes all read requests, keeping up to `entries` reads in flight.
+  // Requests that fail (e.g. because the kernel doesn't support
+  // IORING_OP_READ) or that return fewer bytes than requested are completed
+  // with ReadFully(). Returns false if any read fails.
+  bool ReadAll(int fd, const std::vector<ReadRequest> &requests) {
+    size_t next = 0;       // next request to queue
+    size_t completed = 0;  // number of completed requests
+    unsigned in_flight = 0;
+    unsigned unsubmitted = 0;
+    bool success = true;
+    while (completed < requests.size()) {
+      // Queue as many requests as fit.
+      unsigned tail = *sq_tail;
+      while (next < requests.size() && in_flight < entries) {
+        const ReadRequest &request = requests[next];
+        const unsigned index = tail & *sq_mask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(request.buffer);
+        sqe->len = request.length;
+        sqe->off = request.offset;
+        sqe->user_data = next;
+        sq_array[index] = index;
+        ++tail;
+        ++next;
+        ++in_flight;
+        ++unsubmitted;
+      }
+      __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+      // Submit queued requests and wait for at least one completion.
+      int ret = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        std::cerr << "io_uring_enter() failed: " << strerror(errno) << std::endl;
+        return false;
+      }
+      unsubmitted -= ret;
+
+      // Reap completions.
+      unsigned head = *cq_head;
+      const unsigned cq_tail_value = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != cq_tail_value; ++head) {
+        const io_uring_cqe &cqe = cqes[head & *cq_mask];
+        const ReadRequest &request = requests[cqe.user_data];
+        if (cqe.res < 0 || size_t(cqe.res) < request.length) {
+          // Complete the rest of the read synchronously.
+          const size_t done = cqe.res < 0 ? 0 : cqe.res;
+          ReadRequest rest = {int64_t(request.offset + done), request.length - done, request.buffer + done};
+          success = ReadFully(fd, rest) && success;
+        }
+        --in_flight;
+        ++completed;
+      }
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    return success;
+  }
+
+private:
+  IoUring() {}
+
+  bool Init(unsigned requested_entries) {
+    io_uring_params params = {};
+    ring_fd = syscall(__NR_io_uring_setup, requested_entries, &params);
+    if (ring_fd < 0) return false;
+    entries = params.sq_entries;
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_size = cq_size = std::max(sq_size, cq_size);
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return false;
+    cq_ptr = single_mmap ? sq_ptr :
+        mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) return false;
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(
+        mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) return false;
+
+    char *sq = static_cast<char*>(sq_ptr);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char *cq = static_cast<char*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  int ring_fd = -1;
+  unsigned entries = 0;
+  void *sq_ptr = MAP_FAILED;
+  void *cq_ptr = MAP_FAILED;
+  size_t sq_size = 0;
+  size_t cq_size = 0;
+  io_uring_sqe *sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqes_size = 0;
+  unsigned *sq_tail = nullptr;
+  unsigned *sq_mask = nullptr;
+  unsigned *sq_array = nullptr;
+  unsigned *cq_head = nullptr;
+  unsigned *cq_tail = nullptr;
+  unsigned *cq_mask = nullptr;
+  io_uring_cqe *cqes = nullptr;
+};
+
+#else  // !HAVE_IO_URING
+
+// Placeholder for platforms without io_uring.
+class IoUring {
+public:
+  static std::unique_ptr<IoUring> Create(unsigned) { return nullptr; }
+
+  bool ReadAll(file_t, const std::vector<ReadRequest>&) { return false; }
+};
+
+#endif  // !HAVE_IO_URING
+
+}  // namespace
+
+bool ParseFileReadPolicy(const std::string &s, FileReadPolicy *policy) {
+  FileReadPolicy result;
+  std::istringstream iss(s);
+  std::string option;
+  while (std::getline(iss, option, ',')) {
+    std::string key = option, value;
+    if (size_t i = option.find('='); i != std::string::npos) {
+      key = option.substr(0, i);
+      value = option.substr(i + 1);
+    }
+    if (key == "auto" && value.empty()) {
+      result.method = FileReadPolicy::Method::AUTO;
+    } else if (key == "uring" && value.empty()) {
+      result.method = FileReadPolicy::Method::IO_URING;
+    } else if (key == "pread" && value.empty()) {
+      result.method = FileReadPolicy::Method::PREAD;
+    } else if (key == "read" && ParseByteSize(value, &result.read_size) &&
+        result.read_size > 0 && std::has_single_bit(result.read_size)) {
+      // Parsed successfully.
+    } else if (int depth = 0; key == "depth" && (std::istringstream(value) >> depth) && depth > 0) {
+      result.queue_depth = depth;
+    } else {
+      std::cerr << "Invalid file read option: " << option << std::endl;
+      return false;
+    }
+  }
+  *policy = result;
+  return true;
+}
+
+class BatchFileReader::Impl {
+public:
+  Impl(const char *filename, const FileReadPolicy &policy) :
+      policy(policy),
+      file_size(std::filesystem::file_size(filename)),
+      file(OpenFile(filename)) {
+    if (policy.method != FileReadPolicy::Method::PREAD) {
+      // Create one ring up front, to find out whether io_uring works.
+      if (auto ring = IoUring::Create(policy.queue_depth)) {
+        free_rings.push_back(std::move(ring));
+        use_io_uring = true;
+      } else if (policy.method == FileReadPolicy::Method::IO_URING) {
+        std::cerr << "io_uring is not available!" << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  ~Impl() {
+    CloseFile(file);
+  }
+
+  void ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) {
+    // Check that offsets nonnegative and in nondecreasing order.
+    assert(count == 0 || offsets[0] >= 0);
+    assert(std::is_sorted(&offsets[0], &offsets[count]));
+    if (count == 0) return;
+    if (offsets[count - 1] >= file_size) {
+      std::cerr << "Offset out of bounds: " << offsets[count - 1] << std::endl;
+      exit(1);
+    }
+
+    // Determine which aligned ranges to read. Offsets in the same or adjacent
+    // blocks are combined into one read, up to a maximum read length.
+    const int64_t block_size = policy.read_size;
+    const int64_t max_length = block_size * max_blocks_per_read;
+    struct Range {
+      int64_t begin, end;
+    };
+    std::vector<Range> ranges;
+    for (size_t i = 0; i < count; ++i) {
+      const int64_t begin = offsets[i] / block_size * block_size;
+      const int64_t end = std::min(begin + block_size, file_size);
+      if (!ranges.empty() && begin <= ranges.back().end && end - ranges.back().begin <= max_length) {
+        ranges.back().end = std::max(ranges.back().end, end);
+      } else {
+        ranges.push_back(Range{begin, end});
+      }
+    }
+
+    size_t total_length = 0;
+    for (const Range &range : ranges) total_length += range.end - range.begin;
+    std::vector<uint8_t> buffer(total_length);
+    std::vector<ReadRequest> requests;
+    requests.reserve(ranges.size());
+    size_t buffer_pos = 0;
+    for (const Range &range : ranges) {
+      const size_t length = range.end - range.begin;
+      requests.push_back(ReadRequest{range.begin, length, buffer.data() + buffer_pos});
+      buffer_pos += length;
+    }
+
+    if (!Execute(requests)) {
+      std::cerr << "Failed to read from file!" << std::endl;
+      exit(1);
+    }
+
+    // Extract the requested bytes. Both offsets and ranges are sorted.
+    size_t r = 0;
+    for (size_t i = 0; i < count; ++i) {
+      while (offsets[i] >= ranges[r].end) ++r;
+      assert(offsets[i] >= ranges[r].begin);
+      bytes[i] = requests[r].buffer[offsets[i] - ranges[r].begin];
+    }
+  }
+
+  int64_t GetFileSize() const { return file_size; }
+
+  bool UsesIoUring() const { return use_io_uring; }
+
+private:
+  bool Execute(const std::vector<ReadRequest> &requests) {
+    // A single read is not worth the io_uring overhead.
+    if (!use_io_uring || requests.size() == 1) {
+      for (const ReadRequest &request : requests) {
+        if (!ReadFully(file, request)) return false;
+      }
+      return true;
+    }
+    std::unique_ptr<IoUring> ring = AcquireRing();
+    if (!ring) return false;
+    bool success = ring->ReadAll(file, requests);
+    ReleaseRing(std::move(ring));
+    return success;
+  }
+
+  // Rings are reused between calls; concurrent calls each get their own ring.
+  std::unique_ptr<IoUring> AcquireRing() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!free_rings.empty()) {
+        std::unique_ptr<IoUring> ring = std::move(free_rings.back());
+        free_rings.pop_back();
+        return ring;
+      }
+    }
+    return IoUring::Create(policy.queue_depth);
+  }
+
+  void ReleaseRing(std::unique_ptr<IoUring> ring) {
+    std::lock_guard<std::mutex> lock(mutex);
+    free_rings.push_back(std::move(ring));
+  }
+
+  const FileReadPolicy policy;
+  const int64_t file_size;
+  const file_t file;
+  bool use_io_uring = false;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<IoUring>> free_rings;
+};
+
+BatchFileReader::BatchFileReader(const char *filename, const FileReadPolicy &policy)
+  : impl(std::make_unique<Impl>(filename, policy)) {}
+
+BatchFileReader::BatchFileReader(BatchFileReader&&) = default;
+
+BatchFileReader::~BatchFileReader() = default;
+
+int64_t BatchFileReader::GetFileSize() const {
+  return impl->GetFileSize();
+}
+
+bool BatchFileReader::UsesIoUring() const {
+  return impl->UsesIoUring();
+}
+
+void BatchFileReader::ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const {
+  impl->ReadBytes(offsets, bytes, count);
+}
+
+ReadRnAccessor::ReadRnAccessor(const char *filename, const FileReadPolicy &policy)
+  : reader(filename, policy),
+    // Same detection logic as AnyRnAccessor.
+    two_bit(reader.GetFileSize() >= int64_t(TwoBitRnAccessor::num_words * sizeof(uint64_t))) {
+  if (!two_bit && reader.GetFileSize() != total_perms / 5) {
+    std::cerr << "Unexpected size of phase file " << filename << ": "
+        << reader.GetFileSize() << " bytes." << std::endl;
+    exit(1);
+  }
+}
+
+void ReadRnAccessor::GetBatch(const int64_t *indices, Outcome *outcomes, size_t count) const {
+  // Sort byte offsets, remembering which index each belongs to.
+  std::vector<std::pair<int64_t, size_t>> sorted(count);
+  for (size_t i = 0; i < count; ++i) {
+    assert(indices[i] >= 0 && indices[i] < total_perms);
+    // In the 2-bit format, value i is stored in bits 2*(i%32) of
+    // little-endian word i/32, which is byte i/4.
+    sorted[i] = {two_bit ? indices[i] / 4 : indices[i] / 5, i};
+  }
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<int64_t> offsets(count);
+  for (size_t i = 0; i < count; ++i) offsets[i] = sorted[i].first;
+  std::vector<uint8_t> bytes = reader.ReadBytes(offsets);
+  for (size_t i = 0; i < count; ++i) {
+    const size_t j = sorted[i].second;
+    const int64_t index = indices[j];
+    outcomes[j] = static_cast<Outcome>(two_bit ?
+        (bytes[i] >> (2 * (index % 4))) & 3 :
+        DecodeTernary(bytes[i], index));
+  }
+}
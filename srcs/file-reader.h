@@ -0,0 +1,113 @@
+#ifndef FILE_READER_H_INCLUDED
+#define FILE_READER_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "board.h"
+
+// Reading data files with explicit positioned reads instead of MemMap().
+//
+// With a memory-mapped file, every random lookup in a page that is not in the
+// page cache causes a synchronous page fault, and the kernel decides how much
+// to read ahead. That's fine once the cache is warm, but on a cold cache (e.g.
+// right after a container starts, or with network-attached storage) lookups
+// are dominated by faults that are serviced one at a time.
+//
+// BatchFileReader instead reads aligned blocks of a configurable size, and
+// submits all reads of a batch at once through io_uring (on Linux), so that
+// the storage device can service them in parallel. If io_uring is not
+// available (e.g. because it's disabled in a sandbox), it falls back to
+// pread(), one read at a time.
+
+// Policy that controls how BatchFileReader reads files.
+struct FileReadPolicy {
+  enum class Method : char { AUTO, IO_URING, PREAD };
+
+  // AUTO uses io_uring if available, and pread() otherwise.
+  Method method = Method::AUTO;
+
+  // Size of each read in bytes (a power of 2). Reads are aligned to this size.
+  size_t read_size = 4096;
+
+  // Maximum number of reads in flight with io_uring.
+  int queue_depth = 64;
+};
+
+// Parses a policy from a comma-separated list of options:
+//
+//   auto, uring, pread   read method
+//   read=<size>          size of each read (e.g. 4K; powers of 2 only)
+//   depth=<n>            io_uring queue depth
+//
+// For example: "uring,read=16K,depth=128". Returns false if the string is
+// invalid.
+bool ParseFileReadPolicy(const std::string &s, FileReadPolicy *policy);
+
+// Reads bytes from a file with batched positioned reads. Thread-safe.
+class BatchFileReader {
+public:
+  // Exits if the file cannot be opened, or if the policy requires io_uring
+  // and it's not available.
+  BatchFileReader(const char *filename, const FileReadPolicy &policy);
+  BatchFileReader(BatchFileReader&&);
+  ~BatchFileReader();
+
+  int64_t GetFileSize() const;
+
+  // Returns whether reads are submitted through io_uring.
+  bool UsesIoUring() const;
+
+  // Reads `count` bytes at the given file offsets.
+  //
+  // Offsets must be between 0 and the file size (exclusive), and must be in
+  // nondecreasing order (duplicates are allowed). All offsets are read in a
+  // single batch; offsets that fall in the same or adjacent blocks are
+  // combined into a single read.
+  void ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const;
+
+  // Convenience method for ReadBytes() above.
+  std::vector<uint8_t> ReadBytes(const std::vector<int64_t> &offsets) const {
+    std::vector<uint8_t> bytes(offsets.size());
+    ReadBytes(offsets.data(), bytes.data(), offsets.size());
+    return bytes;
+  }
+
+  uint8_t ReadByte(int64_t offset) const {
+    uint8_t byte = 0;
+    ReadBytes(&offset, &byte, 1);
+    return byte;
+  }
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+// Accessor for phase result files in the ternary or the 2-bit format (see
+// AnyRnAccessor in accessors.h) that uses a BatchFileReader instead of
+// memory-mapping the file. The format is detected from the file size.
+class ReadRnAccessor {
+public:
+  ReadRnAccessor(const char *filename, const FileReadPolicy &policy);
+
+  Outcome operator[](int64_t i) const {
+    Outcome outcome;
+    GetBatch(&i, &outcome, 1);
+    return outcome;
+  }
+
+  // Looks up the values at `count` indices (in any order) in a single batch,
+  // and writes them to `outcomes`.
+  void GetBatch(const int64_t *indices, Outcome *outcomes, size_t count) const;
+
+  const BatchFileReader &Reader() const { return reader; }
+
+private:
+  BatchFileReader reader;
+  bool two_bit;
+};
+
+#endif  // ndef FILE_READER_H_INCLUDED
@@ -0,0 +1,83 @@
+#include "file-reader.h"
+#include "macros.h"
+#include "random.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+void TestParsePolicy() {
+  FileReadPolicy policy;
+  assert(ParseFileReadPolicy("", &policy));
+  assert(policy.method == FileReadPolicy::Method::AUTO);
+  assert(ParseFileReadPolicy("pread,read=16K,depth=8", &policy));
+  assert(policy.method == FileReadPolicy::Method::PREAD);
+  assert(policy.read_size == 16384);
+  assert(policy.queue_depth == 8);
+  assert(ParseFileReadPolicy("uring", &policy));
+  assert(policy.method == FileReadPolicy::Method::IO_URING);
+  assert(policy.read_size == 4096);
+  assert(!ParseFileReadPolicy("read=3000", &policy));
+  assert(!ParseFileReadPolicy("depth=0", &policy));
+  assert(!ParseFileReadPolicy("mmap", &policy));
+}
+
+void TestReadBytes() {
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("file_reader_test." + std::to_string(getpid()) + ".bin");
+  // Not a multiple of the read size, to test reads at the end of the file.
+  std::vector<uint8_t> data(1000000 + 123);
+  for (uint8_t &byte : data) byte = RandInt(0, 255);
+  {
+    std::ofstream ofs(filename, std::ofstream::binary);
+    ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+    assert(ofs);
+  }
+
+  for (FileReadPolicy::Method method : {FileReadPolicy::Method::AUTO, FileReadPolicy::Method::PREAD}) {
+    for (size_t read_size : {512, 4096, 65536}) {
+      // A small queue depth to test that requests are queued in rounds.
+      FileReadPolicy policy = {.method = method, .read_size = read_size, .queue_depth = 4};
+      BatchFileReader reader(filename.c_str(), policy);
+      assert(reader.GetFileSize() == int64_t(data.size()));
+      assert(reader.ReadByte(0) == data[0]);
+      assert(reader.ReadByte(data.size() - 1) == data.back());
+
+      for (int count : {0, 1, 10, 1000, 100000}) {
+        std::vector<int64_t> offsets(count);
+        for (int64_t &offset : offsets) offset = RandInt(0, data.size() - 1);
+        std::sort(offsets.begin(), offsets.end());
+        std::vector<uint8_t> bytes = reader.ReadBytes(offsets);
+        REP(i, count) assert(bytes[i] == data[offsets[i]]);
+      }
+    }
+  }
+  std::filesystem::remove(filename);
+}
+
+}  // namespace
+
+int main() {
+  TestParsePolicy();
+  TestReadBytes();
+}
@@ -0,0 +1,141 @@
+#include "hot-tier.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "hash.h"
+
+#if !_WIN32
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+struct Header {
+  char magic[8];
+  uint64_t count;
+  uint64_t source_size;
+  sha256_hash_t checksum;
+  char padding[8];
+};
+static_assert(sizeof(Header) == 64);
+
+bool IsStrictlyIncreasing(const std::vector<int64_t> &offsets) {
+  return std::adjacent_find(offsets.begin(), offsets.end(), std::greater_equal<int64_t>()) == offsets.end();
+}
+
+}  // namespace
+
+bool HotTier::IsHotTierFile(const char *filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  char buf[sizeof(magic)];
+  return ifs.read(buf, sizeof(buf)) && memcmp(buf, magic, sizeof(magic)) == 0;
+}
+
+bool HotTier::Write(
+    const char *filename, const std::vector<int64_t> &offsets, const std::vector<uint8_t> &values,
+    uint64_t source_size) {
+  assert(offsets.size() == values.size());
+  assert(IsStrictlyIncreasing(offsets));
+  Header header = {};
+  memcpy(header.magic, magic, sizeof(magic));
+  header.count = offsets.size();
+  header.source_size = source_size;
+  ComputeSha256(values.data(), values.size(), header.checksum);
+  std::ofstream ofs(filename, std::ofstream::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(int64_t));
+  ofs.write(reinterpret_cast<const char*>(values.data()), values.size());
+  ofs.close();
+  if (!ofs) {
+    std::cerr << "Failed to write " << filename << "!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+HotTier::HotTier(const char *filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs) {
+    std::cerr << "Could not open hot tier " << filename << std::endl;
+    exit(1);
+  }
+  Header header;
+  if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      std::filesystem::file_size(filename) != sizeof(header) + header.count * (sizeof(int64_t) + 1)) {
+    std::cerr << filename << " is not a valid hot tier file!" << std::endl;
+    exit(1);
+  }
+  offsets.resize(header.count);
+  values.resize(header.count);
+  ifs.read(reinterpret_cast<char*>(offsets.data()), offsets.size() * sizeof(int64_t));
+  ifs.read(reinterpret_cast<char*>(values.data()), values.size());
+  sha256_hash_t checksum;
+  ComputeSha256(values.data(), values.size(), checksum);
+  if (!ifs || !IsStrictlyIncreasing(offsets) || checksum != header.checksum) {
+    std::cerr << "Hot tier " << filename << " is corrupt!" << std::endl;
+    exit(1);
+  }
+  source_size = header.source_size;
+  Lock();
+}
+
+HotTier::HotTier(
+    std::vector<int64_t> offsets_arg, std::vector<uint8_t> values_arg, uint64_t source_size)
+    : offsets(std::move(offsets_arg)), values(std::move(values_arg)), source_size(source_size) {
+  assert(offsets.size() == values.size());
+  assert(IsStrictlyIncreasing(offsets));
+}
+
+void HotTier::Lock() {
+#if !_WIN32
+  if (offsets.empty()) return;
+  if (mlock(offsets.data(), offsets.size() * sizeof(int64_t)) != 0 ||
+      mlock(values.data(), values.size()) != 0) {
+    std::cerr << "WARNING: mlock() failed on hot tier (check RLIMIT_MEMLOCK)" << std::endl;
+  }
+#endif
+}
+
+std::optional<uint8_t> HotTier::Lookup(int64_t offset) const {
+  auto it = std::lower_bound(offsets.begin(), offsets.end(), offset);
+  if (it == offsets.end() || *it != offset) {
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return {};
+  }
+  hits.fetch_add(1, std::memory_order_relaxed);
+  return values[it - offsets.begin()];
+}
+
+void HotTier::LookupSorted(
+    const int64_t *query, uint8_t *bytes, size_t n, std::vector<size_t> *missing) const {
+  // Since the queries are sorted, each search can start where the previous
+  // one ended.
+  auto it = offsets.begin();
+  int64_t found = 0;
+  for (size_t i = 0; i < n; ++i) {
+    assert(i == 0 || query[i - 1] <= query[i]);
+    it = std::lower_bound(it, offsets.end(), query[i]);
+    if (it != offsets.end() && *it == query[i]) {
+      bytes[i] = values[it - offsets.begin()];
+      ++found;
+    } else {
+      missing->push_back(i);
+    }
+  }
+  hits.fetch_add(found, std::memory_order_relaxed);
+  misses.fetch_add(n - found, std::memory_order_relaxed);
+}
+
+HotTier::Stats HotTier::GetStats() const {
+  return Stats{
+    .hits = hits.load(std::memory_order_relaxed),
+    .misses = misses.load(std::memory_order_relaxed),
+  };
+}
@@ -0,0 +1,98 @@
+#ifndef HOT_TIER_H_INCLUDED
+#define HOT_TIER_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Small in-memory table with the values of frequently queried positions
+// (conventionally named "minimized.bin.hot"), which MinimizedAccessor checks
+// before falling through to the data file. Lookups are heavily skewed towards
+// a few positions (e.g. early-game positions), so keeping their values in RAM
+// avoids most block decompressions when the data file is compressed.
+//
+// The table is built by the build-hot-tier tool, from an access log or a list
+// of positions, and it is locked in memory when it is loaded.
+//
+// Since the values are copies, a table is only valid for the data file it was
+// built from. The header records the uncompressed size of that file, which
+// MinimizedAccessor::LoadHotTier() checks, and a checksum of the values, which
+// is verified when the table is loaded. The size is the same for all formats,
+// so a table built from minimized.bin can be used with minimized.bin.xz.
+//
+// File layout (all integers little-endian):
+//
+//   header (64 bytes):
+//     char[8]  magic "PFHOTT2\n"
+//     uint64   number of entries (N)
+//     uint64   uncompressed size of the source data file in bytes
+//     uint8[32] SHA-256 checksum of the values
+//     padding
+//   int64[N]   minimized indices, in increasing order
+//   uint8[N]   the corresponding bytes of minimized.bin
+class HotTier {
+public:
+  static constexpr char magic[8] = {'P', 'F', 'H', 'O', 'T', 'T', '2', '\n'};
+
+  struct Stats {
+    // Offsets that were found in the table.
+    int64_t hits = 0;
+
+    // Offsets that were not found in the table.
+    int64_t misses = 0;
+  };
+
+  static bool IsHotTierFile(const char *filename);
+
+  // Writes a table to a file. `offsets` must be strictly increasing, and
+  // `values` must have the same size. `source_size` is the uncompressed size
+  // of the data file the values were read from. Returns false on failure.
+  static bool Write(
+      const char *filename, const std::vector<int64_t> &offsets, const std::vector<uint8_t> &values,
+      uint64_t source_size);
+
+  // Loads the table from a file, and locks it in memory (failure to lock is
+  // not an error). Exits if the file is invalid, or if the checksum of the
+  // values doesn't match.
+  explicit HotTier(const char *filename);
+
+  // Creates a table directly. Same requirements as Write().
+  HotTier(std::vector<int64_t> offsets, std::vector<uint8_t> values, uint64_t source_size = 0);
+
+  HotTier(const HotTier&) = delete;
+  HotTier &operator=(const HotTier&) = delete;
+
+  // Number of entries in the table.
+  size_t size() const { return offsets.size(); }
+
+  // Uncompressed size of the data file the values were read from.
+  uint64_t SourceSize() const { return source_size; }
+
+  const std::vector<int64_t> &Offsets() const { return offsets; }
+
+  const std::vector<uint8_t> &Values() const { return values; }
+
+  // Returns the value at the given offset, if it is in the table.
+  std::optional<uint8_t> Lookup(int64_t offset) const;
+
+  // Looks up `n` offsets, which must be in nondecreasing order. For offsets
+  // that are found, the value is written to bytes[i]. The indices of offsets
+  // that are not found are appended to `missing`.
+  void LookupSorted(
+      const int64_t *offsets, uint8_t *bytes, size_t n, std::vector<size_t> *missing) const;
+
+  Stats GetStats() const;
+
+private:
+  void Lock();
+
+  std::vector<int64_t> offsets;
+  std::vector<uint8_t> values;
+  uint64_t source_size = 0;
+
+  mutable std::atomic<int64_t> hits = 0;
+  mutable std::atomic<int64_t> misses = 0;
+};
+
+#endif  // ndef HOT_TIER_H_INCLUDED
@@ -0,0 +1,133 @@
+#include "hot-tier.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "random.h"
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+// Returns a random table with `n` entries, as a map from offset to value.
+std::map<int64_t, uint8_t> RandomTable(size_t n) {
+  std::map<int64_t, uint8_t> table;
+  std::uniform_int_distribution<int64_t> offset_dist(0, 100000);
+  while (table.size() < n) table[offset_dist(rng)] = rng();
+  return table;
+}
+
+HotTier CreateHotTier(const std::map<int64_t, uint8_t> &table) {
+  std::vector<int64_t> offsets;
+  std::vector<uint8_t> values;
+  for (const auto &[offset, value] : table) {
+    offsets.push_back(offset);
+    values.push_back(value);
+  }
+  return HotTier(std::move(offsets), std::move(values));
+}
+
+void TestLookup() {
+  for (size_t n : {0, 1, 2, 100, 10000}) {
+    const std::map<int64_t, uint8_t> table = RandomTable(n);
+    const HotTier hot_tier = CreateHotTier(table);
+    assert(hot_tier.size() == n);
+
+    int64_t hits = 0, misses = 0;
+    for (int64_t offset = 0; offset <= 1000; ++offset) {
+      std::optional<uint8_t> value = hot_tier.Lookup(offset);
+      auto it = table.find(offset);
+      if (it == table.end()) {
+        assert(!value);
+        ++misses;
+      } else {
+        assert(value == it->second);
+        ++hits;
+      }
+    }
+    HotTier::Stats stats = hot_tier.GetStats();
+    assert(stats.hits == hits);
+    assert(stats.misses == misses);
+  }
+}
+
+void TestLookupSorted() {
+  const std::map<int64_t, uint8_t> table = RandomTable(1000);
+  const HotTier hot_tier = CreateHotTier(table);
+
+  // Half of the queries are in the table, some of them duplicated.
+  std::vector<int64_t> offsets;
+  for (const auto &[offset, value] : table) {
+    if (rng() % 2) offsets.push_back(offset);
+    if (rng() % 10 == 0) offsets.push_back(offset);
+  }
+  std::uniform_int_distribution<int64_t> offset_dist(0, 100000);
+  for (size_t i = 0, n = offsets.size(); i < n; ++i) offsets.push_back(offset_dist(rng));
+  std::sort(offsets.begin(), offsets.end());
+
+  std::vector<uint8_t> bytes(offsets.size(), 0xff);
+  std::vector<size_t> missing;
+  hot_tier.LookupSorted(offsets.data(), bytes.data(), offsets.size(), &missing);
+  assert(std::is_sorted(missing.begin(), missing.end()));
+  size_t j = 0;
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    auto it = table.find(offsets[i]);
+    if (it == table.end()) {
+      assert(j < missing.size() && missing[j++] == i);
+      assert(bytes[i] == 0xff);
+    } else {
+      assert(bytes[i] == it->second);
+    }
+  }
+  assert(j == missing.size());
+
+  HotTier::Stats stats = hot_tier.GetStats();
+  assert(stats.hits == static_cast<int64_t>(offsets.size() - missing.size()));
+  assert(stats.misses == static_cast<int64_t>(missing.size()));
+}
+
+void TestFile() {
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("hot_tier_test." + std::to_string(getpid()) + ".hot");
+  const std::map<int64_t, uint8_t> table = RandomTable(1000);
+  std::vector<int64_t> offsets;
+  std::vector<uint8_t> values;
+  for (const auto &[offset, value] : table) {
+    offsets.push_back(offset);
+    values.push_back(value);
+  }
+  assert(HotTier::Write(filename.c_str(), offsets, values, 123456789));
+  assert(HotTier::IsHotTierFile(filename.c_str()));
+  assert(std::filesystem::file_size(filename) == 64 + 9 * table.size());
+
+  const HotTier hot_tier(filename.c_str());
+  assert(hot_tier.size() == table.size());
+  assert(hot_tier.SourceSize() == 123456789);
+  assert(hot_tier.Offsets() == offsets);
+  assert(hot_tier.Values() == values);
+  for (const auto &[offset, value] : table) assert(hot_tier.Lookup(offset) == value);
+  assert(!hot_tier.Lookup(-1));
+  assert(!hot_tier.Lookup(100001));
+
+  std::filesystem::remove(filename);
+  assert(!HotTier::IsHotTierFile(filename.c_str()));
+}
+
+}  // namespace
+
+int main() {
+  TestLookup();
+  TestLookupSorted();
+  TestFile();
+}
@@ -0,0 +1,331 @@
+#include "huffman-accessor.h"
+
+#include <lzma.h>
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "bytes.h"
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little);
+
+struct Header {
+  char magic[8];
+  uint64_t uncompressed_size;
+  uint64_t num_blocks;
+  uint32_t block_size;
+  uint16_t num_symbols;
+  uint8_t run_byte;
+  uint8_t reserved;
+};
+static_assert(sizeof(Header) == 32);
+
+constexpr size_t RoundUp8(size_t n) { return (n + 7) & ~size_t{7}; }
+
+constexpr size_t code_lengths_offset = sizeof(Header);
+constexpr size_t block_offsets_offset =
+    code_lengths_offset + RoundUp8(HuffmanAccessor::num_symbols);
+
+size_t BlockChecksumsOffset(size_t num_blocks) {
+  return block_offsets_offset + (num_blocks + 1) * sizeof(uint64_t);
+}
+
+size_t BlockDataOffset(size_t num_blocks) {
+  return RoundUp8(BlockChecksumsOffset(num_blocks) + num_blocks * sizeof(uint32_t));
+}
+
+// Number of bytes of padding after the block data.
+constexpr size_t tail_padding = 8;
+
+// Calls emit(symbol) for each symbol in the encoding of the given bytes.
+template<class Emit>
+void Tokenize(const uint8_t *data, size_t size, uint8_t run_byte, Emit &&emit) {
+  size_t i = 0;
+  while (i < size) {
+    if (data[i] != run_byte) {
+      emit(data[i++]);
+      continue;
+    }
+    size_t j = i + 1;
+    while (j < size && data[j] == run_byte) ++j;
+    const size_t length = j - i;
+    for (int k = HuffmanAccessor::num_run_tokens - 1; k >= 0; --k) {
+      if ((length >> (k + 1)) & 1) emit(256 + k);
+    }
+    if (length & 1) emit(run_byte);
+    i = j;
+  }
+}
+
+// Validates the header and index of a mapped file, and returns the code
+// lengths. Exits if the file is invalid.
+std::vector<uint8_t> ReadCodeLengths(const DynMappedFile<uint8_t> &file) {
+  const uint8_t *data = file.data();
+  const size_t size = file.size();
+  Header header;
+  if (size < sizeof(header)) {
+    std::cerr << "Huffman file too short!" << std::endl;
+    exit(1);
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, HuffmanAccessor::magic, sizeof(header.magic)) != 0 ||
+      header.num_symbols != HuffmanAccessor::num_symbols ||
+      header.block_size == 0 || header.block_size > HuffmanAccessor::max_block_size ||
+      header.num_blocks != (header.uncompressed_size + header.block_size - 1) / header.block_size ||
+      size < BlockDataOffset(header.num_blocks) + tail_padding) {
+    std::cerr << "Invalid Huffman file header!" << std::endl;
+    exit(1);
+  }
+  const uint64_t *offsets = reinterpret_cast<const uint64_t*>(data + block_offsets_offset);
+  const uint64_t data_start = BlockDataOffset(header.num_blocks);
+  if (offsets[0] != data_start || offsets[header.num_blocks] + tail_padding != size ||
+      !std::is_sorted(offsets, offsets + header.num_blocks + 1)) {
+    std::cerr << "Invalid Huffman file index!" << std::endl;
+    exit(1);
+  }
+  std::vector<uint8_t> lengths(
+      data + code_lengths_offset, data + code_lengths_offset + HuffmanAccessor::num_symbols);
+  if (!ValidateHuffmanCodeLengths(lengths)) {
+    std::cerr << "Invalid Huffman code lengths!" << std::endl;
+    exit(1);
+  }
+  return lengths;
+}
+
+}  // namespace
+
+bool HuffmanAccessor::IsHuffmanFile(const char *filepath) {
+  std::ifstream ifs(filepath, std::ifstream::binary);
+  if (!ifs) return false;
+
+  char buffer[sizeof(magic)] = {};
+  if (!ifs.read(buffer, sizeof(buffer))) return false;
+  return memcmp(buffer, magic, sizeof(magic)) == 0;
+}
+
+HuffmanAccessor::HuffmanAccessor(const char *filepath) :
+    mapped_file(filepath),
+    decoder(ReadCodeLengths(mapped_file)) {
+  Header header;
+  memcpy(&header, mapped_file.data(), sizeof(header));
+  uncompressed_size = header.uncompressed_size;
+  num_blocks = header.num_blocks;
+  block_size = header.block_size;
+  run_byte = header.run_byte;
+  block_offsets = reinterpret_cast<const uint64_t*>(mapped_file.data() + block_offsets_offset);
+  block_checksums = reinterpret_cast<const uint32_t*>(
+      mapped_file.data() + BlockChecksumsOffset(num_blocks));
+  verified = std::make_unique<std::atomic<bool>[]>(num_blocks);
+}
+
+bool HuffmanAccessor::IsBlockValid(int64_t block) const {
+  const uint8_t *data = mapped_file.data() + block_offsets[block];
+  const size_t size = block_offsets[block + 1] - block_offsets[block];
+  return lzma_crc32(data, size, 0) == block_checksums[block];
+}
+
+void HuffmanAccessor::CheckBlock(int64_t block) const {
+  if (verified[block].load(std::memory_order_acquire)) return;
+  if (!IsBlockValid(block)) {
+    std::cerr << "Checksum mismatch in Huffman block " << block << "!" << std::endl;
+    exit(1);
+  }
+  verified[block].store(true, std::memory_order_release);
+}
+
+void HuffmanAccessor::ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const {
+  // Check that offsets nonnegative and in nondecreasing order.
+  assert(count == 0 || offsets[0] >= 0);
+  assert(std::is_sorted(&offsets[0], &offsets[count]));
+
+  if (count > 0 && offsets[count - 1] >= uncompressed_size) {
+    std::cerr << "Offset out of bounds: " << offsets[count - 1] << std::endl;
+    exit(1);
+  }
+
+  // Group offsets by block, as in XzAccessor::ReadBytes().
+  struct Group {
+    int64_t block;
+    size_t begin, end;  // range of offsets
+  };
+  std::vector<Group> groups;
+  size_t i = 0;
+  while (i < count) {
+    const int64_t block = offsets[i] / block_size;
+    const int64_t block_end = (block + 1) * block_size;
+    size_t j = i + 1;
+    while (j < count && offsets[j] < block_end) ++j;
+    groups.push_back(Group{block, i, j});
+    i = j;
+  }
+
+  auto read_group = [&](size_t k) {
+    const Group &group = groups[k];
+    CheckBlock(group.block);
+    if (!DecodeBlockBytes(group.block, offsets + group.begin, bytes + group.begin, group.end - group.begin)) {
+      std::cerr << "Corrupt data in Huffman block " << group.block << "!" << std::endl;
+      exit(1);
+    }
+  };
+  if (groups.size() >= parallel_min_blocks) {
+    ParallelFor(parallel_pool, groups.size(), parallel_max_threads, read_group);
+  } else {
+    for (size_t k = 0; k < groups.size(); ++k) read_group(k);
+  }
+}
+
+bool HuffmanAccessor::DecodeBlockBytes(
+    int64_t block, const int64_t *offsets, uint8_t *bytes, size_t count) const {
+  const uint8_t *data = mapped_file.data() + block_offsets[block];
+  const size_t size_bits = (block_offsets[block + 1] - block_offsets[block]) * 8;
+  const int64_t block_end = std::min((block + 1) * block_size, uncompressed_size);
+  BitReader reader(data);
+  int64_t pos = block * block_size;  // offset of the next decoded byte
+  size_t i = 0;
+  // Only decode as far as needed to find the last requested byte.
+  while (i < count) {
+    const int symbol = decoder.Decode(reader);
+    if (symbol < 0 || reader.Position() > size_bits) return false;
+    if (symbol < 256) {
+      while (i < count && offsets[i] == pos) bytes[i++] = symbol;
+      ++pos;
+    } else {
+      pos += int64_t{2} << (symbol - 256);
+      while (i < count && offsets[i] < pos) bytes[i++] = run_byte;
+    }
+    if (pos > block_end) return false;
+  }
+  return true;
+}
+
+int64_t HuffmanAccessor::VerifyAllBlocks() const {
+  int64_t corrupt = 0;
+  for (int64_t block = 0; block < num_blocks; ++block) {
+    // Decode the last byte of the block, which requires decoding all of it.
+    const int64_t last_offset = std::min((block + 1) * block_size, uncompressed_size) - 1;
+    uint8_t byte;
+    if (!IsBlockValid(block) || !DecodeBlockBytes(block, &last_offset, &byte, 1)) {
+      std::cerr << "Huffman block " << block << " is corrupt!" << std::endl;
+      ++corrupt;
+    }
+  }
+  return corrupt;
+}
+
+void HuffmanAccessor::EnableParallelDecompression(ThreadPool *pool, size_t min_blocks, int max_threads) {
+  parallel_pool = pool;
+  parallel_min_blocks = min_blocks;
+  parallel_max_threads = max_threads;
+}
+
+bool WriteHuffmanFile(
+    const uint8_t *data, size_t size, uint32_t block_size,
+    const char *filename, ThreadPool *pool) {
+  if (block_size == 0 || block_size > HuffmanAccessor::max_block_size) {
+    std::cerr << "Invalid block size: " << block_size << std::endl;
+    return false;
+  }
+  const size_t num_blocks = (size + block_size - 1) / block_size;
+  const int max_threads = pool == nullptr ? 1 : pool->NumThreads() + 1;
+
+  // Pick the most frequent byte value as the run byte.
+  std::vector<int64_t> byte_freqs(256, 0);
+  {
+    std::mutex mutex;
+    ParallelFor(pool, num_blocks, max_threads, [&](size_t block) {
+      int64_t local[256] = {};
+      const size_t begin = block * block_size;
+      const size_t end = std::min(begin + block_size, size);
+      for (size_t i = begin; i < end; ++i) ++local[data[i]];
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int b = 0; b < 256; ++b) byte_freqs[b] += local[b];
+    });
+  }
+  const uint8_t run_byte = std::max_element(byte_freqs.begin(), byte_freqs.end()) - byte_freqs.begin();
+
+  // Count symbol frequencies.
+  std::vector<int64_t> freqs(HuffmanAccessor::num_symbols, 0);
+  {
+    std::mutex mutex;
+    ParallelFor(pool, num_blocks, max_threads, [&](size_t block) {
+      std::vector<int64_t> local(HuffmanAccessor::num_symbols, 0);
+      const size_t begin = block * block_size;
+      const size_t end = std::min(begin + block_size, size);
+      Tokenize(data + begin, end - begin, run_byte, [&local](int symbol) { ++local[symbol]; });
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int s = 0; s < HuffmanAccessor::num_symbols; ++s) freqs[s] += local[s];
+    });
+  }
+  // Make sure the code isn't degenerate, even for empty input.
+  if (freqs[run_byte] == 0) freqs[run_byte] = 1;
+  const std::vector<uint8_t> lengths = BuildHuffmanCodeLengths(freqs, huffman_max_code_length);
+  const HuffmanEncoder encoder(lengths);
+
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs) {
+    std::cerr << "Could not open " << filename << " for writing!" << std::endl;
+    return false;
+  }
+
+  // Write the header and code lengths, and reserve space for the index,
+  // which is filled in after the block data has been written.
+  Header header = {};
+  memcpy(header.magic, HuffmanAccessor::magic, sizeof(header.magic));
+  header.uncompressed_size = size;
+  header.num_blocks = num_blocks;
+  header.block_size = block_size;
+  header.num_symbols = HuffmanAccessor::num_symbols;
+  header.run_byte = run_byte;
+  bytes_t prefix(BlockDataOffset(num_blocks), 0);
+  memcpy(prefix.data(), &header, sizeof(header));
+  memcpy(prefix.data() + code_lengths_offset, lengths.data(), lengths.size());
+  ofs.write(reinterpret_cast<const char*>(prefix.data()), prefix.size());
+
+  // Encode blocks in batches, so that we don't need to keep the whole
+  // compressed output in memory.
+  std::vector<uint64_t> offsets(num_blocks + 1);
+  std::vector<uint32_t> checksums(num_blocks);
+  offsets[0] = prefix.size();
+  constexpr size_t batch_size = 4096;
+  std::vector<bytes_t> encoded(batch_size);
+  for (size_t batch_start = 0; batch_start < num_blocks; batch_start += batch_size) {
+    const size_t batch_end = std::min(batch_start + batch_size, num_blocks);
+    ParallelFor(pool, batch_end - batch_start, max_threads, [&](size_t k) {
+      const size_t block = batch_start + k;
+      const size_t begin = block * block_size;
+      const size_t end = std::min(begin + block_size, size);
+      bytes_t &output = encoded[k];
+      output.clear();
+      BitWriter writer(output);
+      Tokenize(data + begin, end - begin, run_byte,
+          [&encoder, &writer](int symbol) { encoder.Encode(writer, symbol); });
+      writer.Flush();
+      checksums[block] = lzma_crc32(output.data(), output.size(), 0);
+    });
+    for (size_t block = batch_start; block < batch_end; ++block) {
+      const bytes_t &output = encoded[block - batch_start];
+      ofs.write(reinterpret_cast<const char*>(output.data()), output.size());
+      offsets[block + 1] = offsets[block] + output.size();
+    }
+  }
+  const char padding[tail_padding] = {};
+  ofs.write(padding, sizeof(padding));
+
+  ofs.seekp(block_offsets_offset);
+  ofs.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char*>(checksums.data()), checksums.size() * sizeof(uint32_t));
+  if (!ofs.flush()) {
+    std::cerr << "Failed to write " << filename << "!" << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,119 @@
+#ifndef HUFFMAN_ACCESSOR_H_INCLUDED
+#define HUFFMAN_ACCESSOR_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "accessors.h"
+#include "huffman-codec.h"
+#include "thread-pool.h"
+
+// Compressed file format designed for fast random access to minimized.bin
+// (conventionally named "minimized.bin.huff").
+//
+// The uncompressed data is split into blocks of a fixed size, which are
+// compressed independently with a canonical Huffman code shared by all blocks.
+// Since most bytes in minimized.bin are WinIn(1), runs of the most common byte
+// value (the "run byte") are encoded with special tokens: token 256 + k
+// represents 2**(k + 1) copies of the run byte, for k between 0 and 19
+// (inclusive). Other bytes are encoded as themselves. A run of arbitrary
+// length is encoded as the sum of powers of two, plus at most one literal.
+//
+// File layout (all integers little-endian):
+//
+//   header (32 bytes):
+//     char[8]  magic "PFHUFF1\n"
+//     uint64   uncompressed size
+//     uint64   number of blocks (N)
+//     uint32   uncompressed block size (except for the last block)
+//     uint16   number of symbols (256 + 20)
+//     uint8    run byte
+//     uint8    reserved (0)
+//   uint8[number of symbols]  code lengths, padded with zeroes to a multiple of 8
+//   uint64[N + 1]             file offset of each block (and of the end of the data)
+//   uint32[N]                 CRC32 of the compressed bytes of each block
+//   padding to a multiple of 8 bytes
+//   compressed block data
+//   8 zero bytes of padding (so the decoder can read 8 bytes at a time)
+//
+// Block checksums are verified the first time each block is accessed.
+class HuffmanAccessor {
+public:
+  static constexpr char magic[8] = {'P', 'F', 'H', 'U', 'F', 'F', '1', '\n'};
+  static constexpr int num_run_tokens = 20;
+  static constexpr int num_symbols = 256 + num_run_tokens;
+  static constexpr uint32_t max_block_size = uint32_t{1} << num_run_tokens;
+
+  // Returns whether the file starts with the magic bytes of this format.
+  static bool IsHuffmanFile(const char *filepath);
+
+  explicit HuffmanAccessor(const char *filepath);
+
+  int64_t GetUncompressedFileSize() const { return uncompressed_size; }
+
+  // Reads `count` different bytes at the given uncompressed file offsets.
+  //
+  // Offsets must be between 0 and the uncompressed file size (exclusive),
+  // and must in nondecreasing order (duplicates are allowed).
+  //
+  // This method is thread-safe.
+  void ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const;
+
+  // Convenience method for ReadBytes() above.
+  std::vector<uint8_t> ReadBytes(const std::vector<int64_t> &offsets) const {
+    size_t count = offsets.size();
+    std::vector<uint8_t> bytes(count);
+    ReadBytes(offsets.data(), bytes.data(), count);
+    return bytes;
+  }
+
+  // Convenience method to get a single byte.
+  uint8_t ReadByte(int64_t offset) const {
+    uint8_t byte = 0;
+    ReadBytes(&offset, &byte, 1);
+    return byte;
+  }
+
+  // Same as XzAccessor::EnableParallelDecompression().
+  void EnableParallelDecompression(ThreadPool *pool, size_t min_blocks, int max_threads);
+
+  // Verifies the checksums of all blocks, and checks that they decode to the
+  // expected size. Returns the number of corrupt blocks.
+  int64_t VerifyAllBlocks() const;
+
+private:
+  // Checks the checksum of the given block, if that wasn't done before. Exits
+  // the process if the block is corrupt.
+  void CheckBlock(int64_t block) const;
+
+  bool IsBlockValid(int64_t block) const;
+
+  // Decodes the bytes at the given offsets, which must all be in `block`.
+  // Returns false if the block data is corrupt.
+  bool DecodeBlockBytes(int64_t block, const int64_t *offsets, uint8_t *bytes, size_t count) const;
+
+  DynMappedFile<uint8_t> mapped_file;
+  int64_t uncompressed_size = 0;
+  int64_t num_blocks = 0;
+  int64_t block_size = 0;
+  uint8_t run_byte = 0;
+  const uint64_t *block_offsets = nullptr;
+  const uint32_t *block_checksums = nullptr;
+  HuffmanDecoder decoder;
+  std::unique_ptr<std::atomic<bool>[]> verified;
+
+  ThreadPool *parallel_pool = nullptr;
+  size_t parallel_min_blocks = SIZE_MAX;
+  int parallel_max_threads = 1;
+};
+
+// Compresses `size` bytes of `data` into a new file in the format described
+// above, using `pool` (if not null) to compress blocks in parallel. Returns
+// false (after printing an error message) if an error occurs.
+bool WriteHuffmanFile(
+    const uint8_t *data, size_t size, uint32_t block_size,
+    const char *filename, ThreadPool *pool);
+
+#endif  // ndef HUFFMAN_ACCESSOR_H_INCLUDED
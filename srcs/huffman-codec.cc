@@ -0,0 +1,135 @@
+#include "huffman-codec.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Computes unrestricted Huffman code lengths for the symbols with nonzero
+// frequency. Requires at least two such symbols.
+std::vector<uint8_t> ComputeLengths(const std::vector<int64_t> &freqs) {
+  const size_t n = freqs.size();
+
+  // Nodes 0..n-1 are leaves; internal nodes are appended after them.
+  std::vector<int> parent(n, -1);
+  using item_t = std::pair<int64_t, int>;  // (frequency, node)
+  std::priority_queue<item_t, std::vector<item_t>, std::greater<item_t>> queue;
+  for (size_t i = 0; i < n; ++i) {
+    if (freqs[i] > 0) queue.push({freqs[i], i});
+  }
+  assert(queue.size() >= 2);
+  while (queue.size() > 1) {
+    item_t a = queue.top();
+    queue.pop();
+    item_t b = queue.top();
+    queue.pop();
+    int node = parent.size();
+    parent.push_back(-1);
+    parent[a.second] = node;
+    parent[b.second] = node;
+    queue.push({a.first + b.first, node});
+  }
+
+  // Internal nodes are created after their children, so depths can be
+  // computed from the root down by iterating in reverse order.
+  std::vector<int> depth(parent.size(), 0);
+  for (int node = parent.size() - 2; node >= 0; --node) {
+    if (parent[node] >= 0) depth[node] = depth[parent[node]] + 1;
+  }
+  std::vector<uint8_t> lengths(n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    if (freqs[i] > 0) lengths[i] = depth[i];
+  }
+  return lengths;
+}
+
+uint16_t ReverseBits(uint16_t code, int length) {
+  uint16_t result = 0;
+  for (int i = 0; i < length; ++i) {
+    result = (result << 1) | ((code >> i) & 1);
+  }
+  return result;
+}
+
+// Assigns canonical codes (most-significant bit first) to the given lengths.
+std::vector<uint16_t> CanonicalCodes(const std::vector<uint8_t> &lengths) {
+  std::vector<int> order;
+  for (size_t i = 0; i < lengths.size(); ++i) {
+    if (lengths[i] > 0) order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(),
+      [&lengths](int a, int b) { return lengths[a] < lengths[b]; });
+  std::vector<uint16_t> codes(lengths.size(), 0);
+  uint32_t code = 0;
+  int prev_length = 0;
+  for (int symbol : order) {
+    code <<= lengths[symbol] - prev_length;
+    prev_length = lengths[symbol];
+    codes[symbol] = code++;
+  }
+  return codes;
+}
+
+}  // namespace
+
+std::vector<uint8_t> BuildHuffmanCodeLengths(const std::vector<int64_t> &freqs, int max_length) {
+  assert(max_length > 0 && max_length <= huffman_max_code_length);
+  size_t used = std::count_if(freqs.begin(), freqs.end(), [](int64_t f) { return f > 0; });
+  assert(used <= (size_t{1} << max_length));
+  if (used < 2) {
+    std::vector<uint8_t> lengths(freqs.size(), 0);
+    for (size_t i = 0; i < freqs.size(); ++i) {
+      if (freqs[i] > 0) lengths[i] = 1;
+    }
+    return lengths;
+  }
+
+  // If the optimal code is too long, flatten the distribution by halving
+  // the frequencies (while keeping them nonzero) until the code fits. This
+  // isn't optimal, but the loss is negligible when only rare symbols are
+  // affected.
+  std::vector<int64_t> scaled = freqs;
+  for (;;) {
+    std::vector<uint8_t> lengths = ComputeLengths(scaled);
+    if (*std::max_element(lengths.begin(), lengths.end()) <= max_length) return lengths;
+    for (int64_t &f : scaled) {
+      if (f > 0) f = (f + 1) / 2;
+    }
+  }
+}
+
+bool ValidateHuffmanCodeLengths(const std::vector<uint8_t> &lengths) {
+  // Kraft's inequality: sum of 2**-length must not exceed 1.
+  uint64_t total = 0;
+  for (uint8_t length : lengths) {
+    if (length > huffman_max_code_length) return false;
+    if (length > 0) total += uint64_t{1} << (huffman_max_code_length - length);
+  }
+  return total <= (uint64_t{1} << huffman_max_code_length);
+}
+
+HuffmanEncoder::HuffmanEncoder(const std::vector<uint8_t> &lengths)
+    : lengths(lengths), codes(CanonicalCodes(lengths)) {
+  for (size_t i = 0; i < codes.size(); ++i) {
+    codes[i] = ReverseBits(codes[i], lengths[i]);
+  }
+}
+
+HuffmanDecoder::HuffmanDecoder(const std::vector<uint8_t> &lengths)
+    : table(table_mask + 1, Entry{0, 0}) {
+  assert(ValidateHuffmanCodeLengths(lengths));
+  std::vector<uint16_t> codes = CanonicalCodes(lengths);
+  for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+    const int length = lengths[symbol];
+    if (length == 0) continue;
+    // Fill all table entries whose low `length` bits match the code.
+    const uint16_t reversed = ReverseBits(codes[symbol], length);
+    for (size_t i = reversed; i <= table_mask; i += size_t{1} << length) {
+      table[i] = Entry{static_cast<uint16_t>(symbol), static_cast<uint8_t>(length)};
+    }
+  }
+}
@@ -0,0 +1,129 @@
+#ifndef HUFFMAN_CODEC_H_INCLUDED
+#define HUFFMAN_CODEC_H_INCLUDED
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "bytes.h"
+
+// Canonical Huffman coding with length-limited codes, for use in the
+// compressed minimized file format (see huffman-accessor.h).
+//
+// Bits are written least-significant bit first, and codes are stored
+// bit-reversed, so that the decoder can look up the next symbol in a table
+// indexed by the next `max_code_length` bits of the stream.
+
+// Maximum supported code length. The decoder table has 2**max_code_length
+// entries, so this determines its size.
+constexpr int huffman_max_code_length = 12;
+
+// Computes code lengths for the given symbol frequencies, such that no code is
+// longer than `max_length` bits. Symbols with frequency 0 get length 0 (no
+// code). If only a single symbol has a nonzero frequency, it gets a 1-bit code.
+std::vector<uint8_t> BuildHuffmanCodeLengths(const std::vector<int64_t> &freqs, int max_length);
+
+// Returns whether the code lengths describe a valid prefix code: no length
+// exceeds huffman_max_code_length, and the code space is not oversubscribed.
+bool ValidateHuffmanCodeLengths(const std::vector<uint8_t> &lengths);
+
+class BitWriter {
+public:
+  explicit BitWriter(bytes_t &output) : output(output) {}
+
+  ~BitWriter() {
+    Flush();
+  }
+
+  // Writes the lowest `num_bits` bits of `bits`, least-significant bit first.
+  // num_bits must be at most 32.
+  void Write(uint64_t bits, int num_bits) {
+    assert(num_bits <= 32);
+    buffer |= bits << count;
+    count += num_bits;
+    while (count >= 8) {
+      output.push_back(buffer & 0xff);
+      buffer >>= 8;
+      count -= 8;
+    }
+  }
+
+  // Writes any remaining bits, padded with zeroes to a whole byte.
+  void Flush() {
+    if (count > 0) output.push_back(buffer & 0xff);
+    buffer = 0;
+    count = 0;
+  }
+
+private:
+  bytes_t &output;
+  uint64_t buffer = 0;
+  int count = 0;
+};
+
+// Reads bits least-significant bit first. Note that Peek() reads 8 bytes at a
+// time, so the data must be followed by at least 8 bytes of (arbitrary)
+// padding.
+class BitReader {
+public:
+  BitReader(const uint8_t *data) : data(data) {}
+
+  // Returns the next 57 (or more) bits in the low bits of the result.
+  uint64_t Peek() const {
+    uint64_t word;
+    memcpy(&word, data + pos / 8, 8);
+    return word >> (pos % 8);
+  }
+
+  void Skip(int num_bits) {
+    pos += num_bits;
+  }
+
+  size_t Position() const { return pos; }
+
+private:
+  const uint8_t *data;
+  size_t pos = 0;
+};
+
+class HuffmanEncoder {
+public:
+  explicit HuffmanEncoder(const std::vector<uint8_t> &lengths);
+
+  void Encode(BitWriter &writer, int symbol) const {
+    assert(lengths[symbol] > 0);
+    writer.Write(codes[symbol], lengths[symbol]);
+  }
+
+private:
+  std::vector<uint8_t> lengths;
+  std::vector<uint16_t> codes;  // bit-reversed
+};
+
+class HuffmanDecoder {
+public:
+  // The code lengths must be valid (see ValidateHuffmanCodeLengths()).
+  explicit HuffmanDecoder(const std::vector<uint8_t> &lengths);
+
+  // Decodes the next symbol from `reader`. Returns -1 if the bits do not
+  // correspond to any code (which means the data is corrupt).
+  int Decode(BitReader &reader) const {
+    Entry entry = table[reader.Peek() & table_mask];
+    reader.Skip(entry.length);
+    return entry.length > 0 ? entry.symbol : -1;
+  }
+
+private:
+  static constexpr size_t table_mask = (size_t{1} << huffman_max_code_length) - 1;
+
+  struct Entry {
+    uint16_t symbol;
+    uint8_t length;  // 0 for invalid codes
+  };
+
+  std::vector<Entry> table;
+};
+
+#endif  // ndef HUFFMAN_CODEC_H_INCLUDED
@@ -0,0 +1,125 @@
+#include "huffman-accessor.h"
+#include "huffman-codec.h"
+#include "macros.h"
+#include "random.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+void TestCodeLengths() {
+  // Optimal lengths for a simple distribution.
+  assert(BuildHuffmanCodeLengths({8, 4, 2, 1, 1, 0}, 12) ==
+      (std::vector<uint8_t>{1, 2, 3, 4, 4, 0}));
+
+  // A single used symbol gets a 1-bit code.
+  assert(BuildHuffmanCodeLengths({0, 5, 0}, 12) == (std::vector<uint8_t>{0, 1, 0}));
+
+  // Fibonacci frequencies produce very long codes, unless limited.
+  std::vector<int64_t> freqs = {1, 1};
+  while (freqs.size() < 40) freqs.push_back(freqs[freqs.size() - 1] + freqs[freqs.size() - 2]);
+  for (int max_length : {6, 8, 12}) {
+    std::vector<uint8_t> lengths = BuildHuffmanCodeLengths(freqs, max_length);
+    assert(ValidateHuffmanCodeLengths(lengths));
+    assert(*std::max_element(lengths.begin(), lengths.end()) <= max_length);
+    for (uint8_t length : lengths) assert(length > 0);
+  }
+
+  assert(!ValidateHuffmanCodeLengths({1, 1, 1}));
+  assert(!ValidateHuffmanCodeLengths({13, 1}));
+}
+
+void TestEncodeDecode() {
+  std::vector<int64_t> freqs(50);
+  REP(i, freqs.size()) freqs[i] = 1 + i * i;
+  const std::vector<uint8_t> lengths = BuildHuffmanCodeLengths(freqs, huffman_max_code_length);
+  const HuffmanEncoder encoder(lengths);
+  const HuffmanDecoder decoder(lengths);
+
+  std::vector<int> symbols(10000);
+  REP(i, symbols.size()) symbols[i] = RandInt(0, freqs.size() - 1);
+
+  bytes_t encoded;
+  {
+    BitWriter writer(encoded);
+    for (int symbol : symbols) encoder.Encode(writer, symbol);
+  }
+  encoded.resize(encoded.size() + 8);  // padding required by BitReader
+
+  BitReader reader(encoded.data());
+  for (int symbol : symbols) assert(decoder.Decode(reader) == symbol);
+}
+
+// Generates data that resembles minimized.bin: mostly runs of 2 (WinIn(1)),
+// mixed with other small values.
+std::vector<uint8_t> GenerateTestData(size_t size) {
+  std::vector<uint8_t> data(size, 2);
+  for (size_t i = 0; i < size; ) {
+    i += RandInt(0, 2) == 0 ? RandInt(1000, 5000) : RandInt(1, 20);
+    if (i < size) data[i] = RandInt(0, 99);
+  }
+  return data;
+}
+
+void TestFileRoundTrip() {
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("huffman_test." + std::to_string(getpid()) + ".huff");
+  ThreadPool pool(2);
+  for (size_t size : {0, 1, 1000, 100000}) {
+    for (uint32_t block_size : {1u, 100u, 4096u, HuffmanAccessor::max_block_size}) {
+      if (size > 1000 && block_size == 1) continue;
+      const std::vector<uint8_t> data = GenerateTestData(size);
+
+      std::filesystem::remove(filename);
+      assert(WriteHuffmanFile(data.data(), data.size(), block_size, filename.c_str(), &pool));
+      assert(HuffmanAccessor::IsHuffmanFile(filename.c_str()));
+
+      HuffmanAccessor acc(filename.c_str());
+      assert(acc.GetUncompressedFileSize() == int64_t(size));
+      assert(acc.VerifyAllBlocks() == 0);
+
+      // Read everything at once.
+      std::vector<int64_t> offsets(size);
+      std::iota(offsets.begin(), offsets.end(), 0);
+      assert(acc.ReadBytes(offsets) == data);
+
+      // Read random sorted offsets (with duplicates), in parallel.
+      acc.EnableParallelDecompression(&pool, 2, 3);
+      REP(i, offsets.size()) offsets[i] = RandInt(0, size - 1);
+      std::sort(offsets.begin(), offsets.end());
+      std::vector<uint8_t> bytes = acc.ReadBytes(offsets);
+      REP(i, offsets.size()) assert(bytes[i] == data[offsets[i]]);
+
+      if (size > 0) assert(acc.ReadByte(size - 1) == data[size - 1]);
+    }
+  }
+  std::filesystem::remove(filename);
+}
+
+}  // namespace
+
+int main() {
+  TestCodeLengths();
+  TestEncodeDecode();
+  TestFileRoundTrip();
+}
@@ -1,5 +1,6 @@
 #include "accessors.h"
 #include "byte_span.h"
+#include "codec.h"
 #include "efcodec.h"
 #include "input-generation.h"
 #include "input-verification.h"
@@ -12,9 +13,13 @@
 #include <fstream>
 #include <functional>
 #include <optional>
+#include <thread>
 
 namespace {
 
+// Number of threads used to apply the diff. 0 to disable multithreading.
+const int num_threads = std::thread::hardware_concurrency();
+
 // Generates an input file from a previous one and a list of new losses and wins.
 //
 // Let's say we have:
@@ -75,30 +80,25 @@ bool GeneratePhaseInput(
   std::cerr << "Generating " << input_filename << " from "
       << previous_input_filename << " and " << diff_filename << "..." << std::endl;
   {
-    MutableRnAccessor acc(temp_filename);
+    ConcurrentMutableRnAccessor acc(temp_filename);
     int64_t losses = 0, wins = 0, new_losses = 0, new_wins = 0;
     REP(chunk, num_chunks) REP(part, 2) {
-      int64_t changes = 0;
       const char *what = part == 0 ? "losses" : "wins";
       Outcome new_outcome = part == 0 ? LOSS : WIN;
       std::optional<std::vector<int64_t>> ints = DecodeEF(&diff_bytes);
       if (!ints) {
         std::cerr << "Failed to decode chunk " << chunk << " " << what << " in file: " << diff_filename << std::endl;
-        return 1;
+        return false;
       }
-      for (int64_t i : *ints) {
-        Outcome o = acc[i];
-        if (o == new_outcome) {
-          continue;
-        }
-        if (o != TIE) {
-          std::cerr << temp_filename << ": Permutation " << i << " is marked " << OutcomeToString(o)
-              << " should be " << OutcomeToString(new_outcome) << std::endl;
-          return 1;
-        }
-        acc[i] = new_outcome;
-        ++changes;
+      ConcurrentMutableRnAccessor::UpdateStats stats =
+          acc.ApplySortedUpdates(*ints, new_outcome, num_threads);
+      if (stats.conflicts > 0) {
+        int64_t i = stats.first_conflict;
+        std::cerr << temp_filename << ": Permutation " << i << " is marked " << OutcomeToString(acc[i])
+            << " should be " << OutcomeToString(new_outcome) << std::endl;
+        return false;
       }
+      int64_t changes = stats.changed;
       (part == 0 ? losses : wins) += ints->size();
       (part == 0 ? new_losses : new_wins) += changes;
       std::cerr << "Chunk " << chunk << " / " << num_chunks << ": "
@@ -192,3 +192,53 @@ std::string PreparePhaseInput(int phase, const client_factory_t &client_factory)
 
   return input_filename;
 }
+
+bool ParseInputFormat(const std::string &s, InputFormat *format) {
+  if (s.empty() || s == "ternary") {
+    *format = InputFormat::TERNARY;
+  } else if (s == "2bit") {
+    *format = InputFormat::TWO_BIT;
+  } else {
+    std::cerr << "Invalid input format: " << s << " (expected ternary or 2bit)" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::string PrepareInputFormat(const std::string &filename, InputFormat format) {
+  if (format == InputFormat::TERNARY) return filename;
+
+  assert(format == InputFormat::TWO_BIT);
+  std::string two_bit_filename = std::filesystem::path(filename).replace_extension(".2bit").string();
+  if (std::filesystem::exists(two_bit_filename)) {
+    // The converted file is reused only if it's complete, and newer than the
+    // input file (which may have been regenerated since it was converted).
+    if (std::filesystem::file_size(two_bit_filename) == TwoBitRnAccessor::num_words * sizeof(uint64_t) &&
+        std::filesystem::last_write_time(two_bit_filename) >= std::filesystem::last_write_time(filename)) {
+      std::cerr << "Using existing input file " << two_bit_filename << std::endl;
+      return two_bit_filename;
+    }
+    std::cerr << "Existing input file " << two_bit_filename << " is out of date." << std::endl;
+  }
+
+  std::string temp_filename = two_bit_filename + ".tmp";
+  std::cerr << "Converting " << filename << " to " << two_bit_filename << "..." << std::endl;
+  {
+    std::ifstream ifs(filename, std::ifstream::binary);
+    if (!ifs) {
+      std::cerr << "Could not open " << filename << std::endl;
+      exit(1);
+    }
+    std::ofstream ofs(temp_filename, std::ofstream::binary);
+    if (!ofs) {
+      std::cerr << "Could not create " << temp_filename << std::endl;
+      exit(1);
+    }
+    if (!ConvertTernaryToTwoBit(ifs, ofs, total_perms) || !ofs.flush()) {
+      std::cerr << "Failed to convert " << filename << std::endl;
+      exit(1);
+    }
+  }
+  std::filesystem::rename(temp_filename, two_bit_filename);
+  return two_bit_filename;
+}
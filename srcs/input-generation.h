@@ -11,4 +11,23 @@ using client_factory_t = std::function<std::optional<Client>()>;
 
 std::string PreparePhaseInput(int phase, const client_factory_t &client_factory);
 
+// Format of the phase input file used by the solvers.
+enum class InputFormat : char {
+  TERNARY,  // 5 values per byte; see RnAccessor
+  TWO_BIT,  // 32 values per 64-bit word; see TwoBitRnAccessor
+};
+
+// Parses the value of an --input-format flag: "ternary" (or empty) or "2bit".
+// Returns false (after printing an error message) if the value is invalid.
+bool ParseInputFormat(const std::string &s, InputFormat *format);
+
+// Returns the filename of the input file in the given format. `filename` is
+// the name of the input file in the ternary format (e.g. "input/r4.bin"). If
+// format is TWO_BIT, the input file is converted first, unless the converted
+// file (e.g. "input/r4.2bit") already exists, has the expected size, and is
+// not older than the input file.
+//
+// Exits the process if the conversion fails.
+std::string PrepareInputFormat(const std::string &filename, InputFormat format);
+
 #endif  // ndef INPUT_GENERATION_H_INCLUDED
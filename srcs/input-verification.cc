@@ -12,29 +12,75 @@
 #include <random>
 
 #include "accessors.h"
+#include "codec.h"
 #include "hash.h"
 #include "macros.h"
+#include "merkle.h"
 #include "random.h"
 
 // This class has friend access to RnAccessor to be able to access the
 // underlying memory mapped file.
+//
+// Checksums are always computed over the ternary encoding of a chunk, so for
+// input in the 2-bit format, chunks are transcoded to ternary first.
 class ChunkVerifier {
 public:
   constexpr static size_t chunk_byte_size = chunk_size / 5;
 
-  ChunkVerifier(const RnAccessor &acc) : acc(acc) {}
+  ChunkVerifier(const RnAccessor &acc) : acc(&acc) {}
+  ChunkVerifier(const TwoBitRnAccessor &acc) : two_bit_acc(&acc) {}
+  ChunkVerifier(const ShardedRnAccessor &acc) : sharded_acc(&acc) {}
+  ChunkVerifier(const AnyRnAccessor &acc) :
+      acc(acc.Ternary()), two_bit_acc(acc.TwoBit()), sharded_acc(acc.Sharded()) {}
 
-  // This method is threadsafe.
+  // This method is threadsafe, as long as each thread uses its own copy of
+  // the ChunkVerifier.
   sha256_hash_t ComputeChunkHash(int chunk) {
-    return ComputeSha256(GetChunkBytes(chunk));
+    byte_span_t bytes = GetChunkBytes(chunk);
+    if (acc != nullptr) {
+      // The whole chunk is about to be read, so let the kernel read it ahead
+      // instead of faulting it in page by page.
+      MemWillNeed(bytes.data(), bytes.size());
+    }
+    return ComputeSha256(bytes);
+  }
+
+  // Asks the kernel to start reading the given chunk in the background, so
+  // it is (partially) in memory by the time it is hashed. This only has an
+  // effect for memory-mapped ternary files.
+  void Prefetch(int chunk) const {
+    if (acc != nullptr) {
+      MemWillNeed(acc->map.data() + chunk_byte_size * chunk, chunk_byte_size);
+    }
   }
 
 private:
   byte_span_t GetChunkBytes(int chunk) {
-    return byte_span_t(acc.map.data() + chunk_byte_size * chunk, chunk_byte_size);
+    if (acc != nullptr) {
+      return byte_span_t(acc->map.data() + chunk_byte_size * chunk, chunk_byte_size);
+    }
+    if (sharded_acc != nullptr) {
+      // A chunk may span two shards, so copy it into a contiguous buffer.
+      buffer.resize(chunk_byte_size);
+      sharded_acc->map.Copy(chunk_byte_size * chunk, chunk_byte_size, buffer.data());
+      return byte_span_t(buffer.data(), buffer.size());
+    }
+    assert(two_bit_acc != nullptr);
+    constexpr size_t slice_size = part_size;
+    static_assert(chunk_size % slice_size == 0);
+    buffer.resize(chunk_byte_size);
+    std::vector<Outcome> outcomes(slice_size);
+    for (size_t i = 0; i < chunk_size; i += slice_size) {
+      two_bit_acc->Decode(size_t{chunk_size} * chunk + i, slice_size, outcomes.data());
+      EncodeOutcomes(outcomes.data(), buffer.data() + i / 5, slice_size / 5);
+    }
+    return byte_span_t(buffer.data(), buffer.size());
   }
 
-  const RnAccessor &acc;
+  const RnAccessor *acc = nullptr;
+  const TwoBitRnAccessor *two_bit_acc = nullptr;
+  const ShardedRnAccessor *sharded_acc = nullptr;
+  std::vector<uint8_t> buffer;
 };
 
 std::string GetChecksumFilename(const char *subdir, int phase) {
@@ -45,11 +91,24 @@ std::string GetChecksumFilename(const char *subdir, int phase) {
   return oss.str();
 }
 
+std::string GetMerkleIndexFilename(const char *subdir, int phase) {
+  std::ostringstream oss;
+  oss << subdir;
+  if (*subdir) oss << '/';
+  oss << "chunk-r" << phase << ".merkle";
+  return oss.str();
+}
+
 namespace {
 
 // Number of threads to use for calculations.
 const int num_threads = std::thread::hardware_concurrency();
 
+// Number of chunks (beyond those being hashed) that are prefetched from
+// memory-mapped files. Each chunk is about 10.8 MB, so this bounds the
+// read-ahead to about 700 MB.
+const int read_ahead_chunks = 64;
+
 // SHA256 checksums of chunks of r4.bin
 constexpr std::pair<int, const char*> r4_chunk_hashes[] = {
   // First three chunks
@@ -112,8 +171,7 @@ constexpr std::pair<int, const char*> r6_chunk_hashes[] = {
 
 std::mt19937 rng = InitializeRng();
 
-int Verify(int phase, const RnAccessor &acc, const std::pair<int, const char*> *hashes, size_t size) {
-  ChunkVerifier verifier = ChunkVerifier(acc);
+int Verify(int phase, ChunkVerifier verifier, const std::pair<int, const char*> *hashes, size_t size) {
   int failures = 0;
   for (size_t i = 0; i < size; ++i) {
     int chunk = hashes[i].first;
@@ -136,8 +194,8 @@ int Verify(int phase, const RnAccessor &acc, const std::pair<int, const char*> *
 }
 
 template<int N>
-int Verify(int phase, const RnAccessor &acc, const std::pair<int, const char*> (&hashes)[N]) {
-  return Verify(phase, acc, hashes, N);
+int Verify(int phase, const ChunkVerifier &verifier, const std::pair<int, const char*> (&hashes)[N]) {
+  return Verify(phase, verifier, hashes, N);
 }
 
 std::optional<std::vector<sha256_hash_t>> LoadChecksums(const char *filename) {
@@ -162,76 +220,100 @@ std::optional<std::vector<sha256_hash_t>> LoadChecksums(const char *filename) {
   return result;
 }
 
-void VerifyChecksumsThread(
-    int phase, const RnAccessor *acc,
-    const std::vector<sha256_hash_t> *checksums,
+void ComputeChunkHashesThread(
+    int phase, const ChunkVerifier *prototype,
     const std::vector<int> *chunks,
+    std::vector<sha256_hash_t> *hashes,
     std::atomic<int> *next_index,
-    std::atomic<int> *failures,
     std::mutex *io_mutex) {
-  ChunkVerifier verifier = ChunkVerifier(*acc);
+  ChunkVerifier verifier = *prototype;
   for (int i; (i = (*next_index)++) < chunks->size(); ) {
+    if (i + read_ahead_chunks < chunks->size()) {
+      verifier.Prefetch(chunks->at(i + read_ahead_chunks));
+    }
     int chunk = chunks->at(i);
-    sha256_hash_t computed_hash = verifier.ComputeChunkHash(chunk);
-    const sha256_hash_t &expected_hash = checksums->at(chunk);
-    if (computed_hash != expected_hash) {
+    (*hashes)[i] = verifier.ComputeChunkHash(chunk);
+    if ((i + 1) % 10 == 0 && chunks->size() > 10) {
       std::lock_guard lock(*io_mutex);
-      std::cerr << "\rVerification of checksum for phase " << phase << " chunk " << chunk << " failed!\n"
-          << "Expected SHA-256 sum: " << HexEncode(expected_hash) << "\n"
-          << "Computed SHA-256 sum: " << HexEncode(computed_hash) << std::endl;
-      ++(*failures);
-    } else if ((i + 1) % 10 == 0 && chunks->size() > 10) {
-      std::lock_guard lock(*io_mutex);
-      std::cerr << "\rVerified checksum for phase " << phase << " chunk " << chunk << " (" << i + 1 << " of " << chunks->size() << ")...";
+      std::cerr << "\rComputed checksum for phase " << phase << " chunk " << chunk << " (" << i + 1 << " of " << chunks->size() << ")...";
     }
   }
 }
 
-int VerifyChecksums(
-    int phase, const RnAccessor &acc,
-    const std::vector<sha256_hash_t> &checksums,
-    const std::vector<int> &chunks) {
+// Computes the checksums of the given chunks using all cores. Returns the
+// hashes in the same order as `chunks`.
+std::vector<sha256_hash_t> ComputeChunkHashes(
+    int phase, const ChunkVerifier &verifier, const std::vector<int> &chunks) {
+  std::vector<sha256_hash_t> hashes(chunks.size());
   std::atomic<int> next_index = 0;
-  std::atomic<int> failures = 0;
   std::mutex io_mutex;
+  if (!chunks.empty()) {
+    // Start reading the first chunks while the threads are starting up.
+    for (int i = 0; i < read_ahead_chunks && i < chunks.size(); ++i) verifier.Prefetch(chunks[i]);
+  }
   if (num_threads == 0) {
-    VerifyChecksumsThread(phase, &acc, &checksums,
-      &chunks, &next_index, &failures, &io_mutex);
+    ComputeChunkHashesThread(phase, &verifier, &chunks, &hashes, &next_index, &io_mutex);
   } else {
     assert(num_threads > 0);
     std::vector<std::thread> threads;
     threads.reserve(num_threads);
     REP(i, num_threads) {
       threads.emplace_back(
-        VerifyChecksumsThread, phase, &acc, &checksums,
-        &chunks, &next_index, &failures, &io_mutex);
+        ComputeChunkHashesThread, phase, &verifier, &chunks, &hashes, &next_index, &io_mutex);
     }
     REP(i, num_threads) threads[i].join();
     assert(next_index == chunks.size() + num_threads);
-    if (chunks.size() > 10) {
-      // Clear last line.
-      std::cerr << std::endl;
+  }
+  if (chunks.size() > 10) {
+    // Clear last line.
+    std::cerr << std::endl;
+  }
+  return hashes;
+}
+
+void PrintChecksumFailure(int phase, int chunk, const sha256_hash_t &expected, const sha256_hash_t &computed) {
+  std::cerr << "Verification of checksum for phase " << phase << " chunk " << chunk << " failed!\n"
+      << "Expected SHA-256 sum: " << HexEncode(expected) << "\n"
+      << "Computed SHA-256 sum: " << HexEncode(computed) << std::endl;
+}
+
+int VerifyChecksums(
+    int phase, const ChunkVerifier &verifier,
+    const std::vector<sha256_hash_t> &checksums,
+    const std::vector<int> &chunks) {
+  std::vector<sha256_hash_t> hashes = ComputeChunkHashes(phase, verifier, chunks);
+  int failures = 0;
+  REP(i, chunks.size()) {
+    if (hashes[i] != checksums[chunks[i]]) {
+      PrintChecksumFailure(phase, chunks[i], checksums[chunks[i]], hashes[i]);
+      ++failures;
     }
   }
   return failures;
 }
 
-int VerifyFromChecksumFile(int phase, const RnAccessor &acc, int chunks_to_verify) {
+std::optional<std::vector<sha256_hash_t>> LoadChecksumsForPhase(int phase) {
   std::string path = GetChecksumFilename("metadata", phase);
   if (!std::filesystem::exists(path)) {
     std::cerr << "Checksum file for phase " << phase << " does not exist: " << path << std::endl;
-    return 1;
+    return {};
   }
   auto checksums = LoadChecksums(path.c_str());
   if (!checksums) {
     std::cerr << "Could not load checksum file." << std::endl;
-    return 1;
+    return {};
   }
   if (checksums->size() != num_chunks) {
     std::cerr << "Invalid number of checksums. "
         << "Expected " << num_chunks << ", actual " << checksums->size() << std::endl;
-    return 1;
+    return {};
   }
+  return checksums;
+}
+
+int VerifyFromChecksumFile(int phase, const ChunkVerifier &verifier, int chunks_to_verify) {
+  auto checksums = LoadChecksumsForPhase(phase);
+  if (!checksums) return 1;
 
   // Select chunks to verify. Always start with first and last chunk.
   std::vector<int> chunks;
@@ -253,17 +335,79 @@ int VerifyFromChecksumFile(int phase, const RnAccessor &acc, int chunks_to_verif
       std::sort(&chunks[2], &chunks[chunks_to_verify]);
     }
   }
-  return VerifyChecksums(phase, acc, *checksums, chunks);
+  return VerifyChecksums(phase, verifier, *checksums, chunks);
+}
+
+int VerifyInputChunks(int phase, const ChunkVerifier &verifier, int chunks_to_verify) {
+  switch (phase) {
+    case 4: return Verify(4, verifier, r4_chunk_hashes);
+    case 5: return Verify(5, verifier, r5_chunk_hashes);
+    case 6: return Verify(6, verifier, r6_chunk_hashes);
+    default:
+      return VerifyFromChecksumFile(phase, verifier, chunks_to_verify);
+  }
 }
 
 }  // namespace
 
 int VerifyInputChunks(int phase, const RnAccessor &acc, int chunks_to_verify) {
-  switch (phase) {
-    case 4: return Verify(4, acc, r4_chunk_hashes);
-    case 5: return Verify(5, acc, r5_chunk_hashes);
-    case 6: return Verify(6, acc, r6_chunk_hashes);
-    default:
-      return VerifyFromChecksumFile(phase, acc, chunks_to_verify);
+  return VerifyInputChunks(phase, ChunkVerifier(acc), chunks_to_verify);
+}
+
+int VerifyInputChunks(int phase, const AnyRnAccessor &acc, int chunks_to_verify) {
+  return VerifyInputChunks(phase, ChunkVerifier(acc), chunks_to_verify);
+}
+
+int VerifyAllChunks(
+    int phase, const char *filename, const AnyRnAccessor &acc,
+    const FullVerificationOptions &options) {
+  auto checksums = LoadChecksumsForPhase(phase);
+  if (!checksums) return 1;
+  const std::string index_filename = GetMerkleIndexFilename("metadata", phase);
+
+  // Determine which chunks need to be hashed.
+  std::optional<MerkleIndex> index;
+  if (options.incremental) {
+    if (!std::filesystem::exists(index_filename)) {
+      std::cerr << "Merkle index " << index_filename << " does not exist." << std::endl;
+    } else {
+      index = ReadMerkleIndex(index_filename.c_str());
+    }
+    if (index && (index->tree.LeafCount() != num_chunks ||
+        index->data_size != std::filesystem::file_size(filename))) {
+      std::cerr << "Merkle index " << index_filename << " does not match " << filename << "." << std::endl;
+      index.reset();
+    }
+    if (index && !index->IsUpToDate(filename) && options.changed_chunks.empty()) {
+      std::cerr << filename << " was modified after " << index_filename << " was written." << std::endl;
+      index.reset();
+    }
+    if (!index) std::cerr << "Verifying all chunks instead." << std::endl;
+  }
+  std::vector<int> chunks;
+  if (!index) {
+    REP(chunk, num_chunks) chunks.push_back(chunk);
+    index.emplace();
+    index->tree = MerkleTree(std::vector<sha256_hash_t>(num_chunks));
+  } else {
+    chunks = options.changed_chunks;
+  }
+  index->data_size = std::filesystem::file_size(filename);
+  index->data_mtime = DataFileModificationTime(filename);
+
+  std::cerr << "Computing checksums of " << chunks.size() << " of " << num_chunks << " chunks." << std::endl;
+  const std::vector<sha256_hash_t> hashes = ComputeChunkHashes(phase, ChunkVerifier(acc), chunks);
+  REP(i, chunks.size()) index->tree.SetLeaf(chunks[i], hashes[i]);
+
+  // Save the index even if verification fails, so that after repairing the
+  // failed chunks, only those need to be verified again.
+  if (options.write_index && !WriteMerkleIndex(index_filename.c_str(), *index)) return 1;
+
+  const MerkleTree expected(std::move(*checksums));
+  if (index->tree.Root() == expected.Root()) return 0;
+  const std::vector<size_t> failed_chunks = index->tree.Diff(expected);
+  for (size_t chunk : failed_chunks) {
+    PrintChecksumFailure(phase, chunk, expected.Leaf(chunk), index->tree.Leaf(chunk));
   }
+  return failed_chunks.size();
 }
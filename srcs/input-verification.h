@@ -2,6 +2,7 @@
 #define INPUT_VERIFICATION_H_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "accessors.h"
 
@@ -9,6 +10,42 @@
 // (but not all!) chunks. Returns the number of failures.
 int VerifyInputChunks(int phase, const RnAccessor &acc, int chunks_to_verify = 10);
 
+// Version of the above that also supports input in the 2-bit format. The
+// checksums are computed over the ternary encoding in either case.
+int VerifyInputChunks(int phase, const AnyRnAccessor &acc, int chunks_to_verify = 10);
+
 std::string GetChecksumFilename(const char *subdir, int phase);
 
+// Returns the filename of the Merkle index (see merkle.h) written by
+// VerifyAllChunks(), which is stored next to the checksum file.
+std::string GetMerkleIndexFilename(const char *subdir, int phase);
+
+struct FullVerificationOptions {
+  // Reuse checksums from the Merkle index, instead of hashing all chunks.
+  bool incremental = false;
+
+  // In incremental mode, the chunks to hash again. All other chunks are
+  // assumed to be unchanged since the index was written, even if the file's
+  // modification time has changed (e.g. after recomputing the chunks listed
+  // in an incident report).
+  std::vector<int> changed_chunks;
+
+  // Whether to write the Merkle index after hashing.
+  bool write_index = true;
+};
+
+// Fully verifies an input file against the checksums in the
+// metadata/chunk-rN.sha256sum file, hashing chunks on all cores while reading
+// ahead a bounded number of chunks, and saves the computed checksums as a
+// Merkle index in metadata/chunk-rN.merkle. Returns the number of failures.
+//
+// In incremental mode, only `changed_chunks` are hashed, and the checksums of
+// the other chunks are taken from the existing Merkle index. If no changed
+// chunks are given, no chunks are hashed if the file has the same size and
+// modification time as when the index was written, and all chunks are hashed
+// otherwise.
+int VerifyAllChunks(
+    int phase, const char *filename, const AnyRnAccessor &acc,
+    const FullVerificationOptions &options);
+
 #endif  // ndef INPUT_VERIFICATION_H_INCLUDED
@@ -2,23 +2,62 @@
 
 #include <cassert>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <optional>
+#include <thread>
 
 #include "accessors.h"
 #include "efcodec.h"
-#include "bytes.h"
 #include "codec.h"
 #include "macros.h"
 
-template<class Acc>
-void Assign(Acc &acc, int64_t i, Outcome o) {
-  acc[i] = o;
+// Number of threads used to apply updates. 0 to disable multithreading.
+const int num_threads = std::thread::hardware_concurrency();
+
+// Number of permutations that are decoded and applied at a time. This bounds
+// the memory used, independent of the size of the input files.
+const size_t block_size = 1 << 20;
+
+void PrintConflict(const char *filename, int64_t i, Outcome o, Outcome new_outcome) {
+  std::cerr << filename << ": Permutation " << i << " is marked " << OutcomeToString(o)
+      << " should be " << OutcomeToString(new_outcome) << std::endl;
+}
+
+// Read only accessor. Counts the number of changes without doing anything.
+//
+// Returns -1 if a conflict is found.
+int64_t Integrate(
+    AnyRnAccessor &acc, const std::vector<int64_t> &ints, Outcome new_outcome,
+    const char *filename) {
+  int64_t changes = 0;
+  for (int64_t i : ints) {
+    Outcome o = acc[i];
+    if (o == new_outcome) {
+      continue;
+    }
+    if (o != TIE) {
+      PrintConflict(filename, i, o, new_outcome);
+      return -1;
+    }
+    ++changes;
+  }
+  return changes;
 }
 
-template<>
-void Assign<RnAccessor>(RnAccessor &, int64_t, Outcome) {
-  // Read only accessor. Do nothing.
+// Mutable accessor. Applies all changes in parallel.
+//
+// Returns -1 if a conflict is found.
+int64_t Integrate(
+    ConcurrentMutableRnAccessor &acc, const std::vector<int64_t> &ints, Outcome new_outcome,
+    const char *filename) {
+  ConcurrentMutableRnAccessor::UpdateStats stats =
+      acc.ApplySortedUpdates(ints, new_outcome, num_threads);
+  if (stats.conflicts > 0) {
+    PrintConflict(filename, stats.first_conflict, acc[stats.first_conflict], new_outcome);
+    return -1;
+  }
+  return stats.changed;
 }
 
 template<class Acc>
@@ -29,31 +68,30 @@ int Main(Acc &acc, int start_argi, int argc, char *argv[]) {
   int64_t total_new_wins = 0;
   FOR(i, start_argi, argc) {
     const char *filename = argv[i];
-    bytes_t bytes = ReadFromFile(filename);
-    byte_span_t byte_span = bytes;
+    std::ifstream ifs(filename, std::ifstream::binary);
+    if (!ifs) {
+      std::cerr << "Failed to open " << filename << std::endl;
+      return 1;
+    }
     REP(p, 2) {
-      int64_t changes = 0;
       const char *what = p == 0 ? "losses" : "wins";
       Outcome new_outcome = p == 0 ? LOSS : WIN;
-      std::optional<std::vector<int64_t>> ints = DecodeEF(&byte_span);
-      if (!ints) {
+      EFIterator it(ifs);
+      int64_t changes = 0;
+      std::vector<int64_t> ints;
+      for (;;) {
+        ints.resize(block_size);
+        ints.resize(it.Read(ints.data(), ints.size()));
+        if (ints.empty()) break;
+        int64_t block_changes = Integrate(acc, ints, new_outcome, filename);
+        if (block_changes < 0) return 1;
+        changes += block_changes;
+      }
+      if (it.Failed()) {
         std::cerr << "Failed to decode " << what << " in file: " << filename << std::endl;
         return 1;
       }
-      for (int64_t i : *ints) {
-        Outcome o = acc[i];
-        if (o == new_outcome) {
-          continue;
-        }
-        if (o != TIE) {
-          std::cerr << filename << ": Permutation " << i << " is marked " << OutcomeToString(o)
-              << " should be " << OutcomeToString(new_outcome) << std::endl;
-          return 1;
-        }
-        Assign<Acc>(acc, i, new_outcome);
-        ++changes;
-      }
-      int64_t perms = ints->size();
+      int64_t perms = it.size();
       std::cout << filename << ": " << perms << " " << what << ", " << changes << " new " << what << "." << std::endl;
       if (p == 0) {
         total_losses += perms;
@@ -87,10 +125,10 @@ int main(int argc, char *argv[]) {
   }
 
   if (dry_run) {
-    RnAccessor acc(argv[start_argi++]);
-    Main<RnAccessor>(acc, start_argi, argc, argv);
+    AnyRnAccessor acc(argv[start_argi++]);
+    Main<AnyRnAccessor>(acc, start_argi, argc, argv);
   } else {
-    MutableRnAccessor acc(argv[start_argi++]);
-    Main<MutableRnAccessor>(acc, start_argi, argc, argv);
+    ConcurrentMutableRnAccessor acc(argv[start_argi++]);
+    Main<ConcurrentMutableRnAccessor>(acc, start_argi, argc, argv);
   }
 }
@@ -2,12 +2,13 @@
 
 #include <cassert>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <optional>
+#include <thread>
 
 #include "accessors.h"
 #include "efcodec.h"
-#include "bytes.h"
 #include "codec.h"
 #include "macros.h"
 
@@ -24,33 +25,59 @@ int main(int argc, char *argv[]) {
     ++start_argi;
   }
 
-  MutableRnAccessor acc(argv[start_argi++]);
+  // Number of threads used to apply updates. 0 to disable multithreading.
+  const int num_threads = std::thread::hardware_concurrency();
+
+  // Number of permutations that are decoded and applied at a time. This
+  // bounds the memory used, independent of the size of the input files.
+  const size_t block_size = 1 << 20;
+
+  ConcurrentMutableRnAccessor acc(argv[start_argi++]);
   int64_t total_perms = 0;
   int64_t total_changes = 0;
   for (int i = start_argi; i < argc; ++i) {
     const char *filename = argv[i];
     int64_t changes = 0;
-    bytes_t bytes = ReadFromFile(filename);
-    std::optional<std::vector<int64_t>> ints = DecodeEF(bytes);
-    if (!ints) {
-      std::cerr << "Failed to decode " << filename << std::endl;
+    std::ifstream ifs(filename, std::ifstream::binary);
+    if (!ifs) {
+      std::cerr << "Failed to open " << filename << std::endl;
       return 1;
     }
-    for (int64_t i : *ints) {
-      Outcome o = acc[i];
-      if (o == WIN) {
-        // Already marked winning.
-        continue;
+    EFIterator it(ifs);
+    if (dry_run) {
+      for (int64_t i : it) {
+        Outcome o = acc[i];
+        if (o == WIN) {
+          // Already marked winning.
+          continue;
+        }
+        if (o == LOSS) {
+          std::cerr << filename << ": Permutation " << i << " is already marked LOSS!" << std::endl;
+          return 1;
+        }
+        assert(o == TIE);
+        ++changes;
       }
-      if (o == LOSS) {
-        std::cerr << filename << ": Permutation " << i << " is already marked LOSS!" << std::endl;
-        return 1;
+    } else {
+      std::vector<int64_t> ints;
+      for (;;) {
+        ints.resize(block_size);
+        ints.resize(it.Read(ints.data(), ints.size()));
+        if (ints.empty()) break;
+        ConcurrentMutableRnAccessor::UpdateStats stats =
+            acc.ApplySortedUpdates(ints, WIN, num_threads);
+        if (stats.conflicts > 0) {
+          std::cerr << filename << ": Permutation " << stats.first_conflict << " is already marked LOSS!" << std::endl;
+          return 1;
+        }
+        changes += stats.changed;
       }
-      assert(o == TIE);
-      if (!dry_run) acc[i] = WIN;
-      ++changes;
     }
-    int64_t perms = ints->size();
+    if (it.Failed()) {
+      std::cerr << "Failed to decode " << filename << std::endl;
+      return 1;
+    }
+    int64_t perms = it.size();
     std::cout << filename << ": " << perms << " permutations, " << changes << " new wins recorded." << std::endl;
     total_perms += perms;
     total_changes += changes;
@@ -1,20 +1,43 @@
 // Tool to look up a value at a specific index in a rN output file,
 // along with successor information.
+//
+// With --read=<policy> (see ParseFileReadPolicy() in file-reader.h), the file
+// is read with explicit reads instead of being memory-mapped, and the
+// successors are looked up in a single batch.
 
 #include <cassert>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "accessors.h"
 #include "board.h"
+#include "file-reader.h"
+#include "flags.h"
 #include "macros.h"
 #include "perms.h"
 #include "parse-int.h"
 #include "search.h"
 
+namespace {
+
+void PrintUsage() {
+  std::cout << "Usage: lookup-rN [--read=<policy>] <rN.bin|rN.2bit> <index>\n";
+}
+
+}  // namespace
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    std::cout << "Usage: lookup-rN <rN.bin> <index>\n";
+  std::string arg_read;
+  std::map<std::string, Flag> flags = {
+    // If given, read the file with explicit reads (e.g. "uring,read=4K").
+    {"read", Flag::optional(arg_read)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc != 3) {
+    PrintUsage();
     return 0;
   }
   const char *filename = argv[1];
@@ -24,27 +47,58 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  RnAccessor acc(filename);
+  std::optional<AnyRnAccessor> mapped_acc;
+  std::optional<ReadRnAccessor> read_acc;
+  if (arg_read.empty()) {
+    mapped_acc.emplace(filename);
+  } else {
+    FileReadPolicy policy;
+    if (!ParseFileReadPolicy(arg_read, &policy)) {
+      PrintUsage();
+      return 1;
+    }
+    read_acc.emplace(filename, policy);
+  }
+  auto lookup = [&](const std::vector<int64_t> &indices) {
+    std::vector<Outcome> outcomes(indices.size());
+    if (read_acc) {
+      read_acc->GetBatch(indices.data(), outcomes.data(), indices.size());
+    } else {
+      REP(i, indices.size()) outcomes[i] = (*mapped_acc)[indices[i]];
+    }
+    return outcomes;
+  };
+
   Perm perm = PermAtIndex(index);
 
-  std::cout << "Stored outcome: " << OutcomeToString(acc[index]) << std::endl;
+  std::cout << "Stored outcome: " << OutcomeToString(lookup({index})[0]) << std::endl;
 
-  Outcome o = LOSS;
   std::vector<std::pair<Moves, State>> successors = GenerateAllSuccessors(perm);
   Deduplicate(successors);
+
+  // Look up all undecided successors at once.
+  std::vector<int64_t> succ_indices(successors.size(), -1);
+  std::vector<int64_t> lookup_indices;
+  REP(i, successors.size()) {
+    if (successors[i].second.outcome == TIE) {
+      succ_indices[i] = IndexOf(successors[i].second.perm);
+      lookup_indices.push_back(succ_indices[i]);
+    }
+  }
+  const std::vector<Outcome> lookup_outcomes = lookup(lookup_indices);
+
+  Outcome o = LOSS;
   std::cout << "\n" << successors.size() << " distinct successors:\n";
   Moves best_moves;
   best_moves.size = 0;
-  for (const std::pair<Moves, State> &elem : successors) {
-    const Moves &moves = elem.first;
-    const State &state = elem.second;
+  size_t lookup_pos = 0;
+  REP(i, successors.size()) {
+    const Moves &moves = successors[i].first;
+    const State &state = successors[i].second;
 
     Outcome p = state.outcome;
-    int64_t succ_i = -1;
-    if (p == TIE) {
-      succ_i = IndexOf(state.perm);
-      p = acc[succ_i];
-    }
+    int64_t succ_i = succ_indices[i];
+    if (p == TIE) p = lookup_outcomes[lookup_pos++];
     std::cout << ' ' << moves << ' ' << succ_i << ' ' << OutcomeToString(p) << '\n';
 
     Outcome old_o = o;
@@ -35,6 +35,8 @@
 // 24: win in 22  (from r22-new)
 //  etc.
 //
+// The EF-coded inputs are decoded incrementally, so memory use does not depend
+// on the number of new losses and wins.
 
 #include "board.h"
 #include "codec.h"
@@ -79,6 +81,19 @@ int main(int argc, char *argv[]) {
     files.push_back(std::move(p));
   }
 
+  // Each chunk of a diff file contains a list of losses followed by a list
+  // of wins. To read both lists of a chunk at the same time, the wins are
+  // read from a second stream opened on the same file.
+  std::vector<std::unique_ptr<std::ifstream>> win_files;
+  REP(i, diff_count) {
+    const char *filename = argv[1 + full_input_count + i];
+    win_files.push_back(std::make_unique<std::ifstream>(filename, std::istream::binary));
+    if (!*win_files.back()) {
+      std::cerr << "Failed to open " << filename << std::endl;
+      return 1;
+    }
+  }
+
   BinaryReader r0(*files[0]);
   std::vector<std::unique_ptr<TernaryReader>> rN;
   FOR(i, 1, full_input_count) {
@@ -86,17 +101,18 @@ int main(int argc, char *argv[]) {
   }
 
   REP(chunk, num_chunks) {
-    std::vector<std::vector<int64_t>> new_wins;
-    std::vector<std::vector<int64_t>> new_losses;
-    std::vector<size_t> new_win_pos;
-    std::vector<size_t> new_loss_pos;
+    // New losses and wins of all diff files, merged into a single sequence.
+    // List 2*i contains the losses and list 2*i + 1 the wins of diff i.
+    std::vector<EFIterator> lists;
     REP(i, diff_count) {
-      std::istream &is = *files[full_input_count + i];
-      new_losses.push_back(DecodeEF(is).value());
-      new_wins.push_back(DecodeEF(is).value());
-      new_loss_pos.push_back(0);
-      new_win_pos.push_back(0);
+      lists.emplace_back(*files[full_input_count + i]);
+      if (!EFIterator(*win_files[i]).SkipToEnd()) {
+        std::cerr << "Failed to decode losses of chunk " << chunk << " in diff " << i << std::endl;
+        return 1;
+      }
+      lists.emplace_back(*win_files[i]);
     }
+    EFMerger merger(std::move(lists));
 
     std::vector<int> freq;
     std::vector<uint8_t> output_chunk(chunk_size);
@@ -126,19 +142,11 @@ int main(int argc, char *argv[]) {
         }
       }
 
-      REP(i, diff_count) {
-        if (new_loss_pos[i] < new_losses[i].size() && new_losses[i][new_loss_pos[i]] <= index) {
-          assert(new_losses[i][new_loss_pos[i]] == index);
-          assert(value == 0);
-          value = 2*(full_input_count + i) + 1;
-          ++new_loss_pos[i];
-        }
-        if (new_win_pos[i] < new_wins[i].size() && new_wins[i][new_win_pos[i]] <= index) {
-          assert(new_wins[i][new_win_pos[i]] <= index);
-          assert(value == 0);
-          value = 2*(full_input_count + i) + 2;
-          ++new_win_pos[i];
-        }
+      while (!merger.AtEnd() && merger.Value() <= index) {
+        assert(merger.Value() == index);
+        assert(value == 0);
+        value = 2*full_input_count + merger.Source() + 1;
+        merger.Advance();
       }
 
       assert(value >= 0 && value < 256);
@@ -147,9 +155,17 @@ int main(int argc, char *argv[]) {
       if (value >= freq.size()) freq.resize(value + 1);
       ++freq[value];
     }
+    if (merger.Failed()) {
+      std::cerr << "Failed to decode new losses or wins of chunk " << chunk << std::endl;
+      return 1;
+    }
+    assert(merger.AtEnd());
     REP(i, diff_count) {
-      assert(new_loss_pos[i] == new_losses[i].size());
-      assert(new_win_pos[i] == new_wins[i].size());
+      // Skip over the wins in the first stream.
+      if (!EFIterator(*files[full_input_count + i]).SkipToEnd()) {
+        std::cerr << "Failed to decode wins of chunk " << chunk << " in diff " << i << std::endl;
+        return 1;
+      }
     }
 
     // Debug-print frequencies for comparison against results/expected-merged-frequencies.txt
@@ -0,0 +1,148 @@
+#include "merkle.h"
+
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "shards.h"
+
+namespace {
+
+constexpr char magic[8] = {'P', 'F', 'M', 'R', 'K', 'L', '1', '\n'};
+
+struct Header {
+  char magic[8];
+  uint64_t data_size;
+  int64_t data_mtime;
+  uint64_t leaf_count;
+  sha256_hash_t root;
+};
+static_assert(sizeof(Header) == 64);
+
+sha256_hash_t HashPair(const sha256_hash_t &left, const sha256_hash_t &right) {
+  uint8_t data[64];
+  memcpy(data, left.data(), 32);
+  memcpy(data + 32, right.data(), 32);
+  return ComputeSha256(byte_span_t(data, sizeof(data)));
+}
+
+int64_t FileModificationTime(const std::string &filename) {
+  return std::filesystem::last_write_time(filename).time_since_epoch().count();
+}
+
+}  // namespace
+
+MerkleTree::MerkleTree(std::vector<sha256_hash_t> leaves) {
+  levels.push_back(std::move(leaves));
+  if (levels[0].empty()) {
+    levels.push_back({sha256_hash_t{}});
+    return;
+  }
+  while (levels.back().size() > 1) {
+    levels.emplace_back((levels.back().size() + 1) / 2);
+    for (size_t i = 0; i < levels.back().size(); ++i) UpdateParent(levels.size() - 2, 2*i);
+  }
+}
+
+void MerkleTree::UpdateParent(size_t level, size_t i) {
+  const std::vector<sha256_hash_t> &nodes = levels[level];
+  const size_t left = i & ~size_t{1};
+  levels[level + 1][i / 2] = left + 1 < nodes.size() ?
+      HashPair(nodes[left], nodes[left + 1]) : nodes[left];
+}
+
+void MerkleTree::SetLeaf(size_t i, const sha256_hash_t &hash) {
+  assert(i < LeafCount());
+  levels[0][i] = hash;
+  for (size_t level = 0; level + 1 < levels.size(); ++level, i /= 2) UpdateParent(level, i);
+}
+
+std::vector<size_t> MerkleTree::Diff(const MerkleTree &other) const {
+  assert(LeafCount() == other.LeafCount());
+  std::vector<size_t> result;
+  if (LeafCount() == 0) return result;
+  // Nodes that differ at the current level, starting from the root.
+  std::vector<size_t> nodes = {0};
+  for (size_t level = levels.size() - 1; ; --level) {
+    std::vector<size_t> differing;
+    for (size_t i : nodes) {
+      if (levels[level][i] != other.levels[level][i]) differing.push_back(i);
+    }
+    if (level == 0) return differing;
+    nodes.clear();
+    for (size_t i : differing) {
+      nodes.push_back(2*i);
+      if (2*i + 1 < levels[level - 1].size()) nodes.push_back(2*i + 1);
+    }
+  }
+}
+
+bool MerkleIndex::IsUpToDate(const char *data_filename) const {
+  std::error_code error;
+  const uintmax_t size = std::filesystem::file_size(data_filename, error);
+  return !error && size == data_size && DataFileModificationTime(data_filename) == data_mtime;
+}
+
+int64_t DataFileModificationTime(const char *data_filename) {
+  int64_t mtime = FileModificationTime(data_filename);
+  if (IsShardManifest(data_filename)) {
+    ShardManifest manifest;
+    if (ReadShardManifest(data_filename, &manifest)) {
+      for (const std::string &path : manifest.paths) {
+        mtime = std::max(mtime, FileModificationTime(path));
+      }
+    }
+  }
+  return mtime;
+}
+
+std::optional<MerkleIndex> ReadMerkleIndex(const char *filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs) {
+    std::cerr << "Could not open Merkle index " << filename << std::endl;
+    return {};
+  }
+  Header header;
+  if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      std::filesystem::file_size(filename) != sizeof(header) + header.leaf_count * sizeof(sha256_hash_t)) {
+    std::cerr << filename << " is not a valid Merkle index!" << std::endl;
+    return {};
+  }
+  std::vector<sha256_hash_t> leaves(header.leaf_count);
+  ifs.read(reinterpret_cast<char*>(leaves.data()), leaves.size() * sizeof(sha256_hash_t));
+  MerkleIndex index;
+  index.data_size = header.data_size;
+  index.data_mtime = header.data_mtime;
+  index.tree = MerkleTree(std::move(leaves));
+  if (!ifs || index.tree.Root() != header.root) {
+    std::cerr << "Merkle index " << filename << " is corrupt!" << std::endl;
+    return {};
+  }
+  return index;
+}
+
+bool WriteMerkleIndex(const char *filename, const MerkleIndex &index) {
+  Header header = {};
+  memcpy(header.magic, magic, sizeof(magic));
+  header.data_size = index.data_size;
+  header.data_mtime = index.data_mtime;
+  header.leaf_count = index.tree.LeafCount();
+  header.root = index.tree.Root();
+
+  const std::string temp_filename = std::string(filename) + ".tmp";
+  std::ofstream ofs(temp_filename, std::ofstream::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(index.tree.Leaves().data()),
+      index.tree.LeafCount() * sizeof(sha256_hash_t));
+  ofs.close();
+  std::error_code error;
+  if (!ofs || (std::filesystem::rename(temp_filename, filename, error), error)) {
+    std::cerr << "Failed to write " << filename << "!" << std::endl;
+    std::filesystem::remove(temp_filename, error);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef MERKLE_H_INCLUDED
+#define MERKLE_H_INCLUDED
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+
+// Merkle tree over the SHA-256 checksums of the chunks of a data file.
+//
+// The leaves are the chunk checksums, exactly as listed in the
+// metadata/chunk-rN.sha256sum files. Each internal node is the SHA-256 of the
+// concatenation of its two children; a node without a sibling (at the end of
+// an odd-sized level) is copied to the next level unchanged. This means two
+// trees can be compared by their roots, and differing chunks can be found by
+// descending only into differing subtrees.
+class MerkleTree {
+public:
+  explicit MerkleTree(std::vector<sha256_hash_t> leaves);
+
+  size_t LeafCount() const { return levels[0].size(); }
+
+  const sha256_hash_t &Leaf(size_t i) const { return levels[0][i]; }
+
+  const std::vector<sha256_hash_t> &Leaves() const { return levels[0]; }
+
+  // Root of the tree. For an empty tree, this is all zeroes.
+  const sha256_hash_t &Root() const { return levels.back()[0]; }
+
+  // Replaces the i-th leaf, and updates the nodes on the path to the root.
+  void SetLeaf(size_t i, const sha256_hash_t &hash);
+
+  // Returns the indices of the leaves that differ from `other`, which must
+  // have the same number of leaves, in increasing order.
+  std::vector<size_t> Diff(const MerkleTree &other) const;
+
+private:
+  void UpdateParent(size_t level, size_t i);
+
+  // levels[0] contains the leaves, levels.back() contains only the root.
+  std::vector<std::vector<sha256_hash_t>> levels;
+};
+
+// Merkle tree of a data file, together with the size and modification time
+// of the data file when it was hashed. This is saved as a small binary file
+// (see GetMerkleIndexFilename() in input-verification.h) so that later
+// verifications can skip hashing chunks that have not changed.
+struct MerkleIndex {
+  // Size of the data file in bytes.
+  uint64_t data_size = 0;
+
+  // Modification time of the data file (see DataFileModificationTime()).
+  int64_t data_mtime = 0;
+
+  MerkleTree tree{{}};
+
+  // Returns whether the data file has the same size and modification time as
+  // when the index was written.
+  bool IsUpToDate(const char *data_filename) const;
+};
+
+// Returns the latest modification time of the data file, or of any of its
+// shards if it is a shard manifest (see shards.h).
+int64_t DataFileModificationTime(const char *data_filename);
+
+// Reads an index written by WriteMerkleIndex(). Returns nothing (after
+// printing an error message) if the file is missing or invalid.
+std::optional<MerkleIndex> ReadMerkleIndex(const char *filename);
+
+// Writes the index to a temporary file first, then renames it, so readers
+// never see a partially written index. Returns false on failure.
+bool WriteMerkleIndex(const char *filename, const MerkleIndex &index);
+
+#endif  // ndef MERKLE_H_INCLUDED
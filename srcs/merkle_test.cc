@@ -0,0 +1,137 @@
+#include "merkle.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "random.h"
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+sha256_hash_t RandomHash() {
+  sha256_hash_t hash;
+  for (uint8_t &byte : hash) byte = rng();
+  return hash;
+}
+
+std::vector<sha256_hash_t> RandomHashes(size_t n) {
+  std::vector<sha256_hash_t> hashes(n);
+  for (auto &hash : hashes) hash = RandomHash();
+  return hashes;
+}
+
+void TestSmallTrees() {
+  assert(MerkleTree({}).Root() == sha256_hash_t{});
+
+  const sha256_hash_t a = RandomHash();
+  const sha256_hash_t b = RandomHash();
+  const sha256_hash_t c = RandomHash();
+  assert(MerkleTree({a}).Root() == a);
+
+  uint8_t ab_bytes[64];
+  std::copy(a.begin(), a.end(), ab_bytes);
+  std::copy(b.begin(), b.end(), ab_bytes + 32);
+  const sha256_hash_t ab = ComputeSha256(byte_span_t(ab_bytes, 64));
+  assert(MerkleTree({a, b}).Root() == ab);
+
+  // A node without a sibling is copied to the next level.
+  uint8_t abc_bytes[64];
+  std::copy(ab.begin(), ab.end(), abc_bytes);
+  std::copy(c.begin(), c.end(), abc_bytes + 32);
+  assert(MerkleTree({a, b, c}).Root() == ComputeSha256(byte_span_t(abc_bytes, 64)));
+}
+
+void TestUpdatesAndDiff() {
+  for (size_t n : {1, 2, 3, 7, 8, 9, 1000, 7429}) {
+    const std::vector<sha256_hash_t> leaves = RandomHashes(n);
+    const MerkleTree original(leaves);
+    MerkleTree tree = original;
+    assert(tree.Diff(original).empty());
+
+    // Change some leaves; the root must match a tree built from scratch.
+    std::vector<sha256_hash_t> changed_leaves = leaves;
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < n; i += 1 + rng() % (n / 3 + 1)) {
+      changed_leaves[i] = RandomHash();
+      tree.SetLeaf(i, changed_leaves[i]);
+      changed.push_back(i);
+    }
+    assert(tree.Root() == MerkleTree(changed_leaves).Root());
+    assert(tree.Root() != original.Root());
+    assert(tree.Diff(original) == changed);
+    assert(original.Diff(tree) == changed);
+
+    // Changing the leaves back restores the original root.
+    for (size_t i : changed) tree.SetLeaf(i, leaves[i]);
+    assert(tree.Root() == original.Root());
+  }
+}
+
+void TestIndexFile() {
+  const std::string dir = std::filesystem::temp_directory_path() /
+      ("merkle_test." + std::to_string(getpid()));
+  std::filesystem::create_directory(dir);
+  const std::string data_filename = dir + "/r5.bin";
+  const std::string index_filename = dir + "/chunk-r5.merkle";
+  {
+    std::ofstream ofs(data_filename);
+    ofs << "data";
+  }
+
+  MerkleIndex index;
+  index.data_size = 4;
+  index.data_mtime = DataFileModificationTime(data_filename.c_str());
+  index.tree = MerkleTree(RandomHashes(100));
+  assert(index.IsUpToDate(data_filename.c_str()));
+  assert(WriteMerkleIndex(index_filename.c_str(), index));
+
+  std::optional<MerkleIndex> loaded = ReadMerkleIndex(index_filename.c_str());
+  assert(loaded);
+  assert(loaded->data_size == index.data_size);
+  assert(loaded->data_mtime == index.data_mtime);
+  assert(loaded->tree.Leaves() == index.tree.Leaves());
+  assert(loaded->tree.Root() == index.tree.Root());
+  assert(loaded->IsUpToDate(data_filename.c_str()));
+
+  // Modifying the data file makes the index out of date.
+  {
+    std::ofstream ofs(data_filename, std::ofstream::app);
+    ofs << "more";
+  }
+  assert(!loaded->IsUpToDate(data_filename.c_str()));
+
+  // Corrupted indices are rejected.
+  {
+    // Invert a byte, since writing a fixed value could leave it unchanged.
+    std::fstream fs(index_filename, std::fstream::in | std::fstream::out | std::fstream::binary);
+    fs.seekg(100);
+    const char byte = fs.get();
+    fs.seekp(100);
+    fs.put(~byte);
+    assert(fs);
+  }
+  assert(!ReadMerkleIndex(index_filename.c_str()));
+  assert(!ReadMerkleIndex(data_filename.c_str()));
+
+  std::filesystem::remove_all(dir);
+}
+
+}  // namespace
+
+int main() {
+  TestSmallTrees();
+  TestUpdatesAndDiff();
+  TestIndexFile();
+}
@@ -7,6 +7,7 @@
 #include "accessors.h"
 #include "board.h"
 #include "chunks.h"
+#include "flags.h"
 #include "macros.h"
 #include "perms.h"
 #include "search.h"
@@ -17,6 +18,8 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <string>
 
 namespace {
 
@@ -57,12 +60,22 @@ void HandlePerm(
 }  // namespace
 
 int main(int argc, char* argv[]) {
-  if (argc != 2) {
-    std::cerr << "Usage: minify-merged <minimized.bin>\n"
+  std::string arg_mmap;
+  std::map<std::string, Flag> flags = {
+    // Memory map policy for the output file (see ParseMemMapPolicy() in accessors.h)
+    {"mmap", Flag::optional(arg_mmap)},
+  };
+
+  if (!ParseFlags(argc, argv, flags) || argc != 2) {
+    std::cerr << "Usage: minify-merged [--mmap=<policy>] <minimized.bin>\n"
         "Merged output is read from standard input." << std::endl;
     return 1;
   }
 
+  if (!InitMemMapPolicyFromFlag(arg_mmap)) {
+    return 1;
+  }
+
   const char *output_filename = argv[1];
 
   // Create and open output file.
@@ -1,34 +1,84 @@
 #include "minimized-accessor.h"
 
 #include "accessors.h"
+#include "elided-accessor.h"
+#include "file-reader.h"
+#include "hot-tier.h"
+#include "huffman-accessor.h"
+#include "w1-bitmap-accessor.h"
 #include "xz-accessor.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <filesystem>
 #include <vector>
 
 namespace {
 
-std::variant<MappedMinIndex, XzAccessor>
-OpenAccessor(const char *filename) {
+// Exits if a compressed file does not decode to a full min-index.
+void CheckUncompressedSize(const char *filename, int64_t size) {
+  if (size != min_index_size) {
+    std::cerr << "Compressed file has wrong uncompressed size: " << filename
+        << " (" << size << " bytes, expected " << min_index_size << ")" << std::endl;
+    exit(1);
+  }
+}
+
+MinimizedVariant
+OpenAccessor(const char *filename, size_t xz_cache_size, const FileReadPolicy *read_policy) {
   if (!std::filesystem::is_regular_file(filename)) {
     std::cerr << "File does not exit (or is not a regular file): " << filename << std::endl;
     exit(1);
   }
+  if (std::filesystem::file_size(filename) == min_index_size && read_policy != nullptr) {
+    // Read uncompressed file with explicit reads instead of memory-mapping it.
+    return MinimizedVariant(std::in_place_type<BatchFileReader>, filename, *read_policy);
+  }
   if (std::filesystem::file_size(filename) == min_index_size) {
     // Open binary file with one byte postion.
-    return std::variant<MappedMinIndex, XzAccessor>(std::in_place_type<MappedMinIndex>, filename);
+    return MinimizedVariant(std::in_place_type<MappedMinIndex>, filename);
+  }
+  if (IsShardManifest(filename)) {
+    // Open uncompressed file split into shards.
+    auto var = MinimizedVariant(std::in_place_type<ShardedMinIndex>, filename);
+    if (std::get<ShardedMinIndex>(var).size() != min_index_size) {
+      std::cerr << "Sharded file has wrong size: " << filename << std::endl;
+      exit(1);
+    }
+    return var;
   }
   if (XzAccessor::IsXzFile(filename)) {
     // Open XZ compressed file.
-    auto var = std::variant<MappedMinIndex, XzAccessor>(std::in_place_type<XzAccessor>, filename);
-    assert(std::get<XzAccessor>(var).GetUncompressedFileSize() == min_index_size);
+    auto var = MinimizedVariant(std::in_place_type<XzAccessor>, filename, xz_cache_size);
+    CheckUncompressedSize(filename, std::get<XzAccessor>(var).GetUncompressedFileSize());
+    return var;
+  }
+  if (HuffmanAccessor::IsHuffmanFile(filename)) {
+    // Open Huffman compressed file.
+    auto var = MinimizedVariant(std::in_place_type<HuffmanAccessor>, filename);
+    CheckUncompressedSize(filename, std::get<HuffmanAccessor>(var).GetUncompressedFileSize());
+    return var;
+  }
+  if (W1BitmapAccessor::IsW1BitmapFile(filename)) {
+    // Open W1 bitmap file.
+    auto var = MinimizedVariant(std::in_place_type<W1BitmapAccessor>, filename);
+    CheckUncompressedSize(filename, std::get<W1BitmapAccessor>(var).GetUncompressedFileSize());
+    return var;
+  }
+  if (ElidedAccessor::IsElidedFile(filename)) {
+    // Open elided file.
+    auto var = MinimizedVariant(std::in_place_type<ElidedAccessor>, filename);
+    CheckUncompressedSize(filename, std::get<ElidedAccessor>(var).GetUncompressedFileSize());
     return var;
   }
   std::cerr << "Unkown type of file: " << filename << std::endl;
   exit(1);
 }
 
+// Maximum number of hot tier entries compared with the data file by
+// LoadHotTier().
+constexpr size_t hot_tier_verify_samples = 4096;
+
 struct ReadByteImpl {
   int64_t offset;
 
@@ -39,6 +89,26 @@ struct ReadByteImpl {
   uint8_t operator()(const XzAccessor &acc) {
     return acc.ReadByte(offset);
   }
+
+  uint8_t operator()(const HuffmanAccessor &acc) {
+    return acc.ReadByte(offset);
+  }
+
+  uint8_t operator()(const W1BitmapAccessor &acc) {
+    return acc.ReadByte(offset);
+  }
+
+  uint8_t operator()(const ElidedAccessor &acc) {
+    return acc.ReadByte(offset);
+  }
+
+  uint8_t operator()(const BatchFileReader &acc) {
+    return acc.ReadByte(offset);
+  }
+
+  uint8_t operator()(const ShardedMinIndex &acc) {
+    return acc[offset];
+  }
 };
 
 struct ReadBytesImpl {
@@ -55,19 +125,61 @@ struct ReadBytesImpl {
   void operator()(const XzAccessor &acc) {
     return acc.ReadBytes(offsets, bytes, count);
   }
+
+  void operator()(const HuffmanAccessor &acc) {
+    return acc.ReadBytes(offsets, bytes, count);
+  }
+
+  void operator()(const W1BitmapAccessor &acc) {
+    return acc.ReadBytes(offsets, bytes, count);
+  }
+
+  void operator()(const ElidedAccessor &acc) {
+    return acc.ReadBytes(offsets, bytes, count);
+  }
+
+  void operator()(const BatchFileReader &acc) {
+    return acc.ReadBytes(offsets, bytes, count);
+  }
+
+  void operator()(const ShardedMinIndex &acc) {
+    for (size_t i = 0; i < count; ++i) {
+      bytes[i] = acc[offsets[i]];
+    }
+  }
 };
 
 }  // namespace
 
-MinimizedAccessor::MinimizedAccessor(const char *filename)
-  : acc(OpenAccessor(filename)) {}
+MinimizedAccessor::MinimizedAccessor(
+    const char *filename, size_t xz_cache_size, const FileReadPolicy *read_policy)
+  : acc(OpenAccessor(filename, xz_cache_size, read_policy)) {}
 
 uint8_t MinimizedAccessor::ReadByte(int64_t offset) const {
+  if (hot_tier) {
+    if (std::optional<uint8_t> byte = hot_tier->Lookup(offset)) return *byte;
+  }
   return std::visit(ReadByteImpl{offset}, acc);
 }
 
 void MinimizedAccessor::ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t n) const {
-  return std::visit(ReadBytesImpl{offsets, bytes, n}, acc);
+  if (!hot_tier) {
+    return std::visit(ReadBytesImpl{offsets, bytes, n}, acc);
+  }
+  std::vector<size_t> missing;
+  hot_tier->LookupSorted(offsets, bytes, n, &missing);
+  if (missing.empty()) return;
+  if (missing.size() == n) {
+    return std::visit(ReadBytesImpl{offsets, bytes, n}, acc);
+  }
+  // Read the remaining offsets (which are still in nondecreasing order) from
+  // the file, then scatter the results.
+  std::vector<int64_t> missing_offsets;
+  missing_offsets.reserve(missing.size());
+  for (size_t i : missing) missing_offsets.push_back(offsets[i]);
+  std::vector<uint8_t> missing_bytes(missing.size());
+  std::visit(ReadBytesImpl{missing_offsets.data(), missing_bytes.data(), missing.size()}, acc);
+  for (size_t j = 0; j < missing.size(); ++j) bytes[missing[j]] = missing_bytes[j];
 }
 
 std::vector<uint8_t> MinimizedAccessor::ReadBytes(const std::vector<int64_t> &offsets) const {
@@ -76,3 +188,64 @@ std::vector<uint8_t> MinimizedAccessor::ReadBytes(const std::vector<int64_t> &of
   ReadBytes(offsets.data(), bytes.data(), count);
   return bytes;
 }
+
+void MinimizedAccessor::EnableParallelDecompression(ThreadPool *pool, size_t min_blocks, int max_threads) {
+  if (XzAccessor *xz_acc = std::get_if<XzAccessor>(&acc)) {
+    xz_acc->EnableParallelDecompression(pool, min_blocks, max_threads);
+  }
+  if (HuffmanAccessor *huffman_acc = std::get_if<HuffmanAccessor>(&acc)) {
+    huffman_acc->EnableParallelDecompression(pool, min_blocks, max_threads);
+  }
+}
+
+std::optional<XzAccessor::CacheStats> MinimizedAccessor::GetXzCacheStats() const {
+  if (const XzAccessor *xz_acc = std::get_if<XzAccessor>(&acc)) {
+    return xz_acc->GetCacheStats();
+  }
+  return {};
+}
+
+void MinimizedAccessor::LoadHotTier(const char *filename) {
+  auto table = std::make_unique<HotTier>(filename);
+  // All representations of minimized.bin have the same uncompressed size, so
+  // a table built from one can be used with the others.
+  if (table->SourceSize() != min_index_size) {
+    std::cerr << "Hot tier " << filename << " was built from a data file of "
+        << table->SourceSize() << " bytes, but minimized.bin has " << min_index_size
+        << " bytes! Rebuild the hot tier with build-hot-tier." << std::endl;
+    exit(1);
+  }
+  // Offsets are strictly increasing, so it's enough to check the last one.
+  if (table->size() > 0 && table->Offsets().back() >= static_cast<int64_t>(min_index_size)) {
+    std::cerr << "Hot tier " << filename << " contains offset " << table->Offsets().back()
+        << ", which is out of range!" << std::endl;
+    exit(1);
+  }
+  // Compare evenly spaced entries with the data file. Reading all of them
+  // could take a long time if the file is compressed.
+  const size_t samples = std::min<size_t>(table->size(), hot_tier_verify_samples);
+  std::vector<int64_t> offsets(samples);
+  std::vector<uint8_t> expected(samples);
+  for (size_t i = 0; i < samples; ++i) {
+    const size_t j = i * table->size() / samples;
+    offsets[i] = table->Offsets()[j];
+    expected[i] = table->Values()[j];
+  }
+  std::vector<uint8_t> actual(samples);
+  std::visit(ReadBytesImpl{offsets.data(), actual.data(), samples}, acc);
+  if (actual != expected) {
+    std::cerr << "Hot tier " << filename << " does not match the data file! "
+        << "Rebuild the hot tier with build-hot-tier." << std::endl;
+    exit(1);
+  }
+  hot_tier = std::move(table);
+}
+
+std::optional<HotTier::Stats> MinimizedAccessor::GetHotTierStats() const {
+  if (hot_tier) return hot_tier->GetStats();
+  return {};
+}
+
+const BatchFileReader *MinimizedAccessor::GetFileReader() const {
+  return std::get_if<BatchFileReader>(&acc);
+}
@@ -1,6 +1,7 @@
 #ifndef MINIMIZED_ACCESSOR_H_INCLUDED
 #define MINIMIZED_ACCESSOR_H_INCLUDED
 
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -8,19 +9,47 @@
 #include <vector>
 
 #include "accessors.h"
+#include "elided-accessor.h"
+#include "file-reader.h"
+#include "hot-tier.h"
+#include "huffman-accessor.h"
 #include "perms.h"
 #include "position-value.h"
+#include "w1-bitmap-accessor.h"
 #include "xz-accessor.h"
 
 using MappedMinIndex = MappedFile<uint8_t, min_index_size>;
+using ShardedMinIndex = ShardedMappedFile<uint8_t>;
+
+// The possible representations of minimized.bin, one of which is used by
+// MinimizedAccessor.
+using MinimizedVariant = std::variant<
+    MappedMinIndex, XzAccessor, HuffmanAccessor, W1BitmapAccessor, ElidedAccessor,
+    BatchFileReader, ShardedMinIndex>;
 
 // Accessor used to look up the result of positions in either an uncompressed
-// minimized file ("minized.bin") or a compressed file in XZ format
-// ("minimized.bin.xz"). The compressed file must use small blocks to allow
-// efficient random access (see NOTES.txt for details).
+// minimized file ("minized.bin"), an uncompressed file split into shards
+// ("minimized.bin.shards", the manifest; see shards.h), a compressed file in
+// XZ format ("minimized.bin.xz"), a Huffman-compressed file
+// ("minimized.bin.huff", see huffman-accessor.h), a W1 bitmap file
+// ("minimized.bin.w1", see w1-bitmap-accessor.h), or an elided file
+// ("minimized.bin.elided", see elided-accessor.h). The XZ file must use small
+// blocks to allow efficient random access (see NOTES.txt for details).
+//
+// Optionally, a hot tier (see hot-tier.h) can be loaded with LoadHotTier().
+// It is checked before the file, and only offsets that are missing from it are
+// read from the file.
 class MinimizedAccessor {
 public:
-  explicit MinimizedAccessor(const char *filename);
+  // If the file is compressed, `xz_cache_size` is the memory budget (in
+  // bytes) for caching decompressed blocks; see XzAccessor.
+  //
+  // If `read_policy` is given and the file is uncompressed, the file is read
+  // with a BatchFileReader instead of being memory-mapped. This is useful when
+  // the file is not in the page cache, since ReadBytes() then submits all
+  // reads at once. Compressed files are always memory-mapped.
+  explicit MinimizedAccessor(const char *filename, size_t xz_cache_size = 0,
+      const FileReadPolicy *read_policy = nullptr);
 
   // Reads a bytes at the given file offset.
   //
@@ -37,8 +66,33 @@ public:
   // Convenience method that accepts and returns offsets and bytes in a vector.
   std::vector<uint8_t> ReadBytes(const std::vector<int64_t> &offsets) const;
 
+  // Enables parallel block decompression if the file is compressed; see
+  // XzAccessor::EnableParallelDecompression(). Does nothing otherwise.
+  void EnableParallelDecompression(ThreadPool *pool, size_t min_blocks, int max_threads);
+
+  // Returns the block cache statistics if the file is compressed, or nothing
+  // otherwise.
+  std::optional<XzAccessor::CacheStats> GetXzCacheStats() const;
+
+  // Loads a hot tier, which is checked before the file from then on. Exits if
+  // the hot tier file is invalid, or if it was not built from this data file:
+  // its source size must be the uncompressed size of minimized.bin, all of
+  // its offsets must be in range, and a sample of its values must match the
+  // file. Not thread-safe: must be called before any lookups are
+  // done.
+  void LoadHotTier(const char *filename);
+
+  // Returns the hot tier statistics if a hot tier was loaded, or nothing
+  // otherwise.
+  std::optional<HotTier::Stats> GetHotTierStats() const;
+
+  // Returns the file reader if the file is read with explicit reads (see the
+  // constructor), or null if it's memory-mapped.
+  const BatchFileReader *GetFileReader() const;
+
 private:
-  std::variant<MappedMinIndex, XzAccessor> acc;
+  MinimizedVariant acc;
+  std::unique_ptr<HotTier> hot_tier;
 };
 
 #endif  // ndef MINIMIZED_ACCESSOR_H_INCLUDED
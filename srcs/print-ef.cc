@@ -1,9 +1,7 @@
 // Decodes Elias-Fano encoded output files and print the numbers one per line.
 //
-// Note this doesn't stream; it reads the whole input file into memory, so it
-// doesn't work well with very large files.
+// Input is decoded incrementally, so this works with arbitrarily large files.
 
-#include "bytes.h"
 #include "efcodec.h"
 #include "parse-int.h"
 
@@ -11,7 +9,6 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
-#include <vector>
 
 int main(int argc, char *argv[]) {
   int start_argi = 1;
@@ -44,29 +41,27 @@ int main(int argc, char *argv[]) {
   }
 
   for (int i = start_argi; i < argc; ++i) {
-    bytes_t bytes;
-    if (strcmp(argv[i], "-") == 0) {
-      bytes = ReadInput(std::cin);
-    } else {
-      std::ifstream ifs;
-      ifs.rdbuf()->pubsetbuf(nullptr, 0);
+    const bool use_stdin = strcmp(argv[i], "-") == 0;
+    std::ifstream ifs;
+    if (!use_stdin) {
       ifs.open(argv[i], std::ifstream::binary);
       if (!ifs) {
         std::cerr << "Failed to open input: " << argv[i] << std::endl;
         return 1;
       }
-      bytes = ReadInput(ifs);
     }
-    byte_span_t byte_span = bytes;
-    for (int part = 0; !byte_span.empty(); ++part) {
-      auto result = DecodeEF(&byte_span);
-      if (!result) {
-        std::cerr << "Elias-Fano decoding failed!" << std::endl;
-        return 1;
-      }
+    std::istream &is = use_stdin ? std::cin : ifs;
+    for (int part = 0; is.peek() != EOF; ++part) {
+      EFIterator it(is);
       if (every > 0 ? part % every == want_part :
           (want_part == -1 || part == want_part)) {
-        for (auto i : *result) std::cout << i << '\n';
+        for (auto i : it) std::cout << i << '\n';
+      } else {
+        it.SkipToEnd();
+      }
+      if (it.Failed()) {
+        std::cerr << "Elias-Fano decoding failed!" << std::endl;
+        return 1;
       }
     }
   }
@@ -8,11 +8,14 @@
 // entirely. The server is intended for local use only.
 
 #include "bytes.h"
+#include "file-reader.h"
 #include "flags.h"
 #include "minimized-lookup.h"
 #include "minimized-accessor.h"
+#include "parse-int.h"
 #include "parse-perm.h"
 #include "position-value.h"
+#include "thread-pool.h"
 
 #if _WIN32
 
@@ -38,15 +41,18 @@ static int wsa_startup_return_value = CallWsaStartup();
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
 #include <cstdio>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <optional>
 #include <string>
 #include <map>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -56,17 +62,40 @@ const char *default_hostname = "localhost";
 const char *default_portname = "8080";
 const char *default_serve_dir = "static";
 const char *default_index_file = "index.html";
+const char *default_xz_cache_size = "128M";
+const std::string default_xz_threads = std::to_string(std::min(8u, std::max(1u, std::thread::hardware_concurrency())));
 
 std::string minimized_path = default_minimized_path;
 std::string hostname = default_hostname;
 std::string portname = default_portname;
 std::string serve_dir = default_serve_dir;
 std::string index_file = default_index_file;
+std::string mmap_policy;
+std::string read_policy;
+std::string xz_cache_size = default_xz_cache_size;
+std::string xz_threads = default_xz_threads;
+std::string hot_tier_path;
+std::string access_log_path;
 
 const std::string lookup_path = "/lookup/";
 
 std::optional<MinimizedAccessor> acc;
 
+// Worker threads used to decompress blocks of minimized.bin.xz in parallel.
+std::optional<ThreadPool> xz_pool;
+
+// Minimum number of blocks a lookup must touch before decompression is done
+// in parallel. For fewer blocks, the overhead isn't worth it.
+constexpr size_t xz_parallel_min_blocks = 4;
+
+// Cache statistics are logged after every `cache_stats_interval` lookups.
+constexpr int64_t cache_stats_interval = 1000;
+int64_t lookup_count = 0;
+
+// If --access-log is given, the position of each lookup is appended to this
+// file, one per line. This can be used as input to build-hot-tier.
+std::ofstream access_log;
+
 constexpr int max_header_size = 102400;  // 100 KiB
 
 const std::string SPACE_STRING = " ";
@@ -319,6 +348,26 @@ V GetValue(const std::map<K, V> map, const K &key, const V &default_value) {
   }
 }
 
+void MaybeLogCacheStats() {
+  if (++lookup_count % cache_stats_interval != 0) return;
+  if (auto stats = acc->GetXzCacheStats(); stats) {
+    std::cout << "Block cache after " << lookup_count << " lookups: "
+        << stats->hits << " hits, "
+        << stats->extensions << " extensions, "
+        << stats->misses << " misses, "
+        << stats->evictions << " evictions; "
+        << stats->blocks << " blocks (" << stats->bytes << " bytes) cached." << std::endl;
+  }
+  if (auto stats = acc->GetHotTierStats(); stats) {
+    int64_t total = stats->hits + stats->misses;
+    std::cout << "Hot tier after " << lookup_count << " lookups: "
+        << stats->hits << " hits, "
+        << stats->misses << " misses ("
+        << (total > 0 ? 100.0 * stats->hits / total : 0.0) << "% hit rate)." << std::endl;
+  }
+  if (access_log.is_open()) access_log.flush();
+}
+
 void HandleHttpRequest(
     int s,
     const std::string &request_method,
@@ -359,7 +408,9 @@ void HandleHttpRequest(
       std::optional<std::vector<std::pair<EvaluatedSuccessor, std::vector<Value>>>> successors;
       std::string error;
       if (std::optional<Perm> perm = ParsePerm(components[1], &error); perm) {
+        if (access_log.is_open()) access_log << components[1] << '\n';
         successors = LookupDetailedSuccessors(*acc, *perm, detailed, &error);
+        MaybeLogCacheStats();
       }
       if (!successors) {
         SendResponse(s, 400, "Bad Request", error);
@@ -504,6 +555,12 @@ void PrintUsage() {
     << " --port=<port to listen on> (default: " << default_portname << ")\n"
     << " --static=<directory with static content> (default: " << default_serve_dir << ")\n"
     << " --index=<directory index file> (default: " << default_index_file << ")\n"
+    << " --mmap=<memory map options for minimized.bin> (e.g. random,populate; default: none)\n"
+    << " --read=<read minimized.bin with explicit reads instead of mmap> (e.g. uring,read=4K,depth=64; default: use mmap)\n"
+    << " --xz-cache=<memory for decompressed blocks of minimized.bin.xz> (0 to disable; default: " << default_xz_cache_size << ")\n"
+    << " --xz-threads=<threads per lookup to decompress minimized.bin.xz> (1 to disable; default: " << default_xz_threads << ")\n"
+    << " --hot-tier=<hot tier file built by build-hot-tier> (default: none)\n"
+    << " --access-log=<file to append looked-up positions to> (default: none)\n"
     << std::endl;
 }
 
@@ -520,6 +577,12 @@ int main(int argc, char *argv[]) {
     {"port", Flag::optional(portname)},
     {"static", Flag::optional(serve_dir)},
     {"index", Flag::optional(index_file)},
+    {"mmap", Flag::optional(mmap_policy)},
+    {"read", Flag::optional(read_policy)},
+    {"xz-cache", Flag::optional(xz_cache_size)},
+    {"xz-threads", Flag::optional(xz_threads)},
+    {"hot-tier", Flag::optional(hot_tier_path)},
+    {"access-log", Flag::optional(access_log_path)},
   };
 
   if (!ParseFlags(argc, argv, flags)) {
@@ -528,6 +591,33 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (!InitMemMapPolicyFromFlag(mmap_policy)) {
+    std::cout << "\n";
+    PrintUsage();
+    return 1;
+  }
+
+  std::optional<FileReadPolicy> file_read_policy;
+  if (!read_policy.empty() && !ParseFileReadPolicy(read_policy, &file_read_policy.emplace())) {
+    std::cout << "\n";
+    PrintUsage();
+    return 1;
+  }
+
+  size_t xz_cache_bytes = 0;
+  if (!ParseByteSize(xz_cache_size, &xz_cache_bytes)) {
+    std::cerr << "Invalid --xz-cache size: " << xz_cache_size << "\n" << std::endl;
+    PrintUsage();
+    return 1;
+  }
+
+  int xz_thread_count = ParseInt(xz_threads.c_str());
+  if (xz_thread_count < 1) {
+    std::cerr << "Invalid --xz-threads value: " << xz_threads << "\n" << std::endl;
+    PrintUsage();
+    return 1;
+  }
+
   std::cout << "Serving static content from directory: " << serve_dir << std::endl;
   if (!std::filesystem::is_directory(serve_dir)) {
     std::cerr << serve_dir << " is not a directory!" << std::endl;
@@ -552,15 +642,40 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  // Hack: automatically switch to the xz-compressed file if the uncompressed
-  // file does not exist.
-  if (!std::filesystem::exists(minimized_path) &&
-      std::filesystem::exists(minimized_path + ".xz")) {
-    minimized_path += ".xz";
+  // Hack: automatically switch to a sharded or compressed file if the
+  // uncompressed file does not exist. Files are tried from fastest to slowest
+  // to access.
+  if (!std::filesystem::exists(minimized_path)) {
+    for (const char *extension : {".shards", ".w1", ".huff", ".xz", ".elided"}) {
+      if (std::filesystem::exists(minimized_path + extension)) {
+        minimized_path += extension;
+        break;
+      }
+    }
   }
 
   std::cout << "Using minimized position data from: " << minimized_path << std::endl;
-  acc.emplace(minimized_path.c_str());
+  acc.emplace(minimized_path.c_str(), xz_cache_bytes, file_read_policy ? &*file_read_policy : nullptr);
+  if (const BatchFileReader *reader = acc->GetFileReader()) {
+    std::cout << "Reading minimized position data with "
+        << (reader->UsesIoUring() ? "io_uring" : "pread()") << std::endl;
+  }
+  if (!hot_tier_path.empty()) {
+    std::cout << "Loading hot tier from: " << hot_tier_path << std::endl;
+    acc->LoadHotTier(hot_tier_path.c_str());
+  }
+  if (!access_log_path.empty()) {
+    access_log.open(access_log_path, std::ofstream::app);
+    if (!access_log) {
+      std::cerr << "Could not open access log " << access_log_path << std::endl;
+      return 1;
+    }
+    std::cout << "Logging accessed positions to: " << access_log_path << std::endl;
+  }
+  if (xz_thread_count > 1) {
+    xz_pool.emplace(xz_thread_count - 1);
+    acc->EnableParallelDecompression(&*xz_pool, xz_parallel_min_blocks, xz_thread_count);
+  }
 
   std::cout << "Creating a TCP socket to listen on host " << hostname << " port " << portname << "..." << std::endl;
   int server_socket = CreateListeningSocket(hostname.c_str(), portname.c_str());
@@ -0,0 +1,58 @@
+#ifndef RETROGRADE_SLOTS_H_INCLUDED
+#define RETROGRADE_SLOTS_H_INCLUDED
+
+#include <cstdint>
+
+// Encoding of the per-position state ("slots") of solve-retrograde.
+//
+// A slot either holds a final value (with decided_bit set), or the number of
+// distinct successors that are not known to be won yet. Final values use the
+// output format of merge-phases (see merge-phases.cc): 0 for tied, 2k + 1 for
+// lost-in-k, and 2k for won-in-k.
+
+// Set in a slot whose position is decided; the lower 8 bits hold the value.
+constexpr uint16_t decided_bit = 0x8000;
+
+// Values in the output format.
+constexpr int lost_in_0_value = 1;
+constexpr int won_in_1_value = 2;
+constexpr int LostValue(int k) { return 2*k + 1; }
+constexpr int WonValue(int k) { return 2*k; }
+
+constexpr bool IsDecided(uint16_t slot) { return (slot & decided_bit) != 0; }
+
+// Returns the slot of a decided position with the given value.
+constexpr uint16_t DecidedSlot(int value) { return decided_bit | value; }
+
+// Returns the initial slot of a position that is not won-in-1, given its
+// number of distinct successors, and how many of those are not won-in-1
+// either. A position without successors is lost-in-0, and one whose
+// successors are all won-in-1 is lost-in-1.
+constexpr uint16_t InitialSlot(int64_t successors, int64_t not_won_in_1) {
+  return successors == 0 ? DecidedSlot(lost_in_0_value) :
+      not_won_in_1 == 0 ? DecidedSlot(LostValue(1)) :
+      static_cast<uint16_t>(not_won_in_1);
+}
+
+// Returns whether a position with the given slot is lost-in-k, so that its
+// undecided predecessors are won-in-(k + 1). For k = 1, this includes
+// positions that are lost-in-0.
+constexpr bool IsLostIn(uint16_t slot, int k) {
+  return slot == DecidedSlot(LostValue(k)) ||
+      (k == 1 && slot == DecidedSlot(lost_in_0_value));
+}
+
+// Returns the slot of an undecided position after one of its successors was
+// found to be won-in-k. When no undecided successors remain, the position is
+// lost-in-k.
+constexpr uint16_t DecrementedSlot(uint16_t slot, int k) {
+  return slot == 1 ? DecidedSlot(LostValue(k)) : slot - 1;
+}
+
+// Returns the output value of a position. Positions that are still undecided
+// at the end are tied.
+constexpr uint8_t OutputValue(uint16_t slot) {
+  return IsDecided(slot) ? slot & 0xff : 0;
+}
+
+#endif  // ndef RETROGRADE_SLOTS_H_INCLUDED
@@ -0,0 +1,148 @@
+#include "retrograde-slots.h"
+
+#include "dedupe.h"
+#include "lost-positions.h"
+#include "macros.h"
+#include "perms.h"
+#include "search.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// Output of merge-phases for a sample of positions (see sample-bytes.cc).
+const char *samples_filename = "results/merged-samples.txt";
+
+// Number of samples checked per value, to keep the test fast.
+constexpr int samples_per_value = 20;
+
+// Values are encoded as in merge-phases.cc.
+void TestValues() {
+  assert(lost_in_0_value == 1);
+  assert(won_in_1_value == WonValue(1));
+  assert(LostValue(1) == 3);
+  assert(WonValue(2) == 4);
+  assert(LostValue(10) == 21);
+  assert(WonValue(11) == 22);
+  REP(k, 100) {
+    assert(OutputValue(DecidedSlot(LostValue(k))) % 2 == 1);
+    assert(OutputValue(DecidedSlot(WonValue(k + 1))) % 2 == 0);
+    assert(OutputValue(DecidedSlot(WonValue(k + 1))) > 0);
+  }
+}
+
+// Counters and final values can't be confused.
+void TestSlots() {
+  assert(!IsDecided(max_successors));
+  assert(OutputValue(max_successors) == 0);
+  assert(InitialSlot(0, 0) == DecidedSlot(lost_in_0_value));
+  assert(InitialSlot(5, 0) == DecidedSlot(LostValue(1)));
+  assert(InitialSlot(5, 3) == 3);
+  assert(IsLostIn(DecidedSlot(lost_in_0_value), 1));
+  assert(!IsLostIn(DecidedSlot(lost_in_0_value), 2));
+  assert(IsLostIn(DecidedSlot(LostValue(7)), 7));
+  assert(!IsLostIn(DecidedSlot(WonValue(7)), 7));
+
+  // Decrementing a counter to zero makes the position lost.
+  uint16_t slot = InitialSlot(10, 3);
+  slot = DecrementedSlot(slot, 4);
+  slot = DecrementedSlot(slot, 4);
+  assert(!IsDecided(slot) && OutputValue(slot) == 0);
+  slot = DecrementedSlot(slot, 5);
+  assert(slot == DecidedSlot(LostValue(5)));
+  assert(OutputValue(slot) == 11);
+}
+
+bool IsWonInOne(int64_t index) {
+  Perm perm = PermAtIndex(index);
+  return HasWinningMove(perm);
+}
+
+std::vector<int64_t> DistinctSuccessors(int64_t index) {
+  std::vector<int64_t> successors;
+  GenerateSuccessors(PermAtIndex(index), [&successors](const Moves&, const State &state) {
+    assert(state.outcome == TIE);
+    successors.push_back(IndexOf(state.perm));
+    return true;
+  });
+  SortAndDedupe(successors);
+  return successors;
+}
+
+// Slot of a position that is not won-in-1 after step 1 of solve-retrograde.
+uint16_t InitialSlotOf(int64_t index) {
+  const std::vector<int64_t> successors = DistinctSuccessors(index);
+  int64_t count = 0;
+  for (int64_t j : successors) count += !IsWonInOne(j);
+  return InitialSlot(successors.size(), count);
+}
+
+// Like InitialSlotOf(), but only determines whether the slot is decided, which
+// is much faster for positions that aren't: the slot is decided iff all
+// successors are won-in-1.
+uint16_t InitialSlotIfDecided(int64_t index) {
+  const std::vector<int64_t> successors = DistinctSuccessors(index);
+  for (int64_t j : successors) {
+    if (!IsWonInOne(j)) return 1;
+  }
+  return InitialSlot(successors.size(), 0);
+}
+
+// Output value of a position after step 1 and the first round of step 2 of
+// solve-retrograde, which decide the positions that are lost-in-0, won-in-1,
+// lost-in-1 and won-in-2. All other positions are still undecided.
+uint8_t EarlyValue(int64_t index) {
+  if (IsWonInOne(index)) return won_in_1_value;
+  uint16_t slot = InitialSlotOf(index);
+  if (IsDecided(slot)) {
+    if (slot == DecidedSlot(lost_in_0_value)) assert(IsImmediatelyLost(index));
+    return OutputValue(slot);
+  }
+  for (int64_t j : DistinctSuccessors(index)) {
+    if (!IsWonInOne(j) && IsLostIn(InitialSlotIfDecided(j), 1)) return WonValue(2);
+  }
+  return OutputValue(slot);
+}
+
+// Compares the values of early positions with the output of merge-phases.
+void TestSamples() {
+  std::ifstream ifs(samples_filename);
+  if (!ifs) {
+    std::cerr << "Could not open " << samples_filename << std::endl;
+    exit(1);
+  }
+  int checked = 0;
+  int value, sample;
+  int64_t index;
+  while (ifs >> value >> sample >> index) {
+    // Later values take many rounds to determine, but positions with those
+    // values must still be undecided after the first round.
+    if (value > LostValue(3) || sample >= samples_per_value) continue;
+    const int expected = value <= WonValue(2) ? value : 0;
+    const int actual = EarlyValue(index);
+    if (actual != expected) {
+      std::cerr << "Position " << index << " has value " << value
+          << " in " << samples_filename << ", but " << actual
+          << " after the first round." << std::endl;
+      exit(1);
+    }
+    ++checked;
+  }
+  assert(checked == 8 * samples_per_value);
+}
+
+}  // namespace
+
+int main() {
+  TestValues();
+  TestSlots();
+  TestSamples();
+}
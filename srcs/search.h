@@ -5,6 +5,8 @@
 #include "perms.h"
 #include "search-impl.h"
 
+#include <algorithm>
+#include <cassert>
 #include <functional>
 #include <vector>
 #include <utility>
@@ -43,6 +45,40 @@ bool GenerateSuccessors(const Perm &perm, Callback callback) {
     (moves.size = 3, impl::GenerateSuccessors(mutable_perm, moves, 0, callback));
 }
 
+// Enumerates the indices of the successors of `perm` in batches.
+//
+// This is useful to look up successors in a large data file, since a batch of
+// indices can be looked up with prefetching (see e.g. RnAccessor::AnyOf()).
+// Note that the order of indices within a batch is unspecified.
+//
+// Precondition: `perm` must be a permutation that is started or in-progress,
+// and it must not have any immediately winning moves (so that all successors
+// are in-progress too).
+//
+// Callback is a callable of the form: bool(const int64_t *indices, size_t count),
+// where count is between 1 and batch_size (inclusive).
+//
+// When the callback returns false, the search is aborted, and this function
+// returns false too. Otherwise, it returns true after all successors have been
+// passed to the callback.
+template<size_t batch_size, class Callback>
+bool GenerateSuccessorIndices(const Perm &perm, Callback callback) {
+  int64_t indices[batch_size];
+  size_t count = 0;
+  auto flush = [&]() {
+    // Sort indices to improve locality of reference.
+    std::sort(indices, indices + count);
+    size_t n = count;
+    count = 0;
+    return callback(static_cast<const int64_t*>(indices), n);
+  };
+  return GenerateSuccessors(perm, [&](const Moves&, const State& state) {
+    assert(state.outcome == TIE);
+    indices[count++] = IndexOf(state.perm);
+    return count < batch_size || flush();
+  }) && (count == 0 || flush());
+}
+
 // Enumerates the predecessors of `perm`.
 //
 // Note: this includes predecessors that are themselves unreachable!
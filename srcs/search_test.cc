@@ -1,5 +1,6 @@
 #include "search.h"
 
+#include "dedupe.h"
 #include "macros.h"
 #include "perms.h"
 #include "random.h"
@@ -13,6 +14,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <random>
+#include <vector>
 
 static std::mt19937 rng = InitializeRng();
 
@@ -107,4 +109,85 @@ int main() {
     std::cerr << "PartialHasWinningMove() identified " << partial_count << " of "
         <<  winning_count << " winning cases." << std::endl;
   }
+
+  // Test GenerateSuccessorIndices().
+  {
+    int case_count = 0;
+    while (case_count < 25) {
+      std::uniform_int_distribution<int64_t> dist(0, total_perms - 1);
+      Perm perm = PermAtIndex(dist(rng));
+      if (HasWinningMove(perm)) continue;
+      ++case_count;
+
+      std::vector<int64_t> expected;
+      GenerateSuccessors(perm, [&expected](const Moves &, const State &state) {
+        expected.push_back(IndexOf(state.perm));
+        return true;
+      });
+      std::vector<int64_t> received;
+      bool complete = GenerateSuccessorIndices<64>(perm,
+          [&received](const int64_t *indices, size_t count) {
+            assert(count > 0 && count <= 64);
+            received.insert(received.end(), indices, indices + count);
+            return true;
+          });
+      assert(complete);
+      std::sort(expected.begin(), expected.end());
+      std::sort(received.begin(), received.end());
+      assert(received == expected);
+
+      // Aborting stops the enumeration after the first batch.
+      int batches = 0;
+      complete = GenerateSuccessorIndices<64>(perm,
+          [&batches](const int64_t *, size_t) { ++batches; return false; });
+      assert(complete == expected.empty() && batches == (expected.empty() ? 0 : 1));
+    }
+  }
+
+  // Test that in the minimized space (see MinIndexOf()), successors and
+  // reachable predecessors are inverse relations. solve-retrograde relies on
+  // this with --minimized.
+  {
+    auto successors = [](int64_t min_index) {
+      std::vector<int64_t> result;
+      GenerateSuccessors(PermAtMinIndex(min_index), [&result](const Moves &, const State &state) {
+        if (state.outcome == TIE) {
+          assert(IsReachable(state.perm));
+          result.push_back(MinIndexOf(state.perm));
+        }
+        return true;
+      });
+      SortAndDedupe(result);
+      return result;
+    };
+    auto predecessors = [](int64_t min_index) {
+      std::vector<int64_t> result;
+      GeneratePredecessors(PermAtMinIndex(min_index), [&result](const Perm &predecessor) {
+        if (IsReachable(predecessor)) result.push_back(MinIndexOf(predecessor));
+      });
+      SortAndDedupe(result);
+      return result;
+    };
+    // Positions have thousands of successors and predecessors, so only a
+    // sample of them is checked.
+    const size_t max_checks = 25;
+    int64_t num_checked = 0;
+    REP(n, 5) {
+      std::uniform_int_distribution<int64_t> dist(0, min_index_size - 1);
+      const int64_t index = dist(rng);
+      const std::vector<int64_t> succ = successors(index);
+      for (size_t i = 0; i < succ.size(); i += (succ.size() + max_checks - 1) / max_checks) {
+        const std::vector<int64_t> p = predecessors(succ[i]);
+        assert(std::binary_search(p.begin(), p.end(), index));
+        ++num_checked;
+      }
+      const std::vector<int64_t> pred = predecessors(index);
+      for (size_t i = 0; i < pred.size(); i += (pred.size() + max_checks - 1) / max_checks) {
+        const std::vector<int64_t> s = successors(pred[i]);
+        assert(std::binary_search(s.begin(), s.end(), index));
+        ++num_checked;
+      }
+    }
+    std::cerr << "Checked " << num_checked << " minimized successor/predecessor pairs." << std::endl;
+  }
 }
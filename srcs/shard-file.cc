@@ -0,0 +1,198 @@
+// Tool to split large data files into shards on different disks, and to join
+// them back together (see shards.h).
+//
+// Usage:
+//
+//   shard-file split [--shards=N | --shard-size=<size>] <input> <output.shards> <dir>...
+//   shard-file create --size=<size> [--shards=N | --shard-size=<size>] <output.shards> <dir>...
+//   shard-file join <input.shards> <output>
+//   shard-file info <input.shards>
+//
+// split copies an existing file (e.g. r5.bin or minimized.bin) into shards,
+// distributed round-robin over the given directories, and writes the manifest.
+// By default, it creates one shard per directory. The resulting manifest can
+// be passed to any tool that uses AnyRnAccessor or MinimizedAccessor instead
+// of the original file.
+//
+// create creates zero-filled shards (i.e., all TIE values for phase files),
+// which the tools that write phase files through ConcurrentMutableRnAccessor
+// (e.g. integrate-two and integrate-wins2) can fill in place, given the
+// manifest as output file.
+//
+// join concatenates the shards back into a single file, and info prints the
+// byte range of each shard, and the corresponding range of ternary values.
+
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "accessors.h"
+#include "flags.h"
+#include "parse-int.h"
+#include "shards.h"
+
+namespace {
+
+void PrintUsage() {
+  std::cerr << "Usage:\n\n"
+    << "  shard-file split [--shards=N | --shard-size=<size>] <input> <output.shards> <dir>...\n"
+    << "  shard-file create --size=<size> [--shards=N | --shard-size=<size>] <output.shards> <dir>...\n"
+    << "  shard-file join <input.shards> <output>\n"
+    << "  shard-file info <input.shards>\n"
+    << std::endl;
+}
+
+// Parses --shards and --shard-size and creates a manifest for a file of
+// `size` bytes. Returns false if the flags are invalid.
+bool Plan(
+    int64_t size, const std::string &arg_shards, const std::string &arg_shard_size,
+    const char *manifest_filename, const std::vector<std::string> &dirs, ShardManifest *manifest) {
+  if (!arg_shards.empty() && !arg_shard_size.empty()) {
+    std::cerr << "Only one of --shards and --shard-size may be given." << std::endl;
+    return false;
+  }
+  const std::string name = std::filesystem::path(manifest_filename).stem().string();
+  if (!arg_shard_size.empty()) {
+    size_t shard_size = 0;
+    if (!ParseByteSize(arg_shard_size, &shard_size) || shard_size == 0 ||
+        shard_size % shard_alignment != 0) {
+      std::cerr << "Invalid --shard-size: " << arg_shard_size
+          << " (must be a multiple of " << shard_alignment << ")" << std::endl;
+      return false;
+    }
+    *manifest = PlanShardsBySize(size, shard_size, dirs, name);
+  } else {
+    const int shards = arg_shards.empty() ? dirs.size() : ParseInt(arg_shards.c_str());
+    if (shards < 1) {
+      std::cerr << "Invalid --shards: " << arg_shards << std::endl;
+      return false;
+    }
+    *manifest = PlanShards(size, shards, dirs, name);
+  }
+  return true;
+}
+
+int Split(int argc, char *argv[]) {
+  std::string arg_shards;
+  std::string arg_shard_size;
+  std::map<std::string, Flag> flags = {
+    // Number of shards (default: one per directory).
+    {"shards", Flag::optional(arg_shards)},
+    // Size of each shard in bytes (a multiple of 4096), instead of --shards.
+    {"shard-size", Flag::optional(arg_shard_size)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc < 4) {
+    PrintUsage();
+    return 1;
+  }
+  const char *input_filename = argv[1];
+  const char *manifest_filename = argv[2];
+  const std::vector<std::string> dirs(argv + 3, argv + argc);
+  if (!std::filesystem::is_regular_file(input_filename)) {
+    std::cerr << "Input file " << input_filename << " does not exist." << std::endl;
+    return 1;
+  }
+  if (std::filesystem::exists(manifest_filename)) {
+    std::cerr << "Output file " << manifest_filename << " already exists." << std::endl;
+    return 1;
+  }
+  ShardManifest manifest;
+  if (!Plan(std::filesystem::file_size(input_filename), arg_shards, arg_shard_size,
+          manifest_filename, dirs, &manifest) ||
+      !SplitIntoShards(input_filename, manifest) ||
+      !WriteShardManifest(manifest_filename, manifest)) {
+    return 1;
+  }
+  std::cerr << "Wrote " << manifest.paths.size() << " shards." << std::endl;
+  return 0;
+}
+
+int Create(int argc, char *argv[]) {
+  std::string arg_size;
+  std::string arg_shards;
+  std::string arg_shard_size;
+  std::map<std::string, Flag> flags = {
+    // Total size in bytes (e.g. 80313433200 for a phase file).
+    {"size", Flag::required(arg_size)},
+    // Number of shards (default: one per directory).
+    {"shards", Flag::optional(arg_shards)},
+    // Size of each shard in bytes (a multiple of 4096), instead of --shards.
+    {"shard-size", Flag::optional(arg_shard_size)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc < 3) {
+    PrintUsage();
+    return 1;
+  }
+  const char *manifest_filename = argv[1];
+  const std::vector<std::string> dirs(argv + 2, argv + argc);
+  size_t size = 0;
+  if (!ParseByteSize(arg_size, &size) || size == 0) {
+    std::cerr << "Invalid --size: " << arg_size << std::endl;
+    return 1;
+  }
+  if (std::filesystem::exists(manifest_filename)) {
+    std::cerr << "Output file " << manifest_filename << " already exists." << std::endl;
+    return 1;
+  }
+  ShardManifest manifest;
+  if (!Plan(size, arg_shards, arg_shard_size, manifest_filename, dirs, &manifest) ||
+      !CreateShards(manifest) ||
+      !WriteShardManifest(manifest_filename, manifest)) {
+    return 1;
+  }
+  std::cerr << "Created " << manifest.paths.size() << " shards." << std::endl;
+  return 0;
+}
+
+int Join(int argc, char *argv[]) {
+  if (argc != 3) {
+    PrintUsage();
+    return 1;
+  }
+  ShardManifest manifest;
+  if (!ReadShardManifest(argv[1], &manifest) || !JoinShards(manifest, argv[2])) return 1;
+  return 0;
+}
+
+int Info(int argc, char *argv[]) {
+  if (argc != 2) {
+    PrintUsage();
+    return 1;
+  }
+  ShardManifest manifest;
+  if (!ReadShardManifest(argv[1], &manifest)) return 1;
+  std::cout << "Size:       " << manifest.size << " bytes\n"
+      << "Shard size: " << manifest.shard_size << " bytes\n";
+  for (size_t k = 0; k < manifest.paths.size(); ++k) {
+    const int64_t begin = manifest.ShardBegin(k);
+    const int64_t end = manifest.ShardEnd(k);
+    const bool ok = std::filesystem::is_regular_file(manifest.paths[k]) &&
+        int64_t(std::filesystem::file_size(manifest.paths[k])) == end - begin;
+    std::cout << "Shard " << k << ": bytes [" << begin << ", " << end << "), "
+        << "ternary values [" << 5 * begin << ", " << 5 * end << ") "
+        << manifest.paths[k] << (ok ? "" : " (MISSING OR WRONG SIZE)") << '\n';
+  }
+  std::cout << std::flush;
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    PrintUsage();
+    return 1;
+  }
+  const std::string mode = argv[1];
+  // Skip the mode argument, so that argv[0] is the mode and flags follow.
+  if (mode == "split") return Split(argc - 1, argv + 1);
+  if (mode == "create") return Create(argc - 1, argv + 1);
+  if (mode == "join") return Join(argc - 1, argv + 1);
+  if (mode == "info") return Info(argc - 1, argv + 1);
+  std::cerr << "Invalid mode: " << mode << "\n\n";
+  PrintUsage();
+  return 1;
+}
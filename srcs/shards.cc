@@ -0,0 +1,183 @@
+#include "shards.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const std::string manifest_magic = "pushfight-shards 1";
+
+// Size of the buffer used to copy data between files.
+constexpr size_t copy_buffer_size = 64 << 20;
+
+int64_t NumShards(int64_t size, int64_t shard_size) {
+  return (size + shard_size - 1) / shard_size;
+}
+
+bool CreateNewFile(const std::string &path, std::ofstream *ofs) {
+  if (std::filesystem::exists(path)) {
+    std::cerr << "File " << path << " already exists." << std::endl;
+    return false;
+  }
+  ofs->open(path, std::ofstream::binary);
+  if (!*ofs) {
+    std::cerr << "Could not open " << path << " for writing!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Copies `size` bytes from `ifs` to `ofs`.
+bool CopyBytes(std::ifstream &ifs, std::ofstream &ofs, int64_t size, std::vector<char> &buffer) {
+  while (size > 0) {
+    const size_t n = std::min<int64_t>(size, buffer.size());
+    if (!ifs.read(buffer.data(), n) || !ofs.write(buffer.data(), n)) return false;
+    size -= n;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool IsShardManifest(const char *filename) {
+  // Only the first line is read, since this is also called on large data files.
+  std::ifstream ifs(filename, std::ifstream::binary);
+  std::string buf(manifest_magic.size() + 1, '\0');
+  return ifs.read(buf.data(), buf.size()) && buf == manifest_magic + '\n';
+}
+
+bool ReadShardManifest(const char *filename, ShardManifest *manifest) {
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    std::cerr << "Could not open shard manifest " << filename << std::endl;
+    return false;
+  }
+  std::string line;
+  if (!std::getline(ifs, line) || line != manifest_magic) {
+    std::cerr << filename << " is not a shard manifest!" << std::endl;
+    return false;
+  }
+  ShardManifest result;
+  std::string key;
+  if (!std::getline(ifs, line) || !(std::istringstream(line) >> key >> result.size) ||
+      key != "size" || result.size <= 0) {
+    std::cerr << "Invalid size in shard manifest " << filename << std::endl;
+    return false;
+  }
+  if (!std::getline(ifs, line) || !(std::istringstream(line) >> key >> result.shard_size) ||
+      key != "shard-size" || result.shard_size <= 0 || result.shard_size % shard_alignment != 0) {
+    std::cerr << "Invalid shard size in shard manifest " << filename << std::endl;
+    return false;
+  }
+  const std::filesystem::path dir = std::filesystem::path(filename).parent_path();
+  while (std::getline(ifs, line)) {
+    if (line.empty()) continue;
+    std::filesystem::path path(line);
+    if (path.is_relative()) path = dir / path;
+    result.paths.push_back(path.string());
+  }
+  if (int64_t(result.paths.size()) != NumShards(result.size, result.shard_size)) {
+    std::cerr << "Shard manifest " << filename << " lists " << result.paths.size()
+        << " shards; expected " << NumShards(result.size, result.shard_size) << "." << std::endl;
+    return false;
+  }
+  *manifest = std::move(result);
+  return true;
+}
+
+bool WriteShardManifest(const char *filename, const ShardManifest &manifest) {
+  std::ofstream ofs(filename);
+  ofs << manifest_magic << '\n'
+      << "size " << manifest.size << '\n'
+      << "shard-size " << manifest.shard_size << '\n';
+  for (const std::string &path : manifest.paths) ofs << path << '\n';
+  if (!ofs.flush()) {
+    std::cerr << "Failed to write " << filename << "!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+ShardManifest PlanShards(
+    int64_t size, int num_shards, const std::vector<std::string> &dirs, const std::string &name) {
+  int64_t shard_size = (size + num_shards - 1) / num_shards;
+  shard_size = std::max<int64_t>(1, (shard_size + shard_alignment - 1) / shard_alignment) * shard_alignment;
+  return PlanShardsBySize(size, shard_size, dirs, name);
+}
+
+ShardManifest PlanShardsBySize(
+    int64_t size, int64_t shard_size, const std::vector<std::string> &dirs, const std::string &name) {
+  ShardManifest manifest;
+  manifest.size = size;
+  manifest.shard_size = shard_size;
+  for (int64_t k = 0; k < NumShards(size, shard_size); ++k) {
+    // Store absolute paths, so the manifest can be moved elsewhere.
+    std::filesystem::path dir = std::filesystem::absolute(dirs[k % dirs.size()]);
+    manifest.paths.push_back((dir / (name + ".shard" + std::to_string(k))).string());
+  }
+  return manifest;
+}
+
+bool CreateShards(const ShardManifest &manifest) {
+  for (size_t k = 0; k < manifest.paths.size(); ++k) {
+    std::ofstream ofs;
+    if (!CreateNewFile(manifest.paths[k], &ofs)) return false;
+    ofs.close();
+    // Sparse on most file systems, so this is fast.
+    std::error_code error;
+    std::filesystem::resize_file(manifest.paths[k], manifest.ShardEnd(k) - manifest.ShardBegin(k), error);
+    if (error) {
+      std::cerr << "Failed to resize " << manifest.paths[k] << ": " << error.message() << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SplitIntoShards(const char *input, const ShardManifest &manifest) {
+  if (int64_t(std::filesystem::file_size(input)) != manifest.size) {
+    std::cerr << "Input file " << input << " does not have the expected size!" << std::endl;
+    return false;
+  }
+  std::ifstream ifs(input, std::ifstream::binary);
+  if (!ifs) {
+    std::cerr << "Could not open " << input << " for reading!" << std::endl;
+    return false;
+  }
+  std::vector<char> buffer(copy_buffer_size);
+  for (size_t k = 0; k < manifest.paths.size(); ++k) {
+    std::ofstream ofs;
+    if (!CreateNewFile(manifest.paths[k], &ofs)) return false;
+    if (!CopyBytes(ifs, ofs, manifest.ShardEnd(k) - manifest.ShardBegin(k), buffer) || !ofs.flush()) {
+      std::cerr << "Failed to write " << manifest.paths[k] << "!" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JoinShards(const ShardManifest &manifest, const char *output) {
+  std::ofstream ofs;
+  if (!CreateNewFile(output, &ofs)) return false;
+  std::vector<char> buffer(copy_buffer_size);
+  for (size_t k = 0; k < manifest.paths.size(); ++k) {
+    const int64_t shard_size = manifest.ShardEnd(k) - manifest.ShardBegin(k);
+    if (!std::filesystem::is_regular_file(manifest.paths[k]) ||
+        int64_t(std::filesystem::file_size(manifest.paths[k])) != shard_size) {
+      std::cerr << "Shard " << manifest.paths[k] << " is missing or has the wrong size!" << std::endl;
+      return false;
+    }
+    std::ifstream ifs(manifest.paths[k], std::ifstream::binary);
+    if (!CopyBytes(ifs, ofs, shard_size, buffer)) {
+      std::cerr << "Failed to copy " << manifest.paths[k] << "!" << std::endl;
+      return false;
+    }
+  }
+  if (!ofs.flush()) {
+    std::cerr << "Failed to write " << output << "!" << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+#ifndef SHARDS_H_INCLUDED
+#define SHARDS_H_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Support for large data files that are split into shards, so that the
+// shards can be stored on different disks and lookups can use the combined
+// bandwidth of all of them.
+//
+// A sharded file is described by a small text file, the manifest:
+//
+//   pushfight-shards 1
+//   size 80313433200
+//   shard-size 26771144704
+//   /mnt/nvme0/r5.bin.shard0
+//   /mnt/nvme1/r5.bin.shard1
+//   /mnt/nvme2/r5.bin.shard2
+//
+// Shard k contains bytes [k * shard-size, (k + 1) * shard-size) of the
+// logical file (the last shard may be shorter). The shard size is a multiple
+// of shard_alignment, so that each shard can be memory-mapped separately and
+// values never straddle shard boundaries. Relative shard paths are relative
+// to the directory that contains the manifest.
+//
+// Accessors for sharded files are defined in accessors.h (ShardedMappedFile,
+// ShardedRnAccessor, ShardedMutableRnAccessor). AnyRnAccessor and
+// ConcurrentMutableRnAccessor accept a manifest in place of a phase file, and
+// MinimizedAccessor in place of minimized.bin. The shard-file tool splits,
+// joins and creates sharded files.
+
+constexpr int64_t shard_alignment = 4096;
+
+struct ShardManifest {
+  // Total size of the logical file in bytes.
+  int64_t size = 0;
+
+  // Size of each shard in bytes, except the last, which may be shorter.
+  int64_t shard_size = 0;
+
+  // Paths of the shard files, in order.
+  std::vector<std::string> paths;
+
+  int64_t ShardBegin(size_t shard) const { return shard * shard_size; }
+
+  int64_t ShardEnd(size_t shard) const {
+    return std::min<int64_t>((shard + 1) * shard_size, size);
+  }
+};
+
+// Returns whether the given file starts with the manifest magic line.
+bool IsShardManifest(const char *filename);
+
+// Reads and validates a manifest. Relative shard paths are resolved relative
+// to the directory of the manifest. Returns false (after printing an error
+// message) if the manifest is invalid.
+bool ReadShardManifest(const char *filename, ShardManifest *manifest);
+
+// Writes a manifest. Returns false if the file could not be written.
+bool WriteShardManifest(const char *filename, const ShardManifest &manifest);
+
+// Creates a manifest for a file of `size` bytes split into `num_shards`
+// shards of about equal size, distributed round-robin over the given
+// directories. Shard k is named "<name>.shard<k>".
+ShardManifest PlanShards(
+    int64_t size, int num_shards, const std::vector<std::string> &dirs, const std::string &name);
+
+// Same, but with an explicit shard size, which must be a positive multiple of
+// shard_alignment.
+ShardManifest PlanShardsBySize(
+    int64_t size, int64_t shard_size, const std::vector<std::string> &dirs, const std::string &name);
+
+// Creates zero-filled shard files. Fails if any of them already exist.
+bool CreateShards(const ShardManifest &manifest);
+
+// Copies the contents of `input` (which must have size manifest.size) into
+// newly created shard files.
+bool SplitIntoShards(const char *input, const ShardManifest &manifest);
+
+// Concatenates the shards into a newly created file `output`.
+bool JoinShards(const ShardManifest &manifest, const char *output);
+
+#endif  // ndef SHARDS_H_INCLUDED
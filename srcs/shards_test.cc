@@ -0,0 +1,126 @@
+#include "accessors.h"
+#include "macros.h"
+#include "random.h"
+#include "shards.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+std::vector<uint8_t> ReadFile(const std::string &filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void TestShards() {
+  const std::filesystem::path tmp = std::filesystem::temp_directory_path() /
+      ("shards_test." + std::to_string(getpid()));
+  const std::vector<std::string> dirs = {tmp / "a", tmp / "b", tmp / "c"};
+  for (const std::string &dir : dirs) std::filesystem::create_directories(dir);
+
+  // Not a multiple of the shard alignment, so the last shard is shorter.
+  std::vector<uint8_t> data(10 * shard_alignment + 123);
+  for (uint8_t &byte : data) byte = RandInt(0, 255);
+  const std::string input = tmp / "input.bin";
+  {
+    std::ofstream ofs(input, std::ofstream::binary);
+    ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+    assert(ofs);
+  }
+
+  for (int num_shards : {1, 3, 4, 11}) {
+    const std::string manifest_filename = tmp / "input.shards";
+    const std::string output = tmp / "output.bin";
+    ShardManifest manifest = PlanShards(data.size(), num_shards, dirs, "input");
+    assert(manifest.shard_size % shard_alignment == 0);
+    assert(manifest.ShardEnd(manifest.paths.size() - 1) == int64_t(data.size()));
+    assert(SplitIntoShards(input.c_str(), manifest));
+    assert(WriteShardManifest(manifest_filename.c_str(), manifest));
+    assert(IsShardManifest(manifest_filename.c_str()));
+    assert(!IsShardManifest(input.c_str()));
+    for (const char *content : {"", "pushfight-shards 1", "pushfight-shards 10\n"}) {
+      const std::string filename = tmp / "not-a-manifest";
+      std::ofstream(filename, std::ofstream::binary) << content;
+      assert(!IsShardManifest(filename.c_str()));
+    }
+
+    ShardManifest read_manifest;
+    assert(ReadShardManifest(manifest_filename.c_str(), &read_manifest));
+    assert(read_manifest.size == manifest.size);
+    assert(read_manifest.shard_size == manifest.shard_size);
+    assert(read_manifest.paths == manifest.paths);
+
+    {
+      ShardedMappedFile<uint8_t> map(manifest_filename.c_str());
+      assert(map.size() == data.size());
+      REP(i, data.size()) assert(map[i] == data[i]);
+      const size_t begin = RandInt(0, data.size() - 1);
+      const size_t count = RandInt(0, data.size() - begin);
+      std::vector<uint8_t> copy(count);
+      map.Copy(begin, count, copy.data());
+      REP(i, count) assert(copy[i] == data[begin + i]);
+    }
+
+    // Writes through the mutable mapping end up in the joined file.
+    std::vector<uint8_t> modified = data;
+    {
+      ShardedMappedFile<uint8_t, true> map(manifest_filename.c_str());
+      for (int j = 0; j < 1000; ++j) {
+        const size_t i = RandInt(0, data.size() - 1);
+        map[i] = modified[i] = RandInt(0, 255);
+      }
+    }
+    assert(JoinShards(manifest, output.c_str()));
+    assert(ReadFile(output) == modified);
+
+    // Splitting again fails because the shards already exist.
+    assert(!SplitIntoShards(input.c_str(), manifest));
+
+    for (const std::string &path : manifest.paths) std::filesystem::remove(path);
+    std::filesystem::remove(manifest_filename);
+    std::filesystem::remove(output);
+  }
+
+  // Created shards are zero-filled; relative paths are resolved relative to
+  // the manifest.
+  {
+    const std::string manifest_filename = tmp / "zero.shards";
+    ShardManifest manifest = PlanShardsBySize(3 * shard_alignment + 1, shard_alignment, dirs, "zero");
+    assert(manifest.paths.size() == 4);
+    assert(CreateShards(manifest));
+    for (std::string &path : manifest.paths) {
+      path = std::filesystem::relative(path, tmp).string();
+    }
+    assert(WriteShardManifest(manifest_filename.c_str(), manifest));
+    ShardedMappedFile<uint8_t> map(manifest_filename.c_str());
+    assert(map.size() == 3 * shard_alignment + 1);
+    REP(i, map.size()) assert(map[i] == 0);
+  }
+
+  std::filesystem::remove_all(tmp);
+}
+
+}  // namespace
+
+int main() {
+  TestShards();
+}
@@ -0,0 +1,134 @@
+// Daemon that keeps phase files in shared memory, for running several solver
+// processes on the same host (see shm-segment.h).
+//
+// Usage:
+//
+//   shm-loader [--shm-dir=/dev/shm] [--poll-interval=60] [--keep=false] <file>...
+//
+// Copies each file (e.g. input/r4.bin or input/r4.2bit) into a segment in
+// --shm-dir, unless an up-to-date segment exists already, and then waits until
+// it's interrupted. Solvers started with the same --shm-dir map the segments
+// instead of the files. Every --poll-interval seconds (0 to disable), files
+// that have changed since they were loaded are loaded again; solvers that have
+// the old segment mapped keep using it until they restart.
+//
+// On SIGINT or SIGTERM, the segments are removed, unless --keep=true. Memory
+// of removed segments is freed when the last solver that maps them exits.
+//
+// Sharded files (see shards.h) are not supported.
+
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flags.h"
+#include "parse-int.h"
+#include "shards.h"
+#include "shm-segment.h"
+
+namespace {
+
+volatile std::sig_atomic_t interrupted = 0;
+
+void HandleSignal(int) {
+  interrupted = 1;
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: shm-loader [--shm-dir=/dev/shm] [--poll-interval=60] [--keep=false] <file>...\n"
+    << "\nOptions:\n"
+    << "  --shm-dir=<dir>  memory-backed directory for the segments, e.g. a hugetlbfs mount (default: /dev/shm)\n"
+    << "  --poll-interval=<seconds>  how often to reload changed files, or 0 to never reload (default: 60)\n"
+    << "  --keep=true|false  keep the segments when exiting (default: false)\n";
+}
+
+// Loads the segments that are missing or out of date. Returns false if any
+// segment failed to load.
+bool LoadSegments(const std::vector<std::string> &filenames, const std::string &shm_dir) {
+  bool success = true;
+  for (const std::string &filename : filenames) {
+    const std::string segment_path = ShmSegmentPath(shm_dir, filename);
+    if (IsShmSegmentUpToDate(segment_path, filename)) continue;
+    if (!LoadShmSegment(filename, segment_path)) success = false;
+  }
+  return success;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string arg_shm_dir = "/dev/shm";
+  std::string arg_poll_interval = "60";
+  std::string arg_keep = "false";
+  std::map<std::string, Flag> flags = {
+    // Directory in a memory-backed filesystem (tmpfs or hugetlbfs).
+    {"shm-dir", Flag::optional(arg_shm_dir)},
+    // Number of seconds between checks for changed files (0 to disable).
+    {"poll-interval", Flag::optional(arg_poll_interval)},
+    // Whether to leave the segments in place on exit.
+    {"keep", Flag::optional(arg_keep)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc < 2) {
+    PrintUsage();
+    return 1;
+  }
+  if (!std::filesystem::is_directory(arg_shm_dir)) {
+    std::cerr << "Shared-memory directory " << arg_shm_dir << " does not exist!" << std::endl;
+    return 1;
+  }
+  const int poll_interval = ParseInt(arg_poll_interval.c_str());
+  if (poll_interval < 0) {
+    std::cerr << "Invalid poll interval: " << arg_poll_interval << std::endl;
+    return 1;
+  }
+  if (arg_keep != "true" && arg_keep != "false") {
+    std::cerr << "Invalid value for --keep: " << arg_keep << std::endl;
+    return 1;
+  }
+  const bool keep = arg_keep == "true";
+
+  std::vector<std::string> filenames(argv + 1, argv + argc);
+  for (const std::string &filename : filenames) {
+    if (!std::filesystem::is_regular_file(filename)) {
+      std::cerr << "File " << filename << " does not exist!" << std::endl;
+      return 1;
+    }
+    if (IsShardManifest(filename.c_str())) {
+      std::cerr << "Sharded file " << filename << " is not supported!" << std::endl;
+      return 1;
+    }
+  }
+
+  std::signal(SIGINT, HandleSignal);
+  std::signal(SIGTERM, HandleSignal);
+
+  if (!LoadSegments(filenames, arg_shm_dir)) return 1;
+  std::cerr << "All segments loaded. Waiting for SIGINT or SIGTERM..." << std::endl;
+
+  auto last_poll = std::chrono::steady_clock::now();
+  while (!interrupted) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (poll_interval > 0 &&
+        std::chrono::steady_clock::now() - last_poll >= std::chrono::seconds(poll_interval)) {
+      // Don't exit on failure: solvers can still use the old segments, or
+      // fall back to the files.
+      LoadSegments(filenames, arg_shm_dir);
+      last_poll = std::chrono::steady_clock::now();
+    }
+  }
+
+  if (!keep) {
+    for (const std::string &filename : filenames) {
+      const std::string segment_path = ShmSegmentPath(arg_shm_dir, filename);
+      std::error_code error;
+      if (std::filesystem::remove(segment_path, error)) {
+        std::cerr << "Removed " << segment_path << std::endl;
+      }
+    }
+  }
+}
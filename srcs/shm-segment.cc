@@ -0,0 +1,151 @@
+#include "shm-segment.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#endif
+
+#include "accessors.h"
+
+namespace {
+
+// Number of bytes copied at a time by LoadShmSegment().
+constexpr size_t copy_block_size = size_t{1} << 26;
+
+// Returns the size to which a segment of `size` bytes in directory `dir` must
+// be rounded: a multiple of the huge page size on hugetlbfs, or `size` itself
+// on other filesystems.
+uintmax_t SegmentSize(const std::string &dir, uintmax_t size) {
+#ifdef __linux__
+  constexpr unsigned long hugetlbfs_magic = 0x958458f6;  // see linux/magic.h
+  struct statfs st;
+  if (statfs(dir.c_str(), &st) == 0 && static_cast<unsigned long>(st.f_type) == hugetlbfs_magic &&
+      st.f_bsize > 0) {
+    return (size + st.f_bsize - 1) / st.f_bsize * st.f_bsize;
+  }
+#else
+  (void) dir;  // unused
+#endif
+  return size;
+}
+
+// Creates a file of the given size. On Linux, the memory is reserved up front,
+// so running out of shared memory is reported here instead of as a SIGBUS
+// while copying. Returns false on failure.
+bool AllocateSegment(const std::string &path, uintmax_t size) {
+#ifdef __linux__
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) return false;
+  const bool success = posix_fallocate(fd, 0, size) == 0;
+  close(fd);
+  return success;
+#else
+  std::ofstream ofs(path, std::ofstream::binary);
+  if (!ofs) return false;
+  ofs.close();
+  std::error_code error;
+  std::filesystem::resize_file(path, size, error);
+  return !error;
+#endif
+}
+
+}  // namespace
+
+std::string ShmSegmentPath(const std::string &shm_dir, const std::string &filename) {
+  std::string name = std::filesystem::absolute(filename).lexically_normal().string();
+  std::replace(name.begin(), name.end(), '/', '-');
+  return (std::filesystem::path(shm_dir) / ("pushfight" + name)).string();
+}
+
+bool IsShmSegmentUpToDate(const std::string &segment_path, const std::string &filename) {
+  std::error_code error;
+  const uintmax_t segment_size = std::filesystem::file_size(segment_path, error);
+  if (error) return false;
+  const uintmax_t size = std::filesystem::file_size(filename, error);
+  if (error || segment_size < size) return false;
+  const auto segment_mtime = std::filesystem::last_write_time(segment_path, error);
+  if (error) return false;
+  const auto mtime = std::filesystem::last_write_time(filename, error);
+  return !error && segment_mtime == mtime;
+}
+
+bool LoadShmSegment(const std::string &filename, const std::string &segment_path) {
+  std::error_code error;
+  const uintmax_t size = std::filesystem::file_size(filename, error);
+  if (error) {
+    std::cerr << "Could not determine the size of " << filename << std::endl;
+    return false;
+  }
+  const auto mtime = std::filesystem::last_write_time(filename, error);
+  if (error) {
+    std::cerr << "Could not determine the modification time of " << filename << std::endl;
+    return false;
+  }
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs) {
+    std::cerr << "Could not open " << filename << std::endl;
+    return false;
+  }
+
+  const std::string temp_path = segment_path + ".tmp";
+  const uintmax_t segment_size =
+      SegmentSize(std::filesystem::path(segment_path).parent_path().string(), size);
+  if (!AllocateSegment(temp_path, segment_size)) {
+    std::cerr << "Could not allocate " << segment_size << " bytes for " << temp_path
+        << " (is there enough shared memory?)" << std::endl;
+    std::filesystem::remove(temp_path, error);
+    return false;
+  }
+
+  std::cerr << "Loading " << filename << " into " << segment_path << " ("
+      << size / 1e9 << " GB)..." << std::endl;
+  {
+    // Segments on hugetlbfs can only be written through a memory mapping.
+    std::unique_ptr<char, std::function<void(char*)>> data(
+        reinterpret_cast<char*>(MemMap(temp_path.c_str(), segment_size, true)),
+        [segment_size](char *data) { MemUnmap(data, segment_size); });
+    for (uintmax_t pos = 0; pos < size; pos += copy_block_size) {
+      const size_t n = std::min<uintmax_t>(copy_block_size, size - pos);
+      if (!ifs.read(data.get() + pos, n)) {
+        std::cerr << "Failed to read " << filename << " at offset " << pos << std::endl;
+        data.reset();
+        std::filesystem::remove(temp_path, error);
+        return false;
+      }
+      if ((pos / copy_block_size) % 64 == 63) {
+        std::cerr << "Loaded " << (pos + n) * 100 / size << "% of " << filename << "...\r";
+      }
+    }
+  }
+
+  std::filesystem::last_write_time(temp_path, mtime, error);
+  if (!error) std::filesystem::rename(temp_path, segment_path, error);
+  if (error) {
+    std::cerr << "Failed to finalize " << segment_path << "!" << std::endl;
+    std::filesystem::remove(temp_path, error);
+    return false;
+  }
+  std::cerr << "Loaded " << filename << " into " << segment_path << "." << std::endl;
+  return true;
+}
+
+std::string AttachShmSegment(const std::string &filename, const std::string &shm_dir) {
+  if (shm_dir.empty()) return filename;
+  const std::string segment_path = ShmSegmentPath(shm_dir, filename);
+  if (!IsShmSegmentUpToDate(segment_path, filename)) {
+    std::cerr << "WARNING: shared-memory segment " << segment_path << " is missing or out of date. "
+        << "Mapping " << filename << " instead." << std::endl;
+    return filename;
+  }
+  std::cerr << "Using shared-memory segment " << segment_path << std::endl;
+  return segment_path;
+}
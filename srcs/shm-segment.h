@@ -0,0 +1,42 @@
+#ifndef SHM_SEGMENT_H_INCLUDED
+#define SHM_SEGMENT_H_INCLUDED
+
+#include <string>
+
+// Shared-memory copies of phase files, for running several solver processes
+// on the same host.
+//
+// Normally each solver process maps its own view of the phase file (e.g.
+// input/r4.bin), so the data is paged in through the page cache, and each
+// process pays for its own page tables and page faults. Instead, the
+// shm-loader daemon can copy the phase file once into a segment: a file in a
+// memory-backed directory, like /dev/shm (which backs POSIX shm_open()) or a
+// hugetlbfs mount. Solvers started with --shm-dir map the segment read-only
+// instead of the phase file, through the same accessors (see accessors.h).
+// Since the segment lives as long as the daemon, restarting a solver costs no
+// reload.
+//
+// A segment has the same contents as the phase file, and the same
+// modification time, so solvers can tell whether it's up to date. Segments in
+// a hugetlbfs directory are rounded up to a multiple of the huge page size.
+
+// Returns the path of the segment for the given file in directory `shm_dir`
+// (e.g. "/dev/shm/pushfight-home-user-input-r4.bin" for "input/r4.bin").
+std::string ShmSegmentPath(const std::string &shm_dir, const std::string &filename);
+
+// Returns whether the segment at `segment_path` exists and was loaded from the
+// current version of `filename`.
+bool IsShmSegmentUpToDate(const std::string &segment_path, const std::string &filename);
+
+// Copies `filename` into the segment at `segment_path`. The copy is written to
+// a temporary segment first, which is renamed when complete, so processes
+// that have the old segment mapped keep a consistent view. Returns false on
+// failure.
+bool LoadShmSegment(const std::string &filename, const std::string &segment_path);
+
+// Returns the file that a solver should map to read `filename`: the segment
+// in `shm_dir` if it is up to date, or `filename` itself (after printing a
+// warning) if it isn't. If `shm_dir` is empty, returns `filename`.
+std::string AttachShmSegment(const std::string &filename, const std::string &shm_dir);
+
+#endif  // ndef SHM_SEGMENT_H_INCLUDED
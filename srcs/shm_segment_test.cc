@@ -0,0 +1,91 @@
+#include "shm-segment.h"
+#include "macros.h"
+#include "random.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+std::vector<uint8_t> ReadFile(const std::string &filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs), {});
+}
+
+void WriteFile(const std::string &filename, const std::vector<uint8_t> &data) {
+  std::ofstream ofs(filename, std::ofstream::binary);
+  ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+  assert(ofs);
+}
+
+void TestShmSegment() {
+  const std::filesystem::path tmp = std::filesystem::temp_directory_path() /
+      ("shm_segment_test." + std::to_string(getpid()));
+  const std::string shm_dir = tmp / "shm";
+  std::filesystem::create_directories(shm_dir);
+
+  std::vector<uint8_t> data((1 << 20) + 123);
+  for (uint8_t &byte : data) byte = RandInt(0, 255);
+  const std::string input = tmp / "input.bin";
+  WriteFile(input, data);
+
+  // Segment names are derived from the absolute path, so relative and
+  // absolute names of the same file map to the same segment.
+  const std::string segment_path = ShmSegmentPath(shm_dir, input);
+  assert(std::filesystem::path(segment_path).parent_path() == shm_dir);
+  assert(ShmSegmentPath(shm_dir, std::filesystem::relative(input).string()) == segment_path);
+  assert(ShmSegmentPath(shm_dir, tmp / "other.bin") != segment_path);
+
+  assert(!IsShmSegmentUpToDate(segment_path, input));
+  assert(AttachShmSegment(input, shm_dir) == input);
+  assert(AttachShmSegment(input, "") == input);
+
+  assert(LoadShmSegment(input, segment_path));
+  assert(IsShmSegmentUpToDate(segment_path, input));
+  assert(ReadFile(segment_path) == data);
+  assert(!std::filesystem::exists(segment_path + ".tmp"));
+  assert(AttachShmSegment(input, shm_dir) == segment_path);
+
+  // Changing the input invalidates the segment until it's loaded again.
+  data[12345] ^= 1;
+  WriteFile(input, data);
+  std::filesystem::last_write_time(input,
+      std::filesystem::last_write_time(input) + std::chrono::seconds(1));
+  assert(!IsShmSegmentUpToDate(segment_path, input));
+  assert(AttachShmSegment(input, shm_dir) == input);
+  assert(LoadShmSegment(input, segment_path));
+  assert(IsShmSegmentUpToDate(segment_path, input));
+  assert(ReadFile(segment_path) == data);
+
+  // Loading a missing file fails without creating a segment.
+  const std::string missing = tmp / "missing.bin";
+  assert(!LoadShmSegment(missing, ShmSegmentPath(shm_dir, missing)));
+  assert(!std::filesystem::exists(ShmSegmentPath(shm_dir, missing)));
+
+  std::filesystem::remove_all(tmp);
+}
+
+}  // namespace
+
+int main() {
+  TestShmSegment();
+}
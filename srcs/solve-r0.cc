@@ -4,6 +4,7 @@
 #include "parse-int.h"
 #include "perms.h"
 #include "search.h"
+#include "thread-pool.h"
 
 #include <cassert>
 #include <chrono>
@@ -13,6 +14,7 @@
 #include <sstream>
 #include <filesystem>
 #include <functional>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
@@ -22,39 +24,26 @@ namespace {
 // Number of threads to use for calculations. 0 to disable multithreading.
 int num_threads = std::thread::hardware_concurrency();
 
-void ComputeChunkThread(int chunk, std::atomic<int> *next_part, Outcome outcomes[]) {
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
+void ComputePart(int chunk, int part, Outcome outcomes[]) {
   const int64_t start_index = int64_t{chunk} * int64_t{chunk_size};
-  for (;;) {
-    const int part = (*next_part)++;
-    if (part + 1 >= num_threads) PrintChunkUpdate(chunk, part + 1 - num_threads);
-    if (part >= num_parts) break;  // note: will actually exceed num_parts!
-    int part_start = part * part_size;
-    Perm perm = PermAtIndex(start_index + part_start);
-    REP(i, part_size) {
-      outcomes[part_start + i] = HasWinningMove(perm) ? WIN : TIE;
-      std::next_permutation(perm.begin(), perm.end());
-    }
+  int part_start = part * part_size;
+  Perm perm = PermAtIndex(start_index + part_start);
+  REP(i, part_size) {
+    outcomes[part_start + i] = HasWinningMove(perm) ? WIN : TIE;
+    std::next_permutation(perm.begin(), perm.end());
   }
 }
 
 std::vector<Outcome> ComputeChunk(int chunk) {
-  std::vector<uint8_t> bits(chunk_size / 8);
   std::vector<Outcome> outcomes(chunk_size, TIE);
-  std::atomic<int> next_part = 0;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeChunkThread(chunk, &next_part, outcomes.data());
-  } else {
-    // Multi-threaded computation.
-    std::atomic<int> next_part = 0;
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(ComputeChunkThread, chunk, &next_part, outcomes.data());
-    }
-    REP(i, num_threads) threads[i].join();
-    assert(next_part == num_parts + num_threads);
-  }
+  std::atomic<int> parts_done = 0;
+  ParallelFor(pool ? &*pool : nullptr, num_parts, num_threads, [&](size_t part) {
+    ComputePart(chunk, part, outcomes.data());
+    PrintChunkUpdate(chunk, ++parts_done);
+  });
   ClearChunkUpdate();
   return outcomes;
 }
@@ -85,6 +74,8 @@ int main(int argc, char *argv[]) {
   std::cout << "Calculating " << end_chunk - start_chunk << " R0 chunks from " << start_chunk << " to "
       << end_chunk << " (exclusive) using " << num_threads << " threads." << std::endl;
 
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
   FOR(chunk, start_chunk, end_chunk) {
     std::string filename = ChunkFileName(0, "output", chunk);
     if (std::filesystem::exists(filename)) {
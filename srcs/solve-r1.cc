@@ -3,6 +3,7 @@
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -16,12 +17,16 @@
 #include "parse-int.h"
 #include "perms.h"
 #include "search.h"
+#include "thread-pool.h"
 
 namespace {
 
 // Number of threads to use for calculations. 0 to disable multithreading.
 int num_threads = std::thread::hardware_concurrency();
 
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
 struct ChunkStats {
   // Number of preexisting results (WIN/LOSS) that were kept.
   int64_t kept = 0;
@@ -66,57 +71,42 @@ Outcome Compute(const Perm &perm) {
   return complete ? LOSS : TIE;
 }
 
-void ComputeChunkThread(int chunk, std::atomic<int> *next_part, Outcome outcomes[], ChunkStats *stats) {
+void ComputePart(int chunk, int part, Outcome outcomes[], ChunkStats *stats) {
   const int64_t start_index = int64_t{chunk} * int64_t{chunk_size};
-  for (;;) {
-    const int part = (*next_part)++;
-    if (part + 1 >= num_threads) PrintChunkUpdate(chunk, part + 1 - num_threads);
-    if (part >= num_parts) break;  // note: will actually exceed num_parts!
-    int part_start = part * part_size;
-    int64_t perm_index = start_index + part_start;
-    Perm perm = PermAtIndex(perm_index);
-    REP(i, part_size) {
-      Outcome o = r0acc[perm_index] ? WIN : TIE;
-      if (o == WIN) {
-        ++stats->kept;
+  int part_start = part * part_size;
+  int64_t perm_index = start_index + part_start;
+  Perm perm = PermAtIndex(perm_index);
+  REP(i, part_size) {
+    Outcome o = r0acc[perm_index] ? WIN : TIE;
+    if (o == WIN) {
+      ++stats->kept;
+    } else {
+      o = Compute(perm);
+      if (o == TIE) {
+        ++stats->unchanged;
       } else {
-        o = Compute(perm);
-        if (o == TIE) {
-          ++stats->unchanged;
-        } else {
-          assert(o == LOSS);
-          ++stats->changed;
-        }
+        assert(o == LOSS);
+        ++stats->changed;
       }
-      outcomes[part_start + i] = o;
-      std::next_permutation(perm.begin(), perm.end());
-      ++perm_index;
     }
+    outcomes[part_start + i] = o;
+    std::next_permutation(perm.begin(), perm.end());
+    ++perm_index;
   }
 }
 
 std::vector<Outcome> ComputeChunk(int chunk) {
   std::vector<Outcome> outcomes(chunk_size, TIE);
-  std::atomic<int> next_part = 0;
-  ChunkStats stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeChunkThread(chunk, &next_part, outcomes.data(), &stats);
-  } else {
-    assert(chunk_size % num_threads == 0);
-    // Multi-threaded computation.
-    std::atomic<int> next_part = 0;
-    std::vector<std::thread> threads;
-    std::vector<ChunkStats> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(ComputeChunkThread, chunk, &next_part, outcomes.data(), &thread_stats[i]);
-    }
-    REP(i, num_threads) threads[i].join();
-    assert(next_part == num_parts + num_threads);
-    for (const ChunkStats &s : thread_stats) stats.Merge(s);
-  }
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  PerWorker<ChunkStats> thread_stats(pool_ptr);
+  std::atomic<int> parts_done = 0;
+  ParallelFor(pool_ptr, num_parts, num_threads, [&](size_t part) {
+    ComputePart(chunk, part, outcomes.data(), &thread_stats.Local());
+    PrintChunkUpdate(chunk, ++parts_done);
+  });
   ClearChunkUpdate();
+  ChunkStats stats;
+  thread_stats.ForEach([&stats](const ChunkStats &s) { stats.Merge(s); });
   std::cerr << "Chunk stats: kept=" << stats.kept << " unchanged=" << stats.unchanged << " changed=" << stats.changed << std::endl;
   return outcomes;
 }
@@ -142,6 +132,8 @@ int main(int argc, char *argv[]) {
   std::cout << "Calculating " << end_chunk - start_chunk << " R1 chunks from " << start_chunk << " to "
       << end_chunk << " (exclusive) using " << num_threads << " threads." << std::endl;
 
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
   FOR(chunk, start_chunk, end_chunk) {
     std::string filename = ChunkFileName(1, "output", chunk);
     if (std::filesystem::exists(filename)) {
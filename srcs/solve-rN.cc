@@ -17,11 +17,15 @@
 #include "codec.h"
 #include "chunks.h"
 #include "flags.h"
+#include "input-generation.h"
 #include "input-verification.h"
 #include "macros.h"
 #include "parse-int.h"
 #include "perms.h"
 #include "search.h"
+#include "shm-segment.h"
+#include "thread-pool.h"
+#include "tie-bitmap.h"
 
 namespace {
 
@@ -30,6 +34,9 @@ const char *solver_id = "solve-rN-v0.1.3";
 // Number of threads to use for calculations. 0 to disable multithreading.
 int num_threads = std::thread::hardware_concurrency();
 
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
 struct ChunkStats {
   // Number of preexisting results (WIN/LOSS) that were kept.
   int64_t kept = 0;
@@ -48,7 +55,22 @@ struct ChunkStats {
 };
 
 // Accessor for the previous phase's results.
-std::optional<RnAccessor> acc;
+std::optional<AnyRnAccessor> acc;
+
+// Format of the input file (selected with --input-format).
+InputFormat input_format = InputFormat::TERNARY;
+
+// Directory with shared-memory copies of the input files (selected with
+// --shm-dir), or empty to map the input files directly.
+std::string shm_dir;
+
+// Whether to use a tie bitmap (selected with --tie-bitmap). This is opt-in,
+// because the bitmap is written next to the input file and takes about 50 GB
+// (one bit per position).
+bool use_tie_bitmap = false;
+
+// Positions that are still TIE in the previous phase's results, if enabled.
+std::optional<TieBitmap> ties;
 
 int initialized_phase = -1;
 
@@ -66,83 +88,92 @@ int initialized_phase = -1;
 // or loss (if N is odd).
 Outcome expected_outcome = TIE;
 
+// Number of successor indices that are looked up at once. Batching lookups
+// allows memory accesses to overlap, but makes early exit less precise.
+constexpr size_t lookup_batch_size = 64;
+
 Outcome Compute(const Perm &perm) {
   if (expected_outcome == LOSS) {
     // A permutation is losing if all successors are winning (for the opponent).
     // So we can abort the search as soon as we find one non-winning successor.
-    bool complete = GenerateSuccessors(perm, [](const Moves&, const State& state) {
-      // If there is an immediately winning/losing move, we should have skipped the computation.
-      assert(state.outcome == TIE);
-      Outcome p = (*acc)[IndexOf(state.perm)];
+    bool complete = GenerateSuccessorIndices<lookup_batch_size>(perm,
+        [](const int64_t *indices, size_t count) {
+      Outcome p = TIE;
+      if (acc->AllOf(indices, count, WIN, &p)) return true;
       assert(p != LOSS);
-      return p == WIN;
+      return false;
     });
     return complete ? LOSS : TIE;
   } else {
     // A permutation is winning if any successor is losing (for the opponent).
     // So we can abort the search as soon as we find a losing position.
     assert(expected_outcome == WIN);
-    bool complete = GenerateSuccessors(perm, [](const Moves&, const State& state) {
-      // If there is an immediately winning/losing move, we should have skipped the computation.
-      assert(state.outcome == TIE);
-      Outcome p = (*acc)[IndexOf(state.perm)];
-      return p != LOSS;
+    bool complete = GenerateSuccessorIndices<lookup_batch_size>(perm,
+        [](const int64_t *indices, size_t count) {
+      return !acc->AnyOf(indices, count, LOSS);
     });
     return complete ? TIE : WIN;
   }
 }
 
-void ComputeChunkThread(int chunk, std::atomic<int> *next_part, Outcome outcomes[], ChunkStats *stats) {
+// Recomputes the outcome of a position that was TIE in the previous phase.
+Outcome ComputeTie(const Perm &perm, ChunkStats *stats) {
+  Outcome o = Compute(perm);
+  if (o == TIE) {
+    ++stats->unchanged;
+  } else {
+    assert(o == expected_outcome);
+    ++stats->changed;
+  }
+  return o;
+}
+
+void ComputePart(int chunk, int part, Outcome outcomes[], ChunkStats *stats) {
   const int64_t start_index = int64_t{chunk} * int64_t{chunk_size};
-  for (;;) {
-    const int part = (*next_part)++;
-    if (part + 1 >= num_threads) PrintChunkUpdate(chunk, part + 1 - num_threads);
-    if (part >= num_parts) break;  // note: will actually exceed num_parts!
-    int part_start = part * part_size;
-    int64_t perm_index = start_index + part_start;
-    Perm perm = PermAtIndex(perm_index);
-    REP(i, part_size) {
-      Outcome o = (*acc)[perm_index];
-      if (o == LOSS || o == WIN) {
-        ++stats->kept;
-      } else {
-        o = Compute(perm);
-        if (o == TIE) {
-          ++stats->unchanged;
-        } else {
-          assert(o == expected_outcome);
-          ++stats->changed;
-        }
-      }
-      outcomes[part_start + i] = o;
-      std::next_permutation(perm.begin(), perm.end());
-      ++perm_index;
+  int part_start = part * part_size;
+  int64_t perm_index = start_index + part_start;
+  if (ties) {
+    // Copy the previous results, then only recompute the ties.
+    acc->Decode(perm_index, part_size, &outcomes[part_start]);
+    int64_t part_ties = 0;
+    ties->ForEachTieInPart(chunk, part, [&](int64_t i) {
+      assert((*acc)[i] == TIE);
+      ++part_ties;
+      outcomes[i - start_index] = ComputeTie(PermAtIndex(i), stats);
+    });
+    stats->kept += part_size - part_ties;
+    return;
+  }
+  // Decode the previous results of the whole part at once, which is faster
+  // than looking them up one by one (especially in the 2-bit format, which
+  // decodes a word at a time), then recompute the ties.
+  acc->Decode(perm_index, part_size, &outcomes[part_start]);
+  Perm perm = PermAtIndex(perm_index);
+  REP(i, part_size) {
+    Outcome o = outcomes[part_start + i];
+    if (o == LOSS || o == WIN) {
+      ++stats->kept;
+    } else {
+      o = ComputeTie(perm, stats);
     }
+    outcomes[part_start + i] = o;
+    std::next_permutation(perm.begin(), perm.end());
   }
 }
 
 std::vector<uint8_t> ComputeChunk(int phase, int chunk) {
   assert(phase == initialized_phase);
   std::vector<Outcome> outcomes(chunk_size, TIE);
-  std::atomic<int> next_part = 0;
-  ChunkStats stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeChunkThread(chunk, &next_part, outcomes.data(), &stats);
-  } else {
-    assert(chunk_size % num_threads == 0);
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    std::vector<ChunkStats> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(ComputeChunkThread, chunk, &next_part, outcomes.data(), &thread_stats[i]);
-    }
-    REP(i, num_threads) threads[i].join();
-    assert(next_part == num_parts + num_threads);
-    for (const ChunkStats &s : thread_stats) stats.Merge(s);
-  }
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  PerWorker<ChunkStats> thread_stats(pool_ptr);
+  std::atomic<int> parts_done = 0;
+  ParallelFor(pool_ptr, num_parts, num_threads, [&](size_t part) {
+    ComputePart(chunk, part, outcomes.data(), &thread_stats.Local());
+    PrintChunkUpdate(chunk, ++parts_done);
+  });
   ClearChunkUpdate();
+  ChunkStats stats;
+  thread_stats.ForEach([&stats](const ChunkStats &s) { stats.Merge(s); });
   std::cerr << "Chunk stats: kept=" << stats.kept << " unchanged=" << stats.unchanged << " changed=" << stats.changed << std::endl;
   return EncodeOutcomes(outcomes);
 }
@@ -157,10 +188,13 @@ void InitPhase(int phase) {
   expected_outcome = phase % 2 == 0 ? WIN : LOSS;
   std::cout << "Expected outcome: " << OutcomeToString(expected_outcome) << "." << std::endl;
 
-  acc.emplace(PhaseInputFilename(phase - 1).c_str());
+  const std::string input_filename = PhaseInputFilename(phase - 1);
+  acc.emplace(AttachShmSegment(PrepareInputFormat(input_filename, input_format), shm_dir).c_str());
 
   if (VerifyInputChunks(phase - 1, acc.value()) != 0) exit(1);
 
+  if (use_tie_bitmap) ties.emplace(PrepareTieBitmap(input_filename, *acc).c_str());
+
   initialized_phase = phase;
 }
 
@@ -188,7 +222,13 @@ void PrintUsage() {
     << "  solve-rN --phase=N --start=<start-chunk> --end=<end-chunk>\n\n"
     << "For automatic chunk assignment (requires network access):\n\n"
     << "  solve-rN --phase=N --user=<user-id> --machine=<machine-id>\n"
-    << "      [--host=styx.verver.ch] [--port=7429]"
+    << "      [--host=styx.verver.ch] [--port=7429]\n"
+    << "\nOptional flags:\n\n"
+    << "  --mmap=<policy>  memory map options for all mapped files (inputs and outputs), e.g. random,hugepages\n"
+    << "  --input-format=ternary|2bit  format of the input file (default: ternary)\n"
+    << "  --shm-dir=<dir>  map input files from shared memory loaded by shm-loader\n"
+    << "  --tie-bitmap=true|false  only scan positions that are still TIE; writes a ~50 GB\n"
+    << "      .ties file next to the input on first use (default: false)\n"
     << std::endl;
 }
 
@@ -202,6 +242,10 @@ int main(int argc, char *argv[]) {
   std::string arg_port = "7429";
   std::string arg_user;
   std::string arg_machine;
+  std::string arg_mmap;
+  std::string arg_input_format;
+  std::string arg_shm_dir;
+  std::string arg_tie_bitmap = "false";
   std::map<std::string, Flag> flags = {
     {"phase", Flag::required(arg_phase)},
 
@@ -214,6 +258,19 @@ int main(int argc, char *argv[]) {
     {"port", Flag::optional(arg_port)},
     {"user", Flag::optional(arg_user)},
     {"machine", Flag::optional(arg_machine)},
+
+    // Memory map policy for all mapped files, read-only or writable (see
+    // ParseMemMapPolicy() in accessors.h)
+    {"mmap", Flag::optional(arg_mmap)},
+
+    // Input file format: "ternary" (default) or "2bit" (larger, but faster)
+    {"input-format", Flag::optional(arg_input_format)},
+
+    // Directory of segments loaded by shm-loader (see shm-segment.h)
+    {"shm-dir", Flag::optional(arg_shm_dir)},
+
+    // Whether to generate and use a bitmap of TIE positions (see tie-bitmap.h)
+    {"tie-bitmap", Flag::optional(arg_tie_bitmap)},
   };
 
   if (argc == 1) {
@@ -233,6 +290,20 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (!InitMemMapPolicyFromFlag(arg_mmap) ||
+      !ParseInputFormat(arg_input_format, &input_format)) {
+    return 1;
+  }
+  shm_dir = arg_shm_dir;
+
+  if (arg_tie_bitmap != "true" && arg_tie_bitmap != "false") {
+    std::cout << "Invalid value for --tie-bitmap: " << arg_tie_bitmap << "\n";
+    return 1;
+  }
+  use_tie_bitmap = arg_tie_bitmap == "true";
+
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
   bool want_manual = !arg_start.empty() || !arg_end.empty();
   bool want_automatic = !arg_user.empty() || !arg_machine.empty();
 
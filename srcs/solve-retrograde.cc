@@ -0,0 +1,639 @@
+// Solver that uses retrograde analysis with successor counters, instead of
+// re-examining undecided positions in every phase like solve-rN, solve2 and
+// solve3 do.
+//
+// Usage:
+//
+//   solve-retrograde [--threads=N] [--memory-budget=<size>] [--state-file=<path>] <r0.bin> <merged.bin>
+//   solve-retrograde --minimized [--threads=N] [--memory-budget=<size>] [--state-file=<path>] <minimized.bin>
+//
+// By default, the solver works with all permutations (indexed by IndexOf()).
+// <r0.bin> is the result of phase 0 (see R0Accessor), which marks positions
+// that are won-in-1. The output is written in the same format as the output
+// of merge-phases (1 byte per position: 0 for tied, 2k + 1 for lost-in-k,
+// 2k for won-in-k), so the two can be compared directly.
+//
+// With --minimized, the solver works with minimized indices instead (indexed
+// by MinIndexOf()), which only include reachable positions, and identify each
+// position with its rotation. This is 4.6 times fewer positions. Positions
+// that are won-in-1 are determined with HasWinningMove(), so no input files
+// are needed. Only reachable predecessors are generated (successors of
+// reachable positions are reachable too). The output is written in the format
+// of minimized.bin (see minify-merged.cc).
+//
+// In both cases, the frequency of each value is printed to stdout in the
+// format of results/merged-bytecounts.txt (or minimized-bytecounts.txt).
+//
+// Algorithm
+//
+// Only positions that are not won-in-1 (about 15% of all positions) need
+// state, which is stored in a "slot" of 16 bits. The slot of a position is its
+// rank among those positions, which is computed from the won-in-1 bitmap with
+// a rank directory. A slot either holds a final value (with decided_bit set),
+// or the number of distinct successors that are not known to be won yet (see
+// retrograde-slots.h).
+//
+//  1. For each position that is not won-in-1, count the distinct successors
+//     that are not won-in-1 either. If there are no successors at all, the
+//     position is lost-in-0; if all of them are won-in-1, it's lost-in-1.
+//     This is the only step that enumerates successors.
+//  2. For k = 1, 2, 3, ...: the undecided predecessors of the positions that
+//     were lost-in-k (including lost-in-0 when k = 1) are won-in-(k + 1).
+//     Then the counters of the undecided predecessors of those new wins are
+//     decremented; positions whose counter reaches zero are lost-in-(k + 1).
+//  3. Stop when no new positions are found. The remaining undecided
+//     positions are tied.
+//
+// Each decided position is expanded exactly once, when its predecessors are
+// generated. Predecessors are deduplicated per position, since each distinct
+// successor was counted once. In the minimized space, a position and its
+// rotation have the same index, so they're deduplicated as well.
+//
+// Memory use
+//
+// For all permutations, the slots take about 122 GB (2 bytes for each of the
+// ~61 billion positions that are not won-in-1) and the rank directory about
+// 1.6 GB, in addition to the memory-mapped r0.bin (50 GB). For minimized
+// indices, everything is about 4.6 times smaller, and the won-in-1 bitmap
+// (10.8 GB) is kept in memory.
+//
+// If the slots don't fit in the memory budget (--memory-budget; default: the
+// amount of physical memory), they are kept in a memory-mapped file instead
+// (--state-file). Predecessors are spread over the whole index space, so
+// applying their updates directly would cause about one random page fault
+// each. Instead, the slots are split into as many ranges as needed for one
+// range to fit in the memory budget, and each step of the algorithm makes one
+// pass over the frontier per range, applying only the updates that fall into
+// that range. This repeats the predecessor generation for every range, but
+// keeps the pages of the state file that are written in memory. In both
+// cases, updates are collected in batches and sorted by index before they are
+// applied, which improves locality of reference.
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "accessors.h"
+#include "board.h"
+#include "chunks.h"
+#include "dedupe.h"
+#include "flags.h"
+#include "lost-positions.h"
+#include "macros.h"
+#include "parse-int.h"
+#include "perms.h"
+#include "retrograde-slots.h"
+#include "search.h"
+#include "thread-pool.h"
+
+namespace {
+
+static_assert(max_successors < decided_bit);
+
+// Number of positions processed by each task. This is a multiple of 64, so
+// tasks that write the won-in-1 bitmap write separate words.
+constexpr int64_t range_size = int64_t{1} << 18;
+
+// Maximum number of predecessor indices collected by a task before they are
+// sorted and applied.
+constexpr size_t max_update_batch_size = size_t{1} << 20;
+
+// Maximum number of passes per step when the slots don't fit in memory (see
+// UpdatePredecessors()). Each pass generates all predecessors of the frontier
+// again, so more passes than this would be too slow to be useful.
+constexpr int max_update_passes = 16;
+
+// Number of positions written to the output file at a time.
+constexpr int64_t output_block_size = chunk_size;
+
+// Number of threads to use for calculations (including the main thread).
+int num_threads = std::thread::hardware_concurrency();
+
+std::optional<ThreadPool> pool;
+
+// Whether to work with minimized indices (selected with --minimized) instead
+// of all permutations.
+bool minimized = false;
+
+// Number of positions in the index space.
+int64_t IndexSize() {
+  return minimized ? min_index_size : total_perms;
+}
+
+// Returns the position at index i. In the minimized space, this is the
+// unrotated position.
+Perm PermAt(int64_t i) {
+  return minimized ? PermAtMinIndex(i) : PermAtIndex(i);
+}
+
+// Returns the index of a position, which must be reachable in the minimized
+// space.
+int64_t IndexOfPerm(const Perm &perm) {
+  return minimized ? MinIndexOf(perm) : IndexOf(perm);
+}
+
+// Maps positions that are not won-in-1 to slots.
+//
+// This is a rank directory over the complement of the won-in-1 bitmap: for
+// every 2^16 positions, the number of preceding slots, and for every 512
+// positions (which is 64 bytes of the bitmap, i.e. one cache line) the number
+// of slots since the start of the 2^16 positions. A lookup reads one entry of
+// each, and counts bits within at most 8 words of the bitmap.
+class SlotIndex {
+public:
+  // `won_in_1` is a bitmap of `size` bits, where bit (i % 8) of byte (i / 8)
+  // is set if position i is won-in-1 (e.g. the contents of r0.bin).
+  SlotIndex(const uint8_t *won_in_1, int64_t size) :
+      won_in_1(won_in_1),
+      size(size),
+      byte_size((size + 7) / 8),
+      super_counts((size >> super_bits) + 1),
+      block_counts((size >> block_bits) + 1) {
+    constexpr int64_t words_per_block = (int64_t{1} << block_bits) / 64;
+    constexpr int64_t blocks_per_super = int64_t{1} << (super_bits - block_bits);
+    ParallelFor(pool ? &*pool : nullptr, super_counts.size(), num_threads, [&](size_t s) {
+      int64_t count = 0;
+      const int64_t end = std::min<int64_t>((s + 1) * blocks_per_super, block_counts.size());
+      for (int64_t b = s * blocks_per_super; b < end; ++b) {
+        block_counts[b] = count;
+        for (int64_t w = b * words_per_block; w < (b + 1) * words_per_block; ++w) {
+          count += std::popcount(Word(w));
+        }
+      }
+      // Temporarily store the count of this super block; see below.
+      super_counts[s] = count;
+    });
+    for (uint64_t &count : super_counts) {
+      const uint64_t n = count;
+      count = slot_count;
+      slot_count += n;
+    }
+  }
+
+  bool IsWonInOne(int64_t i) const { return (won_in_1[i / 8] >> (i % 8)) & 1; }
+
+  // Total number of slots (positions that are not won-in-1).
+  int64_t SlotCount() const { return slot_count; }
+
+  // Returns the slot of position i, which must not be won-in-1 (or, more
+  // generally, the number of positions before i that are not won-in-1).
+  int64_t Slot(int64_t i) const {
+    int64_t slot = super_counts[i >> super_bits] + block_counts[i >> block_bits];
+    const int64_t last_w = i / 64;
+    for (int64_t w = (i >> block_bits) << (block_bits - 6); w < last_w; ++w) {
+      slot += std::popcount(Word(w));
+    }
+    return slot + std::popcount(Word(last_w) & ((uint64_t{1} << (i % 64)) - 1));
+  }
+
+  // Calls callback(i, slot) for each position i between `begin` and `end`
+  // (exclusive) that is not won-in-1, in increasing order.
+  template<class Callback>
+  void ForEachSlot(int64_t begin, int64_t end, Callback callback) const {
+    if (begin >= end) return;
+    int64_t slot = Slot(begin);
+    const int64_t last_w = (end - 1) / 64;
+    for (int64_t w = begin / 64; w <= last_w; ++w) {
+      uint64_t bits = Word(w);
+      if (w == begin / 64) bits &= ~uint64_t{0} << (begin % 64);
+      if (w == last_w && end % 64 != 0) bits &= (uint64_t{1} << (end % 64)) - 1;
+      while (bits != 0) {
+        callback(w * 64 + std::countr_zero(bits), slot++);
+        bits &= bits - 1;
+      }
+    }
+  }
+
+  size_t MemoryUsage() const {
+    return super_counts.size() * sizeof(uint64_t) + block_counts.size() * sizeof(uint16_t);
+  }
+
+private:
+  static constexpr int super_bits = 16;
+  static constexpr int block_bits = 9;
+
+  // Returns word w of the complement of the won-in-1 bitmap, with bits past
+  // `size` cleared.
+  uint64_t Word(int64_t w) const {
+    uint64_t word = 0;
+    if (8 * w + 8 <= byte_size) {
+      memcpy(&word, won_in_1 + 8 * w, 8);
+    } else if (8 * w < byte_size) {
+      memcpy(&word, won_in_1 + 8 * w, byte_size - 8 * w);
+    }
+    word = ~word;
+    if (w >= size / 64) {
+      word = w > size / 64 ? 0 : word & ((uint64_t{1} << (size % 64)) - 1);
+    }
+    return word;
+  }
+
+  const uint8_t *won_in_1;
+  int64_t size;
+  int64_t byte_size;
+  int64_t slot_count = 0;
+  std::vector<uint64_t> super_counts;
+  std::vector<uint16_t> block_counts;
+};
+
+// Source of the won-in-1 bitmap: r0.bin for all permutations, or a bitmap
+// computed in memory for minimized indices.
+std::optional<MappedFile<uint8_t, total_perms/8>> r0_map;
+std::vector<uint64_t> won_in_1_words;
+
+std::optional<SlotIndex> slot_index;
+
+// Number of passes over the frontier in each step of UpdatePredecessors().
+// Each pass applies the updates to one range of slots (see AllocateSlots()).
+int update_passes = 1;
+
+// Slot values, indexed by SlotIndex::Slot().
+std::unique_ptr<uint16_t, std::function<void(uint16_t*)>> slots;
+
+// Calls func(begin, end) for consecutive ranges of `range_size` positions
+// covering the index space in parallel, and prints progress with the given
+// description.
+template<class Func>
+void ForEachRange(const char *description, const Func &func) {
+  const size_t num_tasks = (IndexSize() + range_size - 1) / range_size;
+  const size_t report_interval = std::max<size_t>(num_tasks / 1000, 1);
+  std::atomic<size_t> tasks_done = 0;
+  ParallelFor(pool ? &*pool : nullptr, num_tasks, num_threads, [&](size_t task) {
+    func(task * range_size, std::min<int64_t>((task + 1) * range_size, IndexSize()));
+    if (size_t done = ++tasks_done; done % report_interval == 0) {
+      std::cerr << description << ": " << done * 1000 / num_tasks / 10.0 << "%...    \r" << std::flush;
+    }
+  });
+  std::cerr << std::string(60, ' ') << '\r';
+}
+
+// Computes the won-in-1 bitmap of the minimized space with HasWinningMove().
+void ComputeWonInOne() {
+  won_in_1_words.assign((min_index_size + 63) / 64, 0);
+  std::atomic<int64_t> total = 0;
+  ForEachRange("Finding positions won-in-1", [&](int64_t begin, int64_t end) {
+    int64_t count = 0;
+    for (int64_t i = begin; i < end; ++i) {
+      Perm perm = PermAt(i);
+      if (HasWinningMove(perm)) {
+        won_in_1_words[i / 64] |= uint64_t{1} << (i % 64);
+        ++count;
+      }
+    }
+    total += count;
+  });
+  std::cerr << "Found " << total << " positions won-in-1." << std::endl;
+}
+
+// Step 1: initializes the slots with the number of distinct successors that
+// are not won-in-1.
+void InitializeCounters() {
+  std::atomic<int64_t> lost_in_0 = 0, lost_in_1 = 0;
+  ForEachRange("Counting successors", [&](int64_t begin, int64_t end) {
+    std::vector<int64_t> successors;
+    int64_t range_lost_in_0 = 0, range_lost_in_1 = 0;
+    slot_index->ForEachSlot(begin, end, [&](int64_t i, int64_t slot) {
+      const Perm perm = PermAt(i);
+      successors.clear();
+      GenerateSuccessors(perm, [&successors](const Moves&, const State &state) {
+        // Since the position isn't won-in-1, all successors are in progress.
+        assert(state.outcome == TIE);
+        successors.push_back(IndexOfPerm(state.perm));
+        return true;
+      });
+      SortAndDedupe(successors);
+      int64_t count = 0;
+      for (int64_t j : successors) count += !slot_index->IsWonInOne(j);
+      const uint16_t v = InitialSlot(successors.size(), count);
+      slots.get()[slot] = v;
+      if (v == DecidedSlot(lost_in_0_value)) {
+        assert(IsImmediatelyLost(IndexOf(perm)));
+        ++range_lost_in_0;
+      } else if (v == DecidedSlot(LostValue(1))) {
+        ++range_lost_in_1;
+      }
+    });
+    lost_in_0 += range_lost_in_0;
+    lost_in_1 += range_lost_in_1;
+  });
+  std::cerr << "Found " << lost_in_0 << " positions lost-in-0 and "
+      << lost_in_1 << " positions lost-in-1." << std::endl;
+}
+
+// Calls update(slot) for each distinct predecessor that is not won-in-1 of
+// each position whose slot value v satisfies is_frontier(v), if the slot of
+// the predecessor is between `slot_begin` and `slot_end` (exclusive). Adds the
+// number of calls that returned true to `total_changed`.
+template<class IsFrontier, class Update>
+void UpdatePredecessorsInRange(
+    const char *description, int64_t slot_begin, int64_t slot_end,
+    IsFrontier is_frontier, Update update, std::atomic<int64_t> &total_changed) {
+  ForEachRange(description, [&](int64_t begin, int64_t end) {
+    std::vector<int64_t> predecessors;
+    std::vector<int64_t> batch;
+    int64_t changed = 0;
+    auto flush = [&]() {
+      std::sort(batch.begin(), batch.end());
+      for (int64_t j : batch) {
+        if (slot_index->IsWonInOne(j)) continue;
+        const int64_t slot = slot_index->Slot(j);
+        if (slot >= slot_begin && slot < slot_end && update(slots.get()[slot])) ++changed;
+      }
+      batch.clear();
+    };
+    slot_index->ForEachSlot(begin, end, [&](int64_t i, int64_t slot) {
+      if (!is_frontier(std::atomic_ref<uint16_t>(slots.get()[slot]).load(std::memory_order_relaxed))) {
+        return;
+      }
+      predecessors.clear();
+      GeneratePredecessors(PermAt(i), [&predecessors](const Perm &pred) {
+        // The minimized space only contains reachable positions.
+        if (minimized && !IsReachable(pred)) return;
+        predecessors.push_back(IndexOfPerm(pred));
+      });
+      SortAndDedupe(predecessors);
+      batch.insert(batch.end(), predecessors.begin(), predecessors.end());
+      if (batch.size() >= max_update_batch_size) flush();
+    });
+    flush();
+    total_changed += changed;
+  });
+}
+
+// Calls update(slot) for each distinct predecessor that is not won-in-1 of
+// each position whose slot value v satisfies is_frontier(v). Returns the
+// number of calls that returned true.
+//
+// With multiple update passes, the frontier is generated once per pass. This
+// is correct because updates never change whether a position belongs to the
+// frontier: they only affect undecided positions, which aren't part of it.
+template<class IsFrontier, class Update>
+int64_t UpdatePredecessors(const char *description, IsFrontier is_frontier, Update update) {
+  std::atomic<int64_t> total_changed = 0;
+  REP(pass, update_passes) {
+    const int64_t slot_begin = slot_index->SlotCount() * pass / update_passes;
+    const int64_t slot_end = slot_index->SlotCount() * (pass + 1) / update_passes;
+    std::string label = description;
+    if (update_passes > 1) {
+      label += " (pass " + std::to_string(pass + 1) + " of " + std::to_string(update_passes) + ")";
+    }
+    UpdatePredecessorsInRange(label.c_str(), slot_begin, slot_end, is_frontier, update, total_changed);
+  }
+  return total_changed;
+}
+
+// Marks the undecided predecessors of positions lost-in-k as won-in-(k + 1).
+// Returns the number of new wins.
+int64_t MarkWins(int k) {
+  const uint16_t win = DecidedSlot(WonValue(k + 1));
+  return UpdatePredecessors("Marking wins",
+      [k](uint16_t v) { return IsLostIn(v, k); },
+      [win](uint16_t &slot) {
+        std::atomic_ref<uint16_t> ref(slot);
+        uint16_t v = ref.load(std::memory_order_relaxed);
+        while (!IsDecided(v)) {
+          if (ref.compare_exchange_weak(v, win, std::memory_order_relaxed)) return true;
+        }
+        // A predecessor of a lost position cannot be lost itself.
+        assert((v & ~decided_bit) % 2 == 0);
+        return false;
+      });
+}
+
+// Decrements the counters of the undecided predecessors of positions
+// won-in-k, and marks positions whose counter reaches zero as lost-in-k.
+// Returns the number of new losses.
+int64_t DecrementCounters(int k) {
+  const uint16_t loss = DecidedSlot(LostValue(k));
+  return UpdatePredecessors("Decrementing counters",
+      [k](uint16_t v) { return v == DecidedSlot(WonValue(k)); },
+      [k, loss](uint16_t &slot) {
+        std::atomic_ref<uint16_t> ref(slot);
+        uint16_t v = ref.load(std::memory_order_relaxed);
+        while (!IsDecided(v)) {
+          assert(v > 0);
+          const uint16_t next = DecrementedSlot(v, k);
+          if (ref.compare_exchange_weak(v, next, std::memory_order_relaxed)) return next == loss;
+        }
+        return false;
+      });
+}
+
+// Writes the output file (in the format of merge-phases, or of minimized.bin),
+// and prints the frequency of each value. Returns false on failure.
+bool WriteOutput(const char *filename) {
+  std::ofstream ofs(filename, std::ofstream::binary);
+  if (!ofs) {
+    std::cerr << "Could not create " << filename << std::endl;
+    return false;
+  }
+  std::vector<int64_t> freq(256);
+  std::vector<uint8_t> bytes(output_block_size);
+  for (int64_t block_begin = 0; block_begin < IndexSize(); block_begin += output_block_size) {
+    const int64_t block_end = std::min(block_begin + output_block_size, IndexSize());
+    const size_t num_tasks = (block_end - block_begin + range_size - 1) / range_size;
+    std::vector<std::vector<int64_t>> task_freq(num_tasks, std::vector<int64_t>(256));
+    ParallelFor(pool ? &*pool : nullptr, num_tasks, num_threads, [&](size_t task) {
+      const int64_t begin = block_begin + task * range_size;
+      const int64_t end = std::min(begin + range_size, block_end);
+      uint8_t *task_bytes = &bytes[begin - block_begin];
+      std::fill(task_bytes, task_bytes + (end - begin), won_in_1_value);
+      slot_index->ForEachSlot(begin, end, [&](int64_t i, int64_t slot) {
+        task_bytes[i - begin] = OutputValue(slots.get()[slot]);
+      });
+      for (int64_t i = 0; i < end - begin; ++i) ++task_freq[task][task_bytes[i]];
+    });
+    for (const auto &f : task_freq) REP(v, 256) freq[v] += f[v];
+    if (!ofs.write(reinterpret_cast<const char*>(bytes.data()), block_end - block_begin)) {
+      std::cerr << "Failed to write to " << filename << std::endl;
+      return false;
+    }
+    std::cerr << "Written " << block_end * 1000 / IndexSize() / 10.0 << "%...    \r" << std::flush;
+  }
+  std::cerr << std::string(60, ' ') << '\r';
+  REP(v, 256) if (freq[v] > 0) std::cout << v << '\t' << freq[v] << '\n';
+  std::cout.flush();
+  return true;
+}
+
+// Allocates the slots in memory, or in a memory-mapped file if they don't
+// fit in the memory budget. In the latter case, sets update_passes so that
+// the slots of one pass fit in the budget.
+void AllocateSlots(size_t memory_budget, const std::string &state_filename) {
+  const size_t slots_size = slot_index->SlotCount() * sizeof(uint16_t);
+  const size_t required = slots_size + slot_index->MemoryUsage() +
+      won_in_1_words.size() * sizeof(uint64_t) +
+      size_t(num_threads) * max_update_batch_size * sizeof(int64_t);
+  if (required <= memory_budget) {
+    std::cerr << "Keeping " << slot_index->SlotCount() << " slots in memory ("
+        << slots_size / 1e9 << " GB)." << std::endl;
+    slots = {new uint16_t[slot_index->SlotCount()], [](uint16_t *p) { delete[] p; }};
+    return;
+  }
+  const size_t available = memory_budget > required - slots_size ? memory_budget - (required - slots_size) : 0;
+  if (available < slots_size / max_update_passes) {
+    std::cerr << "Memory budget of " << memory_budget / 1e9 << " GB is too small! At least "
+        << (required - slots_size + slots_size / max_update_passes) / 1e9 << " GB are needed." << std::endl;
+    exit(1);
+  }
+  update_passes = (slots_size + available - 1) / available;
+  std::cerr << "Slots (" << slots_size / 1e9 << " GB) exceed the memory budget of "
+      << memory_budget / 1e9 << " GB. Keeping them in " << state_filename << " instead, "
+      << "and updating them in " << update_passes << " passes." << std::endl;
+  {
+    std::ofstream ofs(state_filename, std::ofstream::binary);
+    if (!ofs) {
+      std::cerr << "Could not create " << state_filename << std::endl;
+      exit(1);
+    }
+  }
+  std::filesystem::resize_file(state_filename, slots_size);
+  // No access advice: the frontier is read sequentially, and updates are
+  // confined to one range of slots per pass.
+  slots = {
+    reinterpret_cast<uint16_t*>(MemMap(state_filename.c_str(), slots_size, true)),
+    [slots_size](uint16_t *p) { MemUnmap(p, slots_size); }};
+}
+
+size_t PhysicalMemory() {
+#if _WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) {
+    std::cerr << "GlobalMemoryStatusEx() failed! Use --memory-budget instead." << std::endl;
+    exit(1);
+  }
+  return status.ullTotalPhys;
+#else
+  return size_t(sysconf(_SC_PHYS_PAGES)) * size_t(sysconf(_SC_PAGE_SIZE));
+#endif
+}
+
+void PrintUsage() {
+  std::cerr << "Usage: solve-retrograde [<options>] <r0.bin> <merged.bin>\n"
+    << "       solve-retrograde --minimized [<options>] <minimized.bin>\n"
+    << "\nOptions:\n"
+    << "  --minimized  work with minimized indices and write minimized.bin directly\n"
+    << "  --threads=N  number of threads to use (default: all cores)\n"
+    << "  --memory-budget=<size>  memory available for the solver state, e.g. 200G (default: physical memory)\n"
+    << "  --state-file=<path>  file used when the state exceeds the memory budget (default: retrograde-state.bin)\n"
+    << "  --mmap=<policy>  memory map policy for r0.bin and the state file (see ParseMemMapPolicy())\n";
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string arg_minimized = "false";
+  std::string arg_threads;
+  std::string arg_memory_budget;
+  std::string arg_state_file = "retrograde-state.bin";
+  std::string arg_mmap;
+  std::map<std::string, Flag> flags = {
+    // Whether to work with minimized indices instead of all permutations.
+    {"minimized", Flag::optional(arg_minimized)},
+    // Number of threads, including the main thread.
+    {"threads", Flag::optional(arg_threads)},
+    // Maximum amount of memory used for the slots, rank directory and update
+    // batches. If exceeded, the slots are kept in --state-file.
+    {"memory-budget", Flag::optional(arg_memory_budget)},
+    // File that backs the slots if they exceed the memory budget.
+    {"state-file", Flag::optional(arg_state_file)},
+    // Memory map policy (see ParseMemMapPolicy() in accessors.h).
+    {"mmap", Flag::optional(arg_mmap)},
+  };
+  if (!ParseFlags(argc, argv, flags)) {
+    PrintUsage();
+    return 1;
+  }
+  if (arg_minimized != "true" && arg_minimized != "false") {
+    std::cerr << "Invalid value for --minimized: " << arg_minimized << std::endl;
+    return 1;
+  }
+  minimized = arg_minimized == "true";
+  if (argc != (minimized ? 2 : 3)) {
+    PrintUsage();
+    return 1;
+  }
+  if (!arg_threads.empty()) {
+    num_threads = ParseInt(arg_threads.c_str());
+    if (num_threads < 1) {
+      std::cerr << "Invalid number of threads: " << arg_threads << std::endl;
+      return 1;
+    }
+  }
+  num_threads = std::max(num_threads, 1);
+  size_t memory_budget = PhysicalMemory();
+  if (!arg_memory_budget.empty() && !ParseByteSize(arg_memory_budget, &memory_budget)) {
+    std::cerr << "Invalid memory budget: " << arg_memory_budget << std::endl;
+    return 1;
+  }
+  if (!InitMemMapPolicyFromFlag(arg_mmap)) return 1;
+  const char *output_filename = argv[argc - 1];
+
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
+  auto start_time = std::chrono::steady_clock::now();
+  auto print_elapsed = [&start_time]() {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    std::cerr << "(" << elapsed.count() / 3600 << " hours elapsed)" << std::endl;
+  };
+
+  if (minimized) {
+    ComputeWonInOne();
+    print_elapsed();
+    slot_index.emplace(reinterpret_cast<const uint8_t*>(won_in_1_words.data()), min_index_size);
+  } else {
+    const char *r0_filename = argv[1];
+    r0_map.emplace(r0_filename);
+    std::cerr << "Building rank directory of " << r0_filename << "..." << std::endl;
+    slot_index.emplace(r0_map->data(), total_perms);
+  }
+  std::cerr << slot_index->SlotCount() << " positions are not won-in-1." << std::endl;
+  AllocateSlots(memory_budget, arg_state_file);
+
+  InitializeCounters();
+  print_elapsed();
+
+  for (int k = 1;; ++k) {
+    if (WonValue(k + 1) >= 256) {
+      std::cerr << "Value of won-in-" << k + 1 << " does not fit in the output format!" << std::endl;
+      return 1;
+    }
+    if (k > 1) {
+      const int64_t losses = DecrementCounters(k);
+      std::cerr << "Found " << losses << " positions lost-in-" << k << ". ";
+      print_elapsed();
+      if (losses == 0) break;
+    }
+    const int64_t wins = MarkWins(k);
+    std::cerr << "Found " << wins << " positions won-in-" << k + 1 << ". ";
+    print_elapsed();
+    if (wins == 0) break;
+  }
+
+  std::cerr << "Writing " << output_filename << "..." << std::endl;
+  if (!WriteOutput(output_filename)) return 1;
+  print_elapsed();
+}
@@ -40,6 +40,10 @@
 #include "parse-int.h"
 #include "perms.h"
 #include "search.h"
+#include "shm-segment.h"
+#include "thread-pool.h"
+#include "tie-bitmap.h"
+#include "tie-set.h"
 
 #include <cassert>
 #include <chrono>
@@ -62,7 +66,33 @@ constexpr const char *default_portname = "7429";
 // Number of threads to use for calculations. 0 to disable multithreading.
 int num_threads = std::thread::hardware_concurrency();
 
-std::optional<RnAccessor> acc;  // r(N-2).bin
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
+std::optional<AnyRnAccessor> acc;  // r(N-2).bin
+
+// Format of the input file (selected with --input-format).
+InputFormat input_format = InputFormat::TERNARY;
+
+// Directory with shared-memory copies of the input files (selected with
+// --shm-dir), or empty to map the input files directly.
+std::string shm_dir;
+
+// Whether to keep the positions that are still TIE in memory (selected with
+// --tie-set). This is meant for late phases, when few positions are TIE.
+bool use_tie_set = false;
+
+// Positions that are still TIE in r(N-2).bin, if enabled. When present, all
+// lookups are answered from this set instead of from `acc`.
+std::optional<TieSet> tie_set;
+
+// Whether to use a tie bitmap (selected with --tie-bitmap). This is opt-in,
+// because the bitmap is written next to the input file and takes about 50 GB
+// (one bit per position).
+bool use_tie_bitmap = false;
+
+// Positions that are still TIE in r(N-2).bin, if enabled.
+std::optional<TieBitmap> ties;
 
 int initialized_phase = -1;
 
@@ -89,13 +119,23 @@ void InitPhase(int phase) {
   }
   std::cerr << "Initializing solver for phase " << phase << "..." << std::endl;
 
-  acc.emplace(PreparePhaseInput(phase, client_factory).c_str());
+  const std::string input_filename = PreparePhaseInput(phase, client_factory);
+  ties.reset();
+  acc.emplace(AttachShmSegment(PrepareInputFormat(input_filename, input_format), shm_dir).c_str());
   int failures = VerifyInputChunks(phase - 2, acc.value());
   if (failures != 0) exit(1);
+  if (use_tie_bitmap) ties.emplace(PrepareTieBitmap(input_filename, *acc).c_str());
+  tie_set.reset();
+  if (use_tie_set) tie_set.emplace(LoadTieSet(input_filename, *acc));
   std::cerr << "Initialization complete!" << std::endl;
   initialized_phase = phase;
 }
 
+// Returns whether the position is still undetermined in r(N-2).bin.
+bool IsTie(int64_t perm_index) {
+  return tie_set ? tie_set->Contains(perm_index) : (*acc)[perm_index] == TIE;
+}
+
 //
 // Loss computation logic starts here. This is equivalent to solve-rN.cc
 //
@@ -117,24 +157,30 @@ struct ChunkStats1 {
   }
 };
 
+// Number of successor indices that are looked up at once. Batching lookups
+// allows memory accesses to overlap, but makes early exit less precise.
+constexpr size_t lookup_batch_size = 64;
+
 void ComputeLoss(
     int64_t perm_index, const Perm &perm,
     std::vector<int64_t> *losses, ChunkStats1 *stats) {
-  Outcome o = (*acc)[perm_index];
   // Only check undetermined positions.
-  if (o == LOSS || o == WIN) {
+  if (!IsTie(perm_index)) {
     ++stats->skipped;
     return;
   }
 
   // A permutation is losing if all successors are winning (for the opponent).
   // So we can abort the search as soon as we find one non-winning successor.
-  bool complete = GenerateSuccessors(perm, [](const Moves&, const State& state) {
-    // If there is an immediately winning/losing move, we should have skipped the computation.
-    assert(state.outcome == TIE);
-    Outcome p = (*acc)[IndexOf(state.perm)];
+  bool complete = GenerateSuccessorIndices<lookup_batch_size>(perm,
+      [](const int64_t *indices, size_t count) {
+    // Since the position isn't won yet, no successor is LOSS, so it's enough
+    // to check that none are TIE.
+    if (tie_set) return !tie_set->AnyOf(indices, count);
+    Outcome p = TIE;
+    if (acc->AllOf(indices, count, WIN, &p)) return true;
     assert(p != LOSS);
-    return p == WIN;
+    return false;
   });
   if (!complete) {
     ++stats->unchanged;
@@ -144,49 +190,46 @@ void ComputeLoss(
   losses->push_back(perm_index);
 }
 
-void ComputeLossesThread(
-    int chunk, std::atomic<int> *next_part,
+void ComputeLossesInPart(
+    int chunk, int part,
     std::vector<int64_t> *losses,
     ChunkStats1 *stats) {
   const int64_t start_index = int64_t{chunk} * int64_t{chunk_size};
-  for (;;) {
-    const int part = (*next_part)++;
-    if (part + 1 >= num_threads) PrintChunkUpdate(chunk, part + 1 - num_threads);
-    if (part >= num_parts) break;  // note: will actually exceed num_parts!
-    int part_start = part * part_size;
-    int64_t perm_index = start_index + part_start;
-    Perm perm = PermAtIndex(perm_index);
-    REP(i, part_size) {
-      ComputeLoss(perm_index, perm, losses, stats);
-      std::next_permutation(perm.begin(), perm.end());
-      ++perm_index;
-    }
+  int part_start = part * part_size;
+  int64_t perm_index = start_index + part_start;
+  if (ties) {
+    // Only positions that are still TIE need to be checked.
+    int64_t part_ties = 0;
+    ties->ForEachTieInPart(chunk, part, [&](int64_t i) {
+      ++part_ties;
+      ComputeLoss(i, PermAtIndex(i), losses, stats);
+    });
+    stats->skipped += part_size - part_ties;
+    return;
+  }
+  Perm perm = PermAtIndex(perm_index);
+  REP(i, part_size) {
+    ComputeLoss(perm_index, perm, losses, stats);
+    std::next_permutation(perm.begin(), perm.end());
+    ++perm_index;
   }
 }
 
 ChunkStats1 ComputeLosses(int chunk, std::vector<int64_t> &losses) {
-  std::atomic<int> next_part = 0;
-  ChunkStats1 stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeLossesThread(chunk, &next_part, &losses, &stats);
-  } else {
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    std::vector<std::vector<int64_t>> thread_losses(num_threads);
-    std::vector<ChunkStats1> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(ComputeLossesThread, chunk, &next_part, &thread_losses[i], &thread_stats[i]);
-    }
-    REP(i, num_threads) {
-      threads[i].join();
-      losses.insert(losses.end(), thread_losses[i].begin(), thread_losses[i].end());
-      stats.Merge(thread_stats[i]);
-    }
-    assert(next_part == num_parts + num_threads);
-  }
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  PerWorker<std::vector<int64_t>> thread_losses(pool_ptr);
+  PerWorker<ChunkStats1> thread_stats(pool_ptr);
+  std::atomic<int> parts_done = 0;
+  ParallelFor(pool_ptr, num_parts, num_threads, [&](size_t part) {
+    ComputeLossesInPart(chunk, part, &thread_losses.Local(), &thread_stats.Local());
+    PrintChunkUpdate(chunk, ++parts_done);
+  });
   ClearChunkUpdate();
+  ChunkStats1 stats;
+  thread_stats.ForEach([&stats](const ChunkStats1 &s) { stats.Merge(s); });
+  thread_losses.ForEach([&losses](const std::vector<int64_t> &v) {
+    losses.insert(losses.end(), v.begin(), v.end());
+  });
   std::sort(losses.begin(), losses.end());
   assert(std::unique(losses.begin(), losses.end()) == losses.end());
   return stats;
@@ -205,10 +248,14 @@ struct ChunkStats2 {
 void BackpropagateLoss(
     int64_t perm_index, const Perm &perm,
     std::vector<int64_t> *wins, ChunkStats2 *stats) {
-  assert((*acc)[perm_index] == TIE);
+  assert(IsTie(perm_index));
   GeneratePredecessors(perm, [stats, wins](const Perm &pred){
     ++stats->total_predecessors;
     int64_t pred_index = IndexOf(pred);
+    if (tie_set) {
+      if (tie_set->Contains(pred_index)) wins->push_back(pred_index);
+      return;
+    }
     Outcome o = (*acc)[pred_index];
     if (o == TIE) {
       wins->push_back(pred_index);
@@ -218,53 +265,30 @@ void BackpropagateLoss(
   });
 }
 
-void ComputeWinsThread(
-    int chunk, const std::vector<int64_t> *losses, std::atomic<size_t> *next_loss,
-    std::vector<int64_t> *wins, ChunkStats2 *stats) {
-  const size_t num_losses = losses->size();
-  for (;;) {
-    size_t i = (*next_loss)++;
-    if (i + 1 >= num_threads) {
-      int progress = i + 1 - num_threads;
-      if (progress % 1000 == 0) PrintChunkUpdate(chunk, progress, num_losses);
-    }
-    if (i >= num_losses) break;  // note: will actually exceed losses.size()!
-    int64_t perm_index = (*losses)[i];
-    Perm perm = PermAtIndex(perm_index);
-    BackpropagateLoss(perm_index, perm, wins, stats);
-  }
-  SortAndDedupe(*wins);
-}
+// Minimum number of losses claimed by a thread at a time.
+constexpr size_t min_loss_grain_size = 16;
 
 ChunkStats2 ComputeWins(
     int chunk, const std::vector<int64_t> &losses,
     std::vector<int64_t> &wins) {
-  std::atomic<size_t> next_loss = 0;
-  ChunkStats2 stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeWinsThread(chunk, &losses, &next_loss, &wins, &stats);
-    assert(next_loss == losses.size() + 1);
-  } else {
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    std::vector<std::vector<int64_t>> thread_wins(num_threads);
-    std::vector<ChunkStats2> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(
-        ComputeWinsThread, chunk, &losses, &next_loss,
-        &thread_wins[i], &thread_stats[i]);
-    }
-    REP(i, num_threads) {
-      threads[i].join();
-      wins.insert(wins.end(), thread_wins[i].begin(), thread_wins[i].end());
-      stats.Merge(thread_stats[i]);
-    }
-    assert(next_loss == losses.size() + num_threads);
-  }
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  PerWorker<std::vector<int64_t>> thread_wins(pool_ptr);
+  PerWorker<ChunkStats2> thread_stats(pool_ptr);
+  std::atomic<size_t> losses_done = 0;
+  ParallelForRange(pool_ptr, losses.size(), num_threads, min_loss_grain_size,
+      [&](size_t begin, size_t end) {
+        std::vector<int64_t> *wins = &thread_wins.Local();
+        ChunkStats2 *stats = &thread_stats.Local();
+        for (size_t i = begin; i < end; ++i) {
+          int64_t perm_index = losses[i];
+          BackpropagateLoss(perm_index, PermAtIndex(perm_index), wins, stats);
+        }
+        PrintChunkUpdate(chunk, losses_done += end - begin, losses.size());
+      });
   ClearChunkUpdate();
-  SortAndDedupe(wins);
+  ChunkStats2 stats;
+  thread_stats.ForEach([&stats](const ChunkStats2 &s) { stats.Merge(s); });
+  MergeAndDedupe(thread_wins, pool_ptr, wins);
   return stats;
 }
 
@@ -292,9 +316,11 @@ bytes_t ComputeChunk(int phase, int chunk) {
     std::cerr << '\n';
   }
 
+  // Chunk results are verified by comparing their SHA-256 hashes with results
+  // computed earlier, so they must keep using the original encoding.
   bytes_t result;
-  EncodeEF(losses, result);
-  EncodeEF(wins, result);
+  EncodeEF(losses, result, -1, EFVersion::V1);
+  EncodeEF(wins, result, -1, EFVersion::V1);
 
   std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start_time;
   double elapsed_minutes = elapsed_seconds.count() / 60;
@@ -325,6 +351,13 @@ void PrintUsage() {
     << "For automatic chunk assignment (requires network access):\n\n"
     << "  solve2 [--phase=N] --user=<user-id> --machine=<machine-id>\n"
     << "      [--host=" << default_hostname << "] [--port=" << default_portname << "]\n"
+    << "\nOptional flags:\n\n"
+    << "  --mmap=<policy>  memory map options for all mapped files (inputs and outputs), e.g. random,hugepages\n"
+    << "  --input-format=ternary|2bit  format of the input file (default: ternary)\n"
+    << "  --shm-dir=<dir>  map input files from shared memory loaded by shm-loader\n"
+    << "  --tie-set=true|false  keep undetermined positions in memory, for late phases (default: false)\n"
+    << "  --tie-bitmap=true|false  only scan positions that are still TIE; writes a ~50 GB\n"
+    << "      .ties file next to the input on first use (default: false)\n"
     << std::endl;
 }
 
@@ -338,6 +371,11 @@ int main(int argc, char *argv[]) {
   std::string arg_port = default_portname;
   std::string arg_user;
   std::string arg_machine;
+  std::string arg_mmap;
+  std::string arg_input_format;
+  std::string arg_shm_dir;
+  std::string arg_tie_set = "false";
+  std::string arg_tie_bitmap = "false";
   std::map<std::string, Flag> flags = {
     {"phase", Flag::optional(arg_phase)},
 
@@ -350,6 +388,23 @@ int main(int argc, char *argv[]) {
     {"port", Flag::optional(arg_port)},
     {"user", Flag::optional(arg_user)},
     {"machine", Flag::optional(arg_machine)},
+
+    // Memory map policy for all mapped files, read-only or writable (see
+    // ParseMemMapPolicy() in accessors.h)
+    {"mmap", Flag::optional(arg_mmap)},
+
+    // Input file format: "ternary" (default) or "2bit" (larger, but faster)
+    {"input-format", Flag::optional(arg_input_format)},
+
+    // Directory of segments loaded by shm-loader (see shm-segment.h)
+    {"shm-dir", Flag::optional(arg_shm_dir)},
+
+    // Whether to answer lookups from a compressed in-memory set of the TIE
+    // positions (see tie-set.h) instead of from the input file
+    {"tie-set", Flag::optional(arg_tie_set)},
+
+    // Whether to generate and use a bitmap of TIE positions (see tie-bitmap.h)
+    {"tie-bitmap", Flag::optional(arg_tie_bitmap)},
   };
 
   if (argc == 1) {
@@ -369,6 +424,26 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (!InitMemMapPolicyFromFlag(arg_mmap) ||
+      !ParseInputFormat(arg_input_format, &input_format)) {
+    return 1;
+  }
+  shm_dir = arg_shm_dir;
+
+  if (arg_tie_set != "true" && arg_tie_set != "false") {
+    std::cout << "Invalid value for --tie-set: " << arg_tie_set << "\n";
+    return 1;
+  }
+  use_tie_set = arg_tie_set == "true";
+
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
+  if (arg_tie_bitmap != "true" && arg_tie_bitmap != "false") {
+    std::cout << "Invalid value for --tie-bitmap: " << arg_tie_bitmap << "\n";
+    return 1;
+  }
+  use_tie_bitmap = arg_tie_bitmap == "true";
+
   bool want_manual = !arg_start.empty() || !arg_end.empty();
   bool want_automatic = !arg_user.empty() || !arg_machine.empty();
 
@@ -28,6 +28,7 @@
 #include "auto-solver.h"
 #include "accessors.h"
 #include "board.h"
+#include "bucket-spill.h"
 #include "bytes.h"
 #include "chunks.h"
 #include "dedupe.h"
@@ -39,7 +40,11 @@
 #include "parse-int.h"
 #include "perms.h"
 #include "search.h"
+#include "shm-segment.h"
+#include "thread-pool.h"
+#include "tie-set.h"
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <filesystem>
@@ -61,7 +66,37 @@ constexpr const char *default_portname = "7429";
 // Number of threads to use for calculations. 0 to disable multithreading.
 int num_threads = std::thread::hardware_concurrency();
 
-std::optional<RnAccessor> acc;  // r(N-2).bin
+// Worker threads, kept for all chunks. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
+// Minimum number of positions claimed by a thread at a time.
+constexpr size_t min_grain_size = 16;
+
+std::optional<AnyRnAccessor> acc;  // r(N-2).bin
+
+// Format of the input file (selected with --input-format).
+InputFormat input_format = InputFormat::TERNARY;
+
+// Directory with shared-memory copies of the input files (selected with
+// --shm-dir), or empty to map the input files directly.
+std::string shm_dir;
+
+// Whether to keep the positions that are still TIE in memory (selected with
+// --tie-set). This is meant for late phases, when few positions are TIE.
+bool use_tie_set = false;
+
+// Positions that are still TIE in r(N-2).bin, if enabled. When present, all
+// lookups are answered from this set instead of from `acc`.
+std::optional<TieSet> tie_set;
+
+// Directory for spilling newly-winning positions to disk (selected with
+// --spill-dir), or empty to collect them in memory.
+std::string spill_dir;
+
+// Number of positions buffered per thread before spilling (derived from
+// --spill-buffer).
+size_t spill_buffer_size = 0;
+
 std::optional<EFAccessor> pot_loss_acc; // rN-pot-loss.bin
 
 int initialized_phase = -1;
@@ -96,19 +131,27 @@ void InitPhase(int phase) {
   std::cerr << "Initializing solver for phase " << phase << "..." << std::endl;
 
   // Open input/r(N-2).bin
-  acc.emplace(PreparePhaseInput(phase, client_factory).c_str());
+  const std::string input_filename = PreparePhaseInput(phase, client_factory);
+  tie_set.reset();
+  acc.emplace(AttachShmSegment(PrepareInputFormat(input_filename, input_format), shm_dir).c_str());
   int failures = VerifyInputChunks(phase - 2, acc.value());
   if (failures != 0) exit(1);
+  if (use_tie_set) tie_set.emplace(LoadTieSet(input_filename, *acc));
 
   // Open input/rN-pot-loss.bin
   const std::string pot_loss_filename = PotentialLossesFilename(phase);
-  pot_loss_acc = EFAccessor(pot_loss_filename.c_str());
+  pot_loss_acc.emplace(pot_loss_filename.c_str(), /* save_index= */ true);
   assert(pot_loss_acc->PartCount() == num_chunks);
 
   std::cerr << "Initialization complete!" << std::endl;
   initialized_phase = phase;
 }
 
+// Returns whether the position is still undetermined in r(N-2).bin.
+bool IsTie(int64_t perm_index) {
+  return tie_set ? tie_set->Contains(perm_index) : (*acc)[perm_index] == TIE;
+}
+
 //
 // Loss computation logic starts here.
 //
@@ -126,21 +169,27 @@ struct ChunkStats1 {
   }
 };
 
+// Number of successor indices that are looked up at once. Batching lookups
+// allows memory accesses to overlap, but makes early exit less precise.
+constexpr size_t lookup_batch_size = 64;
+
 void ComputeLoss(
     int64_t perm_index, const Perm &perm,
     std::vector<int64_t> *losses, ChunkStats1 *stats) {
   // Only check undetermined positions.
-  Outcome o = (*acc)[perm_index];
-  assert(o == TIE);
+  assert(IsTie(perm_index));
 
   // A permutation is losing if all successors are winning (for the opponent).
   // So we can abort the search as soon as we find one non-winning successor.
-  bool complete = GenerateSuccessors(perm, [](const Moves&, const State& state) {
-    // If there is an immediately winning/losing move, we should have skipped the computation.
-    assert(state.outcome == TIE);
-    Outcome p = (*acc)[IndexOf(state.perm)];
+  bool complete = GenerateSuccessorIndices<lookup_batch_size>(perm,
+      [](const int64_t *indices, size_t count) {
+    // Since the position isn't won yet, no successor is LOSS, so it's enough
+    // to check that none are TIE.
+    if (tie_set) return !tie_set->AnyOf(indices, count);
+    Outcome p = TIE;
+    if (acc->AllOf(indices, count, WIN, &p)) return true;
     assert(p != LOSS);
-    return p == WIN;
+    return false;
   });
   if (!complete) {
     ++stats->unchanged;
@@ -150,51 +199,35 @@ void ComputeLoss(
   losses->push_back(perm_index);
 }
 
-void ComputeLossesThread(
-    int chunk,
-    const std::vector<int64_t> *potential_losses,
-    std::atomic<size_t> *next_index,
-    std::vector<int64_t> *losses,
-    ChunkStats1 *stats) {
-  for (;;) {
-    size_t i = (*next_index)++;
-    if (i + 1 >= num_threads && (i + 1 - num_threads) % 10000 == 0) {
-      PrintChunkUpdate(chunk, i + 1 - num_threads, potential_losses->size());
-    }
-    if (i >= potential_losses->size()) break;  // note: will actually exceed size!
-    int64_t perm_index = potential_losses->at(i);
-    Perm perm = PermAtIndex(perm_index);
-    ComputeLoss(perm_index, perm, losses, stats);
-  }
-}
-
 ChunkStats1 ComputeLosses(
     int chunk,
-    const std::vector<int64_t> &potential_losses,
+    const EFListReader &potential_losses,
     std::vector<int64_t> &losses) {
-  std::atomic<size_t> next_index = 0;
-  ChunkStats1 stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeLossesThread(chunk, &potential_losses, &next_index, &losses, &stats);
-  } else {
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    std::vector<std::vector<int64_t>> thread_losses(num_threads);
-    std::vector<ChunkStats1> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(ComputeLossesThread, chunk, &potential_losses, &next_index,
-          &thread_losses[i], &thread_stats[i]);
-    }
-    REP(i, num_threads) {
-      threads[i].join();
-      losses.insert(losses.end(), thread_losses[i].begin(), thread_losses[i].end());
-      stats.Merge(thread_stats[i]);
-    }
-    assert(next_index == potential_losses.size() + num_threads);
-  }
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  PerWorker<std::vector<int64_t>> thread_losses(pool_ptr);
+  PerWorker<ChunkStats1> thread_stats(pool_ptr);
+  std::atomic<size_t> positions_done = 0;
+  ParallelForRange(pool_ptr, potential_losses.size(), num_threads, min_grain_size,
+      [&](size_t begin, size_t end) {
+        std::vector<int64_t> *losses = &thread_losses.Local();
+        ChunkStats1 *stats = &thread_stats.Local();
+        // Decode the range sequentially, in batches to bound memory use.
+        int64_t perm_indices[4096];
+        for (size_t i = begin; i < end; i += std::size(perm_indices)) {
+          const size_t n = std::min(end - i, std::size(perm_indices));
+          potential_losses.Decode(i, i + n, perm_indices);
+          for (size_t j = 0; j < n; ++j) {
+            ComputeLoss(perm_indices[j], PermAtIndex(perm_indices[j]), losses, stats);
+          }
+        }
+        PrintChunkUpdate(chunk, positions_done += end - begin, potential_losses.size());
+      });
   ClearChunkUpdate();
+  ChunkStats1 stats;
+  thread_stats.ForEach([&stats](const ChunkStats1 &s) { stats.Merge(s); });
+  thread_losses.ForEach([&losses](const std::vector<int64_t> &v) {
+    losses.insert(losses.end(), v.begin(), v.end());
+  });
   std::sort(losses.begin(), losses.end());
   assert(std::unique(losses.begin(), losses.end()) == losses.end());
   return stats;
@@ -210,69 +243,51 @@ struct ChunkStats2 {
   }
 };
 
+// Calls add_win(pred_index) for each predecessor that is still TIE.
+template<class AddWin>
 void BackpropagateLoss(
     int64_t perm_index, const Perm &perm,
-    std::vector<int64_t> *wins, ChunkStats2 *stats) {
-  assert((*acc)[perm_index] == TIE);
-  GeneratePredecessors(perm, [stats, wins](const Perm &pred){
+    const AddWin &add_win, ChunkStats2 *stats) {
+  assert(IsTie(perm_index));
+  GeneratePredecessors(perm, [stats, &add_win](const Perm &pred){
     ++stats->total_predecessors;
     int64_t pred_index = IndexOf(pred);
+    if (tie_set) {
+      if (tie_set->Contains(pred_index)) add_win(pred_index);
+      return;
+    }
     Outcome o = (*acc)[pred_index];
     if (o == TIE) {
-      wins->push_back(pred_index);
+      add_win(pred_index);
     } else {
       assert(o == WIN);
     }
   });
 }
 
-void ComputeWinsThread(
-    int chunk, const std::vector<int64_t> *losses, std::atomic<size_t> *next_loss,
-    std::vector<int64_t> *wins, ChunkStats2 *stats) {
-  const size_t num_losses = losses->size();
-  for (;;) {
-    size_t i = (*next_loss)++;
-    if (i + 1 >= num_threads) {
-      int progress = i + 1 - num_threads;
-      if (progress % 1000 == 0) PrintChunkUpdate(chunk, progress, num_losses);
-    }
-    if (i >= num_losses) break;  // note: will actually exceed losses.size()!
-    int64_t perm_index = (*losses)[i];
-    Perm perm = PermAtIndex(perm_index);
-    BackpropagateLoss(perm_index, perm, wins, stats);
-  }
-  SortAndDedupe(*wins);
-}
-
+// Appends the new wins to `result` as an EF-coded list (using the original
+// encoding), and stores their number in `win_count`.
 ChunkStats2 ComputeWins(
     int chunk, const std::vector<int64_t> &losses,
-    std::vector<int64_t> &wins) {
-  std::atomic<size_t> next_loss = 0;
-  ChunkStats2 stats;
-  if (num_threads == 0) {
-    // Single-threaded computation.
-    ComputeWinsThread(chunk, &losses, &next_loss, &wins, &stats);
-    assert(next_loss == losses.size() + 1);
-  } else {
-    // Multi-threaded computation.
-    std::vector<std::thread> threads;
-    std::vector<std::vector<int64_t>> thread_wins(num_threads);
-    std::vector<ChunkStats2> thread_stats(num_threads);
-    threads.reserve(num_threads);
-    REP(i, num_threads) {
-      threads.emplace_back(
-        ComputeWinsThread, chunk, &losses, &next_loss,
-        &thread_wins[i], &thread_stats[i]);
-    }
-    REP(i, num_threads) {
-      threads[i].join();
-      wins.insert(wins.end(), thread_wins[i].begin(), thread_wins[i].end());
-      stats.Merge(thread_stats[i]);
-    }
-    assert(next_loss == losses.size() + num_threads);
-  }
+    bytes_t &result, int64_t *win_count) {
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  IndexCollector collector(pool_ptr, spill_dir, chunk_size, num_chunks, spill_buffer_size);
+  PerWorker<ChunkStats2> thread_stats(pool_ptr);
+  std::atomic<size_t> losses_done = 0;
+  ParallelForRange(pool_ptr, losses.size(), num_threads, min_grain_size,
+      [&](size_t begin, size_t end) {
+        ChunkStats2 *stats = &thread_stats.Local();
+        collector.WithLocal([&](const auto &add_win) {
+          for (size_t i = begin; i < end; ++i) {
+            BackpropagateLoss(losses[i], PermAtIndex(losses[i]), add_win, stats);
+          }
+        });
+        PrintChunkUpdate(chunk, losses_done += end - begin, losses.size());
+      });
   ClearChunkUpdate();
-  SortAndDedupe(wins);
+  ChunkStats2 stats;
+  thread_stats.ForEach([&stats](const ChunkStats2 &s) { stats.Merge(s); });
+  if (!collector.Encode(result, EFVersion::V1, win_count)) exit(1);
   return stats;
 }
 
@@ -283,7 +298,9 @@ bytes_t ComputeChunk(int phase, int chunk) {
 
   auto start_time = std::chrono::system_clock::now();
 
-  const std::vector<int64_t> potential_losses = pot_loss_acc->GetPart(chunk);
+  // Potential losses are read directly from the encoded file, instead of
+  // decoding the entire part into memory.
+  const EFListReader potential_losses = pot_loss_acc->Part(chunk);
 
   std::vector<int64_t> losses;
   if (!potential_losses.empty()) {
@@ -293,20 +310,22 @@ bytes_t ComputeChunk(int phase, int chunk) {
         << stats1.changed << " new losses. " << std::endl;
   }
 
-  std::vector<int64_t> wins;
-  if (!losses.empty()) {
-    ChunkStats2 stats2 = ComputeWins(chunk, losses, wins);
+  // Chunk results are verified by comparing their SHA-256 hashes with results
+  // computed earlier, so they must keep using the original encoding.
+  bytes_t result;
+  EncodeEF(losses, result, -1, EFVersion::V1);
+  if (losses.empty()) {
+    EncodeEF(std::vector<int64_t>(), result, -1, EFVersion::V1);
+  } else {
+    int64_t win_count = 0;
+    ChunkStats2 stats2 = ComputeWins(chunk, losses, result, &win_count);
 
     std::cerr << "Win computation stats: "
-        << wins.size() << " new wins. "
+        << win_count << " new wins. "
         << stats2.total_predecessors / losses.size() << " average predecessors.";
     std::cerr << '\n';
   }
 
-  bytes_t result;
-  EncodeEF(losses, result);
-  EncodeEF(wins, result);
-
   std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start_time;
   std::cerr << "Chunk " << chunk << " done in " << elapsed_seconds.count() << " seconds. " << std::endl;
 
@@ -335,6 +354,13 @@ void PrintUsage() {
     << "For automatic chunk assignment (requires network access):\n\n"
     << "  solve3 [--phase=N] --user=<user-id> --machine=<machine-id>\n"
     << "      [--host=" << default_hostname << "] [--port=" << default_portname << "]\n"
+    << "\nOptional flags:\n\n"
+    << "  --mmap=<policy>  memory map options for all mapped files (inputs and outputs), e.g. random,hugepages\n"
+    << "  --input-format=ternary|2bit  format of the input file (default: ternary)\n"
+    << "  --shm-dir=<dir>  map input files from shared memory loaded by shm-loader\n"
+    << "  --tie-set=true|false  keep undetermined positions in memory, for late phases (default: false)\n"
+    << "  --spill-dir=<dir>  spill newly-winning positions to temporary files in this directory\n"
+    << "  --spill-buffer=<size>  total memory for buffering spilled positions (default: 4G)\n"
     << std::endl;
 }
 
@@ -348,6 +374,12 @@ int main(int argc, char *argv[]) {
   std::string arg_port = default_portname;
   std::string arg_user;
   std::string arg_machine;
+  std::string arg_mmap;
+  std::string arg_input_format;
+  std::string arg_shm_dir;
+  std::string arg_tie_set = "false";
+  std::string arg_spill_dir;
+  std::string arg_spill_buffer = "4G";
   std::map<std::string, Flag> flags = {
     {"phase", Flag::optional(arg_phase)},
 
@@ -360,6 +392,28 @@ int main(int argc, char *argv[]) {
     {"port", Flag::optional(arg_port)},
     {"user", Flag::optional(arg_user)},
     {"machine", Flag::optional(arg_machine)},
+
+    // Memory map policy for all mapped files, read-only or writable (see
+    // ParseMemMapPolicy() in accessors.h)
+    {"mmap", Flag::optional(arg_mmap)},
+
+    // Input file format: "ternary" (default) or "2bit" (larger, but faster)
+    {"input-format", Flag::optional(arg_input_format)},
+
+    // Directory of segments loaded by shm-loader (see shm-segment.h)
+    {"shm-dir", Flag::optional(arg_shm_dir)},
+
+    // Whether to answer lookups from a compressed in-memory set of the TIE
+    // positions (see tie-set.h) instead of from the input file
+    {"tie-set", Flag::optional(arg_tie_set)},
+
+    // Directory for temporary files (see bucket-spill.h). If set, newly-winning
+    // positions are spilled to disk instead of collected in memory.
+    {"spill-dir", Flag::optional(arg_spill_dir)},
+
+    // Total memory for buffering positions before they are spilled, divided
+    // among the threads
+    {"spill-buffer", Flag::optional(arg_spill_buffer)},
   };
 
   if (argc == 1) {
@@ -379,6 +433,34 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (!InitMemMapPolicyFromFlag(arg_mmap) ||
+      !ParseInputFormat(arg_input_format, &input_format)) {
+    return 1;
+  }
+  shm_dir = arg_shm_dir;
+
+  if (arg_tie_set != "true" && arg_tie_set != "false") {
+    std::cout << "Invalid value for --tie-set: " << arg_tie_set << "\n";
+    return 1;
+  }
+  use_tie_set = arg_tie_set == "true";
+
+  if (!arg_spill_dir.empty() && !std::filesystem::is_directory(arg_spill_dir)) {
+    std::cout << "Spill directory " << arg_spill_dir << " does not exist!\n";
+    return 1;
+  }
+  spill_dir = arg_spill_dir;
+  size_t spill_buffer_bytes = 0;
+  const size_t spill_buffers = std::max(num_threads, 1);
+  if (!ParseByteSize(arg_spill_buffer, &spill_buffer_bytes) ||
+      spill_buffer_bytes < spill_buffers * sizeof(int64_t)) {
+    std::cout << "Invalid value for --spill-buffer: " << arg_spill_buffer << "\n";
+    return 1;
+  }
+  spill_buffer_size = spill_buffer_bytes / spill_buffers / sizeof(int64_t);
+
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
   bool want_manual = !arg_start.empty() || !arg_end.empty();
   bool want_automatic = !arg_user.empty() || !arg_machine.empty();
 
@@ -1,22 +1,32 @@
 #ifndef TERNARY_H_INCLUDED
 #define TERNARY_H_INCLUDED
 
+#include <array>
 #include <cstdint>
 #include <cstdlib>
 
+// Powers of three: ternary_pow3[i] == 3**i.
+constexpr uint8_t ternary_pow3[5] = {1, 3, 9, 27, 81};
+
+// Lookup table used by DecodeTernary(): ternary_decode_table[byte][i] is the
+// i-th ternary digit of byte (least significant digit first).
+//
+// The table has rows for all 256 byte values so that it can be indexed
+// safely, but only the first 243 rows correspond to valid encodings.
+constexpr std::array<std::array<uint8_t, 5>, 256> ternary_decode_table = []() {
+  std::array<std::array<uint8_t, 5>, 256> table = {};
+  for (int byte = 0; byte < 256; ++byte) {
+    for (int i = 0, x = byte; i < 5; ++i, x /= 3) table[byte][i] = x % 3;
+  }
+  return table;
+}();
+
 // Decodes a ternary value from a byte at offset (i % 5).
 //
 // Byte must be between 0 and 243 (exclusive).
 // Result will be between 0 and 3 (exclusive).
 inline int DecodeTernary(uint8_t byte, size_t i) {
-  switch (i % 5) {
-  case 0: return byte % 3;
-  case 1: return byte / 3 % 3;
-  case 2: return byte / (3 * 3) % 3;
-  case 3: return byte / (3 * 3 * 3) % 3;
-  case 4: return byte / (3 * 3 * 3 * 3) % 3;
-  default: abort();  // unreachable
-  }
+  return ternary_decode_table[byte][i % 5];
 }
 
 // Encodes a ternary value into a byte at offset (i % 5).
@@ -25,14 +35,7 @@ inline int DecodeTernary(uint8_t byte, size_t i) {
 // Value must be between 0 and 3 (exclusive).
 // Result will be between 0 and 243 (exclusive).
 inline uint8_t EncodeTernary(uint8_t byte, size_t i, int value) {
-  switch (i % 5) {
-  case 0: return byte + (value - DecodeTernary(byte, i));
-  case 1: return byte + (value - DecodeTernary(byte, i)) * 3;
-  case 2: return byte + (value - DecodeTernary(byte, i)) * 3 * 3;
-  case 3: return byte + (value - DecodeTernary(byte, i)) * 3 * 3 * 3;
-  case 4: return byte + (value - DecodeTernary(byte, i)) * 3 * 3 * 3 * 3;
-  default: abort();  // unreachable
-  }
+  return byte + (value - DecodeTernary(byte, i)) * ternary_pow3[i % 5];
 }
 
 #endif  // ndef TERNARY_H_INCLUDED
@@ -1,12 +1,27 @@
+#include "accessors.h"
+#include "board.h"
+#include "codec.h"
 #include "macros.h"
 #include "ternary.h"
+#include "two-bit.h"
 
 #ifdef NDEBUG
 #error "Can't compile test with -DNDEBUG!"
 #endif
 #include <assert.h>
 
-int main() {
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void TestEncodeDecodeTernary() {
   size_t offset = 0;
   REP(a, 3) REP(b, 3) REP(c, 3) REP(d, 3) REP(e, 3) {
     offset += 31337;
@@ -35,3 +50,140 @@ int main() {
     }
   }
 }
+
+// Tests the bulk EncodeOutcomes(), DecodeOutcomes() and CountOutcomes()
+// functions against DecodeTernary(), for all valid byte values and for a range
+// of buffer sizes (since the first and last bytes are handled specially).
+void TestBulkOutcomes() {
+  for (size_t size = 0; size <= 250; ++size) {
+    std::vector<uint8_t> bytes(size);
+    REP(i, size) bytes[i] = (i * 97 + size) % 243;
+
+    // Add a guard value after the output, to detect writes past the end.
+    std::vector<Outcome> outcomes(5 * size + 1, static_cast<Outcome>(42));
+    DecodeOutcomes(bytes.data(), size, outcomes.data());
+    assert(outcomes[5 * size] == 42);
+    int64_t expected_counts[3] = {0, 0, 0};
+    REP(i, 5 * size) {
+      assert(outcomes[i] == DecodeTernary(bytes[i / 5], i));
+      ++expected_counts[outcomes[i]];
+    }
+
+    std::vector<uint8_t> encoded(size + 1, uint8_t{42});
+    EncodeOutcomes(outcomes.data(), encoded.data(), size);
+    assert(encoded[size] == 42);
+    encoded.pop_back();
+    assert(encoded == bytes);
+
+    int64_t counts[3] = {1, 2, 3};
+    assert(CountOutcomes(bytes.data(), size, counts));
+    assert(counts[TIE] == expected_counts[TIE] + 1);
+    assert(counts[LOSS] == expected_counts[LOSS] + 2);
+    assert(counts[WIN] == expected_counts[WIN] + 3);
+
+    if (size > 0) {
+      bytes[size / 2] = 243;
+      assert(!CountOutcomes(bytes.data(), size, counts));
+    }
+  }
+
+  // Large enough to require CountOutcomes() to flush its counters.
+  std::vector<uint8_t> bytes(1000000, uint8_t{2*1 + 1*3 + 2*81});
+  int64_t counts[3] = {0, 0, 0};
+  assert(CountOutcomes(bytes.data(), bytes.size(), counts));
+  assert(counts[TIE] == 2000000);
+  assert(counts[LOSS] == 1000000);
+  assert(counts[WIN] == 2000000);
+}
+
+void TestTwoBit() {
+  std::vector<Outcome> outcomes(1000);
+  REP(i, outcomes.size()) outcomes[i] = static_cast<Outcome>(i * 7 % 11 % 3);
+
+  uint64_t word = 0;
+  REP(i, 32) word = EncodeTwoBit(word, i, outcomes[i]);
+  REP(i, 32) assert(DecodeTwoBit(word, i) == outcomes[i]);
+  REP(value, 3) {
+    uint32_t mask = TwoBitMatchMask(word, value);
+    REP(i, 32) assert(((mask >> i) & 1) == (outcomes[i] == value));
+  }
+
+  for (size_t size : {0, 1, 31, 32, 33, 995, 1000}) {
+    std::vector<uint64_t> words(TwoBitWordCount(size) + 1, uint64_t{42});
+    EncodeOutcomesTwoBit(outcomes.data(), size, words.data());
+    assert(words.back() == 42);
+    words.pop_back();
+    REP(i, size) assert(DecodeTwoBit(words[i / 32], i) == outcomes[i]);
+    // Padding must consist of TIE values.
+    for (size_t i = size; i < words.size() * 32; ++i) assert(DecodeTwoBit(words[i / 32], i) == TIE);
+
+    std::vector<Outcome> decoded(size);
+    DecodeOutcomesTwoBit(words.data(), size, decoded.data());
+    assert(std::equal(decoded.begin(), decoded.end(), outcomes.begin()));
+  }
+
+  // Round-trip conversion through streams.
+  std::vector<uint8_t> ternary = EncodeOutcomes(outcomes);
+  std::string ternary_string(ternary.begin(), ternary.end());
+  std::istringstream ternary_input(ternary_string);
+  std::ostringstream two_bit_output;
+  assert(ConvertTernaryToTwoBit(ternary_input, two_bit_output, outcomes.size()));
+  assert(two_bit_output.str().size() == TwoBitWordCount(outcomes.size()) * 8);
+  std::istringstream two_bit_input(two_bit_output.str());
+  std::ostringstream ternary_output;
+  assert(ConvertTwoBitToTernary(two_bit_input, ternary_output, outcomes.size()));
+  assert(ternary_output.str() == ternary_string);
+}
+
+// Tests TwoBitRnAccessorBase::Match64() and Decode() against operator[] on a
+// small file, whose size is not a multiple of 32, so that the last word is
+// padded.
+void TestTwoBitAccessor() {
+  constexpr size_t size = 1000;
+  std::vector<Outcome> outcomes(size);
+  REP(i, size) outcomes[i] = static_cast<Outcome>(i * 13 % 17 % 3);
+  std::vector<uint64_t> words(TwoBitWordCount(size));
+  EncodeOutcomesTwoBit(outcomes.data(), size, words.data());
+
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("ternary_test." + std::to_string(getpid()) + ".2bit");
+  std::ofstream(filename, std::ofstream::binary).write(
+      reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+  {
+    const TwoBitRnAccessorBase<size> acc(filename.c_str());
+    REP(i, size) assert(acc[i] == outcomes[i]);
+
+    // Starting positions cover all shifts within a word, and the end of the
+    // file, where bits past the end must be 0.
+    for (size_t start = 0; start <= size + 40; ++start) {
+      for (Outcome o : {TIE, LOSS, WIN}) {
+        const uint64_t mask = acc.Match64(start, o);
+        REP(j, 64) {
+          const bool expected = start + j < size && outcomes[start + j] == o;
+          assert(((mask >> j) & 1) == expected);
+        }
+      }
+    }
+
+    for (size_t start : {0, 1, 31, 32, 33, 500, 967, 968, 999, 1000}) {
+      for (size_t count : {0, 1, 31, 32, 33, 64, 100, 500}) {
+        if (start + count > size) continue;
+        // Add a guard value after the output, to detect writes past the end.
+        std::vector<Outcome> decoded(count + 1, static_cast<Outcome>(42));
+        acc.Decode(start, count, decoded.data());
+        assert(decoded[count] == 42);
+        assert(std::equal(decoded.begin(), decoded.end() - 1, outcomes.begin() + start));
+      }
+    }
+  }
+  std::filesystem::remove(filename);
+}
+
+}  // namespace
+
+int main() {
+  TestEncodeDecodeTernary();
+  TestBulkOutcomes();
+  TestTwoBit();
+  TestTwoBitAccessor();
+}
@@ -0,0 +1,150 @@
+#include "thread-pool.h"
+
+#include <cassert>
+#include <chrono>
+#include <utility>
+
+#include "macros.h"
+
+namespace {
+
+// The pool and worker index of the calling thread (see CurrentWorker()).
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local int current_worker = -1;
+
+// Interval at which TaskGroup::Wait() checks for new tasks to help with.
+constexpr auto task_group_poll_interval = std::chrono::milliseconds(1);
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads) {
+  assert(num_threads > 0);
+  workers.reserve(num_threads);
+  REP(i, num_threads) workers.push_back(std::make_unique<Worker>());
+  threads.reserve(num_threads);
+  REP(i, num_threads) threads.emplace_back(&ThreadPool::WorkerThread, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cond.notify_all();
+  for (std::thread &thread : threads) thread.join();
+  assert(pending == 0);
+  assert(shared_tasks.empty());
+  for (const auto &worker : workers) assert(worker->tasks.empty());
+}
+
+int ThreadPool::CurrentWorker() const {
+  return current_pool == this ? current_worker : -1;
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  const int self = CurrentWorker();
+  if (self >= 0) {
+    std::lock_guard<std::mutex> lock(workers[self]->mutex);
+    workers[self]->tasks.push_back(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    shared_tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(!stopping || self >= 0);
+    ++pending;
+  }
+  cond.notify_one();
+}
+
+bool ThreadPool::TakeTask(int self, std::function<void()> &task) {
+  if (pending == 0) return false;
+  if (self >= 0) {
+    Worker &worker = *workers[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      --pending;
+      return true;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    if (!shared_tasks.empty()) {
+      task = std::move(shared_tasks.front());
+      shared_tasks.pop_front();
+      --pending;
+      return true;
+    }
+  }
+  const int n = workers.size();
+  for (int i = 1; i <= n; ++i) {
+    Worker &victim = *workers[(self + i + n) % n];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --pending;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::RunPendingTask() {
+  std::function<void()> task;
+  if (!TakeTask(CurrentWorker(), task)) return false;
+  task();
+  return true;
+}
+
+void ThreadPool::WorkerThread(int index) {
+  current_pool = this;
+  current_worker = index;
+  for (;;) {
+    std::function<void()> task;
+    if (TakeTask(index, task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this]{ return stopping || pending > 0; });
+    if (stopping && pending == 0) return;
+  }
+}
+
+void TaskGroup::Run(std::function<void()> task) {
+  if (pool == nullptr) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++outstanding;
+  }
+  pool->Submit([this, task=std::move(task)]() {
+    task();
+    // Notify while holding the lock, so that the group isn't destroyed
+    // before notify_all() returns.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--outstanding == 0) cond.notify_all();
+  });
+}
+
+void TaskGroup::Wait() {
+  if (pool == nullptr) return;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (outstanding == 0) return;
+    }
+    if (pool->RunPendingTask()) continue;
+    // All tasks of this group have been started. Wait for them to finish,
+    // but check regularly for new tasks, since a running task may submit
+    // more work.
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_for(lock, task_group_poll_interval, [this]{ return outstanding == 0; });
+  }
+}
@@ -0,0 +1,294 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Pool of worker threads with work stealing.
+//
+// Each worker has its own task queue. Tasks submitted by a worker (e.g. from
+// a nested ParallelFor() or TaskGroup) are added to that worker's queue and
+// executed in LIFO order, which keeps related work on the same core. Tasks
+// submitted by other threads are added to a shared queue and started in FIFO
+// order. Idle workers take tasks from the shared queue first, and steal the
+// oldest task of another worker's queue if it's empty.
+//
+// The pool is meant to be created once and kept for the lifetime of the
+// program, so that thread startup is not on the hot path.
+//
+// Tasks must not throw exceptions. The destructor waits for all queued tasks
+// to finish.
+class ThreadPool {
+public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+
+  int NumThreads() const { return threads.size(); }
+
+  // Adds a task to the queue. It will be executed by one of the worker
+  // threads at some point in the future.
+  void Submit(std::function<void()> task);
+
+  // Executes a single queued task on the calling thread, if there is one.
+  // Returns whether a task was executed. This lets a thread that waits for
+  // other tasks help instead of blocking (see TaskGroup::Wait()).
+  bool RunPendingTask();
+
+  // Returns the index of the worker thread that calls this method (between 0
+  // and NumThreads(), exclusive), or -1 if it is called by a thread that does
+  // not belong to this pool.
+  int CurrentWorker() const;
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // Takes a task from the queue of worker `self` (if it's not -1), the shared
+  // queue, or another worker's queue, in that order.
+  bool TakeTask(int self, std::function<void()> &task);
+
+  void WorkerThread(int index);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  std::mutex shared_mutex;
+  std::deque<std::function<void()>> shared_tasks;  // protected by shared_mutex
+
+  // Idle workers sleep on `cond` until there are queued tasks. `pending`
+  // counts tasks in all queues. It is only incremented while holding `mutex`,
+  // so workers can't miss a wakeup.
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::atomic<int64_t> pending = 0;
+  bool stopping = false;  // protected by mutex
+
+  std::vector<std::thread> threads;
+};
+
+// Set of tasks that can be waited for together.
+//
+// Usage:
+//
+//   TaskGroup group(pool);
+//   group.Run([]() { ... });
+//   group.Run([]() { ... });
+//   group.Wait();
+//
+// While waiting, the calling thread executes queued tasks (of any group), so
+// groups can be nested inside tasks without running out of threads. If `pool`
+// is null, Run() executes the task immediately.
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool *pool) : pool(pool) {}
+
+  // Waits for the remaining tasks.
+  ~TaskGroup() { Wait(); }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup &operator=(const TaskGroup&) = delete;
+
+  void Run(std::function<void()> task);
+
+  // Returns once all tasks passed to Run() have completed.
+  void Wait();
+
+private:
+  ThreadPool *const pool;
+  std::mutex mutex;
+  std::condition_variable cond;
+  int64_t outstanding = 0;  // protected by mutex
+};
+
+// Calls func(i) for each i between 0 and `count` (exclusive), using the
+// calling thread and at most `max_threads - 1` threads from `pool`. Returns
+// once all calls have completed.
+//
+// The calling thread takes part in the work, so this makes progress even if
+// all worker threads are busy (or if `pool` is null). Helper tasks that only
+// start after all work has been claimed return immediately, so the caller
+// never waits for queued tasks, only for calls that are already running.
+//
+// Each index is passed to exactly one call, so results are deterministic as
+// long as func(i) only writes to outputs belonging to index i.
+template<class Func>
+void ParallelFor(ThreadPool *pool, size_t count, int max_threads, const Func &func);
+
+// Like ParallelFor(), but calls func(begin, end) for consecutive ranges that
+// together cover the indices between 0 and `count` (exclusive).
+//
+// Ranges are claimed with guided scheduling: each claim takes a fraction of
+// the remaining indices, but at least `min_grain` of them (except at the end).
+// So the first ranges are large, which keeps the scheduling overhead low for
+// cheap per-index work, and the last ones are small, so that all threads
+// finish at about the same time.
+template<class Func>
+void ParallelForRange(
+    ThreadPool *pool, size_t count, int max_threads, size_t min_grain, const Func &func);
+
+// One value of type T per thread that takes part in a ParallelFor() or
+// TaskGroup on `pool`, for collecting results without locking, e.g.:
+//
+//   PerWorker<int64_t> sums(pool);
+//   ParallelFor(pool, n, max_threads, [&](size_t i) { sums.Local() += f(i); });
+//   int64_t sum = sums.Reduce(int64_t{0}, std::plus<int64_t>());
+//
+// Local() returns the value of the calling worker thread. All threads that
+// don't belong to `pool` share a single value, so at most one of them may use
+// this object at a time (normally the thread that called ParallelFor()).
+template<class T>
+class PerWorker {
+public:
+  // Values are default-constructed, so T doesn't need to be copyable.
+  explicit PerWorker(const ThreadPool *pool)
+    : pool(pool), slots((pool == nullptr ? 0 : pool->NumThreads()) + 1) {}
+
+  PerWorker(const ThreadPool *pool, const T &init)
+    : pool(pool), slots((pool == nullptr ? 0 : pool->NumThreads()) + 1, Slot{init}) {}
+
+  T &Local() { return slots[pool == nullptr ? 0 : pool->CurrentWorker() + 1].value; }
+
+  // Calls func(value) for each value, in a fixed order.
+  template<class Func>
+  void ForEach(const Func &func) {
+    for (Slot &slot : slots) func(slot.value);
+  }
+
+  // Returns op(...op(op(init, v1), v2)..., vN) over all values.
+  template<class Op>
+  T Reduce(T init, const Op &op) const {
+    for (const Slot &slot : slots) init = op(std::move(init), slot.value);
+    return init;
+  }
+
+private:
+  // Aligned to avoid false sharing between threads.
+  struct alignas(64) Slot {
+    T value;
+  };
+
+  const ThreadPool *pool;
+  std::vector<Slot> slots;
+};
+
+// Implementation details below.
+
+namespace thread_pool_internal {
+
+// State shared between the caller of ParallelForRange() and its helper tasks.
+struct ParallelForState {
+  ParallelForState(
+      size_t count, size_t min_grain, size_t max_grain, int num_workers,
+      std::function<void(size_t, size_t)> func)
+    : count(count), min_grain(std::max<size_t>(min_grain, 1)),
+      max_grain(std::max(max_grain, this->min_grain)), num_workers(num_workers),
+      func(std::move(func)) {}
+
+  // Claims a range of indices. Returns false if none are left.
+  bool Claim(size_t &begin, size_t &end) {
+    if (min_grain == max_grain) {
+      begin = next.fetch_add(min_grain);
+      if (begin >= count) return false;
+      end = std::min(count, begin + min_grain);
+      return true;
+    }
+    begin = next.load();
+    do {
+      if (begin >= count) return false;
+      const size_t grain = std::clamp((count - begin) / (2 * num_workers), min_grain, max_grain);
+      end = std::min(count, begin + grain);
+    } while (!next.compare_exchange_weak(begin, end));
+    return true;
+  }
+
+  // Claims and runs ranges until none are left.
+  void Work() {
+    for (size_t begin, end; Claim(begin, end); ) func(begin, end);
+  }
+
+  // Called by a helper task.
+  void Help() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (closed) return;
+      ++active;
+    }
+    Work();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--active == 0) cond.notify_all();
+  }
+
+  // Called by the caller after its own call to Work() returns. After this,
+  // helpers that haven't started yet will not call func anymore.
+  void Close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    cond.wait(lock, [this]{ return active == 0; });
+  }
+
+  const size_t count;
+  const size_t min_grain;
+  const size_t max_grain;
+  const size_t num_workers;
+  const std::function<void(size_t, size_t)> func;
+  std::atomic<size_t> next = 0;
+  std::mutex mutex;
+  std::condition_variable cond;
+  int active = 0;
+  bool closed = false;
+};
+
+// Runs func(begin, end) on ranges of [0, count) with sizes between min_grain
+// and max_grain.
+template<class Func>
+void RunParallel(
+    ThreadPool *pool, size_t count, int max_threads, size_t min_grain, size_t max_grain,
+    const Func &func) {
+  size_t helpers = pool == nullptr || max_threads <= 1 || count <= min_grain ? 0 :
+      std::min({size_t(max_threads - 1), size_t(pool->NumThreads()), count - 1});
+  if (helpers == 0) {
+    if (count > 0) func(0, count);
+    return;
+  }
+  auto state = std::make_shared<ParallelForState>(
+      count, min_grain, max_grain, helpers + 1,
+      [&func](size_t begin, size_t end) { func(begin, end); });
+  for (size_t i = 0; i < helpers; ++i) {
+    pool->Submit([state]() { state->Help(); });
+  }
+  state->Work();
+  state->Close();
+}
+
+}  // namespace thread_pool_internal
+
+template<class Func>
+void ParallelFor(ThreadPool *pool, size_t count, int max_threads, const Func &func) {
+  thread_pool_internal::RunParallel(pool, count, max_threads, 1, 1,
+      [&func](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) func(i);
+      });
+}
+
+template<class Func>
+void ParallelForRange(
+    ThreadPool *pool, size_t count, int max_threads, size_t min_grain, const Func &func) {
+  thread_pool_internal::RunParallel(
+      pool, count, max_threads, min_grain, count, func);
+}
+
+#endif  // ndef THREAD_POOL_H_INCLUDED
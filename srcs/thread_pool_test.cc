@@ -0,0 +1,153 @@
+#include "thread-pool.h"
+
+#include "macros.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace {
+
+void TestSubmit() {
+  std::atomic<int> sum = 0;
+  {
+    ThreadPool pool(4);
+    assert(pool.NumThreads() == 4);
+    REP(i, 1000) pool.Submit([&sum, i]() { sum += i; });
+    // Destructor waits for all tasks to complete.
+  }
+  assert(sum == 999 * 1000 / 2);
+}
+
+void TestParallelFor() {
+  ThreadPool pool(3);
+  for (int max_threads : {0, 1, 2, 4, 100}) {
+    for (size_t count : {0, 1, 2, 10, 1000}) {
+      std::vector<int> calls(count);
+      ParallelFor(&pool, count, max_threads, [&calls](size_t i) { ++calls[i]; });
+      for (int n : calls) assert(n == 1);
+    }
+  }
+
+  // Without a pool, all work is done on the calling thread.
+  std::vector<int> calls(10);
+  ParallelFor(nullptr, calls.size(), 4, [&calls](size_t i) { ++calls[i]; });
+  for (int n : calls) assert(n == 1);
+}
+
+void TestParallelForBusyPool() {
+  // ParallelFor() must complete even if all worker threads are blocked.
+  ThreadPool pool(2);
+  std::atomic<bool> release = false;
+  REP(i, 2) pool.Submit([&release]() { while (!release) std::this_thread::yield(); });
+  std::vector<int> calls(100);
+  ParallelFor(&pool, calls.size(), 3, [&calls](size_t i) { ++calls[i]; });
+  for (int n : calls) assert(n == 1);
+  release = true;
+}
+
+void TestParallelForRange() {
+  ThreadPool pool(3);
+  for (int max_threads : {1, 4}) {
+    for (size_t count : {0, 1, 2, 10, 1000, 100000}) {
+      for (size_t min_grain : {0, 1, 7, 1000}) {
+        std::vector<int> calls(count);
+        std::atomic<size_t> ranges = 0;
+        ParallelForRange(&pool, count, max_threads, min_grain,
+            [&](size_t begin, size_t end) {
+              assert(begin < end && end <= count);
+              assert(end - begin >= min_grain || end == count);
+              for (size_t i = begin; i < end; ++i) ++calls[i];
+              ++ranges;
+            });
+        for (int n : calls) assert(n == 1);
+        // Guided scheduling needs far fewer ranges than indices.
+        if (count >= 1000 && max_threads > 1) assert(ranges < count / 10);
+      }
+    }
+  }
+}
+
+void TestTaskGroup() {
+  ThreadPool pool(3);
+  std::atomic<int> sum = 0;
+  {
+    TaskGroup group(&pool);
+    REP(i, 1000) group.Run([&sum, i]() { sum += i; });
+    group.Wait();
+    assert(sum == 999 * 1000 / 2);
+
+    // A group can be reused after waiting.
+    group.Run([&sum]() { sum += 1; });
+    // Destructor waits too.
+  }
+  assert(sum == 999 * 1000 / 2 + 1);
+
+  // Nested groups must not deadlock, even with more nested tasks than
+  // threads, because waiting threads execute queued tasks.
+  std::atomic<int> leaves = 0;
+  {
+    TaskGroup outer(&pool);
+    REP(i, 10) outer.Run([&pool, &leaves]() {
+      TaskGroup inner(&pool);
+      REP(j, 10) inner.Run([&leaves]() { ++leaves; });
+      inner.Wait();
+    });
+  }
+  assert(leaves == 100);
+
+  // Nested ParallelFor() calls inside tasks.
+  std::vector<std::atomic<int>> calls(20 * 50);
+  ParallelFor(&pool, 20, 4, [&](size_t i) {
+    ParallelFor(&pool, 50, 4, [&](size_t j) { ++calls[i * 50 + j]; });
+  });
+  for (const auto &n : calls) assert(n == 1);
+
+  // Without a pool, tasks run immediately.
+  int count = 0;
+  TaskGroup group(nullptr);
+  group.Run([&count]() { ++count; });
+  assert(count == 1);
+  group.Wait();
+}
+
+void TestPerWorker() {
+  ThreadPool pool(3);
+  assert(pool.CurrentWorker() == -1);
+  PerWorker<int64_t> sums(&pool);
+  PerWorker<int> workers(&pool, -1);
+  ParallelFor(&pool, 10000, 4, [&](size_t i) {
+    sums.Local() += i;
+    const int worker = pool.CurrentWorker();
+    assert(worker >= -1 && worker < pool.NumThreads());
+    int &seen = workers.Local();
+    assert(seen == -1 || seen == worker + 1);
+    seen = worker + 1;
+  });
+  assert(sums.Reduce(int64_t{0}, std::plus<int64_t>()) == int64_t{9999} * 10000 / 2);
+  int slots = 0;
+  sums.ForEach([&slots](int64_t) { ++slots; });
+  assert(slots == pool.NumThreads() + 1);
+
+  // Without a pool, there is a single value.
+  PerWorker<int> single(nullptr, 5);
+  single.Local() += 1;
+  assert(single.Reduce(0, std::plus<int>()) == 6);
+}
+
+}  // namespace
+
+int main() {
+  TestSubmit();
+  TestParallelFor();
+  TestParallelForBusyPool();
+  TestParallelForRange();
+  TestTaskGroup();
+  TestPerWorker();
+}
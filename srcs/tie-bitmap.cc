@@ -0,0 +1,154 @@
+#include "tie-bitmap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+
+#include "merkle.h"
+#include "thread-pool.h"
+
+namespace {
+
+constexpr char magic[8] = {'P', 'F', 'T', 'I', 'E', 'S', '1', '\n'};
+
+// Byte offsets of the sections of the file.
+constexpr size_t counts_offset = 64;
+constexpr size_t words_offset =
+    (counts_offset + TieBitmap::part_count * sizeof(uint32_t) + 4095) / 4096 * 4096;
+constexpr size_t file_size = words_offset + TieBitmap::word_count * sizeof(uint64_t);
+
+// Number of words of the bitmap generated by each task in WriteTieBitmap().
+constexpr int64_t words_per_block = 1 << 16;
+
+}  // namespace
+
+int64_t CountSetBits(const uint64_t *words, int64_t begin, int64_t end) {
+  if (begin >= end) return 0;
+  int64_t w = begin / 64;
+  const int64_t last_w = (end - 1) / 64;
+  uint64_t bits = words[w] & (~uint64_t{0} << (begin % 64));
+  int64_t count = 0;
+  for (;;) {
+    if (w == last_w && end % 64 != 0) bits &= (uint64_t{1} << (end % 64)) - 1;
+    count += std::popcount(bits);
+    if (++w > last_w) break;
+    bits = words[w];
+  }
+  return count;
+}
+
+std::string TieBitmap::FilenameFor(const std::string &phase_filename) {
+  return std::filesystem::path(phase_filename).replace_extension(".ties").string();
+}
+
+TieBitmap::TieBitmap(const char *filename) : map(filename) {
+  header = reinterpret_cast<const Header*>(map.data());
+  if (map.size() != file_size ||
+      memcmp(header->magic, magic, sizeof(magic)) != 0 ||
+      header->value_count != total_perms ||
+      header->part_count != part_count) {
+    std::cerr << filename << " is not a valid tie bitmap! Delete it to regenerate it." << std::endl;
+    exit(1);
+  }
+  counts = reinterpret_cast<const uint32_t*>(map.data() + counts_offset);
+  words = reinterpret_cast<const uint64_t*>(map.data() + words_offset);
+}
+
+bool TieBitmap::IsUpToDate(const char *phase_filename) const {
+  std::error_code error;
+  const uintmax_t size = std::filesystem::file_size(phase_filename, error);
+  return !error && size == header->phase_file_size &&
+      DataFileModificationTime(phase_filename) == header->phase_file_mtime;
+}
+
+bool WriteTieBitmap(const char *phase_filename, const AnyRnAccessor &acc, const char *filename,
+    int num_threads) {
+  const std::string temp_filename = std::string(filename) + ".tmp";
+  {
+    std::ofstream ofs(temp_filename, std::ofstream::binary);
+    if (!ofs) {
+      std::cerr << "Could not create " << temp_filename << std::endl;
+      return false;
+    }
+  }
+  std::filesystem::resize_file(temp_filename, file_size);
+  std::unique_ptr<uint8_t, std::function<void(uint8_t*)>> data(
+      reinterpret_cast<uint8_t*>(MemMap(temp_filename.c_str(), file_size, true)),
+      [](uint8_t *data) { MemUnmap(data, file_size); });
+  TieBitmap::Header *header = reinterpret_cast<TieBitmap::Header*>(data.get());
+  uint32_t *counts = reinterpret_cast<uint32_t*>(data.get() + counts_offset);
+  uint64_t *words = reinterpret_cast<uint64_t*>(data.get() + words_offset);
+
+  std::optional<ThreadPool> pool;
+  if (num_threads > 1) pool.emplace(num_threads - 1);
+
+  // Step 1: generate the bitmap. In the 2-bit format, 64 values can be
+  // compared at once.
+  const TwoBitRnAccessor *two_bit = acc.TwoBit();
+  const int64_t num_blocks = (TieBitmap::word_count + words_per_block - 1) / words_per_block;
+  std::atomic<int64_t> blocks_done = 0;
+  ParallelFor(pool ? &*pool : nullptr, num_blocks, std::max(num_threads, 1), [&](size_t block) {
+    const int64_t end = std::min<int64_t>((block + 1) * words_per_block, TieBitmap::word_count);
+    for (int64_t w = block * words_per_block; w < end; ++w) {
+      words[w] = two_bit ? two_bit->Match64(w * 64, TIE) : TieMask(acc, w * 64, total_perms);
+    }
+    if (int64_t done = ++blocks_done; done % 256 == 0) {
+      std::cerr << "Generated " << done * 100 / num_blocks << "% of the tie bitmap...\r";
+    }
+  });
+
+  // Step 2: count ties per part.
+  std::atomic<int64_t> tie_count = 0;
+  ParallelFor(pool ? &*pool : nullptr, num_chunks, std::max(num_threads, 1), [&](size_t chunk) {
+    int64_t chunk_ties = 0;
+    for (int part = 0; part < num_parts; ++part) {
+      const int64_t begin = int64_t(chunk) * chunk_size + int64_t{part} * part_size;
+      const int64_t count = CountSetBits(words, begin, begin + part_size);
+      counts[int64_t(chunk) * num_parts + part] = count;
+      chunk_ties += count;
+    }
+    tie_count += chunk_ties;
+  });
+
+  // Step 3: write the header last, so an incomplete file is never valid.
+  memcpy(header->magic, magic, sizeof(magic));
+  header->value_count = total_perms;
+  header->part_count = TieBitmap::part_count;
+  header->tie_count = tie_count;
+  header->phase_file_size = std::filesystem::file_size(phase_filename);
+  header->phase_file_mtime = DataFileModificationTime(phase_filename);
+  data.reset();
+
+  std::error_code error;
+  std::filesystem::rename(temp_filename, filename, error);
+  if (error) {
+    std::cerr << "Failed to rename " << temp_filename << " to " << filename << "!" << std::endl;
+    return false;
+  }
+  std::cerr << "Wrote tie bitmap " << filename << " with " << tie_count << " ties ("
+      << 100.0 * tie_count / total_perms << "% of all positions)." << std::endl;
+  return true;
+}
+
+std::string PrepareTieBitmap(const std::string &phase_filename, const AnyRnAccessor &acc) {
+  const std::string filename = TieBitmap::FilenameFor(phase_filename);
+  if (std::filesystem::exists(filename)) {
+    if (TieBitmap(filename.c_str()).IsUpToDate(phase_filename.c_str())) {
+      std::cerr << "Using existing tie bitmap " << filename << std::endl;
+      return filename;
+    }
+    std::cerr << "Tie bitmap " << filename << " is out of date." << std::endl;
+  }
+  std::cerr << "Generating tie bitmap " << filename << " from " << phase_filename << "..." << std::endl;
+  if (!WriteTieBitmap(phase_filename.c_str(), acc, filename.c_str(), std::thread::hardware_concurrency())) {
+    exit(1);
+  }
+  return filename;
+}
@@ -0,0 +1,156 @@
+#ifndef TIE_BITMAP_H_INCLUDED
+#define TIE_BITMAP_H_INCLUDED
+
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <string>
+
+#include "accessors.h"
+#include "chunks.h"
+#include "perms.h"
+
+// Calls callback(i) for each bit i between `begin` and `end` (exclusive) that
+// is set in `words`, in increasing order. Bit i is bit (i % 64) of words[i / 64].
+//
+// This processes 64 bits at a time, and finds set bits by counting trailing
+// zeros (a single TZCNT instruction on modern x86-64 CPUs), so the time taken
+// is proportional to the number of words plus the number of set bits.
+template<class Callback>
+void ForEachSetBit(const uint64_t *words, int64_t begin, int64_t end, Callback callback) {
+  if (begin >= end) return;
+  int64_t w = begin / 64;
+  const int64_t last_w = (end - 1) / 64;
+  uint64_t bits = words[w] & (~uint64_t{0} << (begin % 64));
+  for (;;) {
+    if (w == last_w && end % 64 != 0) bits &= (uint64_t{1} << (end % 64)) - 1;
+    while (bits != 0) {
+      callback(w * 64 + std::countr_zero(bits));
+      bits &= bits - 1;
+    }
+    if (++w > last_w) break;
+    bits = words[w];
+  }
+}
+
+// Returns the number of bits between `begin` and `end` (exclusive) that are
+// set in `words`, using the same bit order as ForEachSetBit().
+int64_t CountSetBits(const uint64_t *words, int64_t begin, int64_t end);
+
+// Returns a 64-bit mask with bit j set if and only if the value at index
+// (start + j) is TIE, for all indices below `end`. Bits for indices at or
+// past `end` are 0.
+template<class Accessor>
+uint64_t TieMask(const Accessor &acc, int64_t start, int64_t end) {
+  uint64_t mask = 0;
+  for (int64_t j = 0; j < 64 && start + j < end; ++j) {
+    mask |= uint64_t{acc[start + j] == TIE} << j;
+  }
+  return mask;
+}
+
+// Bitmap of the positions that are still TIE in a phase file (rN.bin),
+// together with the number of ties in each part of each chunk (see chunks.h).
+//
+// In later phases almost all positions are already WIN or LOSS, so the
+// solvers only need to examine a small fraction of them. Instead of decoding
+// every value of the phase file, they iterate over the set bits of this
+// bitmap, 64 positions at a time, and skip parts without ties entirely.
+//
+// The bitmap is derived from the phase file, and stored next to it with the
+// extension ".ties" (e.g. "input/r4.ties" for "input/r4.bin"). It records the
+// size and modification time of the phase file, so it can be regenerated when
+// the phase file changes (see PrepareTieBitmap()).
+//
+// File layout (all integers little-endian):
+//
+//   header (64 bytes):
+//     char[8]  magic "PFTIES1\n"
+//     uint64   number of values (total_perms)
+//     uint64   number of parts (num_chunks * num_parts)
+//     uint64   total number of ties
+//     uint64   size of the phase file
+//     int64    modification time of the phase file (see merkle.h)
+//     padding
+//   uint32[number of parts]  number of ties in each part
+//   padding to a multiple of 4096 bytes
+//   uint64[(total_perms + 63) / 64]  bit (i % 64) of word (i / 64) is set
+//                                    if and only if value i is TIE
+class TieBitmap {
+public:
+  static constexpr int64_t part_count = int64_t{num_chunks} * num_parts;
+  static constexpr int64_t word_count = (total_perms + 63) / 64;
+
+  // Returns the filename of the bitmap for the given phase file.
+  static std::string FilenameFor(const std::string &phase_filename);
+
+  // Maps the bitmap into memory. Exits if the file is invalid.
+  explicit TieBitmap(const char *filename);
+
+  // Returns whether the bitmap was generated from the current version of the
+  // given phase file (by comparing its size and modification time).
+  bool IsUpToDate(const char *phase_filename) const;
+
+  // Total number of ties.
+  int64_t TieCount() const { return header->tie_count; }
+
+  // Number of ties in the given part of the given chunk.
+  int64_t TieCount(int chunk, int part) const { return counts[int64_t{chunk} * num_parts + part]; }
+
+  bool IsTie(int64_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+  // The bitmap, in the bit order described above.
+  const uint64_t *Words() const { return words; }
+
+  // Calls callback(i) for each index i between `begin` and `end` (exclusive)
+  // that is TIE, in increasing order.
+  template<class Callback>
+  void ForEachTie(int64_t begin, int64_t end, Callback callback) const {
+    assert(0 <= begin && begin <= end && end <= total_perms);
+    ForEachSetBit(words, begin, end, callback);
+  }
+
+  // Calls callback(i) for each TIE index i in the given part of the given
+  // chunk, in increasing order. Parts without ties are skipped without
+  // reading the bitmap.
+  template<class Callback>
+  void ForEachTieInPart(int chunk, int part, Callback callback) const {
+    if (TieCount(chunk, part) == 0) return;
+    const int64_t begin = int64_t{chunk} * chunk_size + int64_t{part} * part_size;
+    ForEachTie(begin, begin + part_size, callback);
+  }
+
+private:
+  struct Header {
+    char magic[8];
+    uint64_t value_count;
+    uint64_t part_count;
+    uint64_t tie_count;
+    uint64_t phase_file_size;
+    int64_t phase_file_mtime;
+    char padding[16];
+  };
+  static_assert(sizeof(Header) == 64);
+
+  friend bool WriteTieBitmap(const char *, const AnyRnAccessor &, const char *, int);
+
+  DynMappedFile<uint8_t> map;
+  const Header *header;
+  const uint32_t *counts;
+  const uint64_t *words;
+};
+
+// Generates the tie bitmap of the phase file `phase_filename`, whose values
+// are read from `acc`, using `num_threads` threads (0 to disable
+// multithreading). The bitmap is written to a temporary file first, which is
+// renamed to `filename` when complete. Returns false on failure.
+bool WriteTieBitmap(const char *phase_filename, const AnyRnAccessor &acc, const char *filename,
+    int num_threads);
+
+// Returns the filename of the tie bitmap of the given phase file, after
+// generating it if it doesn't exist or is out of date. The values are read
+// from `acc`, which may use a different format (e.g. input/r4.2bit) than the
+// phase file itself. Exits if the bitmap cannot be generated.
+std::string PrepareTieBitmap(const std::string &phase_filename, const AnyRnAccessor &acc);
+
+#endif  // ndef TIE_BITMAP_H_INCLUDED
@@ -0,0 +1,179 @@
+#include "tie-set.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+#include "tie-bitmap.h"
+
+namespace {
+
+// Number of blocks encoded by each task when building the set.
+constexpr size_t blocks_per_task = 1024;
+
+constexpr size_t prefetch_distance = 16;
+
+void SetBit(uint64_t *words, uint64_t pos) {
+  words[pos / 64] |= uint64_t{1} << (pos % 64);
+}
+
+// ORs the lower `n` bits of `value` into `words` at bit offset `pos`.
+void PutBits(uint64_t *words, uint64_t pos, uint64_t value, int n) {
+  if (n == 0) return;
+  const unsigned s = pos % 64;
+  words[pos / 64] |= value << s;
+  if (s + n > 64) words[pos / 64 + 1] |= value >> (64 - s);
+}
+
+}  // namespace
+
+TieSet::TieSet(const uint64_t *words, int64_t size, ThreadPool *pool, int num_threads)
+    : size_(size), blocks((size + block_size - 1) >> block_bits) {
+  num_threads = std::max(num_threads, 1);
+  const size_t num_tasks = (blocks.size() + blocks_per_task - 1) / blocks_per_task;
+
+  // Step 1: count the elements of each block.
+  ParallelFor(pool, num_tasks, num_threads, [&](size_t task) {
+    const size_t end = std::min(blocks.size(), (task + 1) * blocks_per_task);
+    for (size_t b = task * blocks_per_task; b < end; ++b) {
+      const int64_t begin = b * block_size;
+      blocks[b] = CountSetBits(words, begin, std::min(begin + block_size, size));
+    }
+  });
+
+  // Step 2: assign bit offsets to blocks.
+  uint64_t offset = 0;
+  for (uint64_t &block : blocks) {
+    const int64_t n = block;
+    tie_count += n;
+    block = offset | (uint64_t(n) << count_shift);
+    offset += BlockBits(n);
+  }
+  assert(offset <= offset_mask);
+  data.assign((offset + 63) / 64 + 1, 0);
+
+  // Step 3: encode blocks.
+  ParallelFor(pool, num_tasks, num_threads, [&](size_t task) {
+    const size_t end = std::min(blocks.size(), (task + 1) * blocks_per_task);
+    for (size_t b = task * blocks_per_task; b < end; ++b) EncodeBlock(words, b);
+  });
+}
+
+void TieSet::EncodeBlock(const uint64_t *words, int64_t b) {
+  const int64_t n = blocks[b] >> count_shift;
+  if (n == 0) return;
+  const uint64_t pos = blocks[b] & offset_mask;
+  const int64_t begin = b * block_size;
+  const int64_t end = std::min(begin + block_size, size_);
+
+  // Encode the block into a local buffer first.
+  uint64_t local[block_size / 64 + 1] = {};
+  if (IsBitmapBlock(n)) {
+    static_assert(block_size % 64 == 0);
+    for (int64_t i = begin; i < end; i += 64) {
+      uint64_t word = words[i / 64];
+      if (end - i < 64) word &= (uint64_t{1} << (end - i)) - 1;
+      local[(i - begin) / 64] = word;
+    }
+  } else {
+    const int l = LowBits(n);
+    const uint64_t lower = n + (block_size >> l);
+    const uint64_t low_mask = (uint64_t{1} << l) - 1;
+    int64_t j = 0;
+    ForEachSetBit(words, begin, end, [&](int64_t i) {
+      const int64_t x = i - begin;
+      SetBit(local, j + (x >> l));
+      PutBits(local, lower + j * l, x & low_mask, l);
+      ++j;
+    });
+    assert(j == n);
+  }
+
+  // Copy the buffer into `data` at bit offset `pos`. The first and last words
+  // may be shared with neighbouring blocks, which are encoded concurrently,
+  // so those are updated atomically.
+  const int64_t bits = BlockBits(n);
+  const unsigned s = pos % 64;
+  const int64_t first = pos / 64;
+  const int64_t last = (pos + bits - 1) / 64;
+  for (int64_t t = 0; first + t <= last; ++t) {
+    uint64_t word = local[t] << s;
+    if (t > 0 && s > 0) word |= local[t - 1] >> (64 - s);
+    if (t == 0 || first + t == last) {
+      std::atomic_ref<uint64_t>(data[first + t]).fetch_or(word, std::memory_order_relaxed);
+    } else {
+      data[first + t] = word;
+    }
+  }
+}
+
+bool TieSet::Contains(int64_t i) const {
+  assert(0 <= i && i < size_);
+  const uint64_t block = blocks[i >> block_bits];
+  const int64_t n = block >> count_shift;
+  if (n == 0) return false;
+  const uint64_t pos = block & offset_mask;
+  const int64_t x = i & (block_size - 1);
+  if (IsBitmapBlock(n)) return ReadWord(pos + x) & 1;
+
+  const int l = LowBits(n);
+  const int64_t h = x >> l;
+  const uint64_t low = x & ((uint64_t{1} << l) - 1);
+
+  // Find the start of bucket h, which follows the h-th 0 bit of the upper
+  // bits.
+  uint64_t q = pos;
+  for (int64_t zeros = h; zeros > 0; ) {
+    uint64_t inverted = ~ReadWord(q);
+    const int c = std::popcount(inverted);
+    if (c < zeros) {
+      zeros -= c;
+      q += 64;
+      continue;
+    }
+    while (--zeros > 0) inverted &= inverted - 1;
+    q += std::countr_zero(inverted) + 1;
+  }
+
+  // Compare the lower bits of the elements in bucket h (which are sorted)
+  // until the bucket ends with a 0 bit.
+  int64_t j = (q - pos) - h;
+  const uint64_t lower = pos + n + (block_size >> l);
+  for (;; q += 64) {
+    const int ones = std::countr_one(ReadWord(q));
+    for (int k = 0; k < ones; ++k, ++j) {
+      const uint64_t value = ReadBits(lower + j * l, l);
+      if (value >= low) return value == low;
+    }
+    if (ones < 64) return false;
+  }
+}
+
+bool TieSet::AnyOf(const int64_t *indices, size_t count) const {
+  for (size_t i = 0; i < count && i < prefetch_distance; ++i) Prefetch(indices[i]);
+  for (size_t i = 0; i < count; ++i) {
+    if (i + prefetch_distance < count) Prefetch(indices[i + prefetch_distance]);
+    if (i + prefetch_distance / 2 < count) {
+      // By now, the block descriptor should be in the cache.
+      const uint64_t block = blocks[indices[i + prefetch_distance / 2] >> block_bits];
+      __builtin_prefetch(&data[(block & offset_mask) / 64]);
+    }
+    if (Contains(indices[i])) return true;
+  }
+  return false;
+}
+
+TieSet LoadTieSet(const std::string &phase_filename, const AnyRnAccessor &acc) {
+  const TieBitmap bitmap(PrepareTieBitmap(phase_filename, acc).c_str());
+  std::cerr << "Building in-memory tie set from " << bitmap.TieCount() << " ties..." << std::endl;
+  const int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  ThreadPool pool(num_threads - 1);
+  TieSet tie_set(bitmap.Words(), total_perms, &pool, num_threads);
+  assert(tie_set.TieCount() == bitmap.TieCount());
+  std::cerr << "Tie set uses " << tie_set.MemoryUsage() / 1e9 << " GB ("
+      << 8.0 * tie_set.MemoryUsage() / std::max<int64_t>(tie_set.TieCount(), 1) << " bits per tie)."
+      << std::endl;
+  return tie_set;
+}
@@ -0,0 +1,121 @@
+#ifndef TIE_SET_H_INCLUDED
+#define TIE_SET_H_INCLUDED
+
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "accessors.h"
+#include "thread-pool.h"
+
+// Compressed in-memory set of the positions that are still TIE, used by the
+// solvers in late phases (see --tie-set in solve2 and solve3).
+//
+// In late phases, the solvers only need to know whether a position is TIE or
+// not: a position is lost if none of its successors are TIE (a LOSS successor
+// would have made it won already), and the predecessors of a new loss are
+// newly won if they are TIE. So instead of probing the 80 GB phase file on
+// disk, they can probe this set, which takes about 6.5 bits per tie (plus 8
+// bytes per block of 8192 positions) and fits in RAM once only a few percent
+// of positions are TIE.
+//
+// The positions are split into blocks of 8192 indices. Each block stores the
+// offsets of its ties with Elias-Fano coding (an upper bit vector in which
+// each tie is a 1 bit and each bucket of 2**k indices ends with a 0 bit,
+// followed by the lower k bits of each offset), or as a plain bitmap if that
+// is smaller. Blocks are packed together without alignment, and a descriptor
+// per block stores the bit offset and the number of ties, which determines
+// the encoding.
+class TieSet {
+public:
+  static constexpr int block_bits = 13;
+  static constexpr int64_t block_size = int64_t{1} << block_bits;
+
+  // Builds the set from a bitmap of `size` bits, where bit i is bit (i % 64)
+  // of words[i / 64] (e.g. the words of a TieBitmap), using the calling
+  // thread and at most `num_threads - 1` threads from `pool` (which may be
+  // null).
+  TieSet(const uint64_t *words, int64_t size, ThreadPool *pool, int num_threads);
+
+  // Number of positions (set and unset).
+  int64_t size() const { return size_; }
+
+  // Number of positions in the set.
+  int64_t TieCount() const { return tie_count; }
+
+  // Approximate memory used by the set, in bytes.
+  size_t MemoryUsage() const {
+    return blocks.size() * sizeof(uint64_t) + data.size() * sizeof(uint64_t);
+  }
+
+  // Returns whether position i is in the set.
+  bool Contains(int64_t i) const;
+
+  // Hints the CPU to start loading the block descriptor of position i.
+  void Prefetch(int64_t i) const {
+    __builtin_prefetch(&blocks[i >> block_bits]);
+  }
+
+  // Returns whether any of the given positions is in the set. Stops at the
+  // first match.
+  bool AnyOf(const int64_t *indices, size_t count) const;
+
+private:
+  static constexpr int count_shift = 40;
+  static constexpr uint64_t offset_mask = (uint64_t{1} << count_shift) - 1;
+
+  // Number of low bits per element of a block with n elements.
+  static int LowBits(int64_t n) {
+    return std::bit_width(static_cast<uint64_t>(block_size / n)) - 1;
+  }
+
+  // Size in bits of the Elias-Fano encoding of a block with n elements.
+  static int64_t EliasFanoBits(int64_t n) {
+    const int l = LowBits(n);
+    return n * l + n + (block_size >> l);
+  }
+
+  // Whether a block with n elements is stored as a plain bitmap.
+  static bool IsBitmapBlock(int64_t n) {
+    return EliasFanoBits(n) >= block_size;
+  }
+
+  // Size in bits of a block with n elements.
+  static int64_t BlockBits(int64_t n) {
+    return n == 0 ? 0 : IsBitmapBlock(n) ? block_size : EliasFanoBits(n);
+  }
+
+  // Returns 64 bits starting from bit `pos` of `data`.
+  uint64_t ReadWord(uint64_t pos) const {
+    const uint64_t w = pos / 64;
+    const unsigned s = pos % 64;
+    return s == 0 ? data[w] : (data[w] >> s) | (data[w + 1] << (64 - s));
+  }
+
+  // Returns `n` bits (at most 64) starting from bit `pos` of `data`.
+  uint64_t ReadBits(uint64_t pos, int n) const {
+    return n == 0 ? 0 : ReadWord(pos) & (~uint64_t{0} >> (64 - n));
+  }
+
+  // Encodes block b from the bitmap into `data`.
+  void EncodeBlock(const uint64_t *words, int64_t b);
+
+  int64_t size_;
+  int64_t tie_count = 0;
+
+  // For each block: bit offset in `data` (lower 40 bits), and number of
+  // elements (upper 24 bits).
+  std::vector<uint64_t> blocks;
+
+  // Encoded blocks, plus one word of padding so ReadWord() can always read
+  // two consecutive words.
+  std::vector<uint64_t> data;
+};
+
+// Builds the set of ties of the given phase file from its tie bitmap (which is
+// generated first if necessary; see PrepareTieBitmap() in tie-bitmap.h) on all
+// cores, and prints its size.
+TieSet LoadTieSet(const std::string &phase_filename, const AnyRnAccessor &acc);
+
+#endif  // ndef TIE_SET_H_INCLUDED
@@ -0,0 +1,77 @@
+#include "tie-bitmap.h"
+#include "codec.h"
+#include "macros.h"
+#include "random.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+std::vector<Outcome> RandomOutcomes(size_t size, int tie_percent) {
+  std::vector<Outcome> outcomes(size);
+  for (Outcome &o : outcomes) o = RandInt(0, 99) < tie_percent ? TIE : RandInt(0, 1) ? WIN : LOSS;
+  return outcomes;
+}
+
+// Builds a bitmap of the ties with TieMask(), like WriteTieBitmap() does.
+std::vector<uint64_t> BuildBitmap(const std::vector<Outcome> &outcomes) {
+  std::vector<uint64_t> words((outcomes.size() + 63) / 64);
+  REP(w, words.size()) words[w] = TieMask(outcomes, 64 * w, outcomes.size());
+  return words;
+}
+
+void TestBitmap() {
+  for (size_t size : {0, 1, 63, 64, 65, 1000, 100000}) {
+    for (int tie_percent : {0, 1, 50, 100}) {
+      const std::vector<Outcome> outcomes = RandomOutcomes(size, tie_percent);
+      const std::vector<uint64_t> words = BuildBitmap(outcomes);
+      REP(i, size) assert(((words[i / 64] >> (i % 64)) & 1) == (outcomes[i] == TIE));
+      if (size % 64 != 0) assert(words.back() >> (size % 64) == 0);
+
+      // Check random ranges, including empty ones and ones within a word.
+      REP(iteration, 100) {
+        int64_t begin = RandInt(0, size);
+        int64_t end = RandInt(begin, std::min<int64_t>(size, begin + (iteration % 2 ? 64 : size)));
+        std::vector<int64_t> expected;
+        for (int64_t i = begin; i < end; ++i) if (outcomes[i] == TIE) expected.push_back(i);
+        std::vector<int64_t> actual;
+        ForEachSetBit(words.data(), begin, end, [&](int64_t i) { actual.push_back(i); });
+        assert(actual == expected);
+        assert(CountSetBits(words.data(), begin, end) == int64_t(expected.size()));
+      }
+    }
+  }
+}
+
+void TestDecodeTernaryRange() {
+  const std::vector<Outcome> outcomes = RandomOutcomes(1000, 30);
+  const std::vector<uint8_t> bytes = EncodeOutcomes(outcomes);
+  REP(iteration, 1000) {
+    size_t start = RandInt(0, outcomes.size());
+    size_t count = RandInt(0, outcomes.size() - start);
+    std::vector<Outcome> decoded(count);
+    DecodeTernaryRange(bytes.data(), start, count, decoded.data());
+    assert(std::equal(decoded.begin(), decoded.end(), outcomes.begin() + start));
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestBitmap();
+  TestDecodeTernaryRange();
+}
@@ -0,0 +1,85 @@
+#include "tie-set.h"
+#include "macros.h"
+#include "random.h"
+#include "thread-pool.h"
+#include "tie-bitmap.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+// Returns a random bitmap of `size` bits where each bit is set with the given
+// probability (in tenths of a percent).
+std::vector<uint64_t> RandomBitmap(int64_t size, int per_mille) {
+  std::vector<uint64_t> words((size + 63) / 64);
+  REP(i, size) if (RandInt(0, 999) < per_mille) words[i / 64] |= uint64_t{1} << (i % 64);
+  return words;
+}
+
+bool IsSet(const std::vector<uint64_t> &words, int64_t i) {
+  return (words[i / 64] >> (i % 64)) & 1;
+}
+
+void TestTieSet(ThreadPool *pool) {
+  for (int64_t size : {0, 1, 8191, 8192, 8193, 100000, 1000000}) {
+    for (int per_mille : {0, 1, 10, 40, 300, 600, 1000}) {
+      const std::vector<uint64_t> words = RandomBitmap(size, per_mille);
+      const TieSet set(words.data(), size, pool, 3);
+      assert(set.size() == size);
+      assert(set.TieCount() == CountSetBits(words.data(), 0, size));
+      REP(i, size) assert(set.Contains(i) == IsSet(words, i));
+
+      if (size == 0) continue;
+      REP(iteration, 100) {
+        std::vector<int64_t> indices(RandInt(0, 20));
+        bool expected = false;
+        for (int64_t &i : indices) {
+          i = RandInt(0, size - 1);
+          expected |= IsSet(words, i);
+        }
+        assert(set.AnyOf(indices.data(), indices.size()) == expected);
+      }
+    }
+  }
+}
+
+void TestDenseBlocks() {
+  // Blocks that are almost full or almost empty exercise both encodings at
+  // the boundary between them.
+  const int64_t size = 50 * TieSet::block_size + 123;
+  std::vector<uint64_t> words((size + 63) / 64);
+  REP(b, 50) {
+    const int64_t begin = b * TieSet::block_size;
+    const int64_t count = b * TieSet::block_size / 49;
+    REP(j, count) {
+      const int64_t i = begin + RandInt(0, TieSet::block_size - 1);
+      words[i / 64] |= uint64_t{1} << (i % 64);
+    }
+  }
+  const TieSet set(words.data(), size, nullptr, 1);
+  assert(set.TieCount() == CountSetBits(words.data(), 0, size));
+  REP(i, size) assert(set.Contains(i) == IsSet(words, i));
+}
+
+}  // namespace
+
+int main() {
+  TestTieSet(nullptr);
+  ThreadPool pool(2);
+  TestTieSet(&pool);
+  TestDenseBlocks();
+}
@@ -0,0 +1,55 @@
+#ifndef TWO_BIT_H_INCLUDED
+#define TWO_BIT_H_INCLUDED
+
+#include <cstdint>
+#include <cstdlib>
+
+// Helper functions for the 2-bit encoding of ternary values.
+//
+// Each 64-bit word stores 32 values, with value i in bits 2*(i % 32) and
+// 2*(i % 32) + 1. Each value is between 0 and 3 (exclusive), so the high bit
+// of a value is set only if the value is 2, and the low bit only if it's 1.
+//
+// Compared to the ternary encoding (see ternary.h), this uses 2 bits per value
+// instead of 1.6, but values can be extracted with shifts and masks only, and
+// words can be compared 32 values at a time.
+
+// Returns the number of 64-bit words needed to store `values` values.
+constexpr size_t TwoBitWordCount(size_t values) {
+  return (values + 31) / 32;
+}
+
+// Decodes a value from a word at offset (i % 32).
+//
+// Result will be between 0 and 3 (exclusive), if the word is valid.
+inline int DecodeTwoBit(uint64_t word, size_t i) {
+  return (word >> (2 * (i % 32))) & 3;
+}
+
+// Encodes a value into a word at offset (i % 32).
+//
+// Value must be between 0 and 3 (exclusive).
+inline uint64_t EncodeTwoBit(uint64_t word, size_t i, int value) {
+  unsigned shift = 2 * (i % 32);
+  return (word & ~(uint64_t{3} << shift)) | (uint64_t(value) << shift);
+}
+
+// Returns a 32-bit mask with bit j set if and only if the j-th value stored in
+// `word` is equal to `value`.
+//
+// Value must be between 0 and 3 (exclusive).
+inline uint32_t TwoBitMatchMask(uint64_t word, int value) {
+  constexpr uint64_t low_bits = 0x5555555555555555;
+  // Pairs of bits that equal `value` become 00 after the XOR.
+  uint64_t x = word ^ (low_bits * uint64_t(value));
+  x = ~(x | (x >> 1)) & low_bits;
+  // Compact the even bits into the low 32 bits.
+  x = (x | (x >> 1)) & 0x3333333333333333;
+  x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0F;
+  x = (x | (x >> 4)) & 0x00FF00FF00FF00FF;
+  x = (x | (x >> 8)) & 0x0000FFFF0000FFFF;
+  x = (x | (x >> 16)) & 0x00000000FFFFFFFF;
+  return x;
+}
+
+#endif  // ndef TWO_BIT_H_INCLUDED
@@ -1,17 +1,67 @@
 // Tool to verify rN.bin files using sha256 checksums of some chunks.
 //
-// This is basically a thin wrapper around the VerifyInputChunks() function.
+// This is basically a thin wrapper around the VerifyInputChunks() and
+// VerifyAllChunks() functions.
+//
+// When all chunks are verified, the computed checksums are saved as a Merkle
+// index in metadata/chunk-rN.merkle. With --incremental, that index is used
+// to skip chunks that have not changed since. After repairing specific chunks
+// (for example, after an incident), use --changed=<chunks> to only verify
+// those chunks again.
 
 #include "accessors.h"
 #include "chunks.h"
+#include "flags.h"
 #include "parse-int.h"
 #include "input-verification.h"
 
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void PrintUsage() {
+  std::cout <<
+      "Usage: verify-input-chunks [--incremental] [--changed=<chunks>] [--write-index=false]\n"
+      "    <rN.bin> <phase> [<count>]\n\n"
+      "<chunks> is a comma-separated list of chunk numbers or ranges (e.g. 12,3715-3718).\n"
+      "--changed implies --incremental. --incremental cannot be combined with <count>."
+      << std::endl;
+}
+
+// Parses a list like "12,3715-3718" into chunk numbers. Returns false if the
+// list is invalid.
+bool ParseChunkList(const std::string &s, std::vector<int> *chunks) {
+  std::istringstream iss(s);
+  std::string part;
+  while (std::getline(iss, part, ',')) {
+    const size_t sep = part.find('-');
+    const int first = ParseInt(part.substr(0, sep).c_str());
+    const int last = sep == std::string::npos ? first : ParseInt(part.substr(sep + 1).c_str());
+    if (first < 0 || last < first || last >= num_chunks) return false;
+    for (int chunk = first; chunk <= last; ++chunk) chunks->push_back(chunk);
+  }
+  return !chunks->empty();
+}
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
-  if (argc < 3 || argc > 4) {
-    std::cout << "Usage: verify-input-chunks <rN.bin> <phase> [<count>]" << std::endl;
+  std::string arg_incremental = "false";
+  std::string arg_changed;
+  std::string arg_write_index = "true";
+  std::map<std::string, Flag> flags = {
+    // Reuse checksums from the Merkle index for chunks that have not changed.
+    {"incremental", Flag::optional(arg_incremental)},
+    // Chunks that have changed since the Merkle index was written.
+    {"changed", Flag::optional(arg_changed)},
+    // Whether to write the Merkle index after verifying all chunks.
+    {"write-index", Flag::optional(arg_write_index)},
+  };
+  if (!ParseFlags(argc, argv, flags) || argc < 3 || argc > 4) {
+    PrintUsage();
     return 1;
   }
   int phase = ParseInt(argv[2]);
@@ -24,8 +74,21 @@ int main(int argc, char *argv[]) {
     std::cout << "Invalid number of chunks to verify!" << std::endl;
     return 1;
   }
-  RnAccessor acc(argv[1]);
-  int failures = VerifyInputChunks(phase, acc, chunks_to_verify);
+  FullVerificationOptions options;
+  options.incremental = arg_incremental == "true" || !arg_changed.empty();
+  options.write_index = arg_write_index == "true";
+  if (!arg_changed.empty() && !ParseChunkList(arg_changed, &options.changed_chunks)) {
+    std::cout << "Invalid list of changed chunks: " << arg_changed << std::endl;
+    return 1;
+  }
+  if (options.incremental && chunks_to_verify != num_chunks) {
+    PrintUsage();
+    return 1;
+  }
+  AnyRnAccessor acc(argv[1]);
+  int failures = chunks_to_verify == num_chunks ?
+      VerifyAllChunks(phase, argv[1], acc, options) :
+      VerifyInputChunks(phase, acc, chunks_to_verify);
   if (failures > 0) {
     std::cerr << failures << " total failures!" << std::endl;
     return failures;
@@ -12,14 +12,18 @@
 #include "perms.h"
 #include "position-value.h"
 #include "search.h"
+#include "thread-pool.h"
 
 #include <algorithm>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 
 namespace {
 
@@ -30,58 +34,57 @@ const int thread_count = (std::thread::hardware_concurrency() * 3 + 1) / 2;
 // Create a checkpoint after this many iterations.
 const int64_t checkpoint_interval = 100000;
 
-void VerifyThread(
-    MinimizedAccessor *acc,
-    int64_t end_index,
-    std::atomic<int64_t> *next_index,
-    std::atomic<int64_t> *failures,
-    std::mutex *io_mutex) {
-  std::vector<int64_t> offsets_scratch;
-  std::vector<uint8_t> bytes_scratch;
-  int64_t index;
-  while ((index = (*next_index)++) < end_index) {
-    Perm perm = PermAtMinIndex(index);
-    uint8_t actual_byte = acc->ReadByte(index);
-    uint8_t expected_byte;
-    // Special case for when we expect a win-in-1 (about 84.9% of minimized
-    // positions): quickly confirm that there is an immediate winning turn,
-    // instead of enumerating all successors with RecalculateValue().
-    if (actual_byte == Value::WinIn(1).byte && (PartialHasWinningMove(perm) || HasWinningMove(perm))) {
-      expected_byte = Value::WinIn(1).byte;
-    } else {
-      // General case: recalculate the value of perm from its successors.
-      expected_byte = RecalculateValue(*acc, perm, offsets_scratch, bytes_scratch).byte;
-    }
-    if (expected_byte != actual_byte) [[unlikely]] {
-      std::lock_guard lock(*io_mutex);
-      std::cerr << "FAILURE at min-index +" << index << "! "
-          << "expected: " << int{expected_byte} << " (" << Value(expected_byte) << "); "
-          << "actual: " << int{actual_byte} << " (" << Value(actual_byte) << ")." << std::endl;
-      ++(*failures);
-    }
+// Minimum number of indices claimed by a thread at a time.
+const size_t min_grain_size = 16;
+
+// Worker threads, kept for all checkpoint intervals. Empty if single-threaded.
+std::optional<ThreadPool> pool;
+
+// Buffers reused by RecalculateValue().
+struct Scratch {
+  std::vector<int64_t> offsets;
+  std::vector<uint8_t> bytes;
+};
+
+// Returns whether the value at the given min-index is correct.
+bool VerifyIndex(MinimizedAccessor &acc, int64_t index, Scratch &scratch, std::mutex &io_mutex) {
+  Perm perm = PermAtMinIndex(index);
+  uint8_t actual_byte = acc.ReadByte(index);
+  uint8_t expected_byte;
+  // Special case for when we expect a win-in-1 (about 84.9% of minimized
+  // positions): quickly confirm that there is an immediate winning turn,
+  // instead of enumerating all successors with RecalculateValue().
+  if (actual_byte == Value::WinIn(1).byte && (PartialHasWinningMove(perm) || HasWinningMove(perm))) {
+    expected_byte = Value::WinIn(1).byte;
+  } else {
+    // General case: recalculate the value of perm from its successors.
+    expected_byte = RecalculateValue(acc, perm, scratch.offsets, scratch.bytes).byte;
   }
+  if (expected_byte != actual_byte) [[unlikely]] {
+    std::lock_guard lock(io_mutex);
+    std::cerr << "FAILURE at min-index +" << index << "! "
+        << "expected: " << int{expected_byte} << " (" << Value(expected_byte) << "); "
+        << "actual: " << int{actual_byte} << " (" << Value(actual_byte) << ")." << std::endl;
+    return false;
+  }
+  return true;
 }
 
-int64_t Verify(MinimizedAccessor &acc, int64_t start_index, int64_t end_index) {
-  std::atomic<int64_t> next_index = start_index;
-  std::atomic<int64_t> failures = 0;
+int64_t Verify(
+    MinimizedAccessor &acc, int64_t start_index, int64_t end_index,
+    PerWorker<Scratch> &scratch) {
+  ThreadPool *pool_ptr = pool ? &*pool : nullptr;
+  PerWorker<int64_t> failures(pool_ptr);
   std::mutex io_mutex;
-  if (thread_count == 0) {
-    VerifyThread(&acc, end_index, &next_index, &failures, &io_mutex);
-    assert(next_index == end_index + 1);
-  } else {
-    std::vector<std::thread> threads;
-    threads.reserve(thread_count);
-    REP(i, thread_count) {
-      threads.emplace_back(
-          VerifyThread, &acc, end_index, &next_index, &failures, &io_mutex);
-    }
-    REP(i, thread_count) {
-      threads[i].join();
-    }
-    assert(next_index == end_index + thread_count);
-  }
-  return failures;
+  ParallelForRange(pool_ptr, end_index - start_index, thread_count, min_grain_size,
+      [&](size_t begin, size_t end) {
+        Scratch &local_scratch = scratch.Local();
+        int64_t &local_failures = failures.Local();
+        for (int64_t index = start_index + begin; index < start_index + end; ++index) {
+          if (!VerifyIndex(acc, index, local_scratch, io_mutex)) ++local_failures;
+        }
+      });
+  return failures.Reduce(int64_t{0}, std::plus<int64_t>());
 }
 
 }  // namespace
@@ -129,11 +132,13 @@ int main(int argc, char *argv[]) {
   }
 
   MinimizedAccessor acc(minimized_path);
+  if (thread_count > 1) pool.emplace(thread_count - 1);
+  PerWorker<Scratch> scratch(pool ? &*pool : nullptr);
 
   while (checkpoint_index < end_index) {
     int64_t chunk_start_index = checkpoint_index;
     int64_t chunk_end_index = std::min(checkpoint_index + checkpoint_interval, end_index);
-    int64_t failures = Verify(acc, chunk_start_index, chunk_end_index);
+    int64_t failures = Verify(acc, chunk_start_index, chunk_end_index, scratch);
     if (failures != 0) {
       std::cerr << "Verification failures detected!" << std::endl;
       return EXIT_FAILURE;
@@ -0,0 +1,157 @@
+#include "w1-bitmap-accessor.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+static_assert(std::endian::native == std::endian::little);
+
+struct Header {
+  char magic[8];
+  uint64_t size;
+  uint64_t num_values;
+  uint8_t w1_byte;
+  uint8_t reserved[39];
+};
+static_assert(sizeof(Header) == 64);
+
+constexpr size_t RoundUp(size_t n, size_t m) { return (n + m - 1) / m * m; }
+
+constexpr int words_per_block = W1BitmapAccessor::block_bits / 64;
+constexpr int blocks_per_superblock = W1BitmapAccessor::superblock_bits / W1BitmapAccessor::block_bits;
+
+// File offsets of the sections of the file.
+struct Layout {
+  explicit Layout(size_t size, size_t num_values) :
+      num_superblocks((size + W1BitmapAccessor::superblock_bits - 1) / W1BitmapAccessor::superblock_bits),
+      num_blocks((size + W1BitmapAccessor::block_bits - 1) / W1BitmapAccessor::block_bits),
+      superblock_ranks(sizeof(Header)),
+      block_ranks(superblock_ranks + num_superblocks * sizeof(uint64_t)),
+      bitmap(RoundUp(block_ranks + num_blocks * sizeof(uint16_t), 64)),
+      // The bitmap is padded to whole blocks, so Rank() never reads past it.
+      values(bitmap + num_blocks * words_per_block * sizeof(uint64_t)),
+      file_size(values + num_values) {}
+
+  size_t num_superblocks;
+  size_t num_blocks;
+  size_t superblock_ranks;
+  size_t block_ranks;
+  size_t bitmap;
+  size_t values;
+  size_t file_size;
+};
+
+}  // namespace
+
+bool W1BitmapAccessor::IsW1BitmapFile(const char *filepath) {
+  std::ifstream ifs(filepath, std::ifstream::binary);
+  if (!ifs) return false;
+
+  char buffer[sizeof(magic)] = {};
+  if (!ifs.read(buffer, sizeof(buffer))) return false;
+  return memcmp(buffer, magic, sizeof(magic)) == 0;
+}
+
+W1BitmapAccessor::W1BitmapAccessor(const char *filepath) : mapped_file(filepath) {
+  Header header;
+  if (mapped_file.size() < sizeof(header)) {
+    std::cerr << "W1 bitmap file too short!" << std::endl;
+    exit(1);
+  }
+  memcpy(&header, mapped_file.data(), sizeof(header));
+  const Layout layout(header.size, header.num_values);
+  if (memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.num_values > header.size ||
+      layout.file_size != mapped_file.size()) {
+    std::cerr << "Invalid W1 bitmap file header!" << std::endl;
+    exit(1);
+  }
+  size = header.size;
+  num_values = header.num_values;
+  w1_byte = header.w1_byte;
+  const uint8_t *data = mapped_file.data();
+  superblock_ranks = reinterpret_cast<const uint64_t*>(data + layout.superblock_ranks);
+  block_ranks = reinterpret_cast<const uint16_t*>(data + layout.block_ranks);
+  bitmap = reinterpret_cast<const uint64_t*>(data + layout.bitmap);
+  values = data + layout.values;
+}
+
+bool WriteW1BitmapFile(
+    const uint8_t *data, size_t size, uint8_t w1_byte,
+    const char *filename, ThreadPool *pool) {
+  constexpr size_t superblock_bits = W1BitmapAccessor::superblock_bits;
+  const size_t num_superblocks = (size + superblock_bits - 1) / superblock_bits;
+  const int max_threads = pool == nullptr ? 1 : pool->NumThreads() + 1;
+
+  // First pass: count the values per superblock, so we know where each
+  // superblock's values start.
+  std::vector<int64_t> value_offsets(num_superblocks + 1, 0);
+  ParallelFor(pool, num_superblocks, max_threads, [&](size_t superblock) {
+    const size_t begin = superblock * superblock_bits;
+    const size_t end = std::min(begin + superblock_bits, size);
+    value_offsets[superblock + 1] = (end - begin) - std::count(data + begin, data + end, w1_byte);
+  });
+  for (size_t i = 0; i < num_superblocks; ++i) value_offsets[i + 1] += value_offsets[i];
+  const int64_t num_values = value_offsets[num_superblocks];
+
+  const Layout layout(size, num_values);
+  {
+    std::ofstream ofs(filename, std::ofstream::binary);
+    if (!ofs) {
+      std::cerr << "Could not open " << filename << " for writing!" << std::endl;
+      return false;
+    }
+  }
+  std::filesystem::resize_file(filename, layout.file_size);
+  MutableDynMappedFile<uint8_t> output(filename);
+
+  Header header = {};
+  memcpy(header.magic, W1BitmapAccessor::magic, sizeof(header.magic));
+  header.size = size;
+  header.num_values = num_values;
+  header.w1_byte = w1_byte;
+  memcpy(output.data(), &header, sizeof(header));
+
+  uint64_t *superblock_ranks = reinterpret_cast<uint64_t*>(output.data() + layout.superblock_ranks);
+  uint16_t *block_ranks = reinterpret_cast<uint16_t*>(output.data() + layout.block_ranks);
+  uint64_t *bitmap = reinterpret_cast<uint64_t*>(output.data() + layout.bitmap);
+  uint8_t *values = output.data() + layout.values;
+
+  // Second pass: fill in the directory, bitmap and values. Superblocks are
+  // independent, so they can be written in parallel.
+  ParallelFor(pool, num_superblocks, max_threads, [&](size_t superblock) {
+    const size_t superblock_begin = superblock * superblock_bits;
+    superblock_ranks[superblock] = superblock_begin - value_offsets[superblock];
+    uint8_t *value = values + value_offsets[superblock];
+    int rank = 0;  // relative to the superblock
+    for (int i = 0; i < blocks_per_superblock; ++i) {
+      const size_t block = superblock * blocks_per_superblock + i;
+      if (block >= layout.num_blocks) break;
+      block_ranks[block] = rank;
+      for (int j = 0; j < words_per_block; ++j) {
+        const size_t begin = (block * words_per_block + j) * 64;
+        const size_t end = std::min(begin + 64, std::max(begin, size));
+        uint64_t word = 0;
+        for (size_t k = begin; k < end; ++k) {
+          if (data[k] == w1_byte) {
+            word |= uint64_t{1} << (k - begin);
+          } else {
+            *value++ = data[k];
+          }
+        }
+        bitmap[block * words_per_block + j] = word;
+        rank += std::popcount(word);
+      }
+    }
+    assert(value == values + value_offsets[superblock + 1]);
+  });
+  return true;
+}
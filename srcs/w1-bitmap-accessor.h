@@ -0,0 +1,112 @@
+#ifndef W1_BITMAP_ACCESSOR_H_INCLUDED
+#define W1_BITMAP_ACCESSOR_H_INCLUDED
+
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "accessors.h"
+#include "thread-pool.h"
+
+// Uncompressed two-level format for minimized.bin (conventionally named
+// "minimized.bin.w1").
+//
+// About 85% of the bytes in minimized.bin are WinIn(1). This format stores a
+// bitmap with one bit per byte, which is set if the byte equals WinIn(1),
+// followed by the remaining bytes in order. The position of a byte that is not
+// WinIn(1) is found by counting the number of set bits before it, using a
+// rank directory. The result is about 24 GB for the full minimized.bin, which
+// fits in RAM, while lookups don't need any decompression: they touch at most
+// 4 cache lines (the bitmap word, the superblock and block counts of the rank
+// directory, and the value).
+//
+// File layout (all integers little-endian):
+//
+//   header (64 bytes):
+//     char[8]  magic "PFW1BM1\n"
+//     uint64   number of bytes (N)
+//     uint64   number of bytes not equal to the W1 byte (M)
+//     uint8    the W1 byte
+//     padding
+//   uint64[ceil(N / 2^16)]  number of set bits before each superblock of 2^16 bits
+//   uint16[ceil(N / 512)]   number of set bits before each block of 512 bits,
+//                           relative to the start of its superblock
+//   padding to a multiple of 64 bytes
+//   uint64[ceil(N / 64)]    the bitmap (bit i is stored in word i/64, bit i%64)
+//   uint8[M]                bytes not equal to the W1 byte
+class W1BitmapAccessor {
+public:
+  static constexpr char magic[8] = {'P', 'F', 'W', '1', 'B', 'M', '1', '\n'};
+
+  static constexpr int superblock_bits = 1 << 16;
+  static constexpr int block_bits = 512;
+
+  // Returns whether the file starts with the magic bytes of this format.
+  static bool IsW1BitmapFile(const char *filepath);
+
+  explicit W1BitmapAccessor(const char *filepath);
+
+  int64_t GetUncompressedFileSize() const { return size; }
+
+  // Exits if the offset is out of bounds, or the rank directory points
+  // past the stored values (which means the file is corrupt).
+  uint8_t ReadByte(int64_t offset) const {
+    if (offset < 0 || offset >= size) [[unlikely]] {
+      std::cerr << "Offset out of bounds: " << offset << std::endl;
+      exit(1);
+    }
+    const uint64_t word = bitmap[offset / 64];
+    const uint64_t bit = uint64_t{1} << (offset % 64);
+    if (word & bit) return w1_byte;
+    const int64_t index = offset - Rank(offset);
+    if (index < 0 || index >= num_values) [[unlikely]] {
+      std::cerr << "Value index out of bounds: " << index << " at offset " << offset << std::endl;
+      exit(1);
+    }
+    return values[index];
+  }
+
+  // Reads the bytes at the given offsets, in any order.
+  void ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const {
+    for (size_t i = 0; i < count; ++i) bytes[i] = ReadByte(offsets[i]);
+  }
+
+  std::vector<uint8_t> ReadBytes(const std::vector<int64_t> &offsets) const {
+    std::vector<uint8_t> bytes(offsets.size());
+    ReadBytes(offsets.data(), bytes.data(), offsets.size());
+    return bytes;
+  }
+
+private:
+  // Returns the number of set bits before bit `offset`.
+  int64_t Rank(int64_t offset) const {
+    const int64_t block = offset / block_bits;
+    int64_t rank = superblock_ranks[offset / superblock_bits] + block_ranks[block];
+    const uint64_t *words = &bitmap[block * (block_bits / 64)];
+    const int n = offset % block_bits / 64;
+    for (int i = 0; i < n; ++i) rank += std::popcount(words[i]);
+    const uint64_t mask = (uint64_t{1} << (offset % 64)) - 1;
+    return rank + std::popcount(words[n] & mask);
+  }
+
+  DynMappedFile<uint8_t> mapped_file;
+  int64_t size = 0;
+  int64_t num_values = 0;
+  uint8_t w1_byte = 0;
+  const uint64_t *superblock_ranks = nullptr;
+  const uint16_t *block_ranks = nullptr;
+  const uint64_t *bitmap = nullptr;
+  const uint8_t *values = nullptr;
+};
+
+// Converts `size` bytes of `data` to a new file in the format described above,
+// using `pool` (if not null) to process parts of the input in parallel. Bytes
+// equal to `w1_byte` are stored in the bitmap. Returns false (after printing an
+// error message) if an error occurs.
+bool WriteW1BitmapFile(
+    const uint8_t *data, size_t size, uint8_t w1_byte,
+    const char *filename, ThreadPool *pool);
+
+#endif  // ndef W1_BITMAP_ACCESSOR_H_INCLUDED
@@ -0,0 +1,53 @@
+#include "w1-bitmap-accessor.h"
+#include "macros.h"
+#include "random.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+void TestRoundTrip() {
+  const std::string filename = std::filesystem::temp_directory_path() /
+      ("w1_bitmap_test." + std::to_string(getpid()) + ".w1");
+  ThreadPool pool(2);
+  // Sizes around block and superblock boundaries.
+  for (size_t size : {0, 1, 63, 64, 65, 511, 512, 513, 65535, 65536, 65537, 300000}) {
+    for (int w1_percent : {0, 85, 100}) {
+      std::vector<uint8_t> data(size);
+      REP(i, size) data[i] = RandInt(0, 99) < w1_percent ? 2 : RandInt(0, 99);
+
+      std::filesystem::remove(filename);
+      assert(WriteW1BitmapFile(data.data(), data.size(), 2, filename.c_str(), &pool));
+      assert(W1BitmapAccessor::IsW1BitmapFile(filename.c_str()));
+
+      W1BitmapAccessor acc(filename.c_str());
+      assert(acc.GetUncompressedFileSize() == int64_t(size));
+      REP(i, size) assert(acc.ReadByte(i) == data[i]);
+    }
+  }
+  std::filesystem::remove(filename);
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+}
@@ -1,13 +1,20 @@
 #include "xz-accessor.h"
 
 #include "accessors.h"
+#include "thread-pool.h"
 
 #include <lzma.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace {
 
@@ -123,6 +130,87 @@ ssize_t DecompressBlockPrefix(
 
 }  // namespace
 
+// Thread-safe LRU cache of decompressed block prefixes, keyed by block number.
+//
+// Cached data is immutable and reference counted, so a block that is evicted
+// while another thread is reading from it stays valid until that thread is
+// done with it.
+class XzAccessor::BlockCache {
+public:
+  using data_t = std::shared_ptr<const std::vector<uint8_t>>;
+
+  explicit BlockCache(size_t budget) : budget(budget) {}
+
+  // Returns the cached prefix of the given block, if it has at least
+  // `min_size` bytes. Otherwise, returns null, and sets *cached_size to the
+  // size of the cached prefix (or 0 if the block is not cached at all).
+  data_t Lookup(int64_t block, size_t min_size, size_t *cached_size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(block);
+    if (it == entries.end()) {
+      ++stats.misses;
+      *cached_size = 0;
+      return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    const data_t &data = it->second->data;
+    if (data->size() < min_size) {
+      ++stats.extensions;
+      *cached_size = data->size();
+      return nullptr;
+    }
+    ++stats.hits;
+    return data;
+  }
+
+  // Adds a block prefix to the cache, replacing a shorter prefix of the same
+  // block, if any, and evicts the least recently used blocks if the cache
+  // exceeds its budget.
+  void Insert(int64_t block, data_t data) {
+    if (data->size() > budget) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto it = entries.find(block); it != entries.end()) {
+      // Another thread may have cached a longer prefix in the meantime.
+      data_t &existing = it->second->data;
+      if (existing->size() < data->size()) {
+        stats.bytes += data->size() - existing->size();
+        existing = std::move(data);
+      }
+      lru.splice(lru.begin(), lru, it->second);
+    } else {
+      stats.bytes += data->size();
+      ++stats.blocks;
+      lru.push_front(Entry{block, std::move(data)});
+      entries[block] = lru.begin();
+    }
+    while (stats.bytes > budget) {
+      const Entry &entry = lru.back();
+      stats.bytes -= entry.data->size();
+      --stats.blocks;
+      ++stats.evictions;
+      entries.erase(entry.block);
+      lru.pop_back();
+    }
+  }
+
+  CacheStats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+private:
+  struct Entry {
+    int64_t block;
+    data_t data;
+  };
+
+  const size_t budget;
+  mutable std::mutex mutex;
+  std::list<Entry> lru;  // most recently used first
+  std::unordered_map<int64_t, std::list<Entry>::iterator> entries;
+  CacheStats stats;
+};
+
 bool XzAccessor::IsXzFile(const char *filepath) {
   std::ifstream ifs(filepath, std::ifstream::binary);
   if (!ifs) return false;
@@ -138,14 +226,75 @@ void XzAccessor::IndexDeleter::operator()(lzma_index *index) {
   lzma_index_end(index, allocator);
 }
 
-XzAccessor::XzAccessor(const char *filepath) :
+XzAccessor::XzAccessor(const char *filepath, size_t cache_size) :
     mapped_file(filepath),
     index(
         CheckLzmaHeadersAndCreateIndex(
             mapped_file.data(), mapped_file.size(),
             header_flags, footer_flags)),
     block_data_start(LZMA_STREAM_HEADER_SIZE),
-    block_data_end(mapped_file.size() - LZMA_STREAM_HEADER_SIZE - footer_flags.backward_size) {
+    block_data_end(mapped_file.size() - LZMA_STREAM_HEADER_SIZE - footer_flags.backward_size),
+    cache(cache_size > 0 ? std::make_unique<BlockCache>(cache_size) : nullptr) {
+  InitUniformBlocks();
+}
+
+void XzAccessor::InitUniformBlocks() {
+  uncompressed_file_size = GetUncompressedFileSize();
+
+  lzma_index_iter iter;
+  lzma_index_iter_init(&iter, index.get());
+  std::vector<CompressedBlock> blocks;
+  blocks.reserve(lzma_index_block_count(index.get()));
+  int64_t block_size = 0;
+  bool last_block_seen = false;
+  while (lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK) == false) {
+    const int64_t size = iter.block.uncompressed_size;
+    if (blocks.empty()) block_size = size;
+    // Only the last block may be smaller than the others.
+    if (last_block_seen || size > block_size || size == 0) return;
+    if (size < block_size) last_block_seen = true;
+    blocks.push_back(CompressedBlock{
+        static_cast<int64_t>(iter.block.compressed_file_offset),
+        static_cast<int64_t>(iter.block.total_size)});
+  }
+  if (blocks.empty()) return;
+  assert(int64_t(blocks.size() - 1) * block_size < uncompressed_file_size);
+  assert(int64_t(blocks.size()) * block_size >= uncompressed_file_size);
+  uniform_block_size = block_size;
+  uniform_blocks = std::move(blocks);
+}
+
+bool XzAccessor::LocateBlock(int64_t offset, BlockLocation *location) const {
+  if (uniform_block_size > 0) {
+    if (offset < 0 || offset >= uncompressed_file_size) return false;
+    const int64_t number = offset / uniform_block_size;
+    location->number = number;
+    location->uoffset = number * uniform_block_size;
+    location->usize = std::min(uniform_block_size, uncompressed_file_size - location->uoffset);
+    location->coffset = uniform_blocks[number].offset;
+    location->csize = uniform_blocks[number].size;
+    return true;
+  }
+
+  // Blocks have variable sizes, so we need to use lzma_index_iter_locate()
+  // to find the right block.
+  lzma_index_iter iter;
+  lzma_index_iter_init(&iter, index.get());
+  if (lzma_index_iter_locate(&iter, offset) == true) return false;
+  location->number = iter.block.number_in_file - 1;
+  location->uoffset = iter.block.uncompressed_file_offset;
+  location->usize = iter.block.uncompressed_size;
+  location->coffset = iter.block.compressed_file_offset;
+  location->csize = iter.block.total_size;
+  return true;
+}
+
+XzAccessor::XzAccessor(XzAccessor&&) = default;
+
+XzAccessor::~XzAccessor() = default;
+
+XzAccessor::CacheStats XzAccessor::GetCacheStats() const {
+  return cache ? cache->GetStats() : CacheStats{};
 }
 
 int64_t XzAccessor::GetUncompressedFileSize() const {
@@ -161,50 +310,87 @@ void XzAccessor::ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count)
   assert(count == 0 || offsets[0] >= 0);
   assert(std::is_sorted(&offsets[0], &offsets[count]));
 
-  // Process offsets in order, but lookup bytes in the same block at once.
-  std::vector<uint8_t> buffer;
+  // Group offsets by block, so that bytes in the same block are looked up at
+  // once. Offsets are sorted, so each group is a contiguous range.
+  struct Group {
+    BlockLocation block;
+    size_t begin, end;  // range of offsets
+  };
+  std::vector<Group> groups;
   size_t i = 0;
   while (i < count) {
-    lzma_index_iter iter;
-    lzma_index_iter_init(&iter, index.get());
-
-    // Currently we assume the .xz file can contain blocks of variable length,
-    // so we need to use lzma_index_iter_locate to find the right block. If we
-    // assume blocks are all of the same size (except possibly the last), then
-    // we could more efficiently index the blocks (i.e., just calculate
-    // block offset / block_size).
-    if (lzma_index_iter_locate(&iter, offsets[i]) == true) {
+    BlockLocation block;
+    if (!LocateBlock(offsets[i], &block)) {
       std::cerr << "Offset out of bounds: " << offsets[i] << std::endl;
       exit(1);
     }
-
-    const int64_t offset = iter.block.uncompressed_file_offset;
-    const int64_t block_size = iter.block.uncompressed_size;
-
     // See how many bytes we can read from this block.
-    assert(offsets[i] >= offset);
-    assert(offsets[i] - offset <= block_size);
+    assert(offsets[i] >= block.uoffset);
+    assert(offsets[i] - block.uoffset <= block.usize);
     size_t j = i + 1;
-    while (j < count && offsets[j] - offset < block_size) ++j;
+    while (j < count && offsets[j] - block.uoffset < block.usize) ++j;
+    groups.push_back(Group{block, i, j});
+    i = j;
+  }
 
-    // The size of the prefix of the block we need to decode.
-    size_t output_size = offsets[j - 1] - offset + 1;
-    assert(output_size <= block_memory_limit);
-    buffer.resize(output_size);
+  // Each group writes only to its own range of `bytes`, so the result doesn't
+  // depend on the order in which groups are processed.
+  auto read_group = [&](size_t k) {
+    const Group &group = groups[k];
+    ReadBlockBytes(group.block, offsets + group.begin, bytes + group.begin, group.end - group.begin);
+  };
+  if (groups.size() >= parallel_min_blocks) {
+    ParallelFor(parallel_pool, groups.size(), parallel_max_threads, read_group);
+  } else {
+    for (size_t k = 0; k < groups.size(); ++k) read_group(k);
+  }
+}
+
+void XzAccessor::ReadBlockBytes(
+    const BlockLocation &block, const int64_t *offsets, uint8_t *bytes, size_t count) const {
+  assert(count > 0);
+  const int64_t offset = block.uoffset;
+  const int64_t block_size = block.usize;
+
+  // The size of the prefix of the block we need to decode.
+  size_t output_size = offsets[count - 1] - offset + 1;
+  assert(output_size <= block_memory_limit);
+
+  BlockCache::data_t cached;
+  size_t cached_size = 0;
+  if (cache) cached = cache->Lookup(block.number, output_size, &cached_size);
+  if (cached == nullptr) {
+    // If only a shorter prefix was cached, decode at least twice as much as
+    // before, so that a block that is read from front to back by many small
+    // requests isn't decompressed over and over again.
+    size_t decode_size = output_size;
+    if (cached_size > 0) {
+      decode_size = std::max(output_size, std::min<size_t>(2 * cached_size, block_size));
+    }
 
-    const int64_t coffset = iter.block.compressed_file_offset;
-    const int64_t csize   = iter.block.total_size;
+    const int64_t coffset = block.coffset;
+    const int64_t csize   = block.csize;
     assert(block_data_start <= coffset && coffset <= block_data_end);
     assert(csize <= block_data_end - coffset);
+    auto buffer = std::make_shared<std::vector<uint8_t>>(decode_size);
     ssize_t bytes_read = DecompressBlockPrefix(
         mapped_file.data(), header_flags.check,
         coffset, csize,
-        buffer.data(), buffer.size());
-    assert(bytes_read == buffer.size());
-    // Extract the requested bytes.
-    while (i < j) {
-      bytes[i] = buffer.at(offsets[i] - offset);
-      ++i;
-    }
+        buffer->data(), buffer->size());
+    assert(bytes_read == buffer->size());
+    cached = std::move(buffer);
+    if (cache) cache->Insert(block.number, cached);
+  }
+  const std::vector<uint8_t> &buffer = *cached;
+
+  // Extract the requested bytes.
+  for (size_t i = 0; i < count; ++i) {
+    bytes[i] = buffer.at(offsets[i] - offset);
   }
 }
+
+void XzAccessor::EnableParallelDecompression(ThreadPool *pool, size_t min_blocks, int max_threads) {
+  parallel_pool = pool;
+  parallel_min_blocks = min_blocks;
+  parallel_max_threads = max_threads;
+}
@@ -2,11 +2,13 @@
 #define XZ_ACCESSOR_H_INCLUDED
 
 #include "accessors.h"
+#include "thread-pool.h"
 
 #include <lzma.h>
 
 #include <cassert>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 // Accessor that looks up bytes in a compressed .xz file.
@@ -14,9 +16,37 @@
 // For greatest efficiency, make sure to batch lookups if there is a chance
 // there are multiple references within the same block.
 //
-// Currently this accessor does not do ANY caching!
+// If all blocks have the same uncompressed size (except possibly the last),
+// as is the case for files created with `xz --block-size=N`, blocks are
+// located with a division and an array lookup. Otherwise, the xz index is
+// searched for each block.
+//
+// Optionally, decompressed blocks are kept in a least-recently-used cache, so
+// that repeated lookups in the same blocks (e.g. when stepping through the
+// moves of a game) don't require decompressing them again. Since only the
+// prefix of a block up to the last requested byte is decompressed, the cache
+// may hold partial blocks; these are extended (by decompressing a longer
+// prefix) when a later lookup needs more.
 class XzAccessor {
 public:
+  struct CacheStats {
+    // Block lookups that were answered from the cache.
+    int64_t hits = 0;
+
+    // Block lookups for which a shorter prefix of the block was cached, so the
+    // block had to be decompressed again.
+    int64_t extensions = 0;
+
+    // Block lookups for blocks that were not cached at all.
+    int64_t misses = 0;
+
+    // Number of blocks evicted to stay within the memory budget.
+    int64_t evictions = 0;
+
+    // Current number of cached blocks, and their total size in bytes.
+    int64_t blocks = 0;
+    int64_t bytes = 0;
+  };
 
   // Checks if the given file refers to an XZ compressed file, by examining
   // the magic bytes at the start of the file. Returns false if the file could
@@ -25,14 +55,25 @@ public:
   // or incomplete.
   static bool IsXzFile(const char *filepath);
 
-  XzAccessor(const char *filepath);
+  // Opens the given file. `cache_size` is the maximum total size (in bytes)
+  // of decompressed blocks to keep in memory. 0 disables caching.
+  explicit XzAccessor(const char *filepath, size_t cache_size = 0);
+
+  XzAccessor(XzAccessor&&);
+  ~XzAccessor();
 
   int64_t GetUncompressedFileSize() const;
 
+  // Returns whether blocks are located without searching the index (see
+  // above), i.e. all blocks except possibly the last have the same size.
+  bool HasUniformBlocks() const { return uniform_block_size > 0; }
+
   // Reads `count` different bytes at the given uncompressed file offsets.
   //
   // Offsets must be between 0 and the compressed file size (exclusive),
   // and must in nondecreasing order (duplicates are allowed).
+  //
+  // This method is thread-safe.
   void ReadBytes(const int64_t *offsets, uint8_t *bytes, size_t count) const;
 
   // Convenience method for ReadBytes() above.
@@ -50,17 +91,70 @@ public:
     return byte;
   }
 
+  // Makes ReadBytes() decompress blocks in parallel, using threads from
+  // `pool`, when a single call touches at least `min_blocks` different blocks.
+  // At most `max_threads` threads (including the calling thread) work on a
+  // single call. The pool must outlive this accessor (or parallel
+  // decompression must be disabled again by passing a null pool).
+  void EnableParallelDecompression(ThreadPool *pool, size_t min_blocks, int max_threads);
+
+  // Returns the cache statistics. All counts are zero if caching is disabled.
+  CacheStats GetCacheStats() const;
+
 private:
   struct IndexDeleter {
     void operator()(lzma_index *index);
   };
 
+  class BlockCache;
+
+  // Location of a block in the compressed and uncompressed file.
+  struct BlockLocation {
+    int64_t number;  // 0-based index of the block in the file
+    int64_t uoffset;  // uncompressed offset
+    int64_t usize;  // uncompressed size
+    int64_t coffset;  // compressed offset (of the block header)
+    int64_t csize;  // compressed size (including the block header)
+  };
+
+  // Compressed offset and size of a block, for files with uniform blocks.
+  struct CompressedBlock {
+    int64_t offset;
+    int64_t size;
+  };
+
+  // Reads `count` bytes from a single block. Offsets are absolute, and must be
+  // in nondecreasing order.
+  void ReadBlockBytes(
+      const BlockLocation &block, const int64_t *offsets, uint8_t *bytes, size_t count) const;
+
+  // Finds the block that contains the given uncompressed offset. Returns false
+  // if the offset is out of bounds.
+  bool LocateBlock(int64_t offset, BlockLocation *location) const;
+
+  // If all blocks (except possibly the last one) have the same uncompressed
+  // size, initializes uniform_block_size and uniform_blocks, so that
+  // LocateBlock() can find blocks without searching the index.
+  void InitUniformBlocks();
+
   DynMappedFile<uint8_t> mapped_file;
   lzma_stream_flags header_flags = {};
   lzma_stream_flags footer_flags = {};
   std::unique_ptr<lzma_index, IndexDeleter> index;
   int64_t block_data_start = 0;
   int64_t block_data_end = 0;
+  std::unique_ptr<BlockCache> cache;
+
+  // Uncompressed size of all blocks except the last, or 0 if the blocks have
+  // different sizes.
+  int64_t uniform_block_size = 0;
+  int64_t uncompressed_file_size = 0;
+  std::vector<CompressedBlock> uniform_blocks;
+
+  // Parallel decompression settings (see EnableParallelDecompression()).
+  ThreadPool *parallel_pool = nullptr;
+  size_t parallel_min_blocks = SIZE_MAX;
+  int parallel_max_threads = 1;
 };
 
 #endif  // ndef XZ_ACCESSOR_H_INCLUDED
@@ -0,0 +1,230 @@
+#include "xz-accessor.h"
+
+#ifdef NDEBUG
+#error "Can't compile test with -DNDEBUG!"
+#endif
+#include <assert.h>
+
+#include <lzma.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "random.h"
+
+namespace {
+
+std::mt19937 rng = InitializeRng();
+
+int64_t RandInt(int64_t min, int64_t max) {
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return dist(rng);
+}
+
+const std::filesystem::path tmp = std::filesystem::temp_directory_path() /
+    ("xz_accessor_test." + std::to_string(getpid()));
+
+// Returns `size` random bytes from a small alphabet, so they compress a bit.
+std::vector<uint8_t> RandomData(int64_t size) {
+  std::vector<uint8_t> data(size);
+  for (uint8_t &byte : data) byte = RandInt(0, 15);
+  return data;
+}
+
+// Writes `data` to an .xz file with one block per element of `block_sizes`,
+// which must add up to the size of the data. Returns the filename.
+std::string WriteXzFile(
+    const std::string &name, const std::vector<uint8_t> &data,
+    const std::vector<int64_t> &block_sizes) {
+  lzma_stream stream = LZMA_STREAM_INIT;
+  lzma_ret ret = lzma_easy_encoder(&stream, 1, LZMA_CHECK_CRC32);
+  assert(ret == LZMA_OK);
+  std::vector<uint8_t> output;
+  uint8_t buffer[4096];
+  // Encodes the next `size` bytes, then finishes the block (or the stream).
+  auto encode = [&](const uint8_t *input, int64_t size, lzma_action action) {
+    stream.next_in = input;
+    stream.avail_in = size;
+    do {
+      stream.next_out = buffer;
+      stream.avail_out = sizeof(buffer);
+      ret = lzma_code(&stream, action);
+      assert(ret == LZMA_OK || ret == LZMA_STREAM_END);
+      output.insert(output.end(), buffer, stream.next_out);
+    } while (ret != LZMA_STREAM_END);
+  };
+  int64_t offset = 0;
+  for (int64_t size : block_sizes) {
+    encode(data.data() + offset, size, LZMA_FULL_FLUSH);
+    offset += size;
+  }
+  assert(offset == static_cast<int64_t>(data.size()));
+  encode(nullptr, 0, LZMA_FINISH);
+  lzma_end(&stream);
+
+  const std::string filename = (tmp / name).string();
+  std::ofstream ofs(filename, std::ofstream::binary);
+  ofs.write(reinterpret_cast<const char*>(output.data()), output.size());
+  assert(ofs);
+  return filename;
+}
+
+// Reads random sorted batches of offsets, and checks them against `data`.
+void CheckRandomReads(const XzAccessor &acc, const std::vector<uint8_t> &data, int rounds) {
+  const int64_t size = data.size();
+  REP(round, rounds) {
+    std::vector<int64_t> offsets(RandInt(1, 50));
+    // Batches are either clustered (few blocks) or spread out (many blocks).
+    const int64_t start = RandInt(0, size - 1);
+    const int64_t range = RandInt(0, 1) ? 3000 : size;
+    for (int64_t &offset : offsets) offset = (start + RandInt(0, range)) % size;
+    std::sort(offsets.begin(), offsets.end());
+    const std::vector<uint8_t> bytes = acc.ReadBytes(offsets);
+    REP(i, offsets.size()) assert(bytes[i] == data[offsets[i]]);
+  }
+}
+
+// The block cache returns the same bytes as uncached reads, and keeps
+// the least recently used blocks within its budget.
+void TestBlockCache() {
+  const int64_t block_size = 1000;
+  const int num_blocks = 20;
+  const std::vector<uint8_t> data = RandomData(block_size * num_blocks);
+  const std::string filename =
+      WriteXzFile("cache.xz", data, std::vector<int64_t>(num_blocks, block_size));
+
+  // The cache holds 5 full blocks.
+  const size_t cache_size = 5 * block_size;
+  XzAccessor acc(filename.c_str(), cache_size);
+  XzAccessor uncached(filename.c_str());
+  assert(acc.GetUncompressedFileSize() == static_cast<int64_t>(data.size()));
+
+  // The first lookup of a block is a miss, and only the prefix up to the
+  // requested byte is cached.
+  assert(acc.ReadByte(10) == data[10]);
+  XzAccessor::CacheStats stats = acc.GetCacheStats();
+  assert(stats.misses == 1 && stats.hits == 0 && stats.extensions == 0);
+  assert(stats.blocks == 1 && stats.bytes == 11);
+
+  // Bytes within the cached prefix are hits.
+  assert(acc.ReadByte(5) == data[5]);
+  stats = acc.GetCacheStats();
+  assert(stats.misses == 1 && stats.hits == 1);
+
+  // Bytes after the cached prefix extend it.
+  assert(acc.ReadByte(500) == data[500]);
+  stats = acc.GetCacheStats();
+  assert(stats.extensions == 1);
+  assert(stats.blocks == 1 && stats.bytes == 501);
+
+  // Reading all blocks evicts all but the last 5. Block 0 is extended in
+  // place, so it counts as an eviction only once.
+  std::vector<int64_t> offsets(data.size());
+  REP(i, offsets.size()) offsets[i] = i;
+  assert(acc.ReadBytes(offsets) == data);
+  assert(uncached.ReadBytes(offsets) == data);
+  stats = acc.GetCacheStats();
+  assert(stats.extensions == 2);
+  assert(stats.misses == num_blocks);
+  assert(stats.evictions == num_blocks - 5);
+  assert(stats.blocks == 5);
+  assert(stats.bytes == static_cast<int64_t>(cache_size));
+
+  // Recently used blocks are still cached, but evicted ones are not.
+  const int64_t hits = stats.hits;
+  assert(acc.ReadByte(data.size() - 1) == data.back());
+  assert(acc.GetCacheStats().hits == hits + 1);
+  assert(acc.ReadByte(0) == data[0]);
+  stats = acc.GetCacheStats();
+  assert(stats.misses == num_blocks + 1);
+  assert(stats.evictions == num_blocks - 4);
+
+  // Random reads across many more blocks than the cache holds.
+  CheckRandomReads(acc, data, 1000);
+  CheckRandomReads(uncached, data, 100);
+  stats = acc.GetCacheStats();
+  assert(stats.hits > hits + 1);
+  assert(stats.bytes <= static_cast<int64_t>(cache_size));
+  assert(uncached.GetCacheStats().misses == 0);
+
+  // Blocks larger than the budget are not cached.
+  XzAccessor small(filename.c_str(), block_size / 2);
+  assert(small.ReadByte(block_size - 1) == data[block_size - 1]);
+  assert(small.GetCacheStats().blocks == 0);
+  assert(small.ReadByte(10) == data[10]);
+  assert(small.ReadByte(10) == data[10]);
+  stats = small.GetCacheStats();
+  assert(stats.blocks == 1 && stats.hits == 1);
+}
+
+// Blocks are located correctly both with and without uniform block sizes.
+// Files with uniform blocks use the division in LocateBlock(), the others
+// fall back to searching the index, and all must return the same bytes.
+void TestBlockLocation() {
+  const int64_t size = 10000;
+  const std::vector<uint8_t> data = RandomData(size);
+  const std::string reference_filename = WriteXzFile("reference.xz", data, {size});
+  const XzAccessor reference(reference_filename.c_str());
+  assert(reference.HasUniformBlocks());
+
+  struct Layout {
+    std::vector<int64_t> block_sizes;
+    bool uniform;
+  };
+  const std::vector<Layout> layouts = {
+    // All blocks have the same size.
+    {std::vector<int64_t>(10, 1000), true},
+    // The last block is smaller.
+    {{1024, 1024, 1024, 1024, 1024, 1024, 1024, 1024, 1024, 784}, true},
+    {{9999, 1}, true},
+    // The last block is larger.
+    {{1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000, 2000}, false},
+    // A block in the middle is smaller or larger.
+    {{1000, 1000, 500, 1500, 1000, 1000, 1000, 1000, 1000, 1000}, false},
+    {{2000, 2000, 1000, 2000, 2000, 1000}, false},
+    // The first block is smaller.
+    {{500, 1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000, 1000, 500}, false},
+  };
+  std::vector<int64_t> all_offsets(size);
+  REP(i, size) all_offsets[i] = i;
+  REP(i, layouts.size()) {
+    const Layout &layout = layouts[i];
+    const std::string filename =
+        WriteXzFile("layout-" + std::to_string(i) + ".xz", data, layout.block_sizes);
+    const XzAccessor acc(filename.c_str());
+    assert(acc.GetUncompressedFileSize() == size);
+    assert(acc.HasUniformBlocks() == layout.uniform);
+
+    // The first and last byte of each block, and the bytes next to them.
+    int64_t start = 0;
+    for (int64_t block_size : layout.block_sizes) {
+      for (int64_t offset : {start - 1, start, start + 1, start + block_size - 1}) {
+        if (offset < 0 || offset >= size) continue;
+        assert(acc.ReadByte(offset) == reference.ReadByte(offset));
+      }
+      start += block_size;
+    }
+
+    // All bytes, one at a time and at once.
+    REP(offset, size) assert(acc.ReadByte(offset) == data[offset]);
+    assert(acc.ReadBytes(all_offsets) == reference.ReadBytes(all_offsets));
+
+    CheckRandomReads(acc, data, 100);
+  }
+}
+
+}  // namespace
+
+int main() {
+  std::filesystem::create_directories(tmp);
+  TestBlockCache();
+  TestBlockLocation();
+  std::filesystem::remove_all(tmp);
+}